@@ -5,7 +5,6 @@
 
 #import "CRLFClient.h"
 #import "CRLFNetworkManager.h"
-#import "CLKSCrashReportFilter.h"
 #import "CLKSCrash.h"
 #import "CRLFMacros.h"
 #import "NSMutableDictionary+CRLFAdditions.h"
@@ -22,12 +21,14 @@
 #import "CRLFReachability.h"
 #import "CRLFFootprint.h"
 #import "CLKSCrashReportStore.h"
+#import "CLKSCrashBreadcrumbs.h"
+#import "CLKSCrashAttributes.h"
 #import "CLKSJSONCodecObjC.h"
 #import "CLKSCrashReportFields.h"
+#import "CLKSCrashUploader.h"
 #import "NSBundle+CRLFAdditions.h"
 
-@interface CRLFClient () <CLKSCrashReportFilter>
-@property (nonatomic) CLKSCrashReportFilterCompletion completionHandler;
+@interface CRLFClient ()
 @property (nonatomic) CRLFNetworkManager *networkManager;
 @property (nonatomic) dispatch_queue_t workQueue;
 @property (nonatomic, nonnull) CRLFAppInfoProvider *appInfoProvider;
@@ -38,9 +39,16 @@
 @property (nonatomic) CRLFTelephonyNetworkInfo *networkInfo;
 @property (nonatomic) CRLFReachability *reachability;
 @property (nonatomic) NSMutableDictionary<NSString *, CRLFAttribute *> *attributes;
-@property (nonatomic) NSMutableArray<CRLFFootprint *> *footprints;
+@property (nonatomic) NSMutableSet<NSString *> *eventLogPathsBeingSent; // only touched on workQueue
 
 @end
+
+static void CRLFWriteCrashUserSection(const CLKSCrashReportWriter *writer)
+{
+    clksattr_writeAttributes(writer, "attributes");
+    clksbc_writeBreadcrumbs(writer, "footprints");
+}
+
 @implementation CRLFClient
 - (instancetype)initWithAPIKey:(NSString *)apiKey sdkVersion:(NSString *)sdkVersion {
     self = [super init];
@@ -50,11 +58,12 @@
         _networkManager = [[CRLFNetworkManager alloc] init];
         _networkInfo = [[CRLFTelephonyNetworkInfo alloc] init];
         _workQueue = dispatch_queue_create("com.buglife.crashlife.clientWorkQueue", DISPATCH_QUEUE_SERIAL);
+        _eventLogPathsBeingSent = [NSMutableSet set];
         _appInfoProvider = [[CRLFAppInfoProvider alloc] init];
         _deviceInfoProvider = [[CRLFDeviceInfoProvider alloc] init];
         _reachability = [CRLFReachability reachabilityForLocalWiFi];
-        // _*work* must exist before setting the sink.
-        [CLKSCrash sharedInstance].sink = self;
+        // _networkManager must exist before the uploader can send anything.
+        [self configureUploader];
         _sdkName = @"Crashlife iOS";
         _sdkVersion = sdkVersion;
         _platform = @"ios";
@@ -79,13 +88,14 @@
     [[NSNotificationCenter defaultCenter] addObserver:self selector:@selector(batteryLevelChanged:) name:UIDeviceBatteryLevelDidChangeNotification object:nil];
     [[NSNotificationCenter defaultCenter] addObserver:self selector:@selector(batteryStateChanged:) name:UIDeviceBatteryStateDidChangeNotification object:nil];
     [[NSNotificationCenter defaultCenter] addObserver:self selector:@selector(isOnWiFiChanged:) name:CRLFReachabilityWiFiStateChangedNotificationName object:nil];
-    //We don't save this because its .sink is retained.
+    [[NSNotificationCenter defaultCenter] addObserver:self selector:@selector(submitPendingEvents) name:UIApplicationDidEnterBackgroundNotification object:nil];
     CLKSCrash *crashReporter = [CLKSCrash sharedInstance];
-    crashReporter.deleteBehaviorAfterSendAll = CLKSCDeleteOnSucess;
     crashReporter.maxReportCount = 1000; //TODO: maybe a better number here
+    crashReporter.collapseDuplicateReports = YES;
     crashReporter.introspectMemory = YES;
     crashReporter.searchQueueNames = YES;
     crashReporter.addConsoleLogToReport = YES;
+    crashReporter.onCrash = CRLFWriteCrashUserSection;
     //TODO: configure monitor types
     //TODO: determine if we want to set our own .onCrash
     [crashReporter install];
@@ -98,15 +108,105 @@
 }
 
 - (void)submitPendingReports {
-    [[CLKSCrash sharedInstance] sendAllReportsWithCompletion:^(NSArray *filteredReports, BOOL completed, NSError *error) {
-        if (error != nil) {
-            CRLFLogExtWarn(@"Unable to submit pending crash reports");
+    dispatch_async(self.workQueue, ^{
+        [self updateUploadEnvelope];
+        // Batched, gzipped and retried with backoff on the uploader's thread.
+        // Uploaded reports are deleted.
+        clkscru_uploadPendingReports();
+    });
+    [self submitPendingEvents];
+}
+
+// Non-fatal events are logged to disk in batches, and each batch is sent in a single request.
+- (void)submitPendingEvents {
+    dispatch_async(self.workQueue, ^{
+        for (NSDictionary *eventLog in [[CLKSCrash sharedInstance] pendingEventLogs]) {
+            NSString *path = eventLog[@"path"];
+            if ([self.eventLogPathsBeingSent containsObject:path]) {
+                continue;
+            }
+            [self postEventLog:eventLog];
         }
-        //TODO: figure out what else to do here, if anything.
-        // Note: deletion is handled by KS
+    });
+}
+
+- (void)postEventLog:(NSDictionary *)eventLog {
+    NSDictionary *session = eventLog[@"session"];
+    NSMutableArray<NSDictionary *> *occurrences = [NSMutableArray array];
+    // Each event logs only the footprints left since the one before it, so add them up
+    // to give every event the trail leading to it, as the breadcrumb ring would.
+    NSMutableArray<CRLFFootprint *> *footprints = [NSMutableArray array];
+    for (NSDictionary *loggedEvent in eventLog[@"events"]) {
+        NSDictionary *rawReport = [self rawReportWithLoggedEvent:loggedEvent session:session];
+        CRLFCrashReport *crashReport = [[CRLFCrashReport alloc] initWithKSCrashReport:rawReport];
+        NSDate *date = [NSDate dateWithTimeIntervalSince1970:[loggedEvent[@CLKSCrashField_Timestamp] doubleValue] / 1000.0];
+        CRLFEvent *event = [CRLFEvent eventWithSeverity:loggedEvent[@CLKSCrashField_Severity] message:loggedEvent[@CLKSCrashField_Message] date:date crashReport:crashReport];
+        [CRLFClient addAttributesToEvent:event crashReport:rawReport];
+        for (NSDictionary *footprintDict in loggedEvent[@CLKSCrashField_Footprints]) {
+            [footprints addObject:[CRLFFootprint fromJSONDictionary:footprintDict]];
+        }
+        if (footprints.count > CLKSBC_CAPACITY) {
+            [footprints removeObjectsInRange:NSMakeRange(0, footprints.count - CLKSBC_CAPACITY)];
+        }
+        event.footprints = [footprints copy];
+        [occurrences addObject:event.occurrenceDict];
+    }
+    if (occurrences.count == 0) {
+        [[CLKSCrash sharedInstance] deleteEventLog:eventLog];
+        return;
+    }
+
+    NSString *path = eventLog[@"path"];
+    [self.eventLogPathsBeingSent addObject:path];
+    NSMutableDictionary *params = [NSMutableDictionary dictionary];
+    [params crlf_safeSetObject:self.apiKey forKey:@"api_key"];
+    [params crlf_safeSetObject:self.appParamsJSON forKey:@"app"];
+    [params crlf_safeSetObject:self.sdkName forKey:@"sdk_name"];
+    [params crlf_safeSetObject:self.sdkVersion forKey:@"sdk_version"];
+    [params crlf_safeSetObject:occurrences forKey:@"occurrences"];
+    [_networkManager POST:@"api/v1/occurrences.json" parameters:params callbackQueue:self.workQueue success:^(id responseObject) {
+        CRLFLogExtInfo(@"Submitted %lu events", (unsigned long)occurrences.count);
+        [[CLKSCrash sharedInstance] deleteEventLog:eventLog];
+        [self.eventLogPathsBeingSent removeObject:path];
+    } failure:^(NSError *error) {
+        // The log stays on disk to be sent next time.
+        CRLFLogExtInfo(@"Error submitting events; Error: %@", [CRLFNSError crlf_debugDescriptionForError:error]);
+        [self.eventLogPathsBeingSent removeObject:path];
     }];
 }
 
+// Reassemble a logged event and its session snapshot into the shape of a crash report,
+// so that it goes through the same conversion as crashes do.
+- (NSDictionary *)rawReportWithLoggedEvent:(NSDictionary *)loggedEvent session:(NSDictionary *)session {
+    NSString *name = loggedEvent[@CLKSCrashField_Name];
+    NSMutableArray<NSDictionary *> *stackFrames = [NSMutableArray array];
+    for (NSNumber *address in loggedEvent[@CLKSCrashField_Backtrace]) {
+        // Symbolicated server-side; the symbol address is only used to find the binary image.
+        [stackFrames addObject:@{@CLKSCrashField_InstructionAddr: address, @CLKSCrashField_SymbolAddr: address}];
+    }
+    NSDictionary *thread = @{@CLKSCrashField_Index: @0,
+                             @CLKSCrashField_Crashed: @(name != nil),
+                             @CLKSCrashField_CurrentThread: @YES,
+                             @CLKSCrashField_Backtrace: @{@CLKSCrashField_Contents: stackFrames}};
+
+    NSMutableDictionary *error = [NSMutableDictionary dictionary];
+    [error crlf_safeSetObject:@CLKSCrashExcType_User forKey:@CLKSCrashField_Type];
+    [error crlf_safeSetObject:(name == nil ? nil : @{@CLKSCrashField_Name: name}) forKey:@CLKSCrashField_User];
+    NSMutableDictionary *crash = [NSMutableDictionary dictionary];
+    [crash crlf_safeSetObject:@[thread] forKey:@CLKSCrashField_Threads];
+    [crash crlf_safeSetObject:error forKey:@CLKSCrashField_Error];
+    [crash crlf_safeSetObject:loggedEvent[@CLKSCrashField_Message] forKey:@CLKSCrashField_Reason];
+
+    NSMutableDictionary *userInfo = [NSMutableDictionary dictionaryWithDictionary:session[@CLKSCrashField_User]];
+    [userInfo crlf_safeSetObject:loggedEvent[@CLKSCrashField_Attributes] forKey:@"attributes"];
+
+    NSMutableDictionary *rawReport = [NSMutableDictionary dictionaryWithDictionary:session];
+    [rawReport crlf_safeSetObject:@{@CLKSCrashField_ID: loggedEvent[@CLKSCrashField_ID] ?: @""} forKey:@CLKSCrashField_Report];
+    [rawReport crlf_safeSetObject:crash forKey:@CLKSCrashField_Crash];
+    [rawReport crlf_safeSetObject:userInfo forKey:@CLKSCrashField_User];
+    return rawReport;
+}
+
 #pragma mark metatdata changes as we go
 
 - (void)localeChanged:(NSNotification *)notif {
@@ -166,11 +266,80 @@
     return newDict;
 }
 
-#pragma mark KSCrash filter/sender
+#pragma mark Crash report upload
+
+// Called on the uploader's encoding threads, several reports at a time. Only reads
+// the report, so it's safe to run concurrently; the client state a batch needs
+// (API key, app info) goes in the envelope, which is copied before the upload starts.
+static char *CRLFEncodeOccurrence(int64_t reportID, int *length, void *userData)
+{
+    @autoreleasepool {
+        NSDictionary *rawReport = [[CLKSCrash sharedInstance] reportWithID:@(reportID)];
+        if (rawReport == nil) {
+            return NULL;
+        }
+        NSError *error;
+        NSData *data = [NSJSONSerialization dataWithJSONObject:[CRLFClient occurrenceDictWithReport:rawReport] options:0 error:&error];
+        if (data == nil) {
+            CRLFLogExtWarn(@"Unable to encode crash report; Error: %@", [CRLFNSError crlf_debugDescriptionForError:error]);
+            return NULL;
+        }
+        char *json = malloc(data.length);
+        if (json != NULL) {
+            memcpy(json, data.bytes, data.length);
+            *length = (int)data.length;
+        }
+        return json;
+    }
+}
+
+static int CRLFSendOccurrenceBatch(const char *body, int bodyLength, bool isGzipped, void *userData)
+{
+    @autoreleasepool {
+        CRLFClient *client = (__bridge CRLFClient *)userData;
+        NSData *data = [NSData dataWithBytes:body length:(NSUInteger)bodyLength];
+        NSInteger statusCode = [client.networkManager sendSynchronousPOST:@"api/v1/occurrences.json" body:data contentEncoding:(isGzipped ? @"gzip" : nil)];
+        if (statusCode == 200 || statusCode == 201) {
+            CRLFLogExtInfo(@"Reports submitted!");
+        }
+        return (int)statusCode;
+    }
+}
+
+- (void)configureUploader {
+    CLKSCrashUploadTransport transport = {CRLFSendOccurrenceBatch, (__bridge void *)self};
+    clkscru_setTransport(&transport);
+    clkscru_setEncodeFunction(CRLFEncodeOccurrence, NULL);
+    clkscru_setEncodeConcurrency((int)[NSProcessInfo processInfo].activeProcessorCount);
+    clkscru_setDeletesUploadedReports(true);
+}
 
-- (void)filterReports:(NSArray<NSDictionary *> *)reports onCompletion:(CLKSCrashReportFilterCompletion)onCompletion {
-    self.completionHandler = onCompletion;
+// The uploader puts each batch's occurrences into this envelope.
+- (void)updateUploadEnvelope {
     NSMutableDictionary *params = [NSMutableDictionary dictionary];
+    [params crlf_safeSetObject:self.apiKey forKey:@"api_key"];
+    [params crlf_safeSetObject:self.appParamsJSON forKey:@"app"];
+    NSData *data = [NSJSONSerialization dataWithJSONObject:params options:0 error:nil];
+    NSString *json = [[NSString alloc] initWithData:data encoding:NSUTF8StringEncoding];
+    if (json.length == 0) {
+        return;
+    }
+    // Leave the object open for the occurrences.
+    NSString *prefix = [[json substringToIndex:json.length - 1] stringByAppendingString:@",\"occurrences\":"];
+    clkscru_setEnvelope(prefix.UTF8String, "}");
+}
+
++ (NSDictionary *)occurrenceDictWithReport:(NSDictionary *)rawReport {
+    NSNumber *preprocessedOccurrence = rawReport[@"preprocessed"];
+    if (preprocessedOccurrence.boolValue) {
+        NSMutableDictionary *preprocessedMinusPreprocessed = rawReport.mutableCopy;
+        [preprocessedMinusPreprocessed removeObjectForKey:@"preprocessed"];
+        return preprocessedMinusPreprocessed;
+    }
+    NSDictionary *userInfo = rawReport[@CLKSCrashField_User];
+    NSArray *footprintsDicts = userInfo[@"footprints"];
+    CRLFCrashReport *crashReport = [[CRLFCrashReport alloc] initWithKSCrashReport:rawReport];
+    CRLFEvent *event = [CRLFEvent eventWithCrashReport:crashReport];
     // Missing thigs:
     // 1. File system free space at crash time - no way to get it async-safe (AND I LOOKED HARD) (but okay with UCH)
     //    Can't watch this one, it changes all the time.
@@ -194,49 +363,17 @@
     // √10.Thermal state
     
     // but this is largely going to have to wait for v1.1.
-    [params crlf_safeSetObject:self.apiKey forKey:@"api_key"];
-    [params crlf_safeSetObject:self.appParamsJSON forKey:@"app"];
-    
-    NSMutableArray<NSDictionary *> *occurrences = [NSMutableArray array];
-    for (NSDictionary *rawReport in reports)
-    {
-        NSNumber *preprocessedOccurrence = rawReport[@"preprocessed"];
-        if (!preprocessedOccurrence.boolValue) {
-            NSDictionary *userInfo = rawReport[@CLKSCrashField_User];
-            NSArray *footprintsDicts = userInfo[@"footprints"];
-            CRLFCrashReport *crashReport = [[CRLFCrashReport alloc] initWithKSCrashReport:rawReport];
-            CRLFEvent *event = [CRLFEvent eventWithCrashReport:crashReport];
-            [self addAttributesToEvent:event crashReport:rawReport];
-            NSMutableArray *footprints = [NSMutableArray array];
-            for (NSDictionary *footprintDict in footprintsDicts) {
-                CRLFFootprint *footprint = [CRLFFootprint fromJSONDictionary:footprintDict];
-                [footprints addObject:footprint];
-            }
-            event.footprints = footprints;
-            [occurrences addObject:event.occurrenceDict];
-        }
-        else {
-            NSMutableDictionary *preprocessedMinusPreprocessed = rawReport.mutableCopy;
-            [preprocessedMinusPreprocessed removeObjectForKey:@"preprocessed"];
-            [occurrences addObject:preprocessedMinusPreprocessed];
-        }
-        
+    [self addAttributesToEvent:event crashReport:rawReport];
+    NSMutableArray *footprints = [NSMutableArray array];
+    for (NSDictionary *footprintDict in footprintsDicts) {
+        CRLFFootprint *footprint = [CRLFFootprint fromJSONDictionary:footprintDict];
+        [footprints addObject:footprint];
     }
-    [params crlf_safeSetObject:occurrences forKey:@"occurrences"];
-    [_networkManager POST:@"api/v1/occurrences.json" parameters:params callbackQueue:self.workQueue success:^(id responseObject) {
-
-        CRLFLogExtInfo(@"Report submitted!");
-        
-        clkscrash_callCompletion(onCompletion, reports, YES, nil);
-    } failure:^(NSError *error) {
-        CRLFLogExtInfo(@"Error submitting report; Error: %@", [CRLFNSError crlf_debugDescriptionForError:error]);
-
-        clkscrash_callCompletion(onCompletion, @[], NO, error);
-    }];
-
+    event.footprints = footprints;
+    return event.occurrenceDict;
 }
 
-- (void)addAttributesToEvent:(CRLFEvent *)event crashReport:(NSDictionary *)rawReport {
++ (void)addAttributesToEvent:(CRLFEvent *)event crashReport:(NSDictionary *)rawReport {
     // Get the systm dictionary
     NSDictionary *systemDict = rawReport[@CLKSCrashField_System];
     NSDictionary *userInfo = rawReport[@CLKSCrashField_User];
@@ -335,33 +472,6 @@
     return [NSDictionary dictionaryWithDictionary:mutableAppInfo];
 }
 
-- (void)postSingleEvent:(CRLFEvent *)event {
-    NSMutableDictionary *params = [NSMutableDictionary dictionary];
-    [params crlf_safeSetObject:self.apiKey forKey:@"api_key"];
-    [params crlf_safeSetObject:[self.appInfoProvider syncFetchAppInfo].JSONDictionary forKey:@"app"];
-    [params crlf_safeSetObject:self.sdkName forKey:@"sdk_name"];
-    [params crlf_safeSetObject:self.sdkVersion forKey:@"sdk_version"];
-    [params crlf_safeSetObject:@[event.occurrenceDict] forKey:@"occurrences"];
-    [_networkManager POST:@"api/v1/occurrences.json" parameters:params callbackQueue:self.workQueue success:^(id responseObject) {
-        
-        CRLFLogExtInfo(@"Report submitted!");
-        //TODO: anything else? Delete save file if there was one?
-    } failure:^(NSError *error) {
-        CRLFLogExtInfo(@"Error submitting report; Error: %@", [CRLFNSError crlf_debugDescriptionForError:error]);
-        NSDictionary *occurrenceDict = event.occurrenceDict;
-        NSMutableDictionary *preprocessed = occurrenceDict.mutableCopy;
-        [preprocessed crlf_safeSetObject:@YES forKey:@"preprocessed"];
-        NSError *jsonEncodingError = nil;
-        NSData *data = [CLKSJSONCodec encode:preprocessed options:CLKSJSONEncodeOptionNone error:&error];
-        if (jsonEncodingError != nil) {
-            CRLFLogExtError(@"Unable to convert user event to JSON: %@. Please report this to team@buglife.com", jsonEncodingError);
-        }
-        NSUInteger reportLength = data.length;
-        clkscrs_addUserReport(data.bytes, (int)reportLength);
-    }];
-
-}
-
 - (void)logClientEventWithName:(nonnull NSString *)eventName afterDelay:(NSTimeInterval)delay
 {
     dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(delay * NSEC_PER_SEC)), dispatch_get_main_queue(), ^{
@@ -428,11 +538,8 @@
 {
     if ([attributeKey length] > 0) {
         [_attributes removeObjectForKey:attributeKey];
+        clksattr_removeAttribute(attributeKey.UTF8String);
     }
-    NSMutableDictionary *newDict = [CRLFClient mutableCLKSCrashUserInfoDict];
-    [newDict removeObjectForKey:attributeKey];
-    CLKSCrash.sharedInstance.userInfo = newDict;
-    
 }
 
 - (void)_setAttribute:(CRLFAttribute *)attribute forKey:(NSString *)attributeKey
@@ -441,43 +548,50 @@
         _attributes[attributeKey] = attribute;
     } else {
         CRLFLogExtError(@"Attempted to set attribute with empty attribute key: \"%@\"", attributeKey);
+        return;
+    }
+    // Written into the report's user section at crash time, so there's no need
+    // to re-encode userInfo for every change.
+    NSString *flagName = attribute.JSONDictionary[@"flag"];
+    if (!clksattr_setAttribute(attributeKey.UTF8String, attribute.stringValue.UTF8String, flagName.UTF8String)) {
+        CRLFLogExtWarn(@"Unable to record attribute \"%@\" for crash reports", attributeKey);
     }
-    NSMutableDictionary *newDict = [CRLFClient mutableCLKSCrashUserInfoDict];
-    NSDictionary *attributesDict = newDict[@"attributes"];
-    NSMutableDictionary *mutableAttributesDict = [NSMutableDictionary dictionaryWithDictionary:attributesDict];
-    
-    mutableAttributesDict[attributeKey] = attribute.JSONDictionary;
-    newDict[@"attributes"] = mutableAttributesDict;
-    CLKSCrash.sharedInstance.userInfo = newDict;
 }
 
 - (void)leaveFootprint:(NSString *)name {
     CRLFFootprint *namedFootprint = [[CRLFFootprint alloc] initWithName:name];
-    [self.footprints addObject:namedFootprint];
     [self addFootprintToCrashInfo:namedFootprint];
 }
 
 - (void)leaveFootprint:(NSString *)name withMetadata:(NSDictionary<NSString *, NSString *> *)metadata {
     CRLFFootprint *footprint = [[CRLFFootprint alloc] initWithName:name attributes:metadata];
-    [self.footprints addObject:footprint];
     [self addFootprintToCrashInfo:footprint];
     
 }
 
 - (void)addFootprintToCrashInfo:(CRLFFootprint *)footprint {
-    NSMutableDictionary *dict = [CRLFClient mutableCLKSCrashUserInfoDict];
-    NSArray *footprints = dict[@"footprints"];
-    NSMutableArray *mutableFootprints = [NSMutableArray arrayWithArray:footprints];
-    [mutableFootprints addObject:footprint.JSONDictionary];
-    dict[@"footprints"] = mutableFootprints;
-    CLKSCrash.sharedInstance.userInfo = dict;
+    // Footprints go into a fixed-size ring that gets written at crash time,
+    // rather than re-encoding the whole userInfo for every footprint.
+    const char *keys[CLKSBC_MAX_METADATA_COUNT];
+    const char *values[CLKSBC_MAX_METADATA_COUNT];
+    int count = 0;
+    for (NSString *key in footprint.attributes) {
+        if (count >= CLKSBC_MAX_METADATA_COUNT) {
+            break;
+        }
+        id value = footprint.attributes[key];
+        NSString *stringValue = [value isKindOfClass:[CRLFAttribute class]] ? [(CRLFAttribute *)value stringValue] : [value description];
+        keys[count] = key.UTF8String;
+        values[count] = stringValue.UTF8String;
+        count++;
+    }
+    clksbc_addBreadcrumb((time_t)footprint.date.timeIntervalSince1970, footprint.name.UTF8String, keys, values, count);
 }
 
 
 #pragma mark Log events
 - (void)logException:(NSException *)exception {
-    CRLFEvent *exceptionEvent = [[CRLFEvent alloc] initWithException:exception attributes:self.attributes footprints:self.footprints];
-    [self postSingleEvent:exceptionEvent];
+    [[CLKSCrash sharedInstance] logEventWithSeverity:CRLFEventSeverityError name:exception.name message:exception.description returnAddresses:exception.callStackReturnAddresses];
 }
 
 - (void)logErrorObject:(NSError *)error {
@@ -494,23 +608,19 @@
         postedReason = [postedReason stringByAppendingFormat:@" %@", domainAndCode];
     }
     postedDescription = [postedDescription stringByAppendingFormat:@"\n%@", postedReason];
-    CRLFEvent *errorEvent = [[CRLFEvent alloc] initWithSeverity:CRLFEventSeverityError message:postedDescription attributes:self.attributes footprints:self.footprints];
-    [self postSingleEvent:errorEvent];
+    [[CLKSCrash sharedInstance] logEventWithSeverity:CRLFEventSeverityError name:nil message:postedDescription returnAddresses:nil];
 }
 
 - (void)logError:(NSString *)message {
-    CRLFEvent *errorEvent = [[CRLFEvent alloc] initWithSeverity:CRLFEventSeverityError message:message attributes:self.attributes footprints:self.footprints];
-    [self postSingleEvent:errorEvent];
+    [[CLKSCrash sharedInstance] logEventWithSeverity:CRLFEventSeverityError name:nil message:message returnAddresses:nil];
 }
 
 - (void)logWarning:(NSString *)message {
-    CRLFEvent *warningEvent = [[CRLFEvent alloc] initWithSeverity:CRLFEventSeverityWarning message:message attributes:self.attributes footprints:self.footprints];
-    [self postSingleEvent:warningEvent];
+    [[CLKSCrash sharedInstance] logEventWithSeverity:CRLFEventSeverityWarning name:nil message:message returnAddresses:nil];
 }
 
 - (void)logInfo:(NSString *)message {
-    CRLFEvent *infoEvent = [[CRLFEvent alloc] initWithSeverity:CRLFEventSeverityInfo message:message attributes:self.attributes footprints:self.footprints];
-    [self postSingleEvent:infoEvent];
+    [[CLKSCrash sharedInstance] logEventWithSeverity:CRLFEventSeverityInfo name:nil message:message returnAddresses:nil];
 }
 
 @end
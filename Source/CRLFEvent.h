@@ -23,6 +23,8 @@ extern CRLFEventSeverity const CRLFEventSeverityCrash;
 @property (nonatomic, nonnull) NSArray<CRLFFootprint *> *footprints;
 @property (nonatomic, nullable) NSString *timestampString;
 + (instancetype)eventWithCrashReport:(CRLFCrashReport *)crashReport;
+// A non-fatal event read back from the event log, with its backtrace in crashReport.
++ (instancetype)eventWithSeverity:(CRLFEventSeverity)severity message:(NSString *)message date:(NSDate *)date crashReport:(CRLFCrashReport *)crashReport;
 
 - (instancetype)initWithSeverity:(CRLFEventSeverity)severity message:(NSString *)message attributes:(NSDictionary<NSString *, CRLFAttribute *> *)attributes footprints:(NSArray *)footprints;
 - (instancetype)initWithException:(NSException *)exception attributes:(NSDictionary<NSString *, CRLFAttribute *> *)attributes footprints:(NSArray *)footprints;
@@ -39,6 +39,14 @@ CRLFEventSeverity const CRLFEventSeverityCrash = @"crash";
     return event;
 }
 
++ (instancetype)eventWithSeverity:(CRLFEventSeverity)severity message:(NSString *)message date:(NSDate *)date crashReport:(CRLFCrashReport *)crashReport {
+    CRLFEvent *event = [self eventWithCrashReport:crashReport];
+    event.severity = severity;
+    event.message = message;
+    event.timestampString = [[CRLFEvent dateFormatter] stringFromDate:date];
+    return event;
+}
+
 - (instancetype)initWithSeverity:(CRLFEventSeverity)severity message:(NSString *)message attributes:(NSDictionary<NSString *, CRLFAttribute *> *)attributes footprints:(NSArray *)footprints {
     self = [super init];
     if (self != nil) {
@@ -73,6 +81,11 @@ CRLFEventSeverity const CRLFEventSeverityCrash = @"crash";
     [ret crlf_safeSetObject:self.message forKey:@"message"];
     [ret crlf_safeSetObject:self.uuid.UUIDString forKey:@"uuid"];
     [ret crlf_safeSetObject:self.timestampString forKey:@"occurred_at"];
+    [ret crlf_safeSetObject:self.crashReport.fingerprint forKey:@"fingerprint"];
+    if (self.crashReport.duplicateCount > 0) {
+        [ret crlf_safeSetObject:@(self.crashReport.duplicateCount + 1) forKey:@"occurrence_count"];
+        [ret crlf_safeSetObject:self.crashReport.lastOccurredAtString forKey:@"last_occurred_at"];
+    }
     [ret crlf_safeSetObject:self.crashReport.denormalizedThreads forKey:@"threads"];
     [ret crlf_safeSetObject:self.crashReport.denormalizedException forKey:@"exceptions"];
     if (self.crashReport == nil && self.caughtException != nil) {
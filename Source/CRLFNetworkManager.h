@@ -26,4 +26,8 @@ typedef void (^CRLFNetworkManagerFailure)(NSError *error);
 - (NSURLSessionTask *)PUT:(NSString *)URLString parameters:(NSDictionary *)parameters callbackQueue:(dispatch_queue_t)callbackQueue success:(CRLFNetworkManagerSuccess)success failure:(CRLFNetworkManagerFailure)failure;
 - (NSURLSessionTask *)POST:(NSString *)URLString parameters:(NSDictionary *)parameters callbackQueue:(dispatch_queue_t)callbackQueue success:(CRLFNetworkManagerSuccess)success failure:(CRLFNetworkManagerFailure)failure;
 
+// POSTs an already encoded JSON body and blocks until the response arrives. Don't call this on the main thread.
+// Returns the HTTP status code, or -1 if there was no response.
+- (NSInteger)sendSynchronousPOST:(NSString *)URLString body:(NSData *)body contentEncoding:(NSString *)contentEncoding;
+
 @end
@@ -56,6 +56,34 @@ static BOOL CRLFStatusCodeIsSuccess(NSInteger statusCode);
     return [self _taskWithHTTPMethod:@"POST" URL:URLString parameters:parameters callbackQueue:callbackQueue success:success failure:failure];
 }
 
+- (NSInteger)sendSynchronousPOST:(NSString *)URLString body:(NSData *)body contentEncoding:(NSString *)contentEncoding
+{
+    NSURL *url = [[[self class] _baseURL] URLByAppendingPathComponent:URLString];
+    NSMutableURLRequest *request = [[NSMutableURLRequest alloc] initWithURL:url];
+    request.HTTPMethod = @"POST";
+    [request setValue:@"application/json" forHTTPHeaderField:@"Content-Type"];
+    if (contentEncoding) {
+        [request setValue:contentEncoding forHTTPHeaderField:@"Content-Encoding"];
+    }
+    [request setHTTPBody:body];
+    
+    __block NSInteger statusCode = -1;
+    dispatch_semaphore_t semaphore = dispatch_semaphore_create(0);
+    NSURLSessionTask *task = [self.session dataTaskWithRequest:request completionHandler:^(NSData * _Nullable data, NSURLResponse * _Nullable response, NSError * _Nullable error) {
+        if ([response isKindOfClass:[NSHTTPURLResponse class]]) {
+            statusCode = ((NSHTTPURLResponse *)response).statusCode;
+        } else {
+            CRLFLogExtInfo(@"No response to POST %@; Error: %@", URLString, [CRLFNSError crlf_debugDescriptionForError:error]);
+        }
+        dispatch_semaphore_signal(semaphore);
+    }];
+    
+    [task resume];
+    dispatch_semaphore_wait(semaphore, DISPATCH_TIME_FOREVER);
+    
+    return statusCode;
+}
+
 #pragma mark - Private
 
 - (NSURLSessionTask *)_taskWithHTTPMethod:(NSString *)HTTPMethod URL:(NSString *)URLString parameters:(NSDictionary *)parameters callbackQueue:(dispatch_queue_t)callbackQueue success:(CRLFNetworkManagerSuccess)success failure:(CRLFNetworkManagerFailure)failure
@@ -81,7 +109,7 @@ static BOOL CRLFStatusCodeIsSuccess(NSInteger statusCode);
     
     [request setHTTPBody:data];
     
-    NSURLSessionTask *task = [[NSURLSession sharedSession] dataTaskWithRequest:request completionHandler:^(NSData * _Nullable data, NSURLResponse * _Nullable response, NSError * _Nullable error) {
+    NSURLSessionTask *task = [self.session dataTaskWithRequest:request completionHandler:^(NSData * _Nullable data, NSURLResponse * _Nullable response, NSError * _Nullable error) {
         
         if ([response isKindOfClass:[NSHTTPURLResponse class]]) {
             NSHTTPURLResponse *httpResponse = (NSHTTPURLResponse *)response;
@@ -107,6 +107,25 @@ typedef enum
  */
 @property(nonatomic,readwrite,assign) double deadlockWatchdogInterval;
 
+/** If the main thread is unresponsive for longer than this, sample its stack
+ * until it recovers and save a call tree of the samples as a user report.
+ * Stalls that never recover are still handled by deadlockWatchdogInterval.
+ *
+ * Note: You must have added CLKSCrashMonitorTypeMainThreadDeadlock to the monitoring
+ *       property in order for this to have any effect.
+ *
+ * 0 = Disabled.
+ *
+ * Default: 0
+ */
+@property(nonatomic,readwrite,assign) double mainThreadHangThreshold;
+
+/** Time between stack samples of an unresponsive main thread.
+ *
+ * Default: 0.05
+ */
+@property(nonatomic,readwrite,assign) double mainThreadHangSampleInterval;
+
 /** If YES, attempt to fetch dispatch queue names for each running thread.
  *
  * WARNING: There is a chance that this will crash on a clksthread_getQueueName() call!
@@ -126,6 +145,14 @@ typedef enum
  */
 @property(nonatomic,readwrite,assign) BOOL introspectMemory;
 
+/** If YES, write binary data such as stack contents as base64 rather than hex.
+ * This makes reports about a third smaller where such data is recorded.
+ * Reports are converted back to hex before being sent.
+ *
+ * Default: NO
+ */
+@property(nonatomic,readwrite,assign) BOOL base64DataElements;
+
 /** If YES, monitor all Objective-C/Swift deallocations and keep track of any
  * accesses after deallocation.
  *
@@ -147,6 +174,55 @@ typedef enum
  */
 @property(nonatomic,readwrite,assign) int maxReportCount;
 
+/** The most disk space reports can use before some get deleted (0 = no limit).
+ * Sent reports are deleted first, then unsent reports whose fingerprint matches
+ * an older unsent report, then recrash reports, then the oldest.
+ *
+ * Default: 0
+ */
+@property(nonatomic,readwrite,assign) int64_t maxTotalReportSize;
+
+/** Reports older than this many seconds get deleted (0 = no limit).
+ *
+ * Default: 0
+ */
+@property(nonatomic,readwrite,assign) NSTimeInterval maxReportAge;
+
+/** Fold unsent crash reports with the same cause into the oldest of them.
+ * The report then carries a "duplicates" section in its "report" section
+ * with the number of duplicates and the time of the latest.
+ *
+ * Default: NO
+ */
+@property(nonatomic,readwrite,assign) BOOL collapseDuplicateReports;
+
+/** User reports are queued and written to disk in batches. A batch is written
+ * once this many bytes are queued.
+ *
+ * Default: 65536
+ */
+@property(nonatomic,readwrite,assign) int userReportBatchMaxBytes;
+
+/** A batch of user reports is written once its oldest report has waited this many seconds.
+ *
+ * Default: 1.0
+ */
+@property(nonatomic,readwrite,assign) double userReportBatchMaxDelay;
+
+/** Sync each batch of user reports to disk before writing the next.
+ *
+ * Default: NO
+ */
+@property(nonatomic,readwrite,assign) BOOL userReportSyncsEachBatch;
+
+/** Reports are written uncompressed. If this is a zlib compression level from
+ * 1 to 9, they get gzipped in the background shortly after installing
+ * (0 = leave them uncompressed).
+ *
+ * Default: 0
+ */
+@property(nonatomic,readwrite,assign) int reportCompressionLevel;
+
 /** The report sink where reports get sent.
  * This MUST be set or else the reporter will not send reports (although it will
  * still record them).
@@ -176,6 +252,45 @@ typedef enum
  */
 @property(nonatomic,readwrite,assign) BOOL printPreviousLog;
 
+/** Log into a fixed-size memory-mapped ring of this many bytes instead of a
+ *  growing file, keeping logging cheap and reports bounded (0 = plain file).
+ *  Must be set before installing.
+ *
+ * Default: 0
+ */
+@property(nonatomic,readwrite,assign) int consoleLogRingSize;
+
+/** When logging into a ring, also copy log entries to stdout from a background thread.
+ *
+ * Default: NO
+ */
+@property(nonatomic,readwrite,assign) BOOL consoleLogRingDrainsToStdout;
+
+/** Only add the last this many bytes of the console log to reports (0 = no limit, max 64 KB).
+ *
+ * Default: 0
+ */
+@property(nonatomic,readwrite,assign) int consoleLogTailMaxBytes;
+
+/** Only add the last this many lines of the console log to reports (0 = no limit).
+ *
+ * Default: 0
+ */
+@property(nonatomic,readwrite,assign) int consoleLogTailMaxLines;
+
+/** Record where only one in every this many C++ throws on a thread was thrown from.
+ * A C++ exception crash whose throw wasn't recorded gets the stack at termination instead.
+ *
+ * Default: 1
+ */
+@property(nonatomic,readwrite,assign) int cppExceptionThrowTraceSampleInterval;
+
+/** Record where at most this many C++ throws per second were thrown from (0 = no limit).
+ *
+ * Default: 0
+ */
+@property(nonatomic,readwrite,assign) int cppExceptionThrowTraceMaxPerSecond;
+
 /** Which languages to demangle when getting stack traces (default CLKSCrashDemangleLanguageAll) */
 @property(nonatomic,readwrite,assign) CLKSCrashDemangleLanguage demangleLanguages;
 
@@ -296,6 +411,39 @@ typedef enum
                logAllThreads:(BOOL) logAllThreads
             terminateProgram:(BOOL) terminateProgram;
 
+/** Log a non-fatal event to the batched event log.
+ * This is much cheaper than reportUserException, since it only records the return
+ * addresses and the current attributes. Binary images and system info are recorded
+ * once per session.
+ *
+ * @param severity The event's severity (such as @"error").
+ *
+ * @param name The event's name, such as an exception name (nil = none).
+ *
+ * @param message The event's message (nil = none).
+ *
+ * @param returnAddresses Return addresses leading up to the event, such as an exception's
+ *                        callStackReturnAddresses (nil = the current thread's).
+ */
+- (void) logEventWithSeverity:(NSString*) severity
+                         name:(NSString*) name
+                      message:(NSString*) message
+              returnAddresses:(NSArray*) returnAddresses;
+
+/** Read the event logs waiting to be sent. The current log is closed first, so
+ * every event logged so far is included.
+ *
+ * @return An array of event logs, oldest first. Each is a dictionary of "events" (the
+ *         events, as dictionaries), "session" (the session snapshot they refer to) and "path".
+ */
+- (NSArray*) pendingEventLogs;
+
+/** Delete an event log returned by pendingEventLogs.
+ *
+ * @param eventLog The event log to delete.
+ */
+- (void) deleteEventLog:(NSDictionary*) eventLog;
+
 @end
 
 
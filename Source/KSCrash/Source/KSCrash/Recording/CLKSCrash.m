@@ -28,14 +28,17 @@
 #import "CLKSCrash.h"
 
 #import "CLKSCrashC.h"
+#import "CLKSCrashEventLog.h"
 #import "CLKSCrashDoctor.h"
 #import "CLKSCrashReportFields.h"
+#import "CLKSCrashReportStore.h"
 #import "CLKSCrashMonitor_AppState.h"
 #import "CLKSJSONCodecObjC.h"
 #import "NSError+CRLFSimpleConstructor.h"
 #import "CLKSCrashMonitorContext.h"
 #import "CLKSCrashMonitor_System.h"
 #import "CLKSSystemCapabilities.h"
+#import "CLKSDate.h"
 
 //#define CLKSLogger_LocalLevel TRACE
 #import "CLKSLogger.h"
@@ -100,16 +103,32 @@ static NSString* getBasePath()
 @synthesize deleteBehaviorAfterSendAll = _deleteBehaviorAfterSendAll;
 @synthesize monitoring = _monitoring;
 @synthesize deadlockWatchdogInterval = _deadlockWatchdogInterval;
+@synthesize mainThreadHangThreshold = _mainThreadHangThreshold;
+@synthesize mainThreadHangSampleInterval = _mainThreadHangSampleInterval;
 @synthesize searchQueueNames = _searchQueueNames;
 @synthesize onCrash = _onCrash;
 @synthesize bundleName = _bundleName;
 @synthesize basePath = _basePath;
 @synthesize introspectMemory = _introspectMemory;
+@synthesize base64DataElements = _base64DataElements;
 @synthesize doNotIntrospectClasses = _doNotIntrospectClasses;
 @synthesize demangleLanguages = _demangleLanguages;
 @synthesize addConsoleLogToReport = _addConsoleLogToReport;
 @synthesize printPreviousLog = _printPreviousLog;
+@synthesize consoleLogRingSize = _consoleLogRingSize;
+@synthesize consoleLogRingDrainsToStdout = _consoleLogRingDrainsToStdout;
+@synthesize consoleLogTailMaxBytes = _consoleLogTailMaxBytes;
+@synthesize consoleLogTailMaxLines = _consoleLogTailMaxLines;
+@synthesize cppExceptionThrowTraceSampleInterval = _cppExceptionThrowTraceSampleInterval;
+@synthesize cppExceptionThrowTraceMaxPerSecond = _cppExceptionThrowTraceMaxPerSecond;
 @synthesize maxReportCount = _maxReportCount;
+@synthesize maxTotalReportSize = _maxTotalReportSize;
+@synthesize maxReportAge = _maxReportAge;
+@synthesize collapseDuplicateReports = _collapseDuplicateReports;
+@synthesize userReportBatchMaxBytes = _userReportBatchMaxBytes;
+@synthesize userReportBatchMaxDelay = _userReportBatchMaxDelay;
+@synthesize userReportSyncsEachBatch = _userReportSyncsEachBatch;
+@synthesize reportCompressionLevel = _reportCompressionLevel;
 @synthesize uncaughtExceptionHandler = _uncaughtExceptionHandler;
 @synthesize currentSnapshotUserReportedExceptionHandler = _currentSnapshotUserReportedExceptionHandler;
 
@@ -148,7 +167,11 @@ static NSString* getBasePath()
         self.introspectMemory = YES;
         self.catchZombies = NO;
         self.maxReportCount = 5;
+        self.userReportBatchMaxBytes = 64 * 1024;
+        self.userReportBatchMaxDelay = 1.0;
         self.searchQueueNames = NO;
+        self.cppExceptionThrowTraceSampleInterval = 1;
+        self.mainThreadHangSampleInterval = 0.05;
         self.monitoring = CLKSCrashMonitorTypeProductionSafeMinimal;
     }
     return self;
@@ -198,6 +221,18 @@ static NSString* getBasePath()
     clkscrash_setDeadlockWatchdogInterval(deadlockWatchdogInterval);
 }
 
+- (void) setMainThreadHangThreshold:(double) mainThreadHangThreshold
+{
+    _mainThreadHangThreshold = mainThreadHangThreshold;
+    clkscrash_setMainThreadHangSampling(mainThreadHangThreshold, self.mainThreadHangSampleInterval);
+}
+
+- (void) setMainThreadHangSampleInterval:(double) mainThreadHangSampleInterval
+{
+    _mainThreadHangSampleInterval = mainThreadHangSampleInterval;
+    clkscrash_setMainThreadHangSampling(self.mainThreadHangThreshold, mainThreadHangSampleInterval);
+}
+
 - (void) setSearchQueueNames:(BOOL) searchQueueNames
 {
     _searchQueueNames = searchQueueNames;
@@ -216,6 +251,12 @@ static NSString* getBasePath()
     clkscrash_setIntrospectMemory(introspectMemory);
 }
 
+- (void) setBase64DataElements:(BOOL) base64DataElements
+{
+    _base64DataElements = base64DataElements;
+    clkscrash_setBase64DataElements(base64DataElements);
+}
+
 - (BOOL) catchZombies
 {
     return (self.monitoring & CLKSCrashMonitorTypeZombie) != 0;
@@ -259,6 +300,54 @@ static NSString* getBasePath()
     clkscrash_setMaxReportCount(maxReportCount);
 }
 
+- (void) setMaxTotalReportSize:(int64_t) maxTotalReportSize
+{
+    _maxTotalReportSize = maxTotalReportSize;
+    clkscrash_setMaxTotalReportSize(maxTotalReportSize);
+}
+
+- (void) setMaxReportAge:(NSTimeInterval) maxReportAge
+{
+    _maxReportAge = maxReportAge;
+    clkscrash_setMaxReportAge((int64_t)maxReportAge);
+}
+
+- (void) setCollapseDuplicateReports:(BOOL) collapseDuplicateReports
+{
+    _collapseDuplicateReports = collapseDuplicateReports;
+    clkscrash_setCollapseDuplicateReports(collapseDuplicateReports);
+}
+
+- (void) setReportCompressionLevel:(int) reportCompressionLevel
+{
+    _reportCompressionLevel = reportCompressionLevel;
+    clkscrash_setReportCompressionLevel(reportCompressionLevel);
+}
+
+- (void) setUserReportBatchMaxBytes:(int) userReportBatchMaxBytes
+{
+    _userReportBatchMaxBytes = userReportBatchMaxBytes;
+    clkscrash_setUserReportWriteQueue(userReportBatchMaxBytes,
+                                      self.userReportBatchMaxDelay,
+                                      self.userReportSyncsEachBatch);
+}
+
+- (void) setUserReportBatchMaxDelay:(double) userReportBatchMaxDelay
+{
+    _userReportBatchMaxDelay = userReportBatchMaxDelay;
+    clkscrash_setUserReportWriteQueue(self.userReportBatchMaxBytes,
+                                      userReportBatchMaxDelay,
+                                      self.userReportSyncsEachBatch);
+}
+
+- (void) setUserReportSyncsEachBatch:(BOOL) userReportSyncsEachBatch
+{
+    _userReportSyncsEachBatch = userReportSyncsEachBatch;
+    clkscrash_setUserReportWriteQueue(self.userReportBatchMaxBytes,
+                                      self.userReportBatchMaxDelay,
+                                      userReportSyncsEachBatch);
+}
+
 - (NSDictionary*) systemInfo
 {
     CLKSCrash_MonitorContext fakeEvent = {0};
@@ -353,12 +442,21 @@ static NSString* getBasePath()
                     name:NSExtensionHostWillEnterForegroundNotification
                   object:nil];
 #endif
+
+    if(self.reportCompressionLevel > 0)
+    {
+        dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_BACKGROUND, 0), ^
+        {
+            clkscrash_compressReports();
+        });
+    }
     
     return true;
 }
 
 - (void) sendAllReportsWithCompletion:(CLKSCrashReportFilterCompletion) onCompletion
 {
+    NSArray* reportIDs = [self reportIDs];
     NSArray* reports = [self allReports];
     
     CLKSLOG_INFO(@"Sending %d crash reports", [reports count]);
@@ -371,6 +469,10 @@ static NSString* getBasePath()
          {
              CLKSLOG_ERROR(@"Failed to send reports: %@", error);
          }
+         for(NSNumber* reportID in reportIDs)
+         {
+             clkscrash_markReportSendAttempt([reportID longLongValue], completed);
+         }
          if((self.deleteBehaviorAfterSendAll == CLKSCDeleteOnSucess && completed) ||
             self.deleteBehaviorAfterSendAll == CLKSCDeleteAlways)
          {
@@ -421,6 +523,116 @@ static NSString* getBasePath()
             terminateProgram);
 }
 
+- (void) logEventWithSeverity:(NSString*) severity
+                         name:(NSString*) name
+                      message:(NSString*) message
+              returnAddresses:(NSArray*) returnAddresses
+{
+    uintptr_t backtrace[CLKSEL_MAX_BACKTRACE_LENGTH];
+    int backtraceLength = (int)MIN(returnAddresses.count, (NSUInteger)CLKSEL_MAX_BACKTRACE_LENGTH);
+    for(int i = 0; i < backtraceLength; i++)
+    {
+        backtrace[i] = (uintptr_t)[returnAddresses[(NSUInteger)i] unsignedLongLongValue];
+    }
+    clkscrash_logEvent([severity UTF8String],
+                       [name UTF8String],
+                       [message UTF8String],
+                       returnAddresses == nil ? NULL : backtrace,
+                       backtraceLength);
+}
+
+- (NSString*) eventLogPath
+{
+    return [self.basePath stringByAppendingPathComponent:@"Events"];
+}
+
+/** Decode one event per line. A line that was cut short by a crash is skipped.
+ */
+- (NSArray*) eventsFromLogAtPath:(NSString*) path
+{
+    NSData* data = [NSData dataWithContentsOfFile:path];
+    NSMutableArray* events = [NSMutableArray array];
+    const char* bytes = data.bytes;
+    const char* end = bytes + data.length;
+    while(bytes < end)
+    {
+        const char* lineEnd = memchr(bytes, '\n', (size_t)(end - bytes));
+        if(lineEnd == NULL)
+        {
+            lineEnd = end;
+        }
+        NSData* line = [NSData dataWithBytesNoCopy:(void*)bytes length:(NSUInteger)(lineEnd - bytes) freeWhenDone:NO];
+        NSError* error = nil;
+        id event = [CLKSJSONCodec decode:line options:CLKSJSONDecodeOptionIgnoreAllNulls error:&error];
+        if([event isKindOfClass:[NSDictionary class]])
+        {
+            [events addObject:event];
+        }
+        else if(line.length > 0)
+        {
+            CLKSLOG_ERROR(@"Skipping unreadable event in %@: %@", path, error);
+        }
+        bytes = lineEnd + 1;
+    }
+    return events;
+}
+
+- (NSArray*) pendingEventLogs
+{
+    clkscrash_closeEventLog();
+
+    NSString* eventLogPath = [self eventLogPath];
+    NSFileManager* fileManager = [NSFileManager defaultManager];
+    NSMutableArray* logPaths = [NSMutableArray array];
+    for(NSString* filename in [fileManager contentsOfDirectoryAtPath:eventLogPath error:nil])
+    {
+        if([[filename pathExtension] isEqualToString:@"events"])
+        {
+            [logPaths addObject:[eventLogPath stringByAppendingPathComponent:filename]];
+        }
+    }
+    [logPaths sortUsingComparator:^NSComparisonResult(NSString* path1, NSString* path2)
+     {
+         NSDate* date1 = [fileManager attributesOfItemAtPath:path1 error:nil].fileModificationDate;
+         NSDate* date2 = [fileManager attributesOfItemAtPath:path2 error:nil].fileModificationDate;
+         return [date1 compare:date2];
+     }];
+
+    NSMutableDictionary* sessions = [NSMutableDictionary dictionary];
+    NSMutableArray* eventLogs = [NSMutableArray arrayWithCapacity:logPaths.count];
+    for(NSString* path in logPaths)
+    {
+        NSString* filename = [path lastPathComponent];
+        NSRange sessionEnd = [filename rangeOfString:@"-" options:NSBackwardsSearch];
+        NSString* sessionID = sessionEnd.location == NSNotFound ? filename : [filename substringToIndex:sessionEnd.location];
+        NSDictionary* session = sessions[sessionID];
+        if(session == nil)
+        {
+            NSString* sessionPath = [eventLogPath stringByAppendingPathComponent:[sessionID stringByAppendingPathExtension:@"session"]];
+            NSData* sessionData = [NSData dataWithContentsOfFile:sessionPath];
+            session = sessionData == nil ? nil : [CLKSJSONCodec decode:sessionData
+                                                               options:CLKSJSONDecodeOptionIgnoreAllNulls |
+                                                                       CLKSJSONDecodeOptionKeepPartialObject
+                                                                 error:nil];
+            if(session == nil)
+            {
+                CLKSLOG_ERROR(@"Could not load session snapshot %@", sessionPath);
+                session = @{};
+            }
+            sessions[sessionID] = session;
+        }
+        [eventLogs addObject:@{@"path": path,
+                               @"session": session,
+                               @"events": [self eventsFromLogAtPath:path]}];
+    }
+    return eventLogs;
+}
+
+- (void) deleteEventLog:(NSDictionary*) eventLog
+{
+    clkscrash_deleteEventLog([eventLog[@"path"] UTF8String]);
+}
+
 // ============================================================================
 #pragma mark - Advanced API -
 // ============================================================================
@@ -500,6 +712,24 @@ SYNTHESIZE_CRASH_STATE_PROPERTY(BOOL, crashedLastLaunch)
     }
 }
 
+- (void) addStoreInfoToReport:(NSMutableDictionary*) report reportID:(int64_t) reportID
+{
+    CLKSCrashReportMetadata metadata;
+    NSMutableDictionary* reportSection = report[@CLKSCrashField_Report];
+    if(reportSection == nil || !clkscrs_getReportMetadata(reportID, &metadata) || metadata.fingerprint == 0)
+    {
+        return;
+    }
+    reportSection[@CLKSCrashField_Fingerprint] = [NSString stringWithFormat:@"%016" PRIx64, metadata.fingerprint];
+    if(metadata.duplicateCount > 0)
+    {
+        char lastTimestamp[21];
+        clksdate_utcStringFromTimestamp((time_t)metadata.lastDuplicateTimestamp, lastTimestamp);
+        reportSection[@CLKSCrashField_Duplicates] = @{@CLKSCrashField_Count: @(metadata.duplicateCount),
+                                                     @CLKSCrashField_LastTimestamp: @(lastTimestamp)};
+    }
+}
+
 - (NSArray*)reportIDs
 {
     int reportCount = clkscrash_getReportCount();
@@ -542,6 +772,7 @@ SYNTHESIZE_CRASH_STATE_PROPERTY(BOOL, crashedLastLaunch)
         return nil;
     }
     [self doctorReport:crashReport];
+    [self addStoreInfoToReport:crashReport reportID:reportID];
 
     return crashReport;
 }
@@ -576,6 +807,44 @@ SYNTHESIZE_CRASH_STATE_PROPERTY(BOOL, crashedLastLaunch)
     clkscrash_setPrintPreviousLog(shouldPrintPreviousLog);
 }
 
+- (void) setConsoleLogRingSize:(int) consoleLogRingSize
+{
+    _consoleLogRingSize = consoleLogRingSize;
+    clkscrash_setConsoleLogRing(consoleLogRingSize, self.consoleLogRingDrainsToStdout);
+}
+
+- (void) setConsoleLogRingDrainsToStdout:(BOOL) consoleLogRingDrainsToStdout
+{
+    _consoleLogRingDrainsToStdout = consoleLogRingDrainsToStdout;
+    clkscrash_setConsoleLogRing(self.consoleLogRingSize, consoleLogRingDrainsToStdout);
+}
+
+- (void) setConsoleLogTailMaxBytes:(int) consoleLogTailMaxBytes
+{
+    _consoleLogTailMaxBytes = consoleLogTailMaxBytes;
+    clkscrash_setConsoleLogTail(consoleLogTailMaxBytes, self.consoleLogTailMaxLines);
+}
+
+- (void) setConsoleLogTailMaxLines:(int) consoleLogTailMaxLines
+{
+    _consoleLogTailMaxLines = consoleLogTailMaxLines;
+    clkscrash_setConsoleLogTail(self.consoleLogTailMaxBytes, consoleLogTailMaxLines);
+}
+
+- (void) setCppExceptionThrowTraceSampleInterval:(int) cppExceptionThrowTraceSampleInterval
+{
+    _cppExceptionThrowTraceSampleInterval = cppExceptionThrowTraceSampleInterval;
+    clkscrash_setCPPExceptionThrowTraceSampling(cppExceptionThrowTraceSampleInterval,
+                                                self.cppExceptionThrowTraceMaxPerSecond);
+}
+
+- (void) setCppExceptionThrowTraceMaxPerSecond:(int) cppExceptionThrowTraceMaxPerSecond
+{
+    _cppExceptionThrowTraceMaxPerSecond = cppExceptionThrowTraceMaxPerSecond;
+    clkscrash_setCPPExceptionThrowTraceSampling(self.cppExceptionThrowTraceSampleInterval,
+                                                cppExceptionThrowTraceMaxPerSecond);
+}
+
 
 // ============================================================================
 #pragma mark - Utility -
@@ -0,0 +1,306 @@
+//
+//  CLKSCrashAttributes.c
+//
+//  Copyright (c) 2012 Karl Stenerud. All rights reserved.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall remain in place
+// in this source code.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+
+
+#include "CLKSCrashAttributes.h"
+
+//#define CLKSLogger_LocalLevel TRACE
+#include "CLKSLogger.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <string.h>
+
+
+/** How often to retry reading a slot that's being updated before skipping it. */
+#define kMaxReadAttempts 100
+
+typedef enum
+{
+    SlotStateEmpty = 0,
+    SlotStateUsed,
+    /** Removed, but still part of other keys' probe sequences. */
+    SlotStateRemoved,
+} SlotState;
+
+typedef struct
+{
+    /** Odd while the slot is being updated. */
+    _Atomic(uint32_t) sequence;
+    SlotState state;
+    char key[CLKSATTR_MAX_KEY_LENGTH];
+    char value[CLKSATTR_MAX_VALUE_LENGTH];
+    char flag[CLKSATTR_MAX_FLAG_LENGTH];
+} Slot;
+
+static Slot g_slots[CLKSATTR_CAPACITY];
+
+/** Serializes writers. Readers never take it. */
+static pthread_mutex_t g_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+
+// ============================================================================
+#pragma mark - Utility -
+// ============================================================================
+
+static inline uint32_t hashKey(const char* key)
+{
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    for(; *key != '\0'; key++)
+    {
+        hash = (hash ^ (uint8_t)*key) * 16777619u;
+    }
+    return hash;
+}
+
+static void copyString(char* dst, const char* src, size_t dstLength)
+{
+    if(src == NULL)
+    {
+        dst[0] = '\0';
+        return;
+    }
+    strncpy(dst, src, dstLength - 1);
+    dst[dstLength - 1] = '\0';
+}
+
+static inline void beginUpdate(Slot* slot)
+{
+    atomic_fetch_add_explicit(&slot->sequence, 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+}
+
+static inline void endUpdate(Slot* slot)
+{
+    atomic_fetch_add_explicit(&slot->sequence, 1, memory_order_release);
+}
+
+/** Find a key's slot, or the slot to insert it into if it isn't present.
+ * Must be called with g_mutex held.
+ *
+ * @return The slot, or NULL if the key isn't present and there's no room.
+ */
+static Slot* findSlot(const char* key, bool* isPresent)
+{
+    Slot* insertSlot = NULL;
+    uint32_t index = hashKey(key);
+    for(int i = 0; i < CLKSATTR_CAPACITY; i++, index++)
+    {
+        Slot* slot = &g_slots[index & (CLKSATTR_CAPACITY - 1)];
+        if(slot->state == SlotStateEmpty)
+        {
+            *isPresent = false;
+            return insertSlot != NULL ? insertSlot : slot;
+        }
+        if(slot->state == SlotStateRemoved)
+        {
+            if(insertSlot == NULL)
+            {
+                insertSlot = slot;
+            }
+        }
+        else if(strcmp(slot->key, key) == 0)
+        {
+            *isPresent = true;
+            return slot;
+        }
+    }
+    *isPresent = false;
+    return insertSlot;
+}
+
+
+// ============================================================================
+#pragma mark - API -
+// ============================================================================
+
+bool clksattr_setAttribute(const char* key, const char* value, const char* flag)
+{
+    if(value == NULL)
+    {
+        clksattr_removeAttribute(key);
+        return true;
+    }
+    if(key == NULL || key[0] == '\0' || strlen(key) >= CLKSATTR_MAX_KEY_LENGTH)
+    {
+        CLKSLOG_ERROR("Invalid attribute key: %s", key == NULL ? "(null)" : key);
+        return false;
+    }
+
+    bool isSuccessful = true;
+    pthread_mutex_lock(&g_mutex);
+    bool isPresent;
+    Slot* slot = findSlot(key, &isPresent);
+    if(slot == NULL)
+    {
+        CLKSLOG_ERROR("Attribute table is full. Dropping attribute %s", key);
+        isSuccessful = false;
+    }
+    else
+    {
+        beginUpdate(slot);
+        if(!isPresent)
+        {
+            copyString(slot->key, key, sizeof(slot->key));
+        }
+        copyString(slot->value, value, sizeof(slot->value));
+        copyString(slot->flag, flag, sizeof(slot->flag));
+        slot->state = SlotStateUsed;
+        endUpdate(slot);
+    }
+    pthread_mutex_unlock(&g_mutex);
+    return isSuccessful;
+}
+
+void clksattr_removeAttribute(const char* key)
+{
+    if(key == NULL)
+    {
+        return;
+    }
+    pthread_mutex_lock(&g_mutex);
+    bool isPresent;
+    Slot* slot = findSlot(key, &isPresent);
+    if(isPresent)
+    {
+        beginUpdate(slot);
+        slot->state = SlotStateRemoved;
+        endUpdate(slot);
+    }
+    pthread_mutex_unlock(&g_mutex);
+}
+
+void clksattr_removeAllAttributes()
+{
+    pthread_mutex_lock(&g_mutex);
+    for(int i = 0; i < CLKSATTR_CAPACITY; i++)
+    {
+        Slot* slot = &g_slots[i];
+        if(slot->state != SlotStateEmpty)
+        {
+            beginUpdate(slot);
+            slot->state = SlotStateEmpty;
+            endUpdate(slot);
+        }
+    }
+    pthread_mutex_unlock(&g_mutex);
+}
+
+/** Copy a slot without locking, retrying if it's being updated.
+ *
+ * @return true if the copy is consistent.
+ */
+static bool copySlot(Slot* const slot, Slot* const dst)
+{
+    for(int attempt = 0; attempt < kMaxReadAttempts; attempt++)
+    {
+        uint32_t sequence = atomic_load_explicit(&slot->sequence, memory_order_acquire);
+        if(sequence & 1)
+        {
+            continue;
+        }
+        dst->state = slot->state;
+        if(dst->state == SlotStateUsed)
+        {
+            memcpy(dst->key, slot->key, sizeof(dst->key));
+            memcpy(dst->value, slot->value, sizeof(dst->value));
+            memcpy(dst->flag, slot->flag, sizeof(dst->flag));
+        }
+        atomic_thread_fence(memory_order_acquire);
+        if(atomic_load_explicit(&slot->sequence, memory_order_relaxed) == sequence)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+/** Read a slot's attribute, if it holds one.
+ *
+ * @return true if the slot holds an attribute and it was copied consistently.
+ */
+static bool readAttribute(int index, Slot* const slot)
+{
+    if(!copySlot(&g_slots[index], slot))
+    {
+        CLKSLOG_DEBUG("Skipping attribute slot %d", index);
+        return false;
+    }
+    if(slot->state != SlotStateUsed)
+    {
+        return false;
+    }
+    slot->key[sizeof(slot->key) - 1] = '\0';
+    slot->value[sizeof(slot->value) - 1] = '\0';
+    slot->flag[sizeof(slot->flag) - 1] = '\0';
+    return true;
+}
+
+void clksattr_writeAttributes(const CLKSCrashReportWriter* const writer, const char* const key)
+{
+    Slot slot;
+    writer->beginObject(writer, key);
+    for(int i = 0; i < CLKSATTR_CAPACITY; i++)
+    {
+        if(!readAttribute(i, &slot))
+        {
+            continue;
+        }
+        writer->beginObject(writer, slot.key);
+        {
+            writer->addStringElement(writer, "value", slot.value);
+            if(slot.flag[0] != '\0')
+            {
+                writer->addStringElement(writer, "flag", slot.flag);
+            }
+        }
+        writer->endContainer(writer);
+    }
+    writer->endContainer(writer);
+}
+
+void clksattr_encodeAttributes(CLKSJSONEncodeContext* const context, const char* const key)
+{
+    Slot slot;
+    clksjson_beginObject(context, key);
+    for(int i = 0; i < CLKSATTR_CAPACITY; i++)
+    {
+        if(!readAttribute(i, &slot))
+        {
+            continue;
+        }
+        clksjson_beginObject(context, slot.key);
+        {
+            clksjson_addStringElement(context, "value", slot.value, CLKSJSON_SIZE_AUTOMATIC);
+            if(slot.flag[0] != '\0')
+            {
+                clksjson_addStringElement(context, "flag", slot.flag, CLKSJSON_SIZE_AUTOMATIC);
+            }
+        }
+        clksjson_endContainer(context);
+    }
+    clksjson_endContainer(context);
+}
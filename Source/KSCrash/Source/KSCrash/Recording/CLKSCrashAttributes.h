@@ -0,0 +1,100 @@
+//
+//  CLKSCrashAttributes.h
+//
+//  Copyright (c) 2012 Karl Stenerud. All rights reserved.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall remain in place
+// in this source code.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+
+/* Fixed-capacity key/value attribute table to add to crash reports.
+ *
+ * Setting or removing an attribute updates one preallocated slot in place,
+ * without allocating. Each slot carries a sequence number so that the crash
+ * handler can read it without locking and skip one caught mid-update.
+ */
+
+#ifndef HDR_CLKSCrashAttributes_h
+#define HDR_CLKSCrashAttributes_h
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+#include "CLKSCrashReportWriter.h"
+#include "CLKSJSONCodec.h"
+
+#include <stdbool.h>
+
+/** Number of slots in the table. Must be a power of 2. */
+#define CLKSATTR_CAPACITY 128
+
+/** Maximum lengths, including the NUL terminator. Longer values are truncated. */
+#define CLKSATTR_MAX_KEY_LENGTH 64
+#define CLKSATTR_MAX_VALUE_LENGTH 256
+#define CLKSATTR_MAX_FLAG_LENGTH 16
+
+/** Set an attribute, replacing any existing value.
+ *
+ * @param key The attribute's key. Keys that are too long are rejected.
+ *
+ * @param value The attribute's value (NULL = remove the attribute).
+ *
+ * @param flag An optional flag name to record alongside the value (NULL = none).
+ *
+ * @return false if the key is invalid or the table is full.
+ */
+bool clksattr_setAttribute(const char* key, const char* value, const char* flag);
+
+/** Remove an attribute.
+ *
+ * @param key The attribute's key.
+ */
+void clksattr_removeAttribute(const char* key);
+
+/** Remove all attributes. */
+void clksattr_removeAllAttributes(void);
+
+/** Write all attributes as an object of { key: { "value": ..., "flag": ... } }.
+ *
+ * This function is async-safe.
+ *
+ * @param writer The report writer.
+ *
+ * @param key The key to write the object under.
+ */
+void clksattr_writeAttributes(const CLKSCrashReportWriter* writer, const char* key);
+
+/** Encode all attributes in the same format as clksattr_writeAttributes(),
+ * for JSON that isn't part of a crash report.
+ *
+ * This function is async-safe.
+ *
+ * @param context The JSON encode context.
+ *
+ * @param key The key to encode the object under.
+ */
+void clksattr_encodeAttributes(CLKSJSONEncodeContext* context, const char* key);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // HDR_CLKSCrashAttributes_h
@@ -0,0 +1,229 @@
+//
+//  CLKSCrashBreadcrumbs.c
+//
+//  Copyright (c) 2012 Karl Stenerud. All rights reserved.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall remain in place
+// in this source code.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+
+
+#include "CLKSCrashBreadcrumbs.h"
+#include "CLKSDate.h"
+
+//#define CLKSLogger_LocalLevel TRACE
+#include "CLKSLogger.h"
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <string.h>
+
+
+typedef struct
+{
+    char key[CLKSBC_MAX_KEY_LENGTH];
+    char value[CLKSBC_MAX_VALUE_LENGTH];
+} Metadata;
+
+typedef struct
+{
+    /** The breadcrumb's index + 1 once complete, 0 while it's being written. */
+    _Atomic(uint64_t) sequence;
+    int64_t timestamp;
+    int metadataCount;
+    char name[CLKSBC_MAX_NAME_LENGTH];
+    Metadata metadata[CLKSBC_MAX_METADATA_COUNT];
+} Breadcrumb;
+
+static Breadcrumb g_breadcrumbs[CLKSBC_CAPACITY];
+
+/** The index of the next breadcrumb to be added. Never wraps. */
+static _Atomic(uint64_t) g_head;
+
+/** The index of the first breadcrumb since the last clear. */
+static _Atomic(uint64_t) g_start;
+
+
+static void copyString(char* dst, const char* src, int dstLength)
+{
+    if(src == NULL)
+    {
+        dst[0] = '\0';
+        return;
+    }
+    strncpy(dst, src, (size_t)dstLength - 1);
+    dst[dstLength - 1] = '\0';
+}
+
+void clksbc_addBreadcrumb(time_t timestamp,
+                          const char* name,
+                          const char* const* keys,
+                          const char* const* values,
+                          int count)
+{
+    const uint64_t index = atomic_fetch_add_explicit(&g_head, 1, memory_order_relaxed);
+    Breadcrumb* const breadcrumb = &g_breadcrumbs[index & (CLKSBC_CAPACITY - 1)];
+    if(count > CLKSBC_MAX_METADATA_COUNT)
+    {
+        count = CLKSBC_MAX_METADATA_COUNT;
+    }
+
+    atomic_store_explicit(&breadcrumb->sequence, 0, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    breadcrumb->timestamp = (int64_t)timestamp;
+    breadcrumb->metadataCount = count;
+    copyString(breadcrumb->name, name, sizeof(breadcrumb->name));
+    for(int i = 0; i < count; i++)
+    {
+        copyString(breadcrumb->metadata[i].key, keys[i], sizeof(breadcrumb->metadata[i].key));
+        copyString(breadcrumb->metadata[i].value, values[i], sizeof(breadcrumb->metadata[i].value));
+    }
+    atomic_store_explicit(&breadcrumb->sequence, index + 1, memory_order_release);
+}
+
+void clksbc_clearBreadcrumbs()
+{
+    atomic_store(&g_start, atomic_load(&g_head));
+}
+
+/** Copy a breadcrumb if it's complete and still holds the one at index. */
+static bool copyBreadcrumb(const uint64_t index, Breadcrumb* const dst)
+{
+    Breadcrumb* const breadcrumb = &g_breadcrumbs[index & (CLKSBC_CAPACITY - 1)];
+    if(atomic_load_explicit(&breadcrumb->sequence, memory_order_acquire) != index + 1)
+    {
+        return false;
+    }
+    dst->timestamp = breadcrumb->timestamp;
+    dst->metadataCount = breadcrumb->metadataCount;
+    memcpy(dst->name, breadcrumb->name, sizeof(dst->name));
+    memcpy(dst->metadata, breadcrumb->metadata, sizeof(dst->metadata));
+    atomic_thread_fence(memory_order_acquire);
+    return atomic_load_explicit(&breadcrumb->sequence, memory_order_relaxed) == index + 1;
+}
+
+/** Get the index of the oldest breadcrumb still in the ring, but not before since. */
+static uint64_t getFirstIndex(const uint64_t head, const uint64_t since)
+{
+    uint64_t index = atomic_load(&g_start);
+    if(index < since)
+    {
+        index = since;
+    }
+    if(index > head)
+    {
+        index = head;
+    }
+    if(head - index > CLKSBC_CAPACITY)
+    {
+        index = head - CLKSBC_CAPACITY;
+    }
+    return index;
+}
+
+/** Copy a breadcrumb, making sure its contents are safe to write.
+ *
+ * @param timeString Set to when the breadcrumb was left, as a UTC string.
+ */
+static bool readBreadcrumb(const uint64_t index, Breadcrumb* const dst, char* const timeString)
+{
+    if(!copyBreadcrumb(index, dst))
+    {
+        CLKSLOG_DEBUG("Skipping breadcrumb %llu", (unsigned long long)index);
+        return false;
+    }
+    dst->name[sizeof(dst->name) - 1] = '\0';
+    if(dst->metadataCount < 0 || dst->metadataCount > CLKSBC_MAX_METADATA_COUNT)
+    {
+        dst->metadataCount = 0;
+    }
+    for(int i = 0; i < dst->metadataCount; i++)
+    {
+        dst->metadata[i].key[sizeof(dst->metadata[i].key) - 1] = '\0';
+        dst->metadata[i].value[sizeof(dst->metadata[i].value) - 1] = '\0';
+    }
+    clksdate_utcStringFromTimestamp((time_t)dst->timestamp, timeString);
+    return true;
+}
+
+void clksbc_writeBreadcrumbs(const CLKSCrashReportWriter* const writer, const char* const key)
+{
+    const uint64_t head = atomic_load(&g_head);
+    Breadcrumb breadcrumb;
+    char timeString[21];
+    writer->beginArray(writer, key);
+    for(uint64_t index = getFirstIndex(head, 0); index < head; index++)
+    {
+        if(!readBreadcrumb(index, &breadcrumb, timeString))
+        {
+            continue;
+        }
+        writer->beginObject(writer, NULL);
+        {
+            writer->addStringElement(writer, "name", breadcrumb.name);
+            writer->addStringElement(writer, "left_at", timeString);
+            writer->beginArray(writer, "metadata");
+            for(int i = 0; i < breadcrumb.metadataCount; i++)
+            {
+                writer->beginObject(writer, NULL);
+                {
+                    writer->addStringElement(writer, "key", breadcrumb.metadata[i].key);
+                    writer->addStringElement(writer, "value", breadcrumb.metadata[i].value);
+                }
+                writer->endContainer(writer);
+            }
+            writer->endContainer(writer);
+        }
+        writer->endContainer(writer);
+    }
+    writer->endContainer(writer);
+}
+
+uint64_t clksbc_encodeBreadcrumbs(CLKSJSONEncodeContext* const context, const char* const key, const uint64_t since)
+{
+    const uint64_t head = atomic_load(&g_head);
+    Breadcrumb breadcrumb;
+    char timeString[21];
+    clksjson_beginArray(context, key);
+    for(uint64_t index = getFirstIndex(head, since); index < head; index++)
+    {
+        if(!readBreadcrumb(index, &breadcrumb, timeString))
+        {
+            continue;
+        }
+        clksjson_beginObject(context, NULL);
+        {
+            clksjson_addStringElement(context, "name", breadcrumb.name, CLKSJSON_SIZE_AUTOMATIC);
+            clksjson_addStringElement(context, "left_at", timeString, CLKSJSON_SIZE_AUTOMATIC);
+            clksjson_beginArray(context, "metadata");
+            for(int i = 0; i < breadcrumb.metadataCount; i++)
+            {
+                clksjson_beginObject(context, NULL);
+                {
+                    clksjson_addStringElement(context, "key", breadcrumb.metadata[i].key, CLKSJSON_SIZE_AUTOMATIC);
+                    clksjson_addStringElement(context, "value", breadcrumb.metadata[i].value, CLKSJSON_SIZE_AUTOMATIC);
+                }
+                clksjson_endContainer(context);
+            }
+            clksjson_endContainer(context);
+        }
+        clksjson_endContainer(context);
+    }
+    clksjson_endContainer(context);
+    return head;
+}
@@ -0,0 +1,109 @@
+//
+//  CLKSCrashBreadcrumbs.h
+//
+//  Copyright (c) 2012 Karl Stenerud. All rights reserved.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall remain in place
+// in this source code.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+
+/* Fixed-capacity ring of breadcrumbs (footprints) to add to crash reports.
+ *
+ * Adding a breadcrumb is a lock-free copy into a preallocated record. Once
+ * the ring is full, the oldest breadcrumbs are overwritten.
+ */
+
+#ifndef HDR_CLKSCrashBreadcrumbs_h
+#define HDR_CLKSCrashBreadcrumbs_h
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+#include "CLKSCrashReportWriter.h"
+#include "CLKSJSONCodec.h"
+
+#include <stdint.h>
+#include <time.h>
+
+/** Number of breadcrumbs kept. Must be a power of 2. */
+#define CLKSBC_CAPACITY 128
+
+/** Maximum number of key/value pairs per breadcrumb. Further pairs are dropped. */
+#define CLKSBC_MAX_METADATA_COUNT 4
+
+/** Maximum lengths, including the NUL terminator. Longer strings are truncated. */
+#define CLKSBC_MAX_NAME_LENGTH 64
+#define CLKSBC_MAX_KEY_LENGTH 32
+#define CLKSBC_MAX_VALUE_LENGTH 64
+
+/** Add a breadcrumb.
+ * This function is lock-free and doesn't allocate.
+ *
+ * @param timestamp When the breadcrumb was left.
+ *
+ * @param name The breadcrumb's name.
+ *
+ * @param keys The metadata keys (can be NULL if count is 0).
+ *
+ * @param values The metadata values (can be NULL if count is 0).
+ *
+ * @param count The number of metadata key/value pairs.
+ */
+void clksbc_addBreadcrumb(time_t timestamp,
+                          const char* name,
+                          const char* const* keys,
+                          const char* const* values,
+                          int count);
+
+/** Remove all breadcrumbs. */
+void clksbc_clearBreadcrumbs(void);
+
+/** Write all breadcrumbs, oldest first, as an array of objects:
+ *  { "name": ..., "left_at": ..., "metadata": [{ "key": ..., "value": ... }] }
+ *
+ * This function is async-safe.
+ *
+ * @param writer The report writer.
+ *
+ * @param key The key to write the array under.
+ */
+void clksbc_writeBreadcrumbs(const CLKSCrashReportWriter* writer, const char* key);
+
+/** Encode the breadcrumbs left since an earlier call, in the same format as
+ * clksbc_writeBreadcrumbs(), for JSON that isn't part of a crash report.
+ *
+ * This function is async-safe.
+ *
+ * @param context The JSON encode context.
+ *
+ * @param key The key to encode the array under.
+ *
+ * @param since The value returned by the earlier call (0 = all breadcrumbs).
+ *
+ * @return The value to pass as since next time.
+ */
+uint64_t clksbc_encodeBreadcrumbs(CLKSJSONEncodeContext* context, const char* key, uint64_t since);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // HDR_CLKSCrashBreadcrumbs_h
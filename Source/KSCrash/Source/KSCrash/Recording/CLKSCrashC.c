@@ -28,18 +28,24 @@
 #include "CLKSCrashC.h"
 
 #include "CLKSCrashCachedData.h"
+#include "CLKSCrashEventLog.h"
+#include "CLKSCrashFingerprint.h"
 #include "CLKSCrashReport.h"
 #include "CLKSCrashReportFixer.h"
 #include "CLKSCrashReportStore.h"
+#include "CLKSCrashMonitor.h"
+#include "CLKSCrashMonitor_CPPException.h"
 #include "CLKSCrashMonitor_Deadlock.h"
 #include "CLKSCrashMonitor_User.h"
 #include "CLKSFileUtils.h"
+#include "CLKSID.h"
 #include "CLKSObjC.h"
 #include "CLKSString.h"
 #include "CLKSCrashMonitor_System.h"
 #include "CLKSCrashMonitor_Zombie.h"
 #include "CLKSCrashMonitor_AppState.h"
 #include "CLKSCrashMonitorContext.h"
+#include "CLKSStackCursor_SelfThread.h"
 #include "CLKSSystemCapabilities.h"
 
 //#define CLKSLogger_LocalLevel TRACE
@@ -60,9 +66,12 @@ static volatile bool g_installed = 0;
 
 static bool g_shouldAddConsoleLogToReport = false;
 static bool g_shouldPrintPreviousLog = false;
+static int g_consoleLogRingCapacity = 0;
+static bool g_consoleLogRingDrainsToStdout = false;
 static char g_consoleLogPath[CLKSFU_MAX_PATH_LENGTH];
 static CLKSCrashMonitorType g_monitoring = CLKSCrashMonitorTypeProductionSafeMinimal;
 static char g_lastCrashReportFilePath[CLKSFU_MAX_PATH_LENGTH];
+static int64_t g_lastCrashReportID;
 static CLKSReportWrittenCallback g_reportWrittenCallback;
 
 
@@ -72,15 +81,36 @@ static CLKSReportWrittenCallback g_reportWrittenCallback;
 
 static void printPreviousLog(const char* filePath)
 {
-    char* data;
+    char* data = NULL;
     int length;
-    if(clksfu_readEntireFile(filePath, &data, &length, 0))
+    bool isRead;
+    if(g_consoleLogRingCapacity > 0)
+    {
+        length = g_consoleLogRingCapacity;
+        data = malloc((unsigned)length);
+        isRead = data != NULL && clkslog_readLogRingFile(filePath, data, length) >= 0;
+    }
+    else
+    {
+        isRead = clksfu_readEntireFile(filePath, &data, &length, 0);
+    }
+    if(isRead)
     {
         printf("\nvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvv Previous Log vvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvv\n\n");
         printf("%s\n", data);
         printf("^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^\n\n");
         fflush(stdout);
     }
+    free(data);
+}
+
+static void writeSessionSnapshot(const char* path)
+{
+    CLKSCrash_MonitorContext context;
+    memset(&context, 0, sizeof(context));
+    context.eventID = clksel_getSessionID();
+    clkscm_addContextualInfo(&context);
+    clkscrashreport_writeSessionSnapshot(&context, path);
 }
 
 
@@ -97,19 +127,29 @@ static void onCrash(struct CLKSCrash_MonitorContext* monitorContext)
     if (monitorContext->currentSnapshotUserReported == false) {
         CLKSLOG_DEBUG("Updating application state to note crash.");
         clkscrashstate_notifyAppCrash();
+        clksel_flushAfterCrash();
     }
     monitorContext->consoleLogPath = g_shouldAddConsoleLogToReport ? g_consoleLogPath : NULL;
 
     if(monitorContext->crashedDuringCrashHandling)
     {
         clkscrashreport_writeRecrashReport(monitorContext, g_lastCrashReportFilePath);
+        clkscrs_writeReportMetadata(g_lastCrashReportID,
+                                    CLKSCrashReportKindRecrash,
+                                    clkscrashmonitortype_name(monitorContext->crashType),
+                                    0);
     }
     else
     {
         char crashReportFilePath[CLKSFU_MAX_PATH_LENGTH];
         int64_t reportID = clkscrs_getNextCrashReport(crashReportFilePath);
         strncpy(g_lastCrashReportFilePath, crashReportFilePath, sizeof(g_lastCrashReportFilePath));
+        g_lastCrashReportID = reportID;
         clkscrashreport_writeStandardReport(monitorContext, crashReportFilePath);
+        clkscrs_writeReportMetadata(reportID,
+                                    CLKSCrashReportKindStandard,
+                                    clkscrashmonitortype_name(monitorContext->crashType),
+                                    clkscfp_fingerprintCrash(monitorContext));
 
         if(g_reportWrittenCallback)
         {
@@ -141,17 +181,30 @@ CLKSCrashMonitorType clkscrash_install(const char *appName, const char *const in
 
     snprintf(path, sizeof(path), "%s/Data", installPath);
     clksfu_makePath(path);
-    snprintf(path, sizeof(path), "%s/Data/CrashState.json", installPath);
-    clkscrashstate_initialize(path);
+    char legacyPath[CLKSFU_MAX_PATH_LENGTH];
+    snprintf(path, sizeof(path), "%s/Data/CrashState.bin", installPath);
+    snprintf(legacyPath, sizeof(legacyPath), "%s/Data/CrashState.json", installPath);
+    clkscrashstate_initialize(path, legacyPath);
+
+    snprintf(path, sizeof(path), "%s/Events", installPath);
+    clksfu_makePath(path);
+    char sessionID[37];
+    clksid_generate(sessionID);
+    clksel_initialize(path, sessionID, writeSessionSnapshot);
 
-    snprintf(g_consoleLogPath, sizeof(g_consoleLogPath), "%s/Data/ConsoleLog.txt", installPath);
+    snprintf(g_consoleLogPath, sizeof(g_consoleLogPath), "%s/Data/ConsoleLog.%s",
+             installPath, g_consoleLogRingCapacity > 0 ? "ring" : "txt");
     if(g_shouldPrintPreviousLog)
     {
         printPreviousLog(g_consoleLogPath);
     }
-    clkslog_setLogFilename(g_consoleLogPath, true);
+    if(g_consoleLogRingCapacity <= 0 ||
+       !clkslog_setLogRing(g_consoleLogPath, g_consoleLogRingCapacity, g_consoleLogRingDrainsToStdout))
+    {
+        clkslog_setLogFilename(g_consoleLogPath, true);
+    }
 
-    clksccd_init(60);
+    clksccd_init();
 
     clkscm_setEventCallback(onCrash);
     CLKSCrashMonitorType monitors = clkscrash_setMonitoring(g_monitoring);
@@ -185,6 +238,13 @@ void clkscrash_setDeadlockWatchdogInterval(double deadlockWatchdogInterval)
 #endif
 }
 
+void clkscrash_setMainThreadHangSampling(double hangThreshold, double sampleInterval)
+{
+#if CLKSCRASH_HAS_OBJC
+    clkscm_setMainThreadHangSampling(hangThreshold, sampleInterval);
+#endif
+}
+
 void clkscrash_setSearchQueueNames(bool searchQueueNames)
 {
     clksccd_setSearchQueueNames(searchQueueNames);
@@ -200,6 +260,11 @@ void clkscrash_setDoNotIntrospectClasses(const char **doNotIntrospectClasses, in
     clkscrashreport_setDoNotIntrospectClasses(doNotIntrospectClasses, length);
 }
 
+void clkscrash_setBase64DataElements(bool base64DataElements)
+{
+    clkscrashreport_setBase64DataElements(base64DataElements);
+}
+
 void clkscrash_setCrashNotifyCallback(const CLKSReportWriteCallback onCrashNotify)
 {
     clkscrashreport_setUserSectionWriteCallback(onCrashNotify);
@@ -220,11 +285,54 @@ void clkscrash_setPrintPreviousLog(bool shouldPrintPreviousLog)
     g_shouldPrintPreviousLog = shouldPrintPreviousLog;
 }
 
+void clkscrash_setConsoleLogRing(int capacityBytes, bool drainToStdout)
+{
+    g_consoleLogRingCapacity = capacityBytes;
+    g_consoleLogRingDrainsToStdout = drainToStdout;
+}
+
+void clkscrash_setConsoleLogTail(int maxBytes, int maxLines)
+{
+    clkscrashreport_setConsoleLogTail(maxBytes, maxLines);
+}
+
+void clkscrash_setCPPExceptionThrowTraceSampling(int sampleInterval, int maxTracesPerSecond)
+{
+    clkscm_setCPPExceptionThrowTraceSampling(sampleInterval, maxTracesPerSecond);
+}
+
 void clkscrash_setMaxReportCount(int maxReportCount)
 {
     clkscrs_setMaxReportCount(maxReportCount);
 }
 
+void clkscrash_setMaxTotalReportSize(int64_t maxTotalReportSize)
+{
+    clkscrs_setMaxTotalReportSize(maxTotalReportSize);
+}
+
+void clkscrash_setCollapseDuplicateReports(bool collapseDuplicateReports)
+{
+    clkscrs_setCollapsesDuplicates(collapseDuplicateReports);
+}
+
+void clkscrash_setMaxReportAge(int64_t maxReportAge)
+{
+    clkscrs_setMaxReportAge(maxReportAge);
+}
+
+void clkscrash_setUserReportWriteQueue(int maxBatchBytes, double maxBatchDelay, bool syncEachBatch)
+{
+    clkscrs_setWriteQueue(maxBatchBytes,
+                          maxBatchDelay,
+                          syncEachBatch ? CLKSCrashReportDurabilitySyncPerBatch : CLKSCrashReportDurabilityNone);
+}
+
+void clkscrash_setReportCompressionLevel(int compressionLevel)
+{
+    clkscrs_setCompressionLevel(compressionLevel);
+}
+
 void clkscrash_reportUserException(const char *name,
         const char *reason,
         const char *language,
@@ -246,19 +354,52 @@ void clkscrash_reportUserException(const char *name,
     }
 }
 
+void clkscrash_logEvent(const char *severity,
+        const char *name,
+        const char *message,
+        const uintptr_t *backtrace,
+        int backtraceLength)
+{
+    uintptr_t selfBacktrace[CLKSEL_MAX_BACKTRACE_LENGTH];
+    if(backtrace == NULL)
+    {
+        CLKSStackCursor stackCursor;
+        clkssc_initSelfThread(&stackCursor, 1);
+        backtraceLength = 0;
+        while(backtraceLength < CLKSEL_MAX_BACKTRACE_LENGTH && stackCursor.advanceCursor(&stackCursor))
+        {
+            selfBacktrace[backtraceLength++] = stackCursor.stackEntry.address;
+        }
+        backtrace = selfBacktrace;
+    }
+    clksel_addEvent(severity, name, message, backtrace, backtraceLength);
+}
+
 void clkscrash_notifyAppActive(bool isActive)
 {
     clkscrashstate_notifyAppActive(isActive);
+    if(isActive && g_installed)
+    {
+        // Threads are usually named after they start, so catch up on any renames.
+        clksccd_refreshAllThreads();
+    }
 }
 
 void clkscrash_notifyAppInForeground(bool isInForeground)
 {
     clkscrashstate_notifyAppInForeground(isInForeground);
+    if(!isInForeground)
+    {
+        clksel_flush();
+        clkscrs_flushUserReports();
+    }
 }
 
 void clkscrash_notifyAppTerminate(void)
 {
     clkscrashstate_notifyAppTerminate();
+    clksel_flush();
+    clkscrs_flushUserReports();
 }
 
 void clkscrash_notifyAppCrash(void)
@@ -266,6 +407,14 @@ void clkscrash_notifyAppCrash(void)
     clkscrashstate_notifyAppCrash();
 }
 
+void clkscrash_notifyThreadRenamed(void)
+{
+    if(g_installed)
+    {
+        clksccd_notifyThreadRenamed();
+    }
+}
+
 int clkscrash_getReportCount()
 {
     return clkscrs_getReportCount();
@@ -276,6 +425,11 @@ int clkscrash_getReportIDs(int64_t *reportIDs, int count)
     return clkscrs_getReportIDs(reportIDs, count);
 }
 
+static int readReportChunk(char* buffer, int bufferLength, void* userData)
+{
+    return clkscrs_readReportChunk((CLKSCrashReportReader*)userData, buffer, bufferLength);
+}
+
 char* clkscrash_readReport(int64_t reportID)
 {
     if(reportID <= 0)
@@ -284,20 +438,20 @@ char* clkscrash_readReport(int64_t reportID)
         return NULL;
     }
 
-    char* rawReport = clkscrs_readReport(reportID);
-    if(rawReport == NULL)
+    CLKSCrashReportReader* reader = clkscrs_openReport(reportID);
+    if(reader == NULL)
     {
         CLKSLOG_ERROR("Failed to load report ID %" PRIx64, reportID);
         return NULL;
     }
 
-    char* fixedReport = clkscrf_fixupCrashReport(rawReport);
+    char* fixedReport = clkscrf_fixupCrashReportStream((int)clkscrs_getReportLength(reader), readReportChunk, reader);
     if(fixedReport == NULL)
     {
         CLKSLOG_ERROR("Failed to fixup report ID %" PRIx64, reportID);
     }
 
-    free(rawReport);
+    clkscrs_closeReport(reader);
     return fixedReport;
 }
 
@@ -306,6 +460,11 @@ int64_t clkscrash_addUserReport(const char *report, int reportLength)
     return clkscrs_addUserReport(report, reportLength);
 }
 
+void clkscrash_compressReports(void)
+{
+    clkscrs_compressReports();
+}
+
 void clkscrash_deleteAllReports()
 {
     clkscrs_deleteAllReports();
@@ -315,3 +474,18 @@ void clkscrash_deleteReportWithID(int64_t reportID)
 {
     clkscrs_deleteReportWithID(reportID);
 }
+
+void clkscrash_markReportSendAttempt(int64_t reportID, bool sent)
+{
+    clkscrs_markReportSendAttempt(reportID, sent);
+}
+
+void clkscrash_closeEventLog()
+{
+    clksel_closeLog();
+}
+
+void clkscrash_deleteEventLog(const char *path)
+{
+    clksel_deleteLog(path);
+}
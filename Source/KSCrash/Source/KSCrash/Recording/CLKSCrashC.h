@@ -89,6 +89,19 @@ void clkscrash_setUserInfoJSON(const char *const userInfoJSON);
  */
 void clkscrash_setDeadlockWatchdogInterval(double deadlockWatchdogInterval);
 
+/** Sample the main thread's stack whenever it is unresponsive for longer than
+ * hangThreshold, and save a call tree of the samples as a user report once it
+ * recovers. Requires the main thread deadlock monitor.
+ *
+ * @param hangThreshold Seconds the main thread may be unresponsive before
+ *                      sampling starts (0 = disabled).
+ *
+ * @param sampleInterval Seconds between samples.
+ *
+ * Default: 0, 0.05
+ */
+void clkscrash_setMainThreadHangSampling(double hangThreshold, double sampleInterval);
+
 /** If true, attempt to fetch dispatch queue names for each running thread.
  *
  * WARNING: There is a chance that this will crash on a clksthread_getQueueName() call!
@@ -116,6 +129,14 @@ void clkscrash_setIntrospectMemory(bool introspectMemory);
  */
 void clkscrash_setDoNotIntrospectClasses(const char **doNotIntrospectClasses, int length);
 
+/** If true, write binary data such as stack contents as base64 rather than hex.
+ * This makes reports about a third smaller where such data is recorded.
+ * CLKSCrashReportFixer converts it back to hex, so sent reports are unaffected.
+ *
+ * Default: false
+ */
+void clkscrash_setBase64DataElements(bool base64DataElements);
+
 /** Set the callback to invoke upon a crash.
  *
  * WARNING: Only call async-safe functions from this function! DO NOT call
@@ -155,12 +176,92 @@ void clkscrash_setAddConsoleLogToReport(bool shouldAddConsoleLogToReport);
  */
 void clkscrash_setPrintPreviousLog(bool shouldPrintPreviousLog);
 
+/** Log into a fixed-size memory-mapped ring instead of an ever-growing file.
+ * Logging becomes a lock-free memory copy, and only the most recent part of the
+ * ring is added to reports. Must be called before clkscrash_install().
+ *
+ * @param capacityBytes The size of the ring (0 = log to a plain file).
+ *
+ * @param drainToStdout If true, copy log entries to stdout from a background thread.
+ *
+ * Default: 0, false
+ */
+void clkscrash_setConsoleLogRing(int capacityBytes, bool drainToStdout);
+
+/** Only add the end of the console log to reports, within a budget.
+ *  The number of lines left out is recorded alongside the log.
+ *
+ * @param maxBytes The most bytes to add (0 = no byte limit, max 64 KB).
+ *
+ * @param maxLines The most lines to add (0 = no line limit).
+ *
+ * Default: 0, 0 (add the whole log file)
+ */
+void clkscrash_setConsoleLogTail(int maxBytes, int maxLines);
+
+/** Set how often C++ throws record where they were thrown from.
+ *
+ * @param sampleInterval Trace one in every this many throws on each thread
+ *                       (1 = every throw).
+ *
+ * @param maxTracesPerSecond Maximum number of throws traced per second (0 = unlimited).
+ *
+ * Default: 1, 0
+ */
+void clkscrash_setCPPExceptionThrowTraceSampling(int sampleInterval, int maxTracesPerSecond);
+
 /** Set the maximum number of reports allowed on disk before old ones get deleted.
  *
  * @param maxReportCount The maximum number of reports.
  */
 void clkscrash_setMaxReportCount(int maxReportCount);
 
+/** Set the most disk space that reports can use before some get deleted.
+ *
+ * @param maxTotalReportSize The maximum total size in bytes (0 = no limit).
+ *
+ * Default: 0
+ */
+void clkscrash_setMaxTotalReportSize(int64_t maxTotalReportSize);
+
+/** Fold unsent crash reports with the same fingerprint (crash type, signal or
+ * exception name, and top in-app frames) into the oldest of them, which keeps
+ * a count of them and the time of the latest.
+ *
+ * @param collapseDuplicateReports If true, fold duplicates.
+ *
+ * Default: false
+ */
+void clkscrash_setCollapseDuplicateReports(bool collapseDuplicateReports);
+
+/** Set how long reports are kept before being deleted.
+ *
+ * @param maxReportAge The maximum age in seconds (0 = no limit).
+ *
+ * Default: 0
+ */
+void clkscrash_setMaxReportAge(int64_t maxReportAge);
+
+/** Set how user reports are batched on their way to disk.
+ *
+ * @param maxBatchBytes Write a batch once this many bytes are queued.
+ *
+ * @param maxBatchDelay Write a batch once its oldest report has waited this many seconds.
+ *
+ * @param syncEachBatch If true, sync each batch to disk before writing the next.
+ *
+ * Default: 65536, 1.0, false
+ */
+void clkscrash_setUserReportWriteQueue(int maxBatchBytes, double maxBatchDelay, bool syncEachBatch);
+
+/** Set how hard clkscrash_compressReports() compresses reports.
+ *
+ * @param compressionLevel A zlib compression level from 1 to 9 (0 = leave reports uncompressed).
+ *
+ * Default: 0
+ */
+void clkscrash_setReportCompressionLevel(int compressionLevel);
+
 /** Report a custom, user defined exception.
  * This can be useful when dealing with scripting languages.
  *
@@ -191,6 +292,26 @@ void clkscrash_reportUserException(const char *name,
         bool logAllThreads,
         bool terminateProgram);
 
+/** Log a non-fatal event to the batched event log.
+ * Unlike clkscrash_reportUserException(), this doesn't write a full report. Binary
+ * images and system info are recorded once per session and referred to by ID.
+ *
+ * @param severity The event's severity (such as "error").
+ *
+ * @param name The event's name, such as an exception name (NULL = none).
+ *
+ * @param message The event's message (NULL = none).
+ *
+ * @param backtrace Return addresses leading up to the event (NULL = the current thread's).
+ *
+ * @param backtraceLength The number of return addresses.
+ */
+void clkscrash_logEvent(const char *severity,
+        const char *name,
+        const char *message,
+        const uintptr_t *backtrace,
+        int backtraceLength);
+
     
 #pragma mark -- Notifications --
 
@@ -215,6 +336,10 @@ void clkscrash_notifyAppTerminate(void);
  */
 void clkscrash_notifyAppCrash(void);
 
+/** Notify the crash reporter that the calling thread has changed its name.
+ */
+void clkscrash_notifyThreadRenamed(void);
+
     
 #pragma mark -- Reporting --
 
@@ -249,6 +374,11 @@ char* clkscrash_readReport(int64_t reportID);
  */
 int64_t clkscrash_addUserReport(const char *report, int reportLength);
 
+/** Compress all reports that aren't compressed yet, according to the report compression level.
+ * This can take a while, so call it on a background thread.
+ */
+void clkscrash_compressReports(void);
+
 /** Delete all reports on disk.
  */
 void clkscrash_deleteAllReports(void);
@@ -259,6 +389,23 @@ void clkscrash_deleteAllReports(void);
  */
 void clkscrash_deleteReportWithID(int64_t reportID);
 
+/** Record an attempt to send a report in its metadata.
+ *
+ * @param reportID The report's ID.
+ * @param sent true if the report was sent successfully.
+ */
+void clkscrash_markReportSendAttempt(int64_t reportID, bool sent);
+
+/** Close the current event log file so that every event logged so far can be read.
+ */
+void clkscrash_closeEventLog(void);
+
+/** Delete an event log file, and its session snapshot once no other logs refer to it.
+ *
+ * @param path The event log file.
+ */
+void clkscrash_deleteEventLog(const char *path);
+
 
 #ifdef __cplusplus
 }
@@ -28,107 +28,96 @@
 //#define CLKSLogger_LocalLevel TRACE
 #include "CLKSLogger.h"
 
+#include "CLKSThreadRegistry.h"
+
 #include <mach/mach.h>
-#include <errno.h>
-#include <memory.h>
 #include <pthread.h>
-#include <string.h>
-#include <stdlib.h>
-#include <unistd.h>
-
+#include <pthread/introspection.h>
+#include <stdatomic.h>
 
-#define SWAP_POINTERS(A, B) \
-{ \
-    void* temp = A; \
-    A = B; \
-    B = temp; \
-}
 
-static int g_pollingIntervalInSeconds;
-static pthread_t g_cacheThread;
-static CLKSThread* g_allMachThreads;
-static CLKSThread* g_allPThreads;
-static const char** g_allThreadNames;
-static const char** g_allQueueNames;
-static int g_allThreadsCount;
+static pthread_introspection_hook_t g_previousIntrospectionHook;
+static const CLKSThreadRegistrySnapshot* g_frozenSnapshot;
 static _Atomic(int) g_semaphoreCount;
 static bool g_searchQueueNames = false;
 
-static void updateThreadList()
+static void registerCurrentThread()
 {
-    const task_t thisTask = mach_task_self();
-    int oldThreadsCount = g_allThreadsCount;
-    CLKSThread* allMachThreads = NULL;
-    CLKSThread* allPThreads = NULL;
-    static const char** allThreadNames;
-    static const char** allQueueNames;
+    char name[CLKSTREG_MAX_NAME_LENGTH];
+    char queueName[CLKSTREG_MAX_NAME_LENGTH];
+    const CLKSThread thread = (CLKSThread)pthread_mach_thread_np(pthread_self());
+    if(pthread_getname_np(pthread_self(), name, sizeof(name)) != 0)
+    {
+        name[0] = 0;
+    }
+    if(!g_searchQueueNames || !clksthread_getQueueName(thread, queueName, sizeof(queueName)))
+    {
+        queueName[0] = 0;
+    }
+    clkstreg_setThread(thread, name, queueName);
+}
 
-    mach_msg_type_number_t allThreadsCount;
-    thread_act_array_t threads;
-    task_threads(thisTask, &threads, &allThreadsCount);
-    
-    allMachThreads = calloc(allThreadsCount, sizeof(*allMachThreads));
-    allPThreads = calloc(allThreadsCount, sizeof(*allPThreads));
-    allThreadNames = calloc(allThreadsCount, sizeof(*allThreadNames));
-    allQueueNames = calloc(allThreadsCount, sizeof(*allQueueNames));
-    
-    for(mach_msg_type_number_t i = 0; i < allThreadsCount; i++)
+static void onThreadEvent(unsigned int event, pthread_t thread, void* addr, size_t size)
+{
+    switch(event)
     {
-        char buffer[1000];
-        thread_t thread = threads[i];
-        pthread_t pthread = pthread_from_mach_thread_np(thread);
-        allMachThreads[i] = (CLKSThread)thread;
-        allPThreads[i] = (CLKSThread)pthread;
-        if(pthread != 0 && pthread_getname_np(pthread, buffer, sizeof(buffer)) == 0 && buffer[0] != 0)
-        {
-            allThreadNames[i] = strdup(buffer);
-        }
-        if(g_searchQueueNames && clksthread_getQueueName((CLKSThread) thread, buffer, sizeof(buffer)) && buffer[0] != 0)
-        {
-            allQueueNames[i] = strdup(buffer);
-        }
+        case PTHREAD_INTROSPECTION_THREAD_START:
+            // Called on the new thread, before its start routine has had a chance to name it.
+            registerCurrentThread();
+            break;
+        case PTHREAD_INTROSPECTION_THREAD_TERMINATE:
+            clkstreg_removeThread((CLKSThread)pthread_mach_thread_np(thread));
+            break;
+        default:
+            break;
     }
-    
-    g_allThreadsCount = g_allThreadsCount < (int)allThreadsCount ? g_allThreadsCount : (int)allThreadsCount;
-    SWAP_POINTERS(g_allMachThreads, allMachThreads);
-    SWAP_POINTERS(g_allPThreads, allPThreads);
-    SWAP_POINTERS(g_allThreadNames, allThreadNames);
-    SWAP_POINTERS(g_allQueueNames, allQueueNames);
-    g_allThreadsCount = (int)allThreadsCount;
-
-    if(allMachThreads != NULL)
+    if(g_previousIntrospectionHook != NULL)
     {
-        free(allMachThreads);
+        g_previousIntrospectionHook(event, thread, addr, size);
     }
-    if(allPThreads != NULL)
+}
+
+void clksccd_refreshAllThreads()
+{
+    const task_t thisTask = mach_task_self();
+    mach_msg_type_number_t allThreadsCount;
+    thread_act_array_t threads;
+    if(task_threads(thisTask, &threads, &allThreadsCount) != KERN_SUCCESS)
     {
-        free(allPThreads);
+        CLKSLOG_ERROR("task_threads failed");
+        return;
     }
-    if(allThreadNames != NULL)
+    int count = allThreadsCount < CLKSTREG_MAX_THREADS ? (int)allThreadsCount : CLKSTREG_MAX_THREADS;
+
+    // Large, but this only runs on lifecycle events.
+    static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+    static CLKSThread allThreads[CLKSTREG_MAX_THREADS];
+    static char nameBuffers[CLKSTREG_MAX_THREADS][2][CLKSTREG_MAX_NAME_LENGTH];
+    static const char* names[CLKSTREG_MAX_THREADS];
+    static const char* queueNames[CLKSTREG_MAX_THREADS];
+
+    pthread_mutex_lock(&mutex);
+    for(int i = 0; i < count; i++)
     {
-        for(int i = 0; i < oldThreadsCount; i++)
+        thread_t thread = threads[i];
+        pthread_t pthread = pthread_from_mach_thread_np(thread);
+        char* name = nameBuffers[i][0];
+        char* queueName = nameBuffers[i][1];
+        allThreads[i] = (CLKSThread)thread;
+        if(pthread == 0 || pthread_getname_np(pthread, name, CLKSTREG_MAX_NAME_LENGTH) != 0)
         {
-            const char* name = allThreadNames[i];
-            if(name != NULL)
-            {
-                free((void*)name);
-            }
+            name[0] = 0;
         }
-        free(allThreadNames);
-    }
-    if(allQueueNames != NULL)
-    {
-        for(int i = 0; i < oldThreadsCount; i++)
+        if(!g_searchQueueNames || !clksthread_getQueueName((CLKSThread)thread, queueName, CLKSTREG_MAX_NAME_LENGTH))
         {
-            const char* name = allQueueNames[i];
-            if(name != NULL)
-            {
-                free((void*)name);
-            }
+            queueName[0] = 0;
         }
-        free(allQueueNames);
+        names[i] = name;
+        queueNames[i] = queueName;
     }
-    
+    clkstreg_replaceAllThreads(allThreads, names, queueNames, count);
+    pthread_mutex_unlock(&mutex);
+
     for(mach_msg_type_number_t i = 0; i < allThreadsCount; i++)
     {
         mach_port_deallocate(thisTask, threads[i]);
@@ -136,51 +125,28 @@ static void updateThreadList()
     vm_deallocate(thisTask, (vm_address_t)threads, sizeof(thread_t) * allThreadsCount);
 }
 
-static void* monitorCachedData(__unused void* const userData)
+void clksccd_notifyThreadRenamed()
 {
-    static int quickPollCount = 4;
-    usleep(1);
-    for(;;)
-    {
-        if(g_semaphoreCount <= 0)
-        {
-            updateThreadList();
-        }
-        unsigned pollintInterval = (unsigned)g_pollingIntervalInSeconds;
-        if(quickPollCount > 0)
-        {
-            // Lots can happen in the first few seconds of operation.
-            quickPollCount--;
-            pollintInterval = 1;
-        }
-        sleep(pollintInterval);
-    }
-    return NULL;
+    registerCurrentThread();
 }
 
-void clksccd_init(int pollingIntervalInSeconds)
+void clksccd_init()
 {
-    g_pollingIntervalInSeconds = pollingIntervalInSeconds;
-    pthread_attr_t attr;
-    pthread_attr_init(&attr);
-    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
-    int error = pthread_create(&g_cacheThread,
-                           &attr,
-                           &monitorCachedData,
-                           "CLKSCrash Cached Data Monitor");
-    if(error != 0)
+    static atomic_flag isInstalled = ATOMIC_FLAG_INIT;
+    if(atomic_flag_test_and_set(&isInstalled))
     {
-        CLKSLOG_ERROR("pthread_create_suspended_np: %s", strerror(error));
+        return;
     }
-    pthread_attr_destroy(&attr);
+    // Install first so that no thread is missed between the scan and the hook.
+    g_previousIntrospectionHook = pthread_introspection_hook_install(onThreadEvent);
+    clksccd_refreshAllThreads();
 }
 
 void clksccd_freeze()
 {
     if(g_semaphoreCount++ <= 0)
     {
-        // Sleep just in case the cached data thread is in the middle of an update.
-        usleep(1);
+        g_frozenSnapshot = clkstreg_acquireSnapshot();
     }
 }
 
@@ -190,6 +156,13 @@ void clksccd_unfreeze()
     {
         // Handle extra calls to unfreeze somewhat gracefully.
         g_semaphoreCount++;
+        return;
+    }
+    if(g_semaphoreCount == 0)
+    {
+        const CLKSThreadRegistrySnapshot* snapshot = g_frozenSnapshot;
+        g_frozenSnapshot = NULL;
+        clkstreg_releaseSnapshot(snapshot);
     }
 }
 
@@ -198,41 +171,31 @@ void clksccd_setSearchQueueNames(bool searchQueueNames)
     g_searchQueueNames = searchQueueNames;
 }
 
-CLKSThread* clksccd_getAllThreads(int *threadCount)
+/** Get the frozen snapshot, or the current one if not frozen.
+ * An unfrozen snapshot can be overwritten two thread events later.
+ */
+static const CLKSThreadRegistrySnapshot* getSnapshot()
 {
-    if(threadCount != NULL)
+    const CLKSThreadRegistrySnapshot* snapshot = g_frozenSnapshot;
+    if(snapshot == NULL)
     {
-        *threadCount = g_allThreadsCount;
+        snapshot = clkstreg_acquireSnapshot();
+        clkstreg_releaseSnapshot(snapshot);
     }
-    return g_allMachThreads;
+    return snapshot;
+}
+
+const CLKSThread* clksccd_getAllThreads(int *threadCount)
+{
+    return clkstreg_getThreads(getSnapshot(), threadCount);
 }
 
 const char* clksccd_getThreadName(CLKSThread thread)
 {
-    if(g_allThreadNames != NULL)
-    {
-        for(int i = 0; i < g_allThreadsCount; i++)
-        {
-            if(g_allMachThreads[i] == thread)
-            {
-                return g_allThreadNames[i];
-            }
-        }
-    }
-    return NULL;
+    return clkstreg_getThreadName(getSnapshot(), thread);
 }
 
 const char* clksccd_getQueueName(CLKSThread thread)
 {
-    if(g_allQueueNames != NULL)
-    {
-        for(int i = 0; i < g_allThreadsCount; i++)
-        {
-            if(g_allMachThreads[i] == thread)
-            {
-                return g_allQueueNames[i];
-            }
-        }
-    }
-    return NULL;
+    return clkstreg_getQueueName(getSnapshot(), thread);
 }
@@ -24,19 +24,31 @@
 
 
 /* Maintains a cache of difficult-to-retrieve data.
+ *
+ * The thread list is kept up to date by pthread introspection events rather
+ * than polling, and is read from a CLKSThreadRegistry snapshot while frozen.
  */
 
 
 #include "CLKSThread.h"
 
-void clksccd_init(int pollingIntervalInSeconds);
+/** Start tracking threads. Safe to call more than once. */
+void clksccd_init(void);
+
+/** Rescan all threads, picking up any names and queue names that have changed
+ * since they started.
+ */
+void clksccd_refreshAllThreads(void);
+
+/** Re-read the calling thread's name after it has been changed. */
+void clksccd_notifyThreadRenamed(void);
 
 void clksccd_freeze(void);
 void clksccd_unfreeze(void);
 
 void clksccd_setSearchQueueNames(bool searchQueueNames);
 
-CLKSThread* clksccd_getAllThreads(int *threadCount);
+const CLKSThread* clksccd_getAllThreads(int *threadCount);
 
 const char* clksccd_getThreadName(CLKSThread thread);
 
@@ -0,0 +1,293 @@
+//
+//  CLKSCrashEventLog.c
+//
+//  Copyright (c) 2012 Karl Stenerud. All rights reserved.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall remain in place
+// in this source code.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+
+
+#include "CLKSCrashEventLog.h"
+#include "CLKSCrashAttributes.h"
+#include "CLKSCrashBreadcrumbs.h"
+#include "CLKSCrashReportFields.h"
+#include "CLKSFileUtils.h"
+#include "CLKSID.h"
+#include "CLKSJSONCodec.h"
+
+//#define CLKSLogger_LocalLevel TRACE
+#include "CLKSLogger.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+
+/** How long events may sit in the write buffer before the next event flushes it. */
+#define kMaxFlushDelayMS 5000
+
+static char g_eventLogPath[CLKSFU_MAX_PATH_LENGTH];
+static char g_sessionID[37];
+static CLKSEventLogSnapshotWriter g_snapshotWriter;
+static bool g_isSnapshotWritten;
+
+/** Index of the current log file within this session. */
+static int g_logIndex = 1;
+static bool g_isLogOpen;
+static CLKSBufferedWriter g_writer;
+static char g_writeBuffer[16384];
+
+/** The first breadcrumb not yet logged with an event in the current log file. */
+static uint64_t g_nextBreadcrumbIndex;
+
+/** When the oldest event still in the write buffer was added, in milliseconds. */
+static int64_t g_oldestBufferedEventTime;
+
+static pthread_mutex_t g_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+
+// ============================================================================
+#pragma mark - Utility -
+// ============================================================================
+
+/** Get the current time in milliseconds since the epoch. */
+static int64_t currentTime(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (int64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
+static void getSnapshotPath(const char* sessionID, char* pathBuffer)
+{
+    snprintf(pathBuffer, CLKSFU_MAX_PATH_LENGTH, "%s/%s.session", g_eventLogPath, sessionID);
+}
+
+static int addJSONData(const char* const data, const int length, void* const userData)
+{
+    CLKSBufferedWriter* writer = userData;
+    return clksfu_writeBufferedWriter(writer, data, length) ? CLKSJSON_OK : CLKSJSON_ERROR_CANNOT_ADD_DATA;
+}
+
+/** Open the current log file if it isn't already.
+ * Must be called with g_mutex held.
+ */
+static bool openLogIfNeeded(void)
+{
+    if(g_isLogOpen)
+    {
+        return true;
+    }
+    if(!g_isSnapshotWritten)
+    {
+        char snapshotPath[CLKSFU_MAX_PATH_LENGTH];
+        getSnapshotPath(g_sessionID, snapshotPath);
+        g_snapshotWriter(snapshotPath);
+        g_isSnapshotWritten = true;
+    }
+    char path[CLKSFU_MAX_PATH_LENGTH];
+    snprintf(path, sizeof(path), "%s/%s-%d.events", g_eventLogPath, g_sessionID, g_logIndex);
+    g_isLogOpen = clksfu_openBufferedWriter(&g_writer, path, g_writeBuffer, sizeof(g_writeBuffer));
+    g_nextBreadcrumbIndex = 0;
+    return g_isLogOpen;
+}
+
+/** Check if a log file other than the one being deleted still refers to a session.
+ */
+static bool sessionHasOtherLogs(const char* sessionID, const char* deletedFilename)
+{
+    bool hasOtherLogs = false;
+    size_t sessionIDLength = strlen(sessionID);
+    DIR* dir = opendir(g_eventLogPath);
+    if(dir == NULL)
+    {
+        CLKSLOG_ERROR("Could not open directory %s", g_eventLogPath);
+        return false;
+    }
+    struct dirent* ent;
+    while((ent = readdir(dir)) != NULL)
+    {
+        const char* suffix = strrchr(ent->d_name, '.');
+        if(strncmp(ent->d_name, sessionID, sessionIDLength) == 0 &&
+           ent->d_name[sessionIDLength] == '-' &&
+           suffix != NULL && strcmp(suffix, ".events") == 0 &&
+           strcmp(ent->d_name, deletedFilename) != 0)
+        {
+            hasOtherLogs = true;
+            break;
+        }
+    }
+    closedir(dir);
+    return hasOtherLogs;
+}
+
+
+// ============================================================================
+#pragma mark - API -
+// ============================================================================
+
+void clksel_initialize(const char* eventLogPath, const char* sessionID, CLKSEventLogSnapshotWriter snapshotWriter)
+{
+    pthread_mutex_lock(&g_mutex);
+    strncpy(g_eventLogPath, eventLogPath, sizeof(g_eventLogPath) - 1);
+    strncpy(g_sessionID, sessionID, sizeof(g_sessionID) - 1);
+    g_snapshotWriter = snapshotWriter;
+    pthread_mutex_unlock(&g_mutex);
+}
+
+const char* clksel_getSessionID()
+{
+    return g_sessionID;
+}
+
+bool clksel_addEvent(const char* severity,
+                     const char* name,
+                     const char* message,
+                     const uintptr_t* backtrace,
+                     int backtraceLength)
+{
+    if(g_eventLogPath[0] == '\0')
+    {
+        CLKSLOG_ERROR("Event log is not initialized. Event has not been recorded.");
+        return false;
+    }
+    if(backtraceLength > CLKSEL_MAX_BACKTRACE_LENGTH)
+    {
+        backtraceLength = CLKSEL_MAX_BACKTRACE_LENGTH;
+    }
+    char eventID[37];
+    clksid_generate(eventID);
+    int64_t timestamp = currentTime();
+
+    pthread_mutex_lock(&g_mutex);
+    bool isSuccessful = openLogIfNeeded();
+    if(!isSuccessful)
+    {
+        goto done;
+    }
+    if(g_writer.position == 0)
+    {
+        g_oldestBufferedEventTime = timestamp;
+    }
+
+    CLKSJSONEncodeContext context;
+    clksjson_beginEncode(&context, false, addJSONData, &g_writer);
+    clksjson_beginObject(&context, NULL);
+    {
+        clksjson_addStringElement(&context, CLKSCrashField_ID, eventID, CLKSJSON_SIZE_AUTOMATIC);
+        clksjson_addStringElement(&context, CLKSCrashField_Session, g_sessionID, CLKSJSON_SIZE_AUTOMATIC);
+        clksjson_addIntegerElement(&context, CLKSCrashField_Timestamp, timestamp);
+        clksjson_addStringElement(&context, CLKSCrashField_Severity, severity, CLKSJSON_SIZE_AUTOMATIC);
+        if(name != NULL)
+        {
+            clksjson_addStringElement(&context, CLKSCrashField_Name, name, CLKSJSON_SIZE_AUTOMATIC);
+        }
+        if(message != NULL)
+        {
+            clksjson_addStringElement(&context, CLKSCrashField_Message, message, CLKSJSON_SIZE_AUTOMATIC);
+        }
+        clksjson_beginArray(&context, CLKSCrashField_Backtrace);
+        for(int i = 0; i < backtraceLength; i++)
+        {
+            clksjson_addIntegerElement(&context, NULL, (int64_t)backtrace[i]);
+        }
+        clksjson_endContainer(&context);
+        clksattr_encodeAttributes(&context, CLKSCrashField_Attributes);
+        g_nextBreadcrumbIndex = clksbc_encodeBreadcrumbs(&context, CLKSCrashField_Footprints, g_nextBreadcrumbIndex);
+    }
+    int result = clksjson_endEncode(&context);
+    isSuccessful = result == CLKSJSON_OK && clksfu_writeBufferedWriter(&g_writer, "\n", 1);
+    if(!isSuccessful)
+    {
+        CLKSLOG_ERROR("Could not log event: %s", clksjson_stringForError(result));
+    }
+
+    if(timestamp - g_oldestBufferedEventTime >= kMaxFlushDelayMS)
+    {
+        clksfu_flushBufferedWriter(&g_writer);
+    }
+
+done:
+    pthread_mutex_unlock(&g_mutex);
+    return isSuccessful;
+}
+
+void clksel_flush()
+{
+    pthread_mutex_lock(&g_mutex);
+    if(g_isLogOpen)
+    {
+        clksfu_flushBufferedWriter(&g_writer);
+    }
+    pthread_mutex_unlock(&g_mutex);
+}
+
+void clksel_flushAfterCrash()
+{
+    if(g_isLogOpen)
+    {
+        clksfu_flushBufferedWriter(&g_writer);
+    }
+}
+
+void clksel_closeLog()
+{
+    pthread_mutex_lock(&g_mutex);
+    if(g_isLogOpen)
+    {
+        clksfu_closeBufferedWriter(&g_writer);
+        g_isLogOpen = false;
+        g_logIndex++;
+    }
+    pthread_mutex_unlock(&g_mutex);
+}
+
+void clksel_deleteLog(const char* path)
+{
+    if(unlink(path) < 0 && errno != ENOENT)
+    {
+        CLKSLOG_ERROR("Could not delete %s: %s", path, strerror(errno));
+        return;
+    }
+
+    const char* filename = strrchr(path, '/');
+    filename = filename == NULL ? path : filename + 1;
+    const char* sessionEnd = strrchr(filename, '-');
+    if(sessionEnd == NULL || sessionEnd - filename >= (int)sizeof(g_sessionID))
+    {
+        return;
+    }
+    char sessionID[sizeof(g_sessionID)] = {0};
+    memcpy(sessionID, filename, (size_t)(sessionEnd - filename));
+    if(strcmp(sessionID, g_sessionID) == 0 || sessionHasOtherLogs(sessionID, filename))
+    {
+        return;
+    }
+
+    char snapshotPath[CLKSFU_MAX_PATH_LENGTH];
+    getSnapshotPath(sessionID, snapshotPath);
+    if(unlink(snapshotPath) < 0 && errno != ENOENT)
+    {
+        CLKSLOG_ERROR("Could not delete %s: %s", snapshotPath, strerror(errno));
+    }
+}
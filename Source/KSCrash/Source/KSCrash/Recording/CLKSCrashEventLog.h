@@ -0,0 +1,126 @@
+//
+//  CLKSCrashEventLog.h
+//
+//  Copyright (c) 2012 Karl Stenerud. All rights reserved.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall remain in place
+// in this source code.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+
+
+/* Batched on-disk log of non-fatal events.
+ *
+ * An event records only its severity, name and message, the return addresses
+ * leading up to it, the current attributes, the breadcrumbs left since the
+ * previous event in the same log file, and the ID of the session it
+ * happened in. The session's binary images, system info and user info are
+ * written to a snapshot file once, the first time an event is logged.
+ * Event timestamps are in milliseconds since the epoch.
+ *
+ * Events are appended as lines of compact JSON to the current log file through
+ * a write buffer. The buffer is flushed when it fills up, when an event is
+ * added after it has held events for a few seconds, or when asked.
+ *
+ * Files in the event log directory:
+ *     <session ID>.session   The session snapshot.
+ *     <session ID>-<n>.events The event logs, in the order they were written.
+ */
+
+#ifndef HDR_CLKSCrashEventLog_h
+#define HDR_CLKSCrashEventLog_h
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+/** Maximum number of return addresses recorded per event. Deeper traces are truncated. */
+#define CLKSEL_MAX_BACKTRACE_LENGTH 64
+
+/** Writes a session snapshot to a file.
+ *
+ * @param path The file to write to.
+ */
+typedef void (*CLKSEventLogSnapshotWriter)(const char* path);
+
+/** Initialize the event log.
+ *
+ * @param eventLogPath The directory to store event logs and session snapshots in.
+ *
+ * @param sessionID The current session's ID.
+ *
+ * @param snapshotWriter Called to write the session snapshot before the first event is logged.
+ */
+void clksel_initialize(const char* eventLogPath, const char* sessionID, CLKSEventLogSnapshotWriter snapshotWriter);
+
+/** Get the current session's ID.
+ *
+ * @return The session ID, or an empty string if not initialized.
+ */
+const char* clksel_getSessionID(void);
+
+/** Append an event to the current log file.
+ *
+ * @param severity The event's severity.
+ *
+ * @param name The event's name, such as an exception name (NULL = none).
+ *
+ * @param message The event's message (NULL = none).
+ *
+ * @param backtrace Return addresses leading up to the event.
+ *
+ * @param backtraceLength The number of return addresses.
+ *
+ * @return false if the event couldn't be logged.
+ */
+bool clksel_addEvent(const char* severity,
+                     const char* name,
+                     const char* message,
+                     const uintptr_t* backtrace,
+                     int backtraceLength);
+
+/** Write any buffered events to the current log file. */
+void clksel_flush(void);
+
+/** Write any buffered events to the current log file without locking.
+ *
+ * This function is async-safe, and must only be called while other threads are stopped.
+ * An event caught mid-append will be written partially and skipped when read.
+ */
+void clksel_flushAfterCrash(void);
+
+/** Close the current log file so that it can be read. The next event starts a new file. */
+void clksel_closeLog(void);
+
+/** Delete a log file, and its session snapshot if no other logs refer to it.
+ *  The current session's snapshot is never deleted.
+ *
+ * @param path The log file to delete.
+ */
+void clksel_deleteLog(const char* path);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // HDR_CLKSCrashEventLog_h
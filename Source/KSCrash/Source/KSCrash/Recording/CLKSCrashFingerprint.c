@@ -0,0 +1,125 @@
+//
+//  CLKSCrashFingerprint.c
+//
+//  Copyright (c) 2012 Karl Stenerud. All rights reserved.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall remain in place
+// in this source code.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+
+
+
+#include "CLKSCrashFingerprint.h"
+#include "CLKSCrashMonitorContext.h"
+#include "CLKSDynamicLinker.h"
+#include "CLKSStackCursor.h"
+
+#include <string.h>
+
+
+#define FNV_OFFSET_BASIS 0xcbf29ce484222325ull
+#define FNV_PRIME 0x100000001b3ull
+
+/** How deep to look for in-app frames before giving up on finding enough. */
+#define MAX_SEARCH_DEPTH 50
+
+static uint64_t hashBytes(uint64_t hash, const void* bytes, size_t length)
+{
+    const uint8_t* pos = bytes;
+    for(size_t i = 0; i < length; i++)
+    {
+        hash = (hash ^ pos[i]) * FNV_PRIME;
+    }
+    return hash;
+}
+
+static uint64_t hashString(uint64_t hash, const char* string)
+{
+    if(string == NULL)
+    {
+        string = "";
+    }
+    // Include the terminator so that adjacent strings can't run together.
+    return hashBytes(hash, string, strlen(string) + 1);
+}
+
+static inline bool isInAppImage(const char* imageName)
+{
+    return strstr(imageName, ".app/") != NULL;
+}
+
+/** Hash the top frames of a stack.
+ *
+ * @return The number of frames hashed.
+ */
+static int hashFrames(uint64_t* hash, CLKSStackCursor* cursor, bool inAppOnly)
+{
+    int frameCount = 0;
+    cursor->resetCursor(cursor);
+    while(frameCount < CLKSCFP_MAX_FRAMES &&
+          cursor->state.currentDepth < MAX_SEARCH_DEPTH &&
+          cursor->advanceCursor(cursor))
+    {
+        if(!cursor->symbolicate(cursor) || cursor->stackEntry.imageName == NULL)
+        {
+            continue;
+        }
+        const char* imageName = cursor->stackEntry.imageName;
+        if(inAppOnly && !isInAppImage(imageName))
+        {
+            continue;
+        }
+        // The UUID and offset stay the same across launches, unlike the address.
+        const uint8_t* uuid = clksdl_imageUUID(imageName, true);
+        if(uuid != NULL)
+        {
+            *hash = hashBytes(*hash, uuid, 16);
+        }
+        else
+        {
+            *hash = hashString(*hash, imageName);
+        }
+        uint64_t offset = (uint64_t)(cursor->stackEntry.address - cursor->stackEntry.imageAddress);
+        *hash = hashBytes(*hash, &offset, sizeof(offset));
+        frameCount++;
+    }
+    return frameCount;
+}
+
+uint64_t clkscfp_fingerprintCrash(const CLKSCrash_MonitorContext* monitorContext)
+{
+    uint64_t hash = FNV_OFFSET_BASIS;
+    int crashType = (int)monitorContext->crashType;
+    hash = hashBytes(hash, &crashType, sizeof(crashType));
+    hash = hashBytes(hash, &monitorContext->signal.signum, sizeof(monitorContext->signal.signum));
+    hash = hashBytes(hash, &monitorContext->mach.type, sizeof(monitorContext->mach.type));
+    hash = hashString(hash, monitorContext->NSException.name);
+    hash = hashString(hash, monitorContext->CPPException.name);
+    hash = hashString(hash, monitorContext->userException.name);
+
+    if(monitorContext->stackCursor != NULL)
+    {
+        // Work on a copy so that the report writer's cursor is left alone.
+        CLKSStackCursor cursor = *(CLKSStackCursor*)monitorContext->stackCursor;
+        if(hashFrames(&hash, &cursor, true) == 0)
+        {
+            hashFrames(&hash, &cursor, false);
+        }
+    }
+    return hash != 0 ? hash : 1;
+}
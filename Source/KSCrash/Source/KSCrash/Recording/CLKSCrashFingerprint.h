@@ -0,0 +1,64 @@
+//
+//  CLKSCrashFingerprint.h
+//
+//  Copyright (c) 2012 Karl Stenerud. All rights reserved.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall remain in place
+// in this source code.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+
+
+
+/* Fingerprints identifying crashes with the same cause, so that the duplicates
+ * a crash loop produces can be folded together before they're sent.
+ */
+
+
+#ifndef HDR_CLKSCrashFingerprint_h
+#define HDR_CLKSCrashFingerprint_h
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+#include <stdint.h>
+
+struct CLKSCrash_MonitorContext;
+
+/** Number of frames of the crashed thread that go into a fingerprint. */
+#define CLKSCFP_MAX_FRAMES 5
+
+/** Compute a crash's fingerprint from its type, its signal or exception name,
+ * and the image UUID and offset of the top in-app frames of the crashed thread.
+ * If no frames are in the app, the top frames of any image are used instead.
+ *
+ * This function is async-safe.
+ *
+ * @param monitorContext The crash's context.
+ *
+ * @return The fingerprint. Never 0.
+ */
+uint64_t clkscfp_fingerprintCrash(const struct CLKSCrash_MonitorContext* monitorContext);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // HDR_CLKSCrashFingerprint_h
@@ -52,11 +52,17 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
+#if defined(__aarch64__) && defined(__LP64__)
+    #include <arm_neon.h>
+#endif
+
 
 // ============================================================================
 #pragma mark - Constants -
@@ -77,6 +83,22 @@
 /** The minimum length for a valid string. */
 #define kMinStringLength 4
 
+/** Values outside of this range can't point to notable data (except tagged pointers).
+ * Anything lower is a small integer or in the zero page.
+ */
+#define kMinPointerAddress ((uintptr_t)0x1000)
+#if defined(__LP64__)
+    #define kMaxPointerAddress ((uintptr_t)1 << 48)
+#else
+    #define kMaxPointerAddress UINTPTR_MAX
+#endif
+
+/** The most recent console log text (in bytes) to add from a log ring by default. */
+#define kDefaultConsoleLogRingTailSize (16 * 1024)
+
+/** The largest console log tail that can be added. */
+#define kMaxConsoleLogTailSize (64 * 1024)
+
 
 // ============================================================================
 #pragma mark - JSON Encoding -
@@ -111,9 +133,26 @@ typedef struct
     int restrictedClassesCount;
 } CLKSCrash_IntrospectionRules;
 
-static const char* g_userInfoJSON;
+/** userInfo, encoded ahead of time as the members of a JSON object. */
+typedef struct EncodedUserInfo
+{
+    /** The next replaced userInfo that is waiting to be freed. */
+    struct EncodedUserInfo* nextRetired;
+    int length;
+    char members[];
+} EncodedUserInfo;
+
+static _Atomic(EncodedUserInfo*) g_userInfo;
+/** Number of report writes currently using g_userInfo. */
+static _Atomic(int) g_userInfoReaderCount;
 static CLKSCrash_IntrospectionRules g_introspectionRules;
+static bool g_base64DataElements;
 static CLKSReportWriteCallback g_userSectionWriteCallback;
+static int g_consoleLogTailMaxBytes;
+static int g_consoleLogTailMaxLines;
+
+/** Only the standard report includes the console log, so one buffer is enough. */
+static char g_consoleLogTailBuffer[kMaxConsoleLogTailSize];
 
 
 #pragma mark Callbacks
@@ -325,6 +364,119 @@ static void addTextLinesFromFile(const CLKSCrashReportWriter* const writer, cons
     clksfu_closeBufferedReader(&reader);
 }
 
+/** Add lines of text as an array of strings, keeping only the last few if needed.
+ *
+ * @return The number of lines added.
+ */
+static int addTextLines(const CLKSCrashReportWriter* const writer,
+                        const char* const key,
+                        const char* text,
+                        const char* const end,
+                        const int maxLines)
+{
+    if(maxLines > 0)
+    {
+        int lineCount = 0;
+        const char* pos = end;
+        if(pos > text && pos[-1] == '\n')
+        {
+            pos--;
+        }
+        for(; pos > text; pos--)
+        {
+            if(pos[-1] == '\n' && ++lineCount == maxLines)
+            {
+                text = pos;
+                break;
+            }
+        }
+    }
+
+    int lineCount = 0;
+    beginArray(writer, key);
+    {
+        while(text < end)
+        {
+            const char* lineEnd = memchr(text, '\n', (size_t)(end - text));
+            if(lineEnd == NULL)
+            {
+                lineEnd = end;
+            }
+            clksjson_addStringElement(getJsonContext(writer), NULL, text, (int)(lineEnd - text));
+            lineCount++;
+            text = lineEnd + 1;
+        }
+    }
+    endContainer(writer);
+    return lineCount;
+}
+
+/** Add how many lines of the log were left out, if the log knows its line count. */
+static void addDroppedLineCount(const CLKSCrashReportWriter* const writer,
+                                const char* const droppedLinesKey,
+                                const int lineCount)
+{
+    int64_t totalLineCount = clkslog_getLogFileLineCount();
+    if(totalLineCount >= 0)
+    {
+        int64_t droppedLineCount = totalLineCount - lineCount;
+        writer->addIntegerElement(writer, droppedLinesKey, droppedLineCount > 0 ? droppedLineCount : 0);
+    }
+}
+
+static void addTextLinesFromLogRing(const CLKSCrashReportWriter* const writer,
+                                    const char* const key,
+                                    const char* const droppedLinesKey)
+{
+    int maxBytes = g_consoleLogTailMaxBytes > 0 ? g_consoleLogTailMaxBytes : kDefaultConsoleLogRingTailSize;
+    if(maxBytes > (int)sizeof(g_consoleLogTailBuffer))
+    {
+        maxBytes = sizeof(g_consoleLogTailBuffer);
+    }
+    int length = clkslog_copyLogRingTail(g_consoleLogTailBuffer, maxBytes);
+    int lineCount = addTextLines(writer, key, g_consoleLogTailBuffer, g_consoleLogTailBuffer + length, g_consoleLogTailMaxLines);
+    addDroppedLineCount(writer, droppedLinesKey, lineCount);
+}
+
+/** Add the end of a text file, reading no more than the configured tail budget. */
+static void addTextLinesFromFileTail(const CLKSCrashReportWriter* const writer,
+                                     const char* const key,
+                                     const char* const droppedLinesKey,
+                                     const char* const filePath)
+{
+    int fd = open(filePath, O_RDONLY);
+    if(fd < 0)
+    {
+        CLKSLOG_ERROR("Could not open %s: %s", filePath, strerror(errno));
+        return;
+    }
+    int maxBytes = g_consoleLogTailMaxBytes > 0 ? g_consoleLogTailMaxBytes : (int)sizeof(g_consoleLogTailBuffer);
+    if(maxBytes > (int)sizeof(g_consoleLogTailBuffer))
+    {
+        maxBytes = sizeof(g_consoleLogTailBuffer);
+    }
+    const off_t fileSize = lseek(fd, 0, SEEK_END);
+    const off_t offset = fileSize > maxBytes ? fileSize - maxBytes : 0;
+    ssize_t length = fileSize < 0 ? -1 : pread(fd, g_consoleLogTailBuffer, (size_t)(fileSize - offset), offset);
+    close(fd);
+    if(length < 0)
+    {
+        CLKSLOG_ERROR("Could not read %s: %s", filePath, strerror(errno));
+        return;
+    }
+
+    const char* text = g_consoleLogTailBuffer;
+    const char* const end = text + length;
+    if(offset > 0)
+    {
+        // Started mid-line.
+        const char* lineEnd = memchr(text, '\n', (size_t)length);
+        text = lineEnd == NULL ? end : lineEnd + 1;
+    }
+    int lineCount = addTextLines(writer, key, text, end, g_consoleLogTailMaxLines);
+    addDroppedLineCount(writer, droppedLinesKey, lineCount);
+}
+
 static int addJSONData(const char* restrict const data, const int length, void* restrict userData)
 {
     CLKSBufferedWriter* writer = (CLKSBufferedWriter*)userData;
@@ -974,6 +1126,54 @@ static void writeStackContents(const CLKSCrashReportWriter* const writer,
     writer->endContainer(writer);
 }
 
+/** Narrow down which words could possibly be notable pointers, without reading memory.
+ * Words that are out of range or point into known unreadable pages are rejected.
+ *
+ * @param words The words to check.
+ *
+ * @param isCandidate Set to nonzero for each word that is worth introspecting.
+ *
+ * @param count The number of words.
+ */
+static void selectPointerCandidates(const uintptr_t* const words, uint8_t* const isCandidate, const int count)
+{
+    int i = 0;
+#if defined(__aarch64__) && defined(__LP64__)
+    const uint64x2_t minAddress = vdupq_n_u64(kMinPointerAddress);
+    const uint64x2_t maxAddress = vdupq_n_u64(kMaxPointerAddress);
+    for(; i + 2 <= count; i += 2)
+    {
+        uint64x2_t values = vld1q_u64((const uint64_t*)words + i);
+        uint64x2_t inRange = vandq_u64(vcgeq_u64(values, minAddress), vcltq_u64(values, maxAddress));
+        isCandidate[i] = (uint8_t)(vgetq_lane_u64(inRange, 0) & 1);
+        isCandidate[i + 1] = (uint8_t)(vgetq_lane_u64(inRange, 1) & 1);
+    }
+#endif
+    // Branch-free so that the compiler can vectorize it elsewhere.
+    for(; i < count; i++)
+    {
+        isCandidate[i] = (uint8_t)((words[i] >= kMinPointerAddress) & (words[i] < kMaxPointerAddress));
+    }
+
+    for(i = 0; i < count; i++)
+    {
+        if(isCandidate[i])
+        {
+            if(clksmem_isKnownUnreadable((const void*)words[i], 1))
+            {
+                isCandidate[i] = 0;
+            }
+        }
+#if CLKSCRASH_HAS_OBJC
+        else if(words[i] != 0 && clksobjc_isTaggedPointer((const void*)words[i]))
+        {
+            // Tagged pointers don't point anywhere, so they can be out of range.
+            isCandidate[i] = 1;
+        }
+#endif
+    }
+}
+
 /** Write any notable addresses near the stack pointer (above and below).
  *
  * @param writer The writer.
@@ -1003,14 +1203,43 @@ static void writeNotableStackContents(const CLKSCrashReportWriter* const writer,
         lowAddress = highAddress;
         highAddress = tmp;
     }
-    uintptr_t contentsAsPointer;
-    char nameBuffer[40];
-    for(uintptr_t address = lowAddress; address < highAddress; address += sizeof(address))
+    const int wordCount = (int)((highAddress - lowAddress) / sizeof(uintptr_t));
+    if(wordCount <= 0)
+    {
+        return;
+    }
+    uintptr_t words[wordCount];
+    uint8_t isCandidate[wordCount];
+    if(!clksmem_copySafely((void*)lowAddress, words, (int)sizeof(words)))
     {
-        if(clksmem_copySafely((void*)address, &contentsAsPointer, sizeof(contentsAsPointer)))
+        // The window runs off the stack, so find out which words are readable.
+        CLKSMemoryCopyRequest requests[wordCount];
+        for(int i = 0; i < wordCount; i++)
         {
-            sprintf(nameBuffer, "stack@%p", (void*)address);
-            writeMemoryContentsIfNotable(writer, nameBuffer, contentsAsPointer);
+            requests[i].src = (void*)(lowAddress + (uintptr_t)i * sizeof(uintptr_t));
+            requests[i].dst = &words[i];
+            requests[i].byteCount = sizeof(uintptr_t);
+        }
+        clksmem_copySafelyMany(requests, wordCount);
+        for(int i = 0; i < wordCount; i++)
+        {
+            if(!requests[i].succeeded)
+            {
+                // Zero is never a candidate.
+                words[i] = 0;
+            }
+        }
+    }
+    selectPointerCandidates(words, isCandidate, wordCount);
+
+    char nameBuffer[sizeof("stack@") - 1 + CLKSSTRING_MAX_HEX_ADDRESS_LENGTH];
+    memcpy(nameBuffer, "stack@", sizeof("stack@") - 1);
+    for(int i = 0; i < wordCount; i++)
+    {
+        if(isCandidate[i])
+        {
+            clksstring_writeHexAddress(lowAddress + (uintptr_t)i * sizeof(uintptr_t), nameBuffer + sizeof("stack@") - 1);
+            writeMemoryContentsIfNotable(writer, nameBuffer, words[i]);
         }
     }
 }
@@ -1601,6 +1830,8 @@ void clkscrashreport_writeRecrashReport(const CLKSCrash_MonitorContext *const mo
     }
 
     clksccd_freeze();
+    // Page readability can only be cached while nothing else can unmap memory.
+    bool wasPageCacheEnabled = clksmem_setPageCacheEnabled(clksmc_isEnvironmentSuspended());
 
     CLKSJSONEncodeContext jsonContext;
     jsonContext.userData = &bufferedWriter;
@@ -1609,6 +1840,10 @@ void clkscrashreport_writeRecrashReport(const CLKSCrash_MonitorContext *const mo
     prepareReportWriter(writer, &jsonContext);
 
     clksjson_beginEncode(getJsonContext(writer), true, addJSONData, &bufferedWriter);
+    if(g_base64DataElements)
+    {
+        clksjson_setDataEncoding(getJsonContext(writer), CLKSJSONDataEncodingBase64);
+    }
 
     writer->beginObject(writer, CLKSCrashField_Report);
     {
@@ -1645,6 +1880,8 @@ void clkscrashreport_writeRecrashReport(const CLKSCrash_MonitorContext *const mo
 
     clksjson_endEncode(getJsonContext(writer));
     clksfu_closeBufferedWriter(&bufferedWriter);
+    CLKSLOG_DEBUG("Page cache saved %llu memory reads", (unsigned long long)clksmem_getSyscallsSaved());
+    clksmem_setPageCacheEnabled(wasPageCacheEnabled);
     clksccd_unfreeze();
 }
 
@@ -1698,7 +1935,21 @@ static void writeDebugInfo(const CLKSCrashReportWriter* const writer,
     {
         if(monitorContext->consoleLogPath != NULL)
         {
-            addTextLinesFromFile(writer, CLKSCrashField_ConsoleLog, monitorContext->consoleLogPath);
+            if(clkslog_isLogRingActive())
+            {
+                addTextLinesFromLogRing(writer, CLKSCrashField_ConsoleLog, CLKSCrashField_ConsoleLogDroppedLines);
+            }
+            else if(g_consoleLogTailMaxBytes > 0 || g_consoleLogTailMaxLines > 0)
+            {
+                addTextLinesFromFileTail(writer,
+                                         CLKSCrashField_ConsoleLog,
+                                         CLKSCrashField_ConsoleLogDroppedLines,
+                                         monitorContext->consoleLogPath);
+            }
+            else
+            {
+                addTextLinesFromFile(writer, CLKSCrashField_ConsoleLog, monitorContext->consoleLogPath);
+            }
         }
     }
     writer->endContainer(writer);
@@ -1717,6 +1968,8 @@ void clkscrashreport_writeStandardReport(const CLKSCrash_MonitorContext *const m
     }
 
     clksccd_freeze();
+    // Page readability can only be cached while nothing else can unmap memory.
+    bool wasPageCacheEnabled = clksmem_setPageCacheEnabled(clksmc_isEnvironmentSuspended());
     
     CLKSJSONEncodeContext jsonContext;
     jsonContext.userData = &bufferedWriter;
@@ -1725,6 +1978,10 @@ void clkscrashreport_writeStandardReport(const CLKSCrash_MonitorContext *const m
     prepareReportWriter(writer, &jsonContext);
 
     clksjson_beginEncode(getJsonContext(writer), true, addJSONData, &bufferedWriter);
+    if(g_base64DataElements)
+    {
+        clksjson_setDataEncoding(getJsonContext(writer), CLKSJSONDataEncodingBase64);
+    }
 
     writer->beginObject(writer, CLKSCrashField_Report);
     {
@@ -1756,15 +2013,15 @@ void clkscrashreport_writeStandardReport(const CLKSCrash_MonitorContext *const m
         }
         writer->endContainer(writer);
 
-        if(g_userInfoJSON != NULL)
+        writer->beginObject(writer, CLKSCrashField_User);
+        atomic_fetch_add(&g_userInfoReaderCount, 1);
+        const EncodedUserInfo* userInfo = atomic_load(&g_userInfo);
+        if(userInfo != NULL)
         {
-            addJSONElement(writer, CLKSCrashField_User, g_userInfoJSON, false);
+            clksjson_addRawJSONElements(getJsonContext(writer), userInfo->members, userInfo->length);
             clksfu_flushBufferedWriter(&bufferedWriter);
         }
-        else
-        {
-            writer->beginObject(writer, CLKSCrashField_User);
-        }
+        atomic_fetch_sub(&g_userInfoReaderCount, 1);
         if(g_userSectionWriteCallback != NULL)
         {
             clksfu_flushBufferedWriter(&bufferedWriter);
@@ -1781,28 +2038,162 @@ void clkscrashreport_writeStandardReport(const CLKSCrash_MonitorContext *const m
     
     clksjson_endEncode(getJsonContext(writer));
     clksfu_closeBufferedWriter(&bufferedWriter);
+    CLKSLOG_DEBUG("Page cache saved %llu memory reads", (unsigned long long)clksmem_getSyscallsSaved());
+    clksmem_setPageCacheEnabled(wasPageCacheEnabled);
     clksccd_unfreeze();
 }
 
+void clkscrashreport_writeSessionSnapshot(const CLKSCrash_MonitorContext *const monitorContext, const char *const path)
+{
+    CLKSLOG_DEBUG("Writing session snapshot to %s", path);
+    char writeBuffer[1024];
+    CLKSBufferedWriter bufferedWriter;
+
+    if(!clksfu_openBufferedWriter(&bufferedWriter, path, writeBuffer, sizeof(writeBuffer)))
+    {
+        return;
+    }
+
+    CLKSJSONEncodeContext jsonContext;
+    jsonContext.userData = &bufferedWriter;
+    CLKSCrashReportWriter concreteWriter;
+    CLKSCrashReportWriter* writer = &concreteWriter;
+    prepareReportWriter(writer, &jsonContext);
+
+    clksjson_beginEncode(getJsonContext(writer), false, addJSONData, &bufferedWriter);
 
+    writer->beginObject(writer, CLKSCrashField_Report);
+    {
+        writeReportInfo(writer,
+                        CLKSCrashField_Report,
+                        CLKSCrashReportType_Session,
+                        monitorContext->eventID,
+                        monitorContext->System.processName);
+        writeBinaryImages(writer, CLKSCrashField_BinaryImages);
+        writeSystemInfo(writer, CLKSCrashField_System, monitorContext);
+
+        writer->beginObject(writer, CLKSCrashField_User);
+        atomic_fetch_add(&g_userInfoReaderCount, 1);
+        const EncodedUserInfo* userInfo = atomic_load(&g_userInfo);
+        if(userInfo != NULL)
+        {
+            clksjson_addRawJSONElements(getJsonContext(writer), userInfo->members, userInfo->length);
+        }
+        atomic_fetch_sub(&g_userInfoReaderCount, 1);
+        writer->endContainer(writer);
+    }
+    writer->endContainer(writer);
+
+    clksjson_endEncode(getJsonContext(writer));
+    clksfu_closeBufferedWriter(&bufferedWriter);
+}
+
+
+
+typedef struct
+{
+    char* data;
+    int length;
+    int capacity;
+} GrowableBuffer;
+
+static int addJSONDataToBuffer(const char* const data, const int length, void* const userData)
+{
+    GrowableBuffer* buffer = userData;
+    if(buffer->length + length > buffer->capacity)
+    {
+        int capacity = buffer->capacity * 2;
+        while(capacity < buffer->length + length)
+        {
+            capacity *= 2;
+        }
+        char* newData = realloc(buffer->data, (size_t)capacity);
+        if(newData == NULL)
+        {
+            return CLKSJSON_ERROR_CANNOT_ADD_DATA;
+        }
+        buffer->data = newData;
+        buffer->capacity = capacity;
+    }
+    memcpy(buffer->data + buffer->length, data, (size_t)length);
+    buffer->length += length;
+    return CLKSJSON_OK;
+}
+
+/** Validate and re-encode userInfo JSON as a compact JSON object.
+ * Invalid JSON gets recorded as an error object instead, like addJSONElement() does.
+ *
+ * @return The encoded object, or NULL if out of memory. Must be freed.
+ */
+static EncodedUserInfo* encodeUserInfo(const char* const userInfoJSON)
+{
+    const int headerLength = (int)offsetof(EncodedUserInfo, members);
+    GrowableBuffer buffer = {.data = malloc(1024), .length = headerLength, .capacity = 1024};
+    if(buffer.data == NULL)
+    {
+        return NULL;
+    }
+    CLKSJSONEncodeContext context;
+    clksjson_beginEncode(&context, false, addJSONDataToBuffer, &buffer);
+    int result = clksjson_addJSONElement(&context, NULL, userInfoJSON, (int)strlen(userInfoJSON), true);
+    if(result == CLKSJSON_OK &&
+       (buffer.length - headerLength < 2 || buffer.data[headerLength] != '{' || buffer.data[buffer.length - 1] != '}'))
+    {
+        result = CLKSJSON_ERROR_INVALID_DATA;
+    }
+    if(result != CLKSJSON_OK)
+    {
+        CLKSLOG_ERROR("Invalid userInfo JSON: %s", clksjson_stringForError(result));
+        char errorBuff[100];
+        snprintf(errorBuff, sizeof(errorBuff), "Invalid JSON data: %s", clksjson_stringForError(result));
+        buffer.length = headerLength;
+        clksjson_beginEncode(&context, false, addJSONDataToBuffer, &buffer);
+        clksjson_beginObject(&context, NULL);
+        clksjson_addStringElement(&context, CLKSCrashField_Error, errorBuff, CLKSJSON_SIZE_AUTOMATIC);
+        clksjson_addStringElement(&context, CLKSCrashField_JSONData, userInfoJSON, CLKSJSON_SIZE_AUTOMATIC);
+        result = clksjson_endEncode(&context);
+    }
+    if(result != CLKSJSON_OK)
+    {
+        free(buffer.data);
+        return NULL;
+    }
+
+    // Keep only the members between the braces.
+    EncodedUserInfo* userInfo = (EncodedUserInfo*)buffer.data;
+    userInfo->nextRetired = NULL;
+    userInfo->length = buffer.length - headerLength - 2;
+    memmove(userInfo->members, userInfo->members + 1, (size_t)userInfo->length);
+    return userInfo;
+}
 
 void clkscrashreport_setUserInfoJSON(const char* const userInfoJSON)
 {
     static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+    /** Replaced userInfo that a report write could still be copying. */
+    static EncodedUserInfo* retiredUserInfo;
     CLKSLOG_TRACE("set userInfoJSON to %p", userInfoJSON);
 
+    // Encode outside the lock; only the swap needs it.
+    EncodedUserInfo* userInfo = userInfoJSON == NULL ? NULL : encodeUserInfo(userInfoJSON);
+
     pthread_mutex_lock(&mutex);
-    if(g_userInfoJSON != NULL)
+    EncodedUserInfo* oldUserInfo = atomic_exchange(&g_userInfo, userInfo);
+    if(oldUserInfo != NULL)
     {
-        free((void*)g_userInfoJSON);
+        oldUserInfo->nextRetired = retiredUserInfo;
+        retiredUserInfo = oldUserInfo;
     }
-    if(userInfoJSON == NULL)
+    // Writes that start from now on can only see the new userInfo, so once
+    // none are in progress, nothing can be holding a retired one.
+    if(atomic_load(&g_userInfoReaderCount) == 0)
     {
-        g_userInfoJSON = NULL;
-    }
-    else
-    {
-        g_userInfoJSON = strdup(userInfoJSON);
+        while(retiredUserInfo != NULL)
+        {
+            EncodedUserInfo* next = retiredUserInfo->nextRetired;
+            free(retiredUserInfo);
+            retiredUserInfo = next;
+        }
     }
     pthread_mutex_unlock(&mutex);
 }
@@ -1812,6 +2203,17 @@ void clkscrashreport_setIntrospectMemory(bool shouldIntrospectMemory)
     g_introspectionRules.enabled = shouldIntrospectMemory;
 }
 
+void clkscrashreport_setBase64DataElements(bool shouldUseBase64)
+{
+    g_base64DataElements = shouldUseBase64;
+}
+
+void clkscrashreport_setConsoleLogTail(int maxBytes, int maxLines)
+{
+    g_consoleLogTailMaxBytes = maxBytes;
+    g_consoleLogTailMaxLines = maxLines;
+}
+
 void clkscrashreport_setDoNotIntrospectClasses(const char** doNotIntrospectClasses, int length)
 {
     const char** oldClasses = g_introspectionRules.restrictedClasses;
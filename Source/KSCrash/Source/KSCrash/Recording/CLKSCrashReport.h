@@ -66,6 +66,22 @@ void clkscrashreport_setIntrospectMemory(bool shouldIntrospectMemory);
  */
 void clkscrashreport_setDoNotIntrospectClasses(const char** doNotIntrospectClasses, int length);
 
+/** Configure whether to write binary data such as stack contents as base64
+ *  rather than hex. Base64 is about a third smaller.
+ *
+ * @param shouldUseBase64 If true, write base64.
+ */
+void clkscrashreport_setBase64DataElements(bool shouldUseBase64);
+
+/** Limit the console log in reports to the end of the log.
+ *  The log is read backwards from the end, so the cost depends only on the limits.
+ *
+ * @param maxBytes The most bytes to include (0 = no byte limit, max 64 KB).
+ *
+ * @param maxLines The most lines to include (0 = no line limit).
+ */
+void clkscrashreport_setConsoleLogTail(int maxBytes, int maxLines);
+
 /** Set the function to call when writing the user section of the report.
  *  This allows the user to add more fields to the user section at the time of the crash.
  *  Note: Only async-safe functions are allowed in the callback.
@@ -99,6 +115,17 @@ void clkscrashreport_writeStandardReport(const CLKSCrash_MonitorContext *const m
 void clkscrashreport_writeRecrashReport(const CLKSCrash_MonitorContext *const monitorContext,
         const char *const path);
 
+/** Write a session snapshot to a file: the binary images, system information and
+ *  user info that non-fatal events refer to by session ID instead of repeating.
+ *
+ * @param monitorContext Contextual information about the environment. Its
+ *                       eventID is used as the session ID.
+ *
+ * @param path The file to write to.
+ */
+void clkscrashreport_writeSessionSnapshot(const CLKSCrash_MonitorContext *const monitorContext,
+        const char *const path);
+
 
 #ifdef __cplusplus
 }
@@ -34,6 +34,8 @@
 #define CLKSCrashReportType_Minimal          "minimal"
 #define CLKSCrashReportType_Standard         "standard"
 #define CLKSCrashReportType_Custom           "custom"
+#define CLKSCrashReportType_Hang             "hang"
+#define CLKSCrashReportType_Session          "session"
 
 
 #pragma mark - Memory Types -
@@ -147,6 +149,32 @@
 #define CLKSCrashField_UserReported          "user_reported"
 
 
+#pragma mark - Hang -
+
+#define CLKSCrashField_CallTree              "call_tree"
+#define CLKSCrashField_Children              "children"
+#define CLKSCrashField_DroppedSampleCount    "dropped_sample_count"
+#define CLKSCrashField_Duration              "duration"
+#define CLKSCrashField_Hang                  "hang"
+#define CLKSCrashField_SampleCount           "sample_count"
+#define CLKSCrashField_SampleInterval        "sample_interval"
+
+
+#pragma mark - Event -
+
+#define CLKSCrashField_Attributes            "attributes"
+#define CLKSCrashField_Footprints            "footprints"
+#define CLKSCrashField_Message               "message"
+#define CLKSCrashField_Session               "session"
+#define CLKSCrashField_Severity              "severity"
+
+
+#pragma mark - Duplicates -
+
+#define CLKSCrashField_Count                 "count"
+#define CLKSCrashField_LastTimestamp         "last_timestamp"
+
+
 #pragma mark - Process State -
 
 #define CLKSCrashField_LastDeallocedNSException "last_dealloced_nsexception"
@@ -171,6 +199,8 @@
 #define CLKSCrashField_Crash                 "crash"
 #define CLKSCrashField_Debug                 "debug"
 #define CLKSCrashField_Diagnosis             "diagnosis"
+#define CLKSCrashField_Duplicates            "duplicates"
+#define CLKSCrashField_Fingerprint           "fingerprint"
 #define CLKSCrashField_ID                    "id"
 #define CLKSCrashField_ProcessName           "process_name"
 #define CLKSCrashField_Report                "report"
@@ -188,6 +218,7 @@
 #define CLKSCrashField_Threads               "threads"
 #define CLKSCrashField_User                  "user"
 #define CLKSCrashField_ConsoleLog            "console_log"
+#define CLKSCrashField_ConsoleLogDroppedLines "console_log_dropped_lines"
 
 #pragma mark Incomplete
 #define CLKSCrashField_Incomplete            "incomplete"
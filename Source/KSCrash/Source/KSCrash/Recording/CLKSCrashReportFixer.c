@@ -24,6 +24,7 @@
 // THE SOFTWARE.
 //
 
+#include "CLKSCrashReportFixer.h"
 #include "CLKSCrashReportFields.h"
 #include "CLKSSystemCapabilities.h"
 #include "CLKSJSONCodec.h"
@@ -56,13 +57,21 @@ static char* demanglePaths[][MAX_DEPTH] =
 };
 static int demanglePathsCount = sizeof(demanglePaths) / sizeof(*demanglePaths);
 
+static char* dataPaths[][MAX_DEPTH] =
+{
+    {"", CLKSCrashField_Crash, CLKSCrashField_Threads, "", CLKSCrashField_Stack, CLKSCrashField_Contents},
+    {"", CLKSCrashField_RecrashReport, CLKSCrashField_Crash, CLKSCrashField_Threads, "", CLKSCrashField_Stack, CLKSCrashField_Contents},
+};
+static int dataPathsCount = sizeof(dataPaths) / sizeof(*dataPaths);
+
 typedef struct
 {
     CLKSJSONEncodeContext* encodeContext;
     char objectPath[MAX_DEPTH][MAX_NAME_LENGTH];
     int currentDepth;
-    char* outputPtr;
-    int outputBytesLeft;
+    char* output;
+    int outputLength;
+    int outputCapacity;
 } FixupContext;
 
 static bool increaseDepth(FixupContext* context, const char* name)
@@ -126,6 +135,43 @@ static bool matchesAPath(FixupContext* context, const char* name, char* paths[][
     return false;
 }
 
+static bool pathStartsWith(FixupContext* context, char** path, const char* finalName)
+{
+    if(finalName == NULL)
+    {
+        finalName = "";
+    }
+    if(context->currentDepth >= MAX_DEPTH)
+    {
+        return false;
+    }
+
+    for(int i = 0;i < context->currentDepth; i++)
+    {
+        if(path[i] == NULL || strncmp(context->objectPath[i], path[i], MAX_NAME_LENGTH) != 0)
+        {
+            return false;
+        }
+    }
+    if(path[context->currentDepth] == NULL || strncmp(finalName, path[context->currentDepth], MAX_NAME_LENGTH) != 0)
+    {
+        return false;
+    }
+    return true;
+}
+
+static bool startsAPath(FixupContext* context, const char* name, char* paths[][MAX_DEPTH], int pathsCount)
+{
+    for(int i = 0; i < pathsCount; i++)
+    {
+        if(pathStartsWith(context, paths[i], name))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
 static bool shouldDemangle(FixupContext* context, const char* name)
 {
     return matchesAPath(context, name, demanglePaths, demanglePathsCount);
@@ -136,6 +182,38 @@ static bool shouldFixDate(FixupContext* context, const char* name)
     return matchesAPath(context, name, datePaths, datePathsCount);
 }
 
+static bool shouldNormalizeData(FixupContext* context, const char* name, const char* value, int length)
+{
+    const int prefixLength = (int)sizeof(CLKSJSON_BASE64_DATA_PREFIX) - 1;
+    return length >= prefixLength &&
+           memcmp(value, CLKSJSON_BASE64_DATA_PREFIX, (size_t)prefixLength) == 0 &&
+           matchesAPath(context, name, dataPaths, dataPathsCount);
+}
+
+/** Re-encode a base64 data element as hex, which is what report consumers expect.
+ */
+static int addNormalizedDataElement(FixupContext* context, const char* name, const char* value, int length)
+{
+    uint8_t* data = malloc((size_t)length);
+    if(data == NULL)
+    {
+        return CLKSJSON_ERROR_CANNOT_ADD_DATA;
+    }
+    int result;
+    int dataLength = clksjson_decodeDataElement(value, length, data, length);
+    if(dataLength < 0)
+    {
+        CLKSLOG_ERROR("Invalid data element %s", name);
+        result = clksjson_addStringElement(context->encodeContext, name, value, length);
+    }
+    else
+    {
+        result = clksjson_addDataElement(context->encodeContext, name, (const char*)data, dataLength);
+    }
+    free(data);
+    return result;
+}
+
 static int onBooleanElement(const char* const name,
                             const bool value,
                             void* const userData)
@@ -184,6 +262,10 @@ static int onStringElement(const char* const name,
                            void* const userData)
 {
     FixupContext* context = (FixupContext*)userData;
+    if(shouldNormalizeData(context, name, value, (int)strlen(value)))
+    {
+        return addNormalizedDataElement(context, name, value, (int)strlen(value));
+    }
     const char* stringValue = value;
     char* demangled = NULL;
     if(shouldDemangle(context, name))
@@ -208,6 +290,61 @@ static int onStringElement(const char* const name,
     return result;
 }
 
+static int onStringSliceElement(const char* const name,
+                                const char* const value,
+                                const int length,
+                                const bool needsEscaping,
+                                void* const userData)
+{
+    FixupContext* context = (FixupContext*)userData;
+    if(shouldDemangle(context, name))
+    {
+        // The demanglers need a NUL terminated string.
+        char* terminated = strndup(value, (size_t)length);
+        if(terminated == NULL)
+        {
+            return CLKSJSON_ERROR_CANNOT_ADD_DATA;
+        }
+        int result = onStringElement(name, terminated, userData);
+        free(terminated);
+        return result;
+    }
+    if(shouldNormalizeData(context, name, value, length))
+    {
+        return addNormalizedDataElement(context, name, value, length);
+    }
+    if(needsEscaping)
+    {
+        return clksjson_addStringElement(context->encodeContext, name, value, length);
+    }
+    return clksjson_addPreEscapedStringElement(context->encodeContext, name, value, length);
+}
+
+static bool shouldPassThrough(const char* const name,
+                              void* const userData)
+{
+    FixupContext* context = (FixupContext*)userData;
+    // Nothing at or below this element will change, so copy it verbatim.
+    return !startsAPath(context, name, datePaths, datePathsCount) &&
+           !startsAPath(context, name, demanglePaths, demanglePathsCount) &&
+           !startsAPath(context, name, dataPaths, dataPathsCount);
+}
+
+static int onBeginRawElement(const char* const name,
+                             void* const userData)
+{
+    FixupContext* context = (FixupContext*)userData;
+    return clksjson_beginElement(context->encodeContext, name);
+}
+
+static int onRawData(const char* const data,
+                     const int length,
+                     void* const userData)
+{
+    FixupContext* context = (FixupContext*)userData;
+    return clksjson_addRawJSONData(context->encodeContext, data, length);
+}
+
 static int onBeginObject(const char* const name,
                          void* const userData)
 {
@@ -252,24 +389,57 @@ static int onEndData(__unused void* const userData)
 static int addJSONData(const char* data, int length, void* userData)
 {
     FixupContext* context = (FixupContext*)userData;
-    if(length > context->outputBytesLeft)
+    // Keep room for the NUL terminator.
+    if(length >= context->outputCapacity - context->outputLength)
     {
-        return CLKSJSON_ERROR_DATA_TOO_LONG;
+        // Base64 stack dumps grow by half again when converted to hex, on
+        // top of the pretty printing, so the first guess can fall short.
+        int64_t capacity = (int64_t)context->outputCapacity * 2 + length;
+        char* output = capacity > INT32_MAX ? NULL : realloc(context->output, (size_t)capacity);
+        if(output == NULL)
+        {
+            return CLKSJSON_ERROR_DATA_TOO_LONG;
+        }
+        context->output = output;
+        context->outputCapacity = (int)capacity;
     }
-    memcpy(context->outputPtr, data, length);
-    context->outputPtr += length;
-    context->outputBytesLeft -= length;
-    
+    memcpy(context->output + context->outputLength, data, (size_t)length);
+    context->outputLength += length;
     return CLKSJSON_OK;
 }
 
+typedef struct
+{
+    const char* data;
+    int bytesLeft;
+} StringReader;
+
+static int readString(char* buffer, int bufferLength, void* userData)
+{
+    StringReader* reader = (StringReader*)userData;
+    int length = reader->bytesLeft < bufferLength ? reader->bytesLeft : bufferLength;
+    memcpy(buffer, reader->data, (size_t)length);
+    reader->data += length;
+    reader->bytesLeft -= length;
+    return length;
+}
+
 char* clkscrf_fixupCrashReport(const char *crashReport)
 {
     if(crashReport == NULL)
     {
         return NULL;
     }
+    StringReader reader =
+    {
+        .data = crashReport,
+        .bytesLeft = (int)strlen(crashReport),
+    };
+    return clkscrf_fixupCrashReportStream(reader.bytesLeft, readString, &reader);
+}
 
+char* clkscrf_fixupCrashReportStream(int reportLength, CLKSCrashReportReadFunction readFunction, void* userData)
+{
     CLKSJSONDecodeCallbacks callbacks =
     {
         .onBeginArray = onBeginArray,
@@ -281,32 +451,63 @@ char* clkscrf_fixupCrashReport(const char *crashReport)
         .onIntegerElement = onIntegerElement,
         .onNullElement = onNullElement,
         .onStringElement = onStringElement,
+        .onStringSliceElement = onStringSliceElement,
+        .shouldPassThrough = shouldPassThrough,
+        .onBeginRawElement = onBeginRawElement,
+        .onRawData = onRawData,
     };
-    int stringBufferLength = 10000;
-    char* stringBuffer = malloc((unsigned)stringBufferLength);
-    int crashReportLength = (int)strlen(crashReport);
-    int fixedReportLength = (int)(crashReportLength * 1.5);
-    char* fixedReport = malloc((unsigned)fixedReportLength);
+    // Decoded tokens are never longer than the report they came from.
+    int scratchLength = reportLength + 1;
+    char* scratch = malloc((unsigned)scratchLength);
+    // Pretty printing usually adds about half again. The output grows if it needs more.
+    int fixedReportCapacity = reportLength + reportLength / 2 + 1;
     CLKSJSONEncodeContext encodeContext;
     FixupContext fixupContext =
     {
         .encodeContext = &encodeContext,
         .currentDepth = 0,
-        .outputPtr = fixedReport,
-        .outputBytesLeft = fixedReportLength,
+        .output = malloc((unsigned)fixedReportCapacity),
+        .outputCapacity = fixedReportCapacity,
     };
-    
+    if(scratch == NULL || fixupContext.output == NULL)
+    {
+        CLKSLOG_ERROR("Could not allocate %d bytes to fix up report", scratchLength + fixedReportCapacity);
+        free(scratch);
+        free(fixupContext.output);
+        return NULL;
+    }
+
     clksjson_beginEncode(&encodeContext, true, addJSONData, &fixupContext);
     
-    int errorOffset = 0;
-    int result = clksjson_decode(crashReport, (int)strlen(crashReport), stringBuffer, stringBufferLength, &callbacks, &fixupContext, &errorOffset);
-    *fixupContext.outputPtr = '\0';
-    free(stringBuffer);
+    CLKSJSONStreamDecodeContext decodeContext;
+    clksjson_beginDecode(&decodeContext, scratch, scratchLength, &callbacks, &fixupContext);
+    char chunk[16384];
+    int result = CLKSJSON_OK;
+    int chunkLength;
+    while(result == CLKSJSON_OK && (chunkLength = readFunction(chunk, sizeof(chunk), userData)) != 0)
+    {
+        if(chunkLength < 0)
+        {
+            CLKSLOG_ERROR("Could not read report");
+            free(scratch);
+            free(fixupContext.output);
+            return NULL;
+        }
+        result = clksjson_decodeChunk(&decodeContext, chunk, chunkLength);
+    }
+    if(result == CLKSJSON_OK)
+    {
+        result = clksjson_endDecode(&decodeContext);
+    }
+    free(scratch);
     if(result != CLKSJSON_OK)
     {
-        CLKSLOG_ERROR("Could not decode report: %s", clksjson_stringForError(result));
-        free(fixedReport);
+        CLKSLOG_ERROR("Could not decode report at offset %d: %s",
+                      clksjson_decodeOffset(&decodeContext),
+                      clksjson_stringForError(result));
+        free(fixupContext.output);
         return NULL;
     }
-    return fixedReport;
+    fixupContext.output[fixupContext.outputLength] = '\0';
+    return fixupContext.output;
 }
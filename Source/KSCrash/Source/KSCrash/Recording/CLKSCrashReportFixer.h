@@ -43,6 +43,23 @@ extern "C" {
  */
 char* clkscrf_fixupCrashReport(const char *crashReport);
 
+/** Reads the next piece of a raw report into a buffer.
+ *
+ * @return The number of bytes read, 0 at the end of the report, or -1 on error.
+ */
+typedef int (*CLKSCrashReportReadFunction)(char* buffer, int bufferLength, void* userData);
+
+/** Fix up a crash report as it's read in pieces, without loading the raw report first.
+ *
+ * @param reportLength The length of the raw report.
+ * @param readFunction Called to get each piece of the raw report.
+ * @param userData Passed to readFunction.
+ *
+ * @return A fixed up crash report, or NULL if the report couldn't be read or decoded.
+ *         MEMORY MANAGEMENT WARNING: User is responsible for calling free() on the returned value.
+ */
+char* clkscrf_fixupCrashReportStream(int reportLength, CLKSCrashReportReadFunction readFunction, void* userData);
+
 
 #ifdef __cplusplus
 }
@@ -33,13 +33,135 @@
 #include <fcntl.h>
 #include <inttypes.h>
 #include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <time.h>
 #include <unistd.h>
+#include <zlib.h>
 
+/** Identifies a metadata record ("CLKM"). */
+#define METADATA_MAGIC 0x434c4b4d
+#define METADATA_VERSION 2
+
+/** Version 1 records end where the fingerprint begins. */
+#define METADATA_V1_SIZE offsetof(CLKSCrashReportMetadata, fingerprint)
+
+/** Identifies a user report record in a segment file ("CLKR"). */
+#define SEGMENT_RECORD_MAGIC 0x434c4b52
+
+/** Reports longer than this (after decompression) are not read. */
+#define MAX_REPORT_LENGTH 2000000
+
+/** Size of the buffers used to compress and decompress reports. */
+#define CODEC_BUFFER_SIZE 16384
+
+/** Queued user reports are dropped beyond this, in case the writer can't keep up (e.g. disk full). */
+#define MAX_QUEUED_BYTES (8 * 1024 * 1024)
+
+/** Crash reports that can be in progress or waiting for the index at once. */
+#define MAX_CRASH_REPORT_SLOTS 32
+
+/** Header of each report in a segment file. The report's contents follow. */
+typedef struct
+{
+    uint32_t magic;
+    uint32_t length;
+    int64_t reportID;
+    /** When the report was added (seconds since the epoch). */
+    int64_t timestamp;
+    /** FNV-1a hash of the contents, to catch torn writes. */
+    uint32_t checksum;
+    uint32_t reserved;
+} SegmentRecordHeader;
+
+/** State of a slot holding a crash report that hasn't reached the index yet. */
+typedef enum
+{
+    SlotFree,
+    /** Taken, but the ID isn't set yet. */
+    SlotClaimed,
+    /** The report's ID has been handed out, but its metadata hasn't been written. */
+    SlotPending,
+    /** The report has been written, and can go into the index. */
+    SlotReady,
+} SlotState;
+
+/** How a report's contents are encoded, according to its first bytes. */
+typedef enum
+{
+    CodecPlain,
+    CodecGZip,
+    CodecZstd,
+} Codec;
+
+/** A report in the index, and where its contents are. */
+typedef struct
+{
+    CLKSCrashReportMetadata metadata;
+    /** The segment holding the report's contents (0 = the report has its own file). */
+    int64_t segmentID;
+    /** Where the report's contents start in its segment. */
+    int64_t segmentOffset;
+} IndexEntry;
+
+/** A segment file that still holds reports in the index. */
+typedef struct
+{
+    int64_t segmentID;
+    /** How many of its reports haven't been deleted. */
+    int liveCount;
+} SegmentInfo;
+
+/** Where a report went in a segment that has just been written. */
+typedef struct
+{
+    int64_t reportID;
+    int64_t timestamp;
+    int64_t offset;
+    int length;
+} SegmentRecord;
+
+/** A segment that has been written, but whose reports aren't in the index yet. */
+typedef struct WrittenSegment
+{
+    struct WrittenSegment* next;
+    int64_t segmentID;
+    int recordCount;
+    SegmentRecord records[];
+} WrittenSegment;
+
+struct CLKSCrashReportReader
+{
+    int fd;
+    bool isCompressed;
+    bool isAtEnd;
+    int64_t length;
+    /** Bytes left to read from an uncompressed report. */
+    int64_t remaining;
+    z_stream stream;
+    Bytef input[CODEC_BUFFER_SIZE];
+};
+
+typedef struct QueuedReport
+{
+    struct QueuedReport* next;
+    int64_t reportID;
+    int64_t timestamp;
+    int length;
+    char contents[];
+} QueuedReport;
 
 static int g_maxReportCount = 5;
+static int64_t g_maxTotalReportSize = 0;
+static int64_t g_maxReportAge = 0;
+static bool g_collapsesDuplicates = false;
+static int g_compressionLevel = 0;
+// Every report up to this ID has been uploaded. Guarded by g_mutex.
+static int64_t g_uploadCursor;
 // Have to use max 32-bit atomics because of MIPS.
 static _Atomic(uint32_t) g_nextUniqueIDLow;
 static int64_t g_nextUniqueIDHigh;
@@ -47,6 +169,51 @@ static const char* g_appName;
 static const char* g_reportsPath;
 static pthread_mutex_t g_mutex = PTHREAD_MUTEX_INITIALIZER;
 
+// Metadata of every report on disk, sorted by report ID. Guarded by g_mutex.
+static IndexEntry* g_index;
+static int g_indexCount;
+static int g_indexCapacity;
+
+// Segments that still hold reports, sorted by ID. Guarded by g_mutex.
+static SegmentInfo* g_segments;
+static int g_segmentCount;
+static int g_segmentCapacity;
+
+// Working space for eviction and duplicate folding, kept between passes. Guarded by g_mutex.
+static int* g_scratchOrder;
+static int* g_scratchRanks;
+static int64_t* g_scratchIDs;
+static int g_scratchCapacity;
+
+/** Set when reports may have been written behind the index's back (by a crash handler). */
+static _Atomic(bool) g_isIndexStale = true;
+
+// Crash reports being written, or written since the index last looked. Filled
+// in from crash handlers, so slots are claimed with atomics rather than g_mutex.
+static _Atomic(uint32_t) g_crashReportSlotStates[MAX_CRASH_REPORT_SLOTS];
+static int64_t g_crashReportSlotIDs[MAX_CRASH_REPORT_SLOTS];
+/** Crash reports being written without a slot to track them. */
+static _Atomic(uint32_t) g_untrackedCrashReportCount;
+
+// User report write queue. Everything here is guarded by g_queueMutex.
+// The writer never takes g_mutex, so it's safe to wait for it while holding g_mutex.
+static pthread_mutex_t g_queueMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_queueChanged = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t g_queueWritten = PTHREAD_COND_INITIALIZER;
+static QueuedReport* g_queueHead;
+static QueuedReport* g_queueTail;
+static struct timespec g_oldestQueuedTime;
+static bool g_isWriterStarted;
+static bool g_isWriting;
+static int g_flushWaiterCount;
+static int g_maxBatchBytes = 64 * 1024;
+static double g_maxBatchDelay = 1.0;
+static CLKSCrashReportDurability g_durability = CLKSCrashReportDurabilityNone;
+static CLKSCrashReportWriteQueueStats g_queueStats;
+/** Segments written since the index last took them in. */
+static WrittenSegment* g_writtenSegmentsHead;
+static WrittenSegment* g_writtenSegmentsTail;
+
 static int compareInt64(const void* a, const void* b)
 {
     int64_t diff = *(int64_t*)a - *(int64_t*)b;
@@ -72,205 +239,2274 @@ static void getCrashReportPathByID(int64_t id, char* pathBuffer)
     
 }
 
-static int64_t getReportIDFromFilename(const char* filename)
+static void getMetadataPathByID(int64_t id, char* pathBuffer)
+{
+    snprintf(pathBuffer, CLKSCRS_MAX_PATH_LENGTH, "%s/%s-report-%016llx.meta", g_reportsPath, g_appName, id);
+}
+
+static void getSegmentPathByID(int64_t firstReportID, char* pathBuffer)
+{
+    snprintf(pathBuffer, CLKSCRS_MAX_PATH_LENGTH, "%s/%s-segment-%016llx.seg", g_reportsPath, g_appName, firstReportID);
+}
+
+static void getSegmentTombstonePathByID(int64_t firstReportID, char* pathBuffer)
+{
+    snprintf(pathBuffer, CLKSCRS_MAX_PATH_LENGTH, "%s/%s-segment-%016llx.del", g_reportsPath, g_appName, firstReportID);
+}
+
+static void getUploadCursorPath(char* pathBuffer)
+{
+    snprintf(pathBuffer, CLKSCRS_MAX_PATH_LENGTH, "%s/%s-upload.cursor", g_reportsPath, g_appName);
+}
+
+/** Get the ID from the name of one of the store's files.
+ *
+ * @param filename The file's name.
+ * @param kind What the file belongs to ("report" or "segment").
+ * @param suffix The file's suffix, which must match exactly (e.g. ".json").
+ *
+ * @return The ID, or 0 if the name doesn't match.
+ */
+static int64_t getIDFromFilename(const char* filename, const char* kind, const char* suffix)
 {
     char scanFormat[100];
-    sprintf(scanFormat, "%s-report-%%" PRIx64 ".json", g_appName);
-    
+    snprintf(scanFormat, sizeof(scanFormat), "%s-%s-%%" PRIx64 "%s%%n", g_appName, kind, suffix);
+
     int64_t reportID = 0;
-    sscanf(filename, scanFormat, &reportID);
+    int scannedLength = 0;
+    sscanf(filename, scanFormat, &reportID, &scannedLength);
+    // Only an exact match counts, not sidecar or temporary files.
+    if(scannedLength == 0 || filename[scannedLength] != '\0')
+    {
+        return 0;
+    }
     return reportID;
 }
 
-static int getReportCount()
+static int syncFile(int fd)
 {
-    int count = 0;
-    DIR* dir = opendir(g_reportsPath);
-    if(dir == NULL)
+#ifdef __APPLE__
+    // Darwin has no usable fdatasync().
+    return fsync(fd);
+#else
+    return fdatasync(fd);
+#endif
+}
+
+/** Sync a directory, so that files created or renamed in it survive a power loss. */
+static bool syncDirectory(const char* path)
+{
+    int fd = open(path, O_RDONLY);
+    if(fd < 0)
     {
-        CLKSLOG_ERROR("Could not open directory %s", g_reportsPath);
-        goto done;
+        CLKSLOG_ERROR("Could not open directory %s: %s", path, strerror(errno));
+        return false;
     }
-    struct dirent* ent;
-    while((ent = readdir(dir)) != NULL)
+    bool isSuccessful = fsync(fd) == 0;
+    if(!isSuccessful)
     {
-        if(getReportIDFromFilename(ent->d_name) > 0)
-        {
-            count++;
-        }
+        CLKSLOG_ERROR("Could not sync directory %s: %s", path, strerror(errno));
     }
+    close(fd);
+    return isSuccessful;
+}
 
-done:
-    if(dir != NULL)
+/** Write a file's contents, optionally syncing them to disk before closing it. */
+static bool writeFile(const char* path, const char* contents, int length, bool shouldSync)
+{
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(fd < 0)
     {
-        closedir(dir);
+        CLKSLOG_ERROR("Could not open file %s: %s", path, strerror(errno));
+        return false;
     }
-    return count;
+    bool isSuccessful = clksfu_writeBytesToFD(fd, contents, length);
+    if(isSuccessful && shouldSync && syncFile(fd) != 0)
+    {
+        CLKSLOG_ERROR("Could not sync file %s: %s", path, strerror(errno));
+        isSuccessful = false;
+    }
+    close(fd);
+    return isSuccessful;
 }
 
-static int getReportIDs(int64_t* reportIDs, int count)
+static bool writeMetadataToDisk(const CLKSCrashReportMetadata* metadata, bool shouldSync)
 {
-    int index = 0;
-    DIR* dir = opendir(g_reportsPath);
-    if(dir == NULL)
+    char path[CLKSCRS_MAX_PATH_LENGTH];
+    getMetadataPathByID(metadata->reportID, path);
+    return writeFile(path, (const char*)metadata, sizeof(*metadata), shouldSync);
+}
+
+static bool writeMetadata(const CLKSCrashReportMetadata* metadata)
+{
+    return writeMetadataToDisk(metadata, false);
+}
+
+static bool readMetadata(int64_t reportID, CLKSCrashReportMetadata* metadata)
+{
+    char path[CLKSCRS_MAX_PATH_LENGTH];
+    getMetadataPathByID(reportID, path);
+    int fd = open(path, O_RDONLY);
+    if(fd < 0)
     {
-        CLKSLOG_ERROR("Could not open directory %s", g_reportsPath);
-        goto done;
+        return false;
+    }
+    memset(metadata, 0, sizeof(*metadata));
+    int bytesRead = (int)read(fd, metadata, sizeof(*metadata));
+    close(fd);
+    if(bytesRead < (int)METADATA_V1_SIZE ||
+       metadata->magic != METADATA_MAGIC ||
+       metadata->reportID != reportID)
+    {
+        return false;
+    }
+    if(metadata->version == 1)
+    {
+        memset((char*)metadata + METADATA_V1_SIZE, 0, sizeof(*metadata) - METADATA_V1_SIZE);
+        metadata->version = METADATA_VERSION;
+        return true;
     }
+    return metadata->version == METADATA_VERSION && bytesRead == (int)sizeof(*metadata);
+}
 
-    struct dirent* ent;
-    while((ent = readdir(dir)) != NULL && index < count)
+/** Get a report's metadata, building a stand-in from the report file if there's no record.
+ */
+static bool loadMetadataFromDisk(int64_t reportID, CLKSCrashReportMetadata* metadata)
+{
+    char path[CLKSCRS_MAX_PATH_LENGTH];
+    getCrashReportPathByID(reportID, path);
+    struct stat st;
+    if(stat(path, &st) != 0)
     {
-        int64_t reportID = getReportIDFromFilename(ent->d_name);
-        if(reportID > 0)
-        {
-            reportIDs[index++] = reportID;
-        }
+        return false;
+    }
+    if(readMetadata(reportID, metadata))
+    {
+        metadata->crashType[sizeof(metadata->crashType) - 1] = '\0';
+        return true;
     }
 
-    qsort(reportIDs, (unsigned)count, sizeof(reportIDs[0]), compareInt64);
+    memset(metadata, 0, sizeof(*metadata));
+    metadata->magic = METADATA_MAGIC;
+    metadata->version = METADATA_VERSION;
+    metadata->kind = CLKSCrashReportKindUnknown;
+    metadata->reportID = reportID;
+    metadata->timestamp = (int64_t)st.st_mtime;
+    metadata->reportSize = (int64_t)st.st_size;
+    return true;
+}
 
-done:
-    if(dir != NULL)
+
+// Report index
+
+static int compareEntriesByID(const void* a, const void* b)
+{
+    return compareInt64(&((const IndexEntry*)a)->metadata.reportID,
+                        &((const IndexEntry*)b)->metadata.reportID);
+}
+
+static bool reserveIndex(int capacity)
+{
+    if(capacity <= g_indexCapacity)
     {
-        closedir(dir);
+        return true;
     }
-    return index;
+    int newCapacity = g_indexCapacity > 0 ? g_indexCapacity : 64;
+    while(newCapacity < capacity)
+    {
+        newCapacity *= 2;
+    }
+    IndexEntry* newIndex = realloc(g_index, sizeof(*g_index) * (size_t)newCapacity);
+    if(newIndex == NULL)
+    {
+        CLKSLOG_ERROR("Could not grow report index to %d entries", newCapacity);
+        return false;
+    }
+    g_index = newIndex;
+    g_indexCapacity = newCapacity;
+    return true;
 }
 
-static void pruneReports()
+/** Find a report among the first count entries of the index.
+ *
+ * @return The report's position in the index, or -1 if it isn't there.
+ */
+static int searchIndex(int64_t reportID, int count)
 {
-    int reportCount = getReportCount();
-    if(reportCount > g_maxReportCount)
+    int low = 0;
+    int high = count - 1;
+    while(low <= high)
     {
-        int64_t reportIDs[reportCount];
-        reportCount = getReportIDs(reportIDs, reportCount);
-        
-        for(int i = 0; i < reportCount - g_maxReportCount; i++)
+        int mid = (low + high) / 2;
+        if(g_index[mid].metadata.reportID < reportID)
+        {
+            low = mid + 1;
+        }
+        else if(g_index[mid].metadata.reportID > reportID)
+        {
+            high = mid - 1;
+        }
+        else
         {
-            clkscrs_deleteReportWithID(reportIDs[i]);
+            return mid;
         }
     }
+    return -1;
 }
 
-static void initializeIDs()
+static int findInIndex(int64_t reportID)
 {
-    time_t rawTime;
-    time(&rawTime);
-    struct tm time;
-    gmtime_r(&rawTime, &time);
-    int64_t baseID = (int64_t)time.tm_sec
-                   + (int64_t)time.tm_min * 61
-                   + (int64_t)time.tm_hour * 61 * 60
-                   + (int64_t)time.tm_yday * 61 * 60 * 24
-                   + (int64_t)time.tm_year * 61 * 60 * 24 * 366;
-    baseID <<= 23;
-
-    g_nextUniqueIDHigh = baseID & ~0xffffffff;
-    g_nextUniqueIDLow = (uint32_t)(baseID & 0xffffffff);
+    return searchIndex(reportID, g_indexCount);
 }
 
+static void putInIndex(const IndexEntry* entry)
+{
+    int index = findInIndex(entry->metadata.reportID);
+    if(index >= 0)
+    {
+        g_index[index] = *entry;
+        return;
+    }
+    if(!reserveIndex(g_indexCount + 1))
+    {
+        // The report is still on disk, and will be picked up by the next rebuild.
+        atomic_store(&g_isIndexStale, true);
+        return;
+    }
+    // New reports nearly always have the highest ID, making this an append.
+    index = g_indexCount;
+    while(index > 0 && g_index[index - 1].metadata.reportID > entry->metadata.reportID)
+    {
+        index--;
+    }
+    memmove(&g_index[index + 1], &g_index[index], sizeof(*g_index) * (size_t)(g_indexCount - index));
+    g_index[index] = *entry;
+    g_indexCount++;
+}
 
-// Public API
+static void removeFromIndexAt(int index)
+{
+    g_indexCount--;
+    memmove(&g_index[index], &g_index[index + 1], sizeof(*g_index) * (size_t)(g_indexCount - index));
+}
 
-void clkscrs_initialize(const char* appName, const char* reportsPath)
+/** Make sure the scratch buffers hold at least capacity entries.
+ * Must be called with g_mutex held.
+ */
+static bool reserveScratch(int capacity)
 {
-    pthread_mutex_lock(&g_mutex);
-    g_appName = strdup(appName);
-    g_reportsPath = strdup(reportsPath);
-    clksfu_makePath(reportsPath);
-    pruneReports();
-    initializeIDs();
-    pthread_mutex_unlock(&g_mutex);
+    if(capacity <= g_scratchCapacity)
+    {
+        return true;
+    }
+    int newCapacity = g_scratchCapacity > 0 ? g_scratchCapacity : 64;
+    while(newCapacity < capacity)
+    {
+        newCapacity *= 2;
+    }
+    int* newOrder = realloc(g_scratchOrder, sizeof(*g_scratchOrder) * (size_t)newCapacity);
+    if(newOrder != NULL)
+    {
+        g_scratchOrder = newOrder;
+    }
+    int* newRanks = realloc(g_scratchRanks, sizeof(*g_scratchRanks) * (size_t)newCapacity);
+    if(newRanks != NULL)
+    {
+        g_scratchRanks = newRanks;
+    }
+    int64_t* newIDs = realloc(g_scratchIDs, sizeof(*g_scratchIDs) * (size_t)newCapacity);
+    if(newIDs != NULL)
+    {
+        g_scratchIDs = newIDs;
+    }
+    if(newOrder == NULL || newRanks == NULL || newIDs == NULL)
+    {
+        CLKSLOG_ERROR("Could not grow scratch space to %d entries", newCapacity);
+        return false;
+    }
+    g_scratchCapacity = newCapacity;
+    return true;
 }
 
-int64_t clkscrs_getNextCrashReport(char *crashReportPathBuffer)
+static bool loadMetadata(int64_t reportID, CLKSCrashReportMetadata* metadata)
 {
-    int64_t nextID = getNextUniqueID();
-    if(crashReportPathBuffer)
+    int index = findInIndex(reportID);
+    if(index < 0)
     {
-        getCrashReportPathByID(nextID, crashReportPathBuffer);
+        return false;
     }
-    return nextID;
+    *metadata = g_index[index].metadata;
+    return true;
 }
 
-int clkscrs_getReportCount()
+
+// Segment registry
+
+static int findSegment(int64_t segmentID)
 {
-    pthread_mutex_lock(&g_mutex);
-    int count = getReportCount();
-    pthread_mutex_unlock(&g_mutex);
-    return count;
+    int low = 0;
+    int high = g_segmentCount - 1;
+    while(low <= high)
+    {
+        int mid = (low + high) / 2;
+        if(g_segments[mid].segmentID < segmentID)
+        {
+            low = mid + 1;
+        }
+        else if(g_segments[mid].segmentID > segmentID)
+        {
+            high = mid - 1;
+        }
+        else
+        {
+            return mid;
+        }
+    }
+    return -1;
 }
 
-int clkscrs_getReportIDs(int64_t *reportIDs, int count)
+static bool addSegment(int64_t segmentID, int liveCount)
 {
-    pthread_mutex_lock(&g_mutex);
-    count = getReportIDs(reportIDs, count);
-    pthread_mutex_unlock(&g_mutex);
-    return count;
+    if(g_segmentCount >= g_segmentCapacity)
+    {
+        int newCapacity = g_segmentCapacity > 0 ? g_segmentCapacity * 2 : 16;
+        SegmentInfo* newSegments = realloc(g_segments, sizeof(*g_segments) * (size_t)newCapacity);
+        if(newSegments == NULL)
+        {
+            CLKSLOG_ERROR("Could not grow segment list to %d entries", newCapacity);
+            return false;
+        }
+        g_segments = newSegments;
+        g_segmentCapacity = newCapacity;
+    }
+    // Segments are nearly always added in order, making this an append.
+    int index = g_segmentCount;
+    while(index > 0 && g_segments[index - 1].segmentID > segmentID)
+    {
+        index--;
+    }
+    memmove(&g_segments[index + 1], &g_segments[index], sizeof(*g_segments) * (size_t)(g_segmentCount - index));
+    g_segments[index] = (SegmentInfo){.segmentID = segmentID, .liveCount = liveCount};
+    g_segmentCount++;
+    return true;
 }
 
-char* clkscrs_readReport(int64_t reportID)
+static void removeSegmentFiles(int64_t segmentID)
 {
-    pthread_mutex_lock(&g_mutex);
     char path[CLKSCRS_MAX_PATH_LENGTH];
-    getCrashReportPathByID(reportID, path);
-    char* result;
-    clksfu_readEntireFile(path, &result, NULL, 2000000);
-    pthread_mutex_unlock(&g_mutex);
-    return result;
+    // The segment goes first, so that its reports can't come back without their tombstones.
+    getSegmentPathByID(segmentID, path);
+    clksfu_removeFile(path, true);
+    getSegmentTombstonePathByID(segmentID, path);
+    clksfu_removeFile(path, false);
 }
 
-int64_t clkscrs_addUserReport(const char *report, int reportLength)
+/** Record that reports in a segment were deleted, so that they stay deleted
+ * when the segment is read again at the next launch. The segment itself goes
+ * once all of its reports have.
+ * Must be called with g_mutex held.
+ *
+ * @param segmentID The segment.
+ * @param reportIDs The deleted reports, all of which were in the index.
+ * @param count The number of reports.
+ */
+static void deleteFromSegment(int64_t segmentID, const int64_t* reportIDs, int count)
 {
-    pthread_mutex_lock(&g_mutex);
-    int64_t currentID = getNextUniqueID();
-    char crashReportPath[CLKSCRS_MAX_PATH_LENGTH];
-    getCrashReportPathByID(currentID, crashReportPath);
+    int index = findSegment(segmentID);
+    if(index < 0)
+    {
+        return;
+    }
+    g_segments[index].liveCount -= count;
+    if(g_segments[index].liveCount <= 0)
+    {
+        removeSegmentFiles(segmentID);
+        g_segmentCount--;
+        memmove(&g_segments[index], &g_segments[index + 1], sizeof(*g_segments) * (size_t)(g_segmentCount - index));
+        return;
+    }
 
-    int fd = open(crashReportPath, O_WRONLY | O_CREAT, 0644);
+    char path[CLKSCRS_MAX_PATH_LENGTH];
+    getSegmentTombstonePathByID(segmentID, path);
+    int fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644);
     if(fd < 0)
     {
-        CLKSLOG_ERROR("Could not open file %s: %s", crashReportPath, strerror(errno));
-        goto done;
+        CLKSLOG_ERROR("Could not open file %s: %s", path, strerror(errno));
+        return;
     }
+    clksfu_writeBytesToFD(fd, (const char*)reportIDs, (int)(sizeof(*reportIDs) * (size_t)count));
+    close(fd);
+}
 
-    int bytesWritten = (int)write(fd, report, (unsigned)reportLength);
-    if(bytesWritten < 0)
+static void deleteReport(int64_t reportID)
+{
+    char path[CLKSCRS_MAX_PATH_LENGTH];
+    int index = findInIndex(reportID);
+    int64_t segmentID = index >= 0 ? g_index[index].segmentID : 0;
+    if(segmentID == 0)
     {
-        CLKSLOG_ERROR("Could not write to file %s: %s", crashReportPath, strerror(errno));
-        goto done;
+        getCrashReportPathByID(reportID, path);
+        clksfu_removeFile(path, true);
+    }
+    getMetadataPathByID(reportID, path);
+    clksfu_removeFile(path, false);
+    if(index >= 0)
+    {
+        removeFromIndexAt(index);
     }
-    else if(bytesWritten < reportLength)
+    if(segmentID != 0)
     {
-        CLKSLOG_ERROR("Expected to write %d bytes to file %s, but only wrote %d", crashReportPath, reportLength, bytesWritten);
+        deleteFromSegment(segmentID, &reportID, 1);
     }
+}
 
-done:
-    if(fd >= 0)
+/** Reports with a lower rank are evicted first.
+ *
+ * @param isDuplicate The report is unsent, and an older unsent report has the same fingerprint.
+ */
+static int getEvictionRank(const CLKSCrashReportMetadata* metadata, bool isDuplicate)
+{
+    if(metadata->sent)
     {
-        close(fd);
+        return 0;
     }
-    pthread_mutex_unlock(&g_mutex);
+    if(isDuplicate)
+    {
+        return 1;
+    }
+    if(metadata->kind == CLKSCrashReportKindRecrash)
+    {
+        return 2;
+    }
+    return 3;
+}
 
-    return currentID;
+static int compareFingerprintOrder(const void* a, const void* b)
+{
+    const CLKSCrashReportMetadata* metadataA = &g_index[*(const int*)a].metadata;
+    const CLKSCrashReportMetadata* metadataB = &g_index[*(const int*)b].metadata;
+    if(metadataA->fingerprint != metadataB->fingerprint)
+    {
+        return metadataA->fingerprint < metadataB->fingerprint ? -1 : 1;
+    }
+    return compareInt64(&metadataA->reportID, &metadataB->reportID);
 }
 
-void clkscrs_deleteAllReports()
+/** Put the positions of unsent reports with a fingerprint into order, grouped
+ * by fingerprint, oldest first within each group.
+ *
+ * @return The number of positions placed in order.
+ */
+static int orderByFingerprint(int* order)
 {
-    pthread_mutex_lock(&g_mutex);
-    clksfu_deleteContentsOfPath(g_reportsPath);
-    pthread_mutex_unlock(&g_mutex);
+    int candidateCount = 0;
+    for(int i = 0; i < g_indexCount; i++)
+    {
+        if(!g_index[i].metadata.sent && g_index[i].metadata.fingerprint != 0)
+        {
+            order[candidateCount++] = i;
+        }
+    }
+    qsort(order, (size_t)candidateCount, sizeof(order[0]), compareFingerprintOrder);
+    return candidateCount;
 }
 
-void clkscrs_deleteReportWithID(int64_t reportID)
+static int compareEvictionOrder(const void* a, const void* b)
 {
-    char path[CLKSCRS_MAX_PATH_LENGTH];
-    getCrashReportPathByID(reportID, path);
-    clksfu_removeFile(path, true);
+    int rankDiff = g_scratchRanks[*(const int*)a] - g_scratchRanks[*(const int*)b];
+    if(rankDiff != 0)
+    {
+        return rankDiff;
+    }
+    return compareInt64(&g_index[*(const int*)a].metadata.reportID, &g_index[*(const int*)b].metadata.reportID);
 }
 
-void clkscrs_setMaxReportCount(int maxReportCount)
+/** Delete reports until the store is within its age, count and size limits.
+ * Expired reports always go. After that, sent reports go first, then
+ * duplicates of a report that is staying, then recrash reports, then the oldest.
+ * Must be called with g_mutex held.
+ */
+static void enforceLimits()
 {
-    g_maxReportCount = maxReportCount;
+    if(g_maxReportAge > 0)
+    {
+        const int64_t cutoff = (int64_t)time(NULL) - g_maxReportAge;
+        for(int i = g_indexCount - 1; i >= 0; i--)
+        {
+            if(g_index[i].metadata.timestamp < cutoff)
+            {
+                deleteReport(g_index[i].metadata.reportID);
+            }
+        }
+    }
+
+    int64_t totalSize = 0;
+    for(int i = 0; i < g_indexCount; i++)
+    {
+        totalSize += g_index[i].metadata.reportSize;
+    }
+    const bool hasSizeLimit = g_maxTotalReportSize > 0;
+    if(g_indexCount <= g_maxReportCount && (!hasSizeLimit || totalSize <= g_maxTotalReportSize))
+    {
+        return;
+    }
+
+    const int reportCount = g_indexCount;
+    if(!reserveScratch(reportCount))
+    {
+        // Try again on the next pass.
+        return;
+    }
+    int* evictionOrder = g_scratchOrder;
+    // The oldest report with each fingerprint represents the rest, even when they aren't collapsed.
+    int candidateCount = orderByFingerprint(evictionOrder);
+    for(int i = 0; i < reportCount; i++)
+    {
+        g_scratchRanks[i] = getEvictionRank(&g_index[i].metadata, false);
+    }
+    for(int i = 1; i < candidateCount; i++)
+    {
+        int index = evictionOrder[i];
+        if(g_index[index].metadata.fingerprint == g_index[evictionOrder[i - 1]].metadata.fingerprint)
+        {
+            g_scratchRanks[index] = getEvictionRank(&g_index[index].metadata, true);
+        }
+    }
+    for(int i = 0; i < reportCount; i++)
+    {
+        evictionOrder[i] = i;
+    }
+    qsort(evictionOrder, (size_t)reportCount, sizeof(evictionOrder[0]), compareEvictionOrder);
+
+    // Pick everything first, since deleting shuffles the index.
+    int64_t* evictedIDs = g_scratchIDs;
+    int evictedCount = 0;
+    int remainingCount = reportCount;
+    while(evictedCount < reportCount &&
+          (remainingCount > g_maxReportCount || (hasSizeLimit && totalSize > g_maxTotalReportSize)))
+    {
+        const CLKSCrashReportMetadata* metadata = &g_index[evictionOrder[evictedCount]].metadata;
+        evictedIDs[evictedCount++] = metadata->reportID;
+        totalSize -= metadata->reportSize;
+        remainingCount--;
+    }
+    for(int i = 0; i < evictedCount; i++)
+    {
+        deleteReport(evictedIDs[i]);
+    }
+    CLKSLOG_DEBUG("Evicted %d reports. %d reports (%lld bytes) remain", evictedCount, remainingCount, totalSize);
+}
+
+/** Fold unsent reports with the same fingerprint into the oldest of them.
+ * Must be called with g_mutex held.
+ */
+static void collapseDuplicates()
+{
+    if(!g_collapsesDuplicates)
+    {
+        return;
+    }
+
+    const int reportCount = g_indexCount;
+    if(!reserveScratch(reportCount))
+    {
+        return;
+    }
+    int* order = g_scratchOrder;
+    const int candidateCount = orderByFingerprint(order);
+
+    // Pick everything first, since deleting shuffles the index.
+    int64_t* duplicateIDs = g_scratchIDs;
+    int duplicateCount = 0;
+    int i = 0;
+    while(i < candidateCount)
+    {
+        CLKSCrashReportMetadata* representative = &g_index[order[i]].metadata;
+        int j = i + 1;
+        for(; j < candidateCount && g_index[order[j]].metadata.fingerprint == representative->fingerprint; j++)
+        {
+            const CLKSCrashReportMetadata* duplicate = &g_index[order[j]].metadata;
+            representative->duplicateCount += 1 + duplicate->duplicateCount;
+            int64_t lastTimestamp = duplicate->timestamp;
+            if(duplicate->lastDuplicateTimestamp > lastTimestamp)
+            {
+                lastTimestamp = duplicate->lastDuplicateTimestamp;
+            }
+            if(lastTimestamp > representative->lastDuplicateTimestamp)
+            {
+                representative->lastDuplicateTimestamp = lastTimestamp;
+            }
+            duplicateIDs[duplicateCount++] = duplicate->reportID;
+        }
+        if(j > i + 1)
+        {
+            writeMetadata(representative);
+        }
+        i = j;
+    }
+    for(int k = 0; k < duplicateCount; k++)
+    {
+        deleteReport(duplicateIDs[k]);
+    }
+    if(duplicateCount > 0)
+    {
+        CLKSLOG_DEBUG("Folded %d duplicate reports", duplicateCount);
+    }
+}
+
+static bool metadataMatches(const CLKSCrashReportMetadata* metadata, const CLKSCrashReportFilter* filter)
+{
+    if(filter == NULL)
+    {
+        return true;
+    }
+    if(filter->kindMask != 0 && (filter->kindMask & (1u << metadata->kind)) == 0)
+    {
+        return false;
+    }
+    if(filter->unsentOnly && metadata->sent)
+    {
+        return false;
+    }
+    if(metadata->timestamp < filter->minTimestamp)
+    {
+        return false;
+    }
+    if(filter->crashType != NULL &&
+       strncmp(metadata->crashType, filter->crashType, sizeof(metadata->crashType)) != 0)
+    {
+        return false;
+    }
+    return true;
+}
+
+
+// User report segments
+
+static uint32_t hashBytes(const char* bytes, int length)
+{
+    uint32_t hash = 2166136261u;
+    for(int i = 0; i < length; i++)
+    {
+        hash = (hash ^ (uint8_t)bytes[i]) * 16777619u;
+    }
+    return hash;
+}
+
+/** Make the index entry for a report in a segment. */
+static void makeSegmentEntry(IndexEntry* entry, int64_t segmentID, const SegmentRecord* record)
+{
+    memset(entry, 0, sizeof(*entry));
+    entry->metadata.magic = METADATA_MAGIC;
+    entry->metadata.version = METADATA_VERSION;
+    entry->metadata.kind = CLKSCrashReportKindUser;
+    entry->metadata.reportID = record->reportID;
+    entry->metadata.timestamp = record->timestamp;
+    entry->metadata.reportSize = record->length;
+    entry->segmentID = segmentID;
+    entry->segmentOffset = record->offset;
+}
+
+/** Write a batch of queued reports to a new segment file in a single write.
+ * The segment is written under a temporary name and renamed into place when complete.
+ *
+ * @param batch The reports, in ID order.
+ * @param durability Whether to sync the segment to disk.
+ *
+ * @return Where each report went, for the index to take in, or NULL if the
+ *         segment couldn't be written.
+ */
+static WrittenSegment* writeSegment(const QueuedReport* batch, CLKSCrashReportDurability durability)
+{
+    int64_t segmentSize = 0;
+    int reportCount = 0;
+    for(const QueuedReport* report = batch; report != NULL; report = report->next)
+    {
+        segmentSize += (int64_t)sizeof(SegmentRecordHeader) + report->length;
+        reportCount++;
+    }
+
+    bool isSuccessful = false;
+    char path[CLKSCRS_MAX_PATH_LENGTH];
+    char tempPath[CLKSCRS_MAX_PATH_LENGTH + 4];
+    getSegmentPathByID(batch->reportID, path);
+    snprintf(tempPath, sizeof(tempPath), "%s.tmp", path);
+    int fd = -1;
+
+    char* buffer = malloc((size_t)segmentSize);
+    WrittenSegment* segment = malloc(sizeof(*segment) + sizeof(*segment->records) * (size_t)reportCount);
+    if(buffer == NULL || segment == NULL)
+    {
+        CLKSLOG_ERROR("Could not allocate %lld bytes for segment %s", segmentSize, path);
+        goto done;
+    }
+    segment->next = NULL;
+    segment->segmentID = batch->reportID;
+    segment->recordCount = 0;
+    char* pos = buffer;
+    for(const QueuedReport* report = batch; report != NULL; report = report->next)
+    {
+        SegmentRecordHeader header =
+        {
+            .magic = SEGMENT_RECORD_MAGIC,
+            .length = (uint32_t)report->length,
+            .reportID = report->reportID,
+            .timestamp = report->timestamp,
+            .checksum = hashBytes(report->contents, report->length),
+        };
+        memcpy(pos, &header, sizeof(header));
+        pos += sizeof(header);
+        segment->records[segment->recordCount++] = (SegmentRecord)
+        {
+            .reportID = report->reportID,
+            .timestamp = report->timestamp,
+            .offset = pos - buffer,
+            .length = report->length,
+        };
+        memcpy(pos, report->contents, (size_t)report->length);
+        pos += report->length;
+    }
+
+    fd = open(tempPath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(fd < 0)
+    {
+        CLKSLOG_ERROR("Could not open file %s: %s", tempPath, strerror(errno));
+        goto done;
+    }
+    if(!clksfu_writeBytesToFD(fd, buffer, (int)segmentSize))
+    {
+        goto done;
+    }
+    const bool shouldSync = durability == CLKSCrashReportDurabilitySyncPerBatch;
+    if(shouldSync && syncFile(fd) != 0)
+    {
+        CLKSLOG_ERROR("Could not sync file %s: %s", tempPath, strerror(errno));
+        goto done;
+    }
+    close(fd);
+    fd = -1;
+    if(rename(tempPath, path) != 0)
+    {
+        CLKSLOG_ERROR("Could not rename %s to %s: %s", tempPath, path, strerror(errno));
+        goto done;
+    }
+    // The rename itself only survives a power loss once the directory is synced.
+    isSuccessful = !shouldSync || syncDirectory(g_reportsPath);
+
+done:
+    if(fd >= 0)
+    {
+        close(fd);
+    }
+    if(!isSuccessful)
+    {
+        unlink(tempPath);
+        free(segment);
+        segment = NULL;
+    }
+    free(buffer);
+    return segment;
+}
+
+/** Hand a written segment over to the index.
+ * Must be called with g_queueMutex held.
+ */
+static void addWrittenSegment(WrittenSegment* segment)
+{
+    if(g_writtenSegmentsTail == NULL)
+    {
+        g_writtenSegmentsHead = segment;
+    }
+    else
+    {
+        g_writtenSegmentsTail->next = segment;
+    }
+    g_writtenSegmentsTail = segment;
+}
+
+static WrittenSegment* takeWrittenSegments()
+{
+    pthread_mutex_lock(&g_queueMutex);
+    WrittenSegment* segments = g_writtenSegmentsHead;
+    g_writtenSegmentsHead = g_writtenSegmentsTail = NULL;
+    pthread_mutex_unlock(&g_queueMutex);
+    return segments;
+}
+
+static void freeWrittenSegments(WrittenSegment* segment)
+{
+    while(segment != NULL)
+    {
+        WrittenSegment* next = segment->next;
+        free(segment);
+        segment = next;
+    }
+}
+
+/** Put a segment's reports into the index, reading them from disk.
+ * Deleted reports are left out, as are any after a damaged record, and any
+ * already in the index as report files (left over from when segments were
+ * split into them).
+ * Must be called with g_mutex held.
+ *
+ * @param segmentID The segment.
+ * @param hasTombstones true if some of the segment's reports were deleted.
+ * @param metadataIDs The reports with metadata files, in ascending order.
+ * @param metadataIDCount The number of IDs in metadataIDs.
+ * @param fileReportCount The number of entries at the start of the index that
+ *                        are report files.
+ *
+ * @return The number of reports that were put in the index.
+ */
+static int indexSegment(int64_t segmentID,
+                        bool hasTombstones,
+                        const int64_t* metadataIDs,
+                        int metadataIDCount,
+                        int fileReportCount)
+{
+    char path[CLKSCRS_MAX_PATH_LENGTH];
+    getSegmentPathByID(segmentID, path);
+    char* contents = NULL;
+    int length = 0;
+    if(!clksfu_readEntireFile(path, &contents, &length, 0))
+    {
+        CLKSLOG_ERROR("Could not read segment %s", path);
+        return 0;
+    }
+    int64_t* tombstones = NULL;
+    int tombstoneCount = 0;
+    if(hasTombstones)
+    {
+        char tombstonePath[CLKSCRS_MAX_PATH_LENGTH];
+        getSegmentTombstonePathByID(segmentID, tombstonePath);
+        char* tombstoneData = NULL;
+        int tombstoneLength = 0;
+        if(clksfu_readEntireFile(tombstonePath, &tombstoneData, &tombstoneLength, 0))
+        {
+            tombstones = (int64_t*)tombstoneData;
+            tombstoneCount = tombstoneLength / (int)sizeof(*tombstones);
+            qsort(tombstones, (size_t)tombstoneCount, sizeof(*tombstones), compareInt64);
+        }
+    }
+    int reportCount = 0;
+
+    const char* pos = contents;
+    const char* end = contents + length;
+    while(pos < end)
+    {
+        SegmentRecordHeader header;
+        if(end - pos < (long)sizeof(header))
+        {
+            CLKSLOG_ERROR("Segment %s is truncated", path);
+            break;
+        }
+        memcpy(&header, pos, sizeof(header));
+        pos += sizeof(header);
+        if(header.magic != SEGMENT_RECORD_MAGIC ||
+           header.length > (uint32_t)(end - pos) ||
+           header.checksum != hashBytes(pos, (int)header.length))
+        {
+            CLKSLOG_ERROR("Segment %s is damaged at offset %d", path, (int)(pos - contents));
+            break;
+        }
+        const int64_t reportID = header.reportID;
+        if(bsearch(&reportID, tombstones, (size_t)tombstoneCount, sizeof(*tombstones), compareInt64) == NULL &&
+           searchIndex(reportID, fileReportCount) < 0 &&
+           reserveIndex(g_indexCount + 1))
+        {
+            SegmentRecord record =
+            {
+                .reportID = reportID,
+                .timestamp = header.timestamp,
+                .offset = pos - contents,
+                .length = (int)header.length,
+            };
+            IndexEntry* entry = &g_index[g_indexCount++];
+            makeSegmentEntry(entry, segmentID, &record);
+            // Reports that have been tried or rated have their own metadata.
+            if(bsearch(&reportID, metadataIDs, (size_t)metadataIDCount, sizeof(*metadataIDs), compareInt64) != NULL &&
+               readMetadata(reportID, &entry->metadata))
+            {
+                entry->metadata.crashType[sizeof(entry->metadata.crashType) - 1] = '\0';
+            }
+            reportCount++;
+        }
+        pos += header.length;
+    }
+
+    free(tombstones);
+    free(contents);
+    return reportCount;
+}
+
+/** Append an ID to a growable list. */
+static void appendID(int64_t** ids, int* count, int* capacity, int64_t id)
+{
+    if(*count >= *capacity)
+    {
+        int newCapacity = *capacity > 0 ? *capacity * 2 : 64;
+        int64_t* newIDs = realloc(*ids, sizeof(**ids) * (size_t)newCapacity);
+        if(newIDs == NULL)
+        {
+            CLKSLOG_ERROR("Could not grow ID list to %d entries", newCapacity);
+            return;
+        }
+        *ids = newIDs;
+        *capacity = newCapacity;
+    }
+    (*ids)[(*count)++] = id;
+}
+
+/** Rebuild the index from the reports directory. This is done at launch, and
+ * afterwards only if reports were written faster than they could be handed
+ * to the index. It's the only time segments are read from disk.
+ * Must be called with g_mutex held.
+ *
+ * @param includeUnfinished Also take in segments whose writer was interrupted
+ *                          before it could rename them into place.
+ *                          Only safe when nothing can be writing.
+ */
+static void rebuildIndex(bool includeUnfinished)
+{
+    g_indexCount = 0;
+    g_segmentCount = 0;
+    DIR* dir = opendir(g_reportsPath);
+    if(dir == NULL)
+    {
+        CLKSLOG_ERROR("Could not open directory %s", g_reportsPath);
+        return;
+    }
+    int64_t* metadataIDs = NULL;
+    int metadataIDCount = 0;
+    int metadataIDCapacity = 0;
+    int64_t* tombstoneIDs = NULL;
+    int tombstoneIDCount = 0;
+    int tombstoneIDCapacity = 0;
+    struct dirent* ent;
+    while((ent = readdir(dir)) != NULL)
+    {
+        int64_t id;
+        if((id = getIDFromFilename(ent->d_name, "report", ".json")) > 0)
+        {
+            if(reserveIndex(g_indexCount + 1) && loadMetadataFromDisk(id, &g_index[g_indexCount].metadata))
+            {
+                g_index[g_indexCount].segmentID = 0;
+                g_index[g_indexCount].segmentOffset = 0;
+                g_indexCount++;
+            }
+        }
+        else if((id = getIDFromFilename(ent->d_name, "report", ".meta")) > 0)
+        {
+            appendID(&metadataIDs, &metadataIDCount, &metadataIDCapacity, id);
+        }
+        else if((id = getIDFromFilename(ent->d_name, "segment", ".del")) > 0)
+        {
+            appendID(&tombstoneIDs, &tombstoneIDCount, &tombstoneIDCapacity, id);
+        }
+        else if((id = getIDFromFilename(ent->d_name, "segment", ".seg")) > 0)
+        {
+            addSegment(id, 0);
+        }
+        else if(includeUnfinished && (id = getIDFromFilename(ent->d_name, "segment", ".seg.tmp")) > 0)
+        {
+            // Whatever made it into the file is still worth keeping.
+            char path[CLKSCRS_MAX_PATH_LENGTH];
+            char tempPath[CLKSCRS_MAX_PATH_LENGTH + 4];
+            getSegmentPathByID(id, path);
+            snprintf(tempPath, sizeof(tempPath), "%s.tmp", path);
+            if(rename(tempPath, path) == 0)
+            {
+                addSegment(id, 0);
+            }
+        }
+    }
+    closedir(dir);
+    qsort(g_index, (size_t)g_indexCount, sizeof(*g_index), compareEntriesByID);
+    qsort(metadataIDs, (size_t)metadataIDCount, sizeof(*metadataIDs), compareInt64);
+    qsort(tombstoneIDs, (size_t)tombstoneIDCount, sizeof(*tombstoneIDs), compareInt64);
+
+    const int fileReportCount = g_indexCount;
+    int keptCount = 0;
+    for(int i = 0; i < g_segmentCount; i++)
+    {
+        SegmentInfo segment = g_segments[i];
+        bool hasTombstones = bsearch(&segment.segmentID, tombstoneIDs, (size_t)tombstoneIDCount,
+                                     sizeof(*tombstoneIDs), compareInt64) != NULL;
+        segment.liveCount = indexSegment(segment.segmentID, hasTombstones, metadataIDs, metadataIDCount, fileReportCount);
+        if(segment.liveCount > 0)
+        {
+            g_segments[keptCount++] = segment;
+        }
+        else
+        {
+            removeSegmentFiles(segment.segmentID);
+        }
+    }
+    g_segmentCount = keptCount;
+    // Tombstones whose segment was deleted before they were.
+    for(int i = 0; i < tombstoneIDCount; i++)
+    {
+        if(findSegment(tombstoneIDs[i]) < 0)
+        {
+            char path[CLKSCRS_MAX_PATH_LENGTH];
+            getSegmentTombstonePathByID(tombstoneIDs[i], path);
+            clksfu_removeFile(path, false);
+        }
+    }
+    qsort(g_index, (size_t)g_indexCount, sizeof(*g_index), compareEntriesByID);
+    free(metadataIDs);
+    free(tombstoneIDs);
+}
+
+
+// Crash report slots
+
+/** Take a free crash report slot, without taking any locks.
+ *
+ * @return The slot, or -1 if they're all in use.
+ */
+static int claimCrashReportSlot()
+{
+    for(int i = 0; i < MAX_CRASH_REPORT_SLOTS; i++)
+    {
+        uint32_t expected = SlotFree;
+        if(atomic_compare_exchange_strong(&g_crashReportSlotStates[i], &expected, SlotClaimed))
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/** Tell the index about a crash report, without taking any locks.
+ * If there's no room, the index is rebuilt instead.
+ */
+static void addWrittenCrashReport(int64_t reportID)
+{
+    for(int i = 0; i < MAX_CRASH_REPORT_SLOTS; i++)
+    {
+        if(atomic_load(&g_crashReportSlotStates[i]) == SlotPending && g_crashReportSlotIDs[i] == reportID)
+        {
+            atomic_store(&g_crashReportSlotStates[i], SlotReady);
+            return;
+        }
+    }
+
+    // Either there was no slot for it, or it's being written again (e.g. a recrash report).
+    int slot = claimCrashReportSlot();
+    if(slot >= 0)
+    {
+        g_crashReportSlotIDs[slot] = reportID;
+        atomic_store(&g_crashReportSlotStates[slot], SlotReady);
+    }
+    else
+    {
+        atomic_store(&g_isIndexStale, true);
+    }
+    // Now that the index will find it, it no longer needs to hold the upload cursor back.
+    uint32_t untrackedCount = atomic_load(&g_untrackedCrashReportCount);
+    while(untrackedCount > 0 &&
+          !atomic_compare_exchange_weak(&g_untrackedCrashReportCount, &untrackedCount, untrackedCount - 1))
+    {
+    }
+}
+
+/** Find the oldest crash report that isn't in the index yet.
+ *
+ * @param lowestID Set to the report's ID, or INT64_MAX if there isn't one.
+ *
+ * @return false if there may be one whose ID can't be known yet.
+ */
+static bool getLowestUnindexedCrashReportID(int64_t* lowestID)
+{
+    if(atomic_load(&g_untrackedCrashReportCount) > 0)
+    {
+        return false;
+    }
+    *lowestID = INT64_MAX;
+    for(int i = 0; i < MAX_CRASH_REPORT_SLOTS; i++)
+    {
+        uint32_t state = atomic_load(&g_crashReportSlotStates[i]);
+        if(state == SlotClaimed)
+        {
+            return false;
+        }
+        if((state == SlotPending || state == SlotReady) && g_crashReportSlotIDs[i] < *lowestID)
+        {
+            *lowestID = g_crashReportSlotIDs[i];
+        }
+    }
+    return true;
+}
+
+/** Put crash reports written since the last look into the index.
+ * Must be called with g_mutex held.
+ *
+ * @return The number of reports added.
+ */
+static int indexWrittenCrashReports()
+{
+    int reportCount = 0;
+    for(int i = 0; i < MAX_CRASH_REPORT_SLOTS; i++)
+    {
+        if(atomic_load(&g_crashReportSlotStates[i]) != SlotReady)
+        {
+            continue;
+        }
+        IndexEntry entry;
+        // It may have been deleted already.
+        if(loadMetadataFromDisk(g_crashReportSlotIDs[i], &entry.metadata))
+        {
+            entry.segmentID = 0;
+            entry.segmentOffset = 0;
+            putInIndex(&entry);
+            reportCount++;
+        }
+        atomic_store(&g_crashReportSlotStates[i], SlotFree);
+    }
+    return reportCount;
+}
+
+
+// Upload cursor
+
+static int64_t readUploadCursor()
+{
+    char path[CLKSCRS_MAX_PATH_LENGTH];
+    getUploadCursorPath(path);
+    int fd = open(path, O_RDONLY);
+    if(fd < 0)
+    {
+        // Nothing has been uploaded yet.
+        return 0;
+    }
+    char buffer[32];
+    int64_t cursor = 0;
+    int length = clksfu_readLineFromFD(fd, buffer, sizeof(buffer));
+    close(fd);
+    if(length <= 0 || sscanf(buffer, "%" PRIx64, &cursor) != 1)
+    {
+        CLKSLOG_ERROR("Upload cursor %s is unreadable", path);
+        return 0;
+    }
+    return cursor;
+}
+
+/** Write the cursor under a temporary name, sync it, and rename it into place.
+ */
+static bool writeUploadCursor(int64_t cursor)
+{
+    char path[CLKSCRS_MAX_PATH_LENGTH];
+    char tempPath[CLKSCRS_MAX_PATH_LENGTH + 4];
+    getUploadCursorPath(path);
+    snprintf(tempPath, sizeof(tempPath), "%s.tmp", path);
+    int fd = open(tempPath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(fd < 0)
+    {
+        CLKSLOG_ERROR("Could not open file %s: %s", tempPath, strerror(errno));
+        return false;
+    }
+    bool isSuccessful = clksfu_writeFmtToFD(fd, "%016llx\n", cursor) && syncFile(fd) == 0;
+    close(fd);
+    if(isSuccessful && rename(tempPath, path) != 0)
+    {
+        CLKSLOG_ERROR("Could not rename %s to %s: %s", tempPath, path, strerror(errno));
+        isSuccessful = false;
+    }
+    if(!isSuccessful)
+    {
+        unlink(tempPath);
+    }
+    return isSuccessful;
+}
+
+/** Mark every report up to the cursor as sent. This finishes the job if the
+ * process died between moving the cursor and updating the reports.
+ * Reports in segments are left without metadata files, since the cursor
+ * marks them sent again every time the index is rebuilt.
+ * Must be called with g_mutex held.
+ */
+static void markReportsUpToCursorSent()
+{
+    for(int i = 0; i < g_indexCount && g_index[i].metadata.reportID <= g_uploadCursor; i++)
+    {
+        CLKSCrashReportMetadata* metadata = &g_index[i].metadata;
+        if(!metadata->sent)
+        {
+            metadata->sent = 1;
+            metadata->sendAttempts++;
+            if(g_index[i].segmentID == 0)
+            {
+                writeMetadata(metadata);
+            }
+        }
+    }
+}
+
+/** Find how far the cursor can move: up to just before the oldest report
+ * that hasn't been sent, counting crash reports that aren't in the index yet.
+ * It never moves past the index, so reports added later stay above it.
+ * Must be called with g_mutex held.
+ */
+static int64_t getSafeUploadCursor()
+{
+    int64_t lowestUnindexedID;
+    // Untracked reports only stop being counted once the index has been marked
+    // stale, so check in this order. A stale index is missing reports until it's rebuilt.
+    if(!getLowestUnindexedCrashReportID(&lowestUnindexedID) || atomic_load(&g_isIndexStale))
+    {
+        return g_uploadCursor;
+    }
+    int64_t cursor = g_uploadCursor;
+    for(int i = 0; i < g_indexCount; i++)
+    {
+        const CLKSCrashReportMetadata* metadata = &g_index[i].metadata;
+        if(metadata->reportID <= g_uploadCursor)
+        {
+            continue;
+        }
+        if(!metadata->sent || metadata->reportID >= lowestUnindexedID)
+        {
+            break;
+        }
+        cursor = metadata->reportID;
+    }
+    return cursor;
+}
+
+
+// Write queue
+
+static void flushWriteQueue()
+{
+    pthread_mutex_lock(&g_queueMutex);
+    g_flushWaiterCount++;
+    pthread_cond_signal(&g_queueChanged);
+    while(g_queueHead != NULL || g_isWriting)
+    {
+        pthread_cond_wait(&g_queueWritten, &g_queueMutex);
+    }
+    g_flushWaiterCount--;
+    pthread_mutex_unlock(&g_queueMutex);
+}
+
+/** Make every user report added so far available, by putting the reports
+ * from newly written segments into the index. Segments are never read here.
+ * Must be called with g_mutex held.
+ *
+ * @return The number of reports added.
+ */
+static int indexWrittenSegments()
+{
+    flushWriteQueue();
+    WrittenSegment* segments = takeWrittenSegments();
+    int reportCount = 0;
+    for(const WrittenSegment* segment = segments; segment != NULL; segment = segment->next)
+    {
+        // A rebuild may have found it on disk already.
+        if(findSegment(segment->segmentID) >= 0)
+        {
+            continue;
+        }
+        if(!addSegment(segment->segmentID, segment->recordCount))
+        {
+            atomic_store(&g_isIndexStale, true);
+            continue;
+        }
+        for(int i = 0; i < segment->recordCount; i++)
+        {
+            IndexEntry entry;
+            makeSegmentEntry(&entry, segment->segmentID, &segment->records[i]);
+            putInIndex(&entry);
+        }
+        reportCount += segment->recordCount;
+    }
+    freeWrittenSegments(segments);
+    return reportCount;
+}
+
+/** Bring the index up to date with everything added to the store, and
+ * enforce the store's limits if anything was added.
+ * Must be called with g_mutex held.
+ */
+static void syncIndex()
+{
+    bool isChanged = atomic_exchange(&g_isIndexStale, false);
+    if(isChanged)
+    {
+        rebuildIndex(false);
+        markReportsUpToCursorSent();
+    }
+    if(indexWrittenCrashReports() > 0)
+    {
+        isChanged = true;
+    }
+    if(indexWrittenSegments() > 0)
+    {
+        isChanged = true;
+    }
+    if(isChanged)
+    {
+        collapseDuplicates();
+        enforceLimits();
+    }
+}
+
+static void freeBatch(QueuedReport* batch)
+{
+    while(batch != NULL)
+    {
+        QueuedReport* next = batch->next;
+        free(batch);
+        batch = next;
+    }
+}
+
+static void* runWriter(__unused void* userData)
+{
+#ifdef __APPLE__
+    pthread_setname_np("CLKSCrash Report Writer");
+#endif
+    pthread_mutex_lock(&g_queueMutex);
+    for(;;)
+    {
+        while(g_queueHead == NULL)
+        {
+            pthread_cond_wait(&g_queueChanged, &g_queueMutex);
+        }
+
+        // Give the batch a chance to fill up, unless someone is waiting on it.
+        struct timespec deadline = g_oldestQueuedTime;
+        int64_t delayNs = (int64_t)(g_maxBatchDelay * 1000000000.0);
+        deadline.tv_sec += (time_t)(delayNs / 1000000000);
+        deadline.tv_nsec += (long)(delayNs % 1000000000);
+        if(deadline.tv_nsec >= 1000000000)
+        {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
+        }
+        while(g_flushWaiterCount == 0 && g_queueStats.queuedBytes < g_maxBatchBytes)
+        {
+            if(pthread_cond_timedwait(&g_queueChanged, &g_queueMutex, &deadline) == ETIMEDOUT)
+            {
+                break;
+            }
+        }
+
+        QueuedReport* batch = g_queueHead;
+        int reportCount = g_queueStats.queuedReports;
+        CLKSCrashReportDurability durability = g_durability;
+        g_queueHead = g_queueTail = NULL;
+        g_queueStats.queuedReports = 0;
+        g_queueStats.queuedBytes = 0;
+        g_isWriting = true;
+        pthread_mutex_unlock(&g_queueMutex);
+
+        WrittenSegment* segment = writeSegment(batch, durability);
+        freeBatch(batch);
+
+        pthread_mutex_lock(&g_queueMutex);
+        g_isWriting = false;
+        if(segment != NULL)
+        {
+            addWrittenSegment(segment);
+            g_queueStats.segmentsWritten++;
+            g_queueStats.reportsWritten += (uint64_t)reportCount;
+        }
+        else
+        {
+            g_queueStats.droppedReports += (uint64_t)reportCount;
+        }
+        pthread_cond_broadcast(&g_queueWritten);
+    }
+    return NULL;
+}
+
+/** Must be called with g_queueMutex held.
+ */
+static bool startWriterIfNeeded()
+{
+    if(g_isWriterStarted)
+    {
+        return true;
+    }
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    pthread_t thread;
+    int error = pthread_create(&thread, &attr, runWriter, NULL);
+    pthread_attr_destroy(&attr);
+    if(error != 0)
+    {
+        CLKSLOG_ERROR("Could not start report writer thread: %s", strerror(error));
+        return false;
+    }
+    g_isWriterStarted = true;
+    return true;
+}
+
+
+// Compression at rest
+
+static Codec detectCodec(int fd)
+{
+    unsigned char magic[4] = {0};
+    int bytesRead = (int)pread(fd, magic, sizeof(magic), 0);
+    if(bytesRead >= 2 && magic[0] == 0x1f && magic[1] == 0x8b)
+    {
+        return CodecGZip;
+    }
+    if(bytesRead == 4 && magic[0] == 0x28 && magic[1] == 0xb5 && magic[2] == 0x2f && magic[3] == 0xfd)
+    {
+        return CodecZstd;
+    }
+    return CodecPlain;
+}
+
+static CLKSCrashReportReader* openReader(int fd, const char* path)
+{
+    struct stat st;
+    if(fstat(fd, &st) != 0)
+    {
+        CLKSLOG_ERROR("Could not stat %s: %s", path, strerror(errno));
+        close(fd);
+        return NULL;
+    }
+
+    Codec codec = detectCodec(fd);
+    if(codec == CodecZstd)
+    {
+        CLKSLOG_ERROR("%s is zstd compressed, which is not supported", path);
+        close(fd);
+        return NULL;
+    }
+
+    CLKSCrashReportReader* reader = calloc(1, sizeof(*reader));
+    if(reader == NULL)
+    {
+        CLKSLOG_ERROR("Could not allocate reader for %s", path);
+        close(fd);
+        return NULL;
+    }
+    reader->fd = fd;
+    reader->length = (int64_t)st.st_size;
+    reader->remaining = reader->length;
+    if(codec == CodecGZip)
+    {
+        // The gzip trailer ends with the uncompressed length, modulo 2^32.
+        uint8_t trailer[4] = {0};
+        if(st.st_size < 18 || pread(fd, trailer, sizeof(trailer), st.st_size - 4) != sizeof(trailer))
+        {
+            CLKSLOG_ERROR("%s is truncated", path);
+            close(fd);
+            free(reader);
+            return NULL;
+        }
+        reader->length = (int64_t)trailer[0] |
+                         (int64_t)trailer[1] << 8 |
+                         (int64_t)trailer[2] << 16 |
+                         (int64_t)trailer[3] << 24;
+        // Nothing checks the trailer until the end, so don't let it size anyone's buffers beyond reason.
+        // Reading stops with an error if the contents don't match it.
+        if(reader->length > MAX_REPORT_LENGTH)
+        {
+            CLKSLOG_ERROR("%s claims to be %lld bytes uncompressed, which is too long", path, reader->length);
+            close(fd);
+            free(reader);
+            return NULL;
+        }
+        reader->remaining = reader->length;
+        int err = inflateInit2(&reader->stream, 16 + MAX_WBITS);
+        if(err != Z_OK)
+        {
+            CLKSLOG_ERROR("inflateInit2 failed for %s: %d", path, err);
+            close(fd);
+            free(reader);
+            return NULL;
+        }
+        reader->isCompressed = true;
+    }
+    return reader;
+}
+
+/** Open a report that is held in a segment. These are never compressed.
+ */
+static CLKSCrashReportReader* openSegmentReader(int fd, const char* path, int64_t offset, int64_t length)
+{
+    if(lseek(fd, (off_t)offset, SEEK_SET) < 0)
+    {
+        CLKSLOG_ERROR("Could not seek to %lld in %s: %s", offset, path, strerror(errno));
+        close(fd);
+        return NULL;
+    }
+    CLKSCrashReportReader* reader = calloc(1, sizeof(*reader));
+    if(reader == NULL)
+    {
+        CLKSLOG_ERROR("Could not allocate reader for %s", path);
+        close(fd);
+        return NULL;
+    }
+    reader->fd = fd;
+    reader->length = length;
+    reader->remaining = length;
+    return reader;
+}
+
+/** Gzip a report in place, through a temporary file.
+ * The report is left as it is if compressing it doesn't make it smaller.
+ * Must be called with g_mutex held.
+ *
+ * @return true if the report was compressed.
+ */
+static bool compressReport(int64_t reportID, int compressionLevel)
+{
+    char path[CLKSCRS_MAX_PATH_LENGTH];
+    char tempPath[CLKSCRS_MAX_PATH_LENGTH + 4];
+    getCrashReportPathByID(reportID, path);
+    snprintf(tempPath, sizeof(tempPath), "%s.tmp", path);
+
+    bool isSuccessful = false;
+    bool isStreamOpen = false;
+    int outFD = -1;
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    int inFD = open(path, O_RDONLY);
+    if(inFD < 0 || detectCodec(inFD) != CodecPlain)
+    {
+        goto done;
+    }
+    outFD = open(tempPath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(outFD < 0)
+    {
+        CLKSLOG_ERROR("Could not open file %s: %s", tempPath, strerror(errno));
+        goto done;
+    }
+    int err = deflateInit2(&stream, compressionLevel, Z_DEFLATED, 16 + MAX_WBITS, 8, Z_DEFAULT_STRATEGY);
+    if(err != Z_OK)
+    {
+        CLKSLOG_ERROR("deflateInit2 failed: %d", err);
+        goto done;
+    }
+    isStreamOpen = true;
+
+    Bytef input[CODEC_BUFFER_SIZE];
+    Bytef output[CODEC_BUFFER_SIZE];
+    int flush = Z_NO_FLUSH;
+    while(flush != Z_FINISH)
+    {
+        int bytesRead = (int)read(inFD, input, sizeof(input));
+        if(bytesRead < 0)
+        {
+            CLKSLOG_ERROR("Could not read %s: %s", path, strerror(errno));
+            goto done;
+        }
+        flush = bytesRead == 0 ? Z_FINISH : Z_NO_FLUSH;
+        stream.next_in = input;
+        stream.avail_in = (uInt)bytesRead;
+        do
+        {
+            stream.next_out = output;
+            stream.avail_out = sizeof(output);
+            // Z_BUF_ERROR only means no progress was possible this time round.
+            err = deflate(&stream, flush);
+            if(err == Z_STREAM_ERROR)
+            {
+                CLKSLOG_ERROR("Could not compress %s: %s", path, stream.msg != NULL ? stream.msg : "stream error");
+                goto done;
+            }
+            int outputLength = (int)(sizeof(output) - stream.avail_out);
+            if(!clksfu_writeBytesToFD(outFD, (const char*)output, outputLength))
+            {
+                goto done;
+            }
+        } while(stream.avail_out == 0);
+    }
+    if(err != Z_STREAM_END)
+    {
+        CLKSLOG_ERROR("Could not finish compressing %s: %d", path, err);
+        goto done;
+    }
+    if(stream.total_out >= stream.total_in)
+    {
+        CLKSLOG_DEBUG("Compressing %s doesn't make it smaller. Leaving it as is.", path);
+        goto done;
+    }
+    if(close(outFD) != 0)
+    {
+        CLKSLOG_ERROR("Could not close %s: %s", tempPath, strerror(errno));
+        outFD = -1;
+        goto done;
+    }
+    outFD = -1;
+    if(rename(tempPath, path) != 0)
+    {
+        CLKSLOG_ERROR("Could not rename %s to %s: %s", tempPath, path, strerror(errno));
+        goto done;
+    }
+    isSuccessful = true;
+
+    int index = findInIndex(reportID);
+    if(index >= 0)
+    {
+        g_index[index].metadata.reportSize = (int64_t)stream.total_out;
+        writeMetadata(&g_index[index].metadata);
+    }
+
+done:
+    if(isStreamOpen)
+    {
+        deflateEnd(&stream);
+    }
+    if(inFD >= 0)
+    {
+        close(inFD);
+    }
+    if(outFD >= 0)
+    {
+        close(outFD);
+    }
+    if(!isSuccessful)
+    {
+        unlink(tempPath);
+    }
+    return isSuccessful;
+}
+
+/** Start IDs from the current time, but always after any ID already handed out,
+ * since the upload cursor relies on them increasing.
+ */
+static void initializeIDs(int64_t lastUsedID)
+{
+    time_t rawTime;
+    time(&rawTime);
+    struct tm time;
+    gmtime_r(&rawTime, &time);
+    int64_t baseID = (int64_t)time.tm_sec
+                   + (int64_t)time.tm_min * 61
+                   + (int64_t)time.tm_hour * 61 * 60
+                   + (int64_t)time.tm_yday * 61 * 60 * 24
+                   + (int64_t)time.tm_year * 61 * 60 * 24 * 366;
+    baseID <<= 23;
+    if(baseID <= lastUsedID)
+    {
+        baseID = lastUsedID + 1;
+    }
+
+    g_nextUniqueIDHigh = baseID & ~(int64_t)0xffffffff;
+    g_nextUniqueIDLow = (uint32_t)(baseID & 0xffffffff);
+}
+
+
+// Public API
+
+void clkscrs_initialize(const char* appName, const char* reportsPath)
+{
+    pthread_mutex_lock(&g_mutex);
+    g_appName = strdup(appName);
+    g_reportsPath = strdup(reportsPath);
+    clksfu_makePath(reportsPath);
+    atomic_store(&g_isIndexStale, false);
+    rebuildIndex(true);
+    g_uploadCursor = readUploadCursor();
+    markReportsUpToCursorSent();
+    collapseDuplicates();
+    enforceLimits();
+    int64_t lastUsedID = g_indexCount > 0 ? g_index[g_indexCount - 1].metadata.reportID : 0;
+    initializeIDs(lastUsedID > g_uploadCursor ? lastUsedID : g_uploadCursor);
+    pthread_mutex_unlock(&g_mutex);
+}
+
+int64_t clkscrs_getNextCrashReport(char *crashReportPathBuffer)
+{
+    // Claim the slot first, so that there's never an ID out that the upload cursor can't see.
+    int slot = claimCrashReportSlot();
+    if(slot < 0)
+    {
+        atomic_fetch_add(&g_untrackedCrashReportCount, 1);
+    }
+    int64_t nextID = getNextUniqueID();
+    if(slot >= 0)
+    {
+        g_crashReportSlotIDs[slot] = nextID;
+        atomic_store(&g_crashReportSlotStates[slot], SlotPending);
+    }
+    if(crashReportPathBuffer)
+    {
+        getCrashReportPathByID(nextID, crashReportPathBuffer);
+    }
+    return nextID;
+}
+
+int clkscrs_getReportCount()
+{
+    pthread_mutex_lock(&g_mutex);
+    syncIndex();
+    int count = g_indexCount;
+    pthread_mutex_unlock(&g_mutex);
+    return count;
+}
+
+int clkscrs_getReportIDs(int64_t *reportIDs, int count)
+{
+    pthread_mutex_lock(&g_mutex);
+    syncIndex();
+    if(count > g_indexCount)
+    {
+        count = g_indexCount;
+    }
+    for(int i = 0; i < count; i++)
+    {
+        reportIDs[i] = g_index[i].metadata.reportID;
+    }
+    pthread_mutex_unlock(&g_mutex);
+    return count;
+}
+
+void clkscrs_writeReportMetadata(int64_t reportID,
+                                 CLKSCrashReportKind kind,
+                                 const char* crashType,
+                                 uint64_t fingerprint)
+{
+    CLKSCrashReportMetadata metadata;
+    memset(&metadata, 0, sizeof(metadata));
+    metadata.magic = METADATA_MAGIC;
+    metadata.version = METADATA_VERSION;
+    metadata.kind = (uint8_t)kind;
+    metadata.reportID = reportID;
+    metadata.timestamp = (int64_t)time(NULL);
+    metadata.fingerprint = fingerprint;
+    if(crashType != NULL)
+    {
+        strncpy(metadata.crashType, crashType, sizeof(metadata.crashType) - 1);
+    }
+
+    char path[CLKSCRS_MAX_PATH_LENGTH];
+    getCrashReportPathByID(reportID, path);
+    struct stat st;
+    if(stat(path, &st) == 0)
+    {
+        metadata.reportSize = (int64_t)st.st_size;
+    }
+    writeMetadata(&metadata);
+    // This may be a crash handler, so leave updating the index to the next reader.
+    addWrittenCrashReport(reportID);
+}
+
+bool clkscrs_getReportMetadata(int64_t reportID, CLKSCrashReportMetadata* metadata)
+{
+    pthread_mutex_lock(&g_mutex);
+    syncIndex();
+    bool exists = loadMetadata(reportID, metadata);
+    pthread_mutex_unlock(&g_mutex);
+    return exists;
+}
+
+int clkscrs_getAllReportMetadata(CLKSCrashReportMetadata* metadata, int count)
+{
+    pthread_mutex_lock(&g_mutex);
+    syncIndex();
+    if(count > g_indexCount)
+    {
+        count = g_indexCount;
+    }
+    for(int i = 0; i < count; i++)
+    {
+        metadata[i] = g_index[i].metadata;
+    }
+    pthread_mutex_unlock(&g_mutex);
+    return count;
+}
+
+int clkscrs_getReportIDsMatching(const CLKSCrashReportFilter* filter, int64_t* reportIDs, int count)
+{
+    pthread_mutex_lock(&g_mutex);
+    syncIndex();
+    int index = 0;
+    for(int i = 0; i < g_indexCount && index < count; i++)
+    {
+        if(metadataMatches(&g_index[i].metadata, filter))
+        {
+            reportIDs[index++] = g_index[i].metadata.reportID;
+        }
+    }
+    pthread_mutex_unlock(&g_mutex);
+    return index;
+}
+
+int64_t clkscrs_getTotalReportSize()
+{
+    pthread_mutex_lock(&g_mutex);
+    syncIndex();
+    int64_t totalSize = 0;
+    for(int i = 0; i < g_indexCount; i++)
+    {
+        totalSize += g_index[i].metadata.reportSize;
+    }
+    pthread_mutex_unlock(&g_mutex);
+    return totalSize;
+}
+
+void clkscrs_markReportSendAttempt(int64_t reportID, bool sent)
+{
+    pthread_mutex_lock(&g_mutex);
+    syncIndex();
+    int index = findInIndex(reportID);
+    if(index >= 0)
+    {
+        g_index[index].metadata.sendAttempts++;
+        if(sent)
+        {
+            g_index[index].metadata.sent = 1;
+        }
+        writeMetadata(&g_index[index].metadata);
+    }
+    pthread_mutex_unlock(&g_mutex);
+}
+
+char* clkscrs_readReport(int64_t reportID)
+{
+    CLKSCrashReportReader* reader = clkscrs_openReport(reportID);
+    if(reader == NULL)
+    {
+        return NULL;
+    }
+    char* result = NULL;
+    if(reader->length > MAX_REPORT_LENGTH)
+    {
+        CLKSLOG_ERROR("Report %016llx is too long (%lld bytes)", reportID, reader->length);
+        goto done;
+    }
+    int length = (int)reader->length;
+    result = malloc((unsigned)length + 1);
+    if(result == NULL)
+    {
+        CLKSLOG_ERROR("Could not allocate %d bytes for report %016llx", length + 1, reportID);
+        goto done;
+    }
+    int offset = 0;
+    int bytesRead;
+    while(offset < length && (bytesRead = clkscrs_readReportChunk(reader, result + offset, length - offset)) > 0)
+    {
+        offset += bytesRead;
+    }
+    // A compressed report also has to end where its trailer says.
+    char extra;
+    if(offset < length || clkscrs_readReportChunk(reader, &extra, 1) != 0)
+    {
+        CLKSLOG_ERROR("Could not read all of report %016llx", reportID);
+        free(result);
+        result = NULL;
+        goto done;
+    }
+    result[length] = '\0';
+
+done:
+    clkscrs_closeReport(reader);
+    return result;
+}
+
+CLKSCrashReportReader* clkscrs_openReport(int64_t reportID)
+{
+    pthread_mutex_lock(&g_mutex);
+    syncIndex();
+    char path[CLKSCRS_MAX_PATH_LENGTH];
+    int index = findInIndex(reportID);
+    const bool isInSegment = index >= 0 && g_index[index].segmentID != 0;
+    int64_t segmentOffset = 0;
+    int64_t segmentLength = 0;
+    if(isInSegment)
+    {
+        getSegmentPathByID(g_index[index].segmentID, path);
+        segmentOffset = g_index[index].segmentOffset;
+        segmentLength = g_index[index].metadata.reportSize;
+    }
+    else
+    {
+        getCrashReportPathByID(reportID, path);
+    }
+    // Once open, the report stays readable even if it's compressed or deleted in the meantime.
+    int fd = open(path, O_RDONLY);
+    pthread_mutex_unlock(&g_mutex);
+    if(fd < 0)
+    {
+        CLKSLOG_ERROR("Could not open file %s: %s", path, strerror(errno));
+        return NULL;
+    }
+    if(isInSegment)
+    {
+        return openSegmentReader(fd, path, segmentOffset, segmentLength);
+    }
+    return openReader(fd, path);
+}
+
+int64_t clkscrs_getReportLength(const CLKSCrashReportReader* reader)
+{
+    return reader->length;
+}
+
+int clkscrs_readReportChunk(CLKSCrashReportReader* reader, char* buffer, int bufferLength)
+{
+    if(!reader->isCompressed)
+    {
+        if(bufferLength > reader->remaining)
+        {
+            bufferLength = (int)reader->remaining;
+        }
+        int bytesRead = (int)read(reader->fd, buffer, (size_t)bufferLength);
+        if(bytesRead < 0)
+        {
+            CLKSLOG_ERROR("Could not read report: %s", strerror(errno));
+            return bytesRead;
+        }
+        reader->remaining -= bytesRead;
+        return bytesRead;
+    }
+    if(reader->isAtEnd)
+    {
+        return 0;
+    }
+
+    // Never return more than the length the report was opened with.
+    Bytef overflow[1];
+    const bool isCheckingEnd = reader->remaining == 0;
+    if(bufferLength > reader->remaining)
+    {
+        bufferLength = (int)reader->remaining;
+    }
+    z_stream* stream = &reader->stream;
+    stream->next_out = isCheckingEnd ? overflow : (Bytef*)buffer;
+    stream->avail_out = isCheckingEnd ? sizeof(overflow) : (uInt)bufferLength;
+    while(stream->avail_out > 0)
+    {
+        if(stream->avail_in == 0)
+        {
+            int bytesRead = (int)read(reader->fd, reader->input, sizeof(reader->input));
+            if(bytesRead <= 0)
+            {
+                CLKSLOG_ERROR("Compressed report is truncated");
+                return -1;
+            }
+            stream->next_in = reader->input;
+            stream->avail_in = (uInt)bytesRead;
+        }
+        int err = inflate(stream, Z_NO_FLUSH);
+        if(err == Z_STREAM_END)
+        {
+            reader->isAtEnd = true;
+            break;
+        }
+        if(err != Z_OK)
+        {
+            CLKSLOG_ERROR("Could not decompress report: %s", stream->msg != NULL ? stream->msg : "unknown error");
+            return -1;
+        }
+    }
+    if(isCheckingEnd)
+    {
+        if(!reader->isAtEnd || stream->avail_out == 0)
+        {
+            CLKSLOG_ERROR("Compressed report is longer than its trailer says");
+            return -1;
+        }
+        return 0;
+    }
+    int bytesRead = bufferLength - (int)stream->avail_out;
+    reader->remaining -= bytesRead;
+    if(reader->isAtEnd && reader->remaining != 0)
+    {
+        CLKSLOG_ERROR("Compressed report is shorter than its trailer says");
+        return -1;
+    }
+    return bytesRead;
+}
+
+void clkscrs_closeReport(CLKSCrashReportReader* reader)
+{
+    if(reader == NULL)
+    {
+        return;
+    }
+    if(reader->isCompressed)
+    {
+        inflateEnd(&reader->stream);
+    }
+    close(reader->fd);
+    free(reader);
+}
+
+void clkscrs_setCompressionLevel(int compressionLevel)
+{
+    g_compressionLevel = compressionLevel < 0 ? 0 : compressionLevel > 9 ? 9 : compressionLevel;
+}
+
+int clkscrs_compressReports()
+{
+    const int compressionLevel = g_compressionLevel;
+    if(compressionLevel == 0)
+    {
+        return 0;
+    }
+
+    pthread_mutex_lock(&g_mutex);
+    syncIndex();
+    int reportCount = 0;
+    // The lock is dropped while compressing, so this can't share the scratch space.
+    int64_t* reportIDs = malloc(sizeof(*reportIDs) * (size_t)(g_indexCount > 0 ? g_indexCount : 1));
+    if(reportIDs == NULL)
+    {
+        CLKSLOG_ERROR("Could not allocate list of %d reports to compress", g_indexCount);
+        pthread_mutex_unlock(&g_mutex);
+        return 0;
+    }
+    for(int i = 0; i < g_indexCount; i++)
+    {
+        // Reports in segments stay as they are.
+        if(g_index[i].segmentID == 0)
+        {
+            reportIDs[reportCount++] = g_index[i].metadata.reportID;
+        }
+    }
+    pthread_mutex_unlock(&g_mutex);
+
+    // Take the lock per report so that reads aren't held up for the whole pass.
+    int compressedCount = 0;
+    for(int i = 0; i < reportCount; i++)
+    {
+        pthread_mutex_lock(&g_mutex);
+        if(compressReport(reportIDs[i], compressionLevel))
+        {
+            compressedCount++;
+        }
+        pthread_mutex_unlock(&g_mutex);
+    }
+    free(reportIDs);
+    CLKSLOG_DEBUG("Compressed %d of %d reports", compressedCount, reportCount);
+    return compressedCount;
+}
+
+int64_t clkscrs_addUserReport(const char *report, int reportLength)
+{
+    QueuedReport* queuedReport = malloc(sizeof(*queuedReport) + (size_t)reportLength);
+    if(queuedReport == NULL)
+    {
+        CLKSLOG_ERROR("Could not allocate %d bytes for user report", reportLength);
+        return 0;
+    }
+    queuedReport->next = NULL;
+    queuedReport->timestamp = (int64_t)time(NULL);
+    queuedReport->length = reportLength;
+    memcpy(queuedReport->contents, report, (size_t)reportLength);
+
+    pthread_mutex_lock(&g_queueMutex);
+    // IDs must reach the queue in order. Otherwise a report could still be on its
+    // way in after a later one was uploaded, and the upload cursor would skip it.
+    const int64_t reportID = getNextUniqueID();
+    queuedReport->reportID = reportID;
+    if(g_queueHead != NULL && g_queueStats.queuedBytes + reportLength > MAX_QUEUED_BYTES)
+    {
+        g_queueStats.droppedReports++;
+        pthread_mutex_unlock(&g_queueMutex);
+        CLKSLOG_ERROR("User report queue is full. Dropping report of %d bytes", reportLength);
+        free(queuedReport);
+        return 0;
+    }
+    if(!startWriterIfNeeded())
+    {
+        // Fall back to writing it on this thread. Keep the lock so that
+        // flushes wait for it, and later reports can't overtake it.
+        WrittenSegment* segment = writeSegment(queuedReport, g_durability);
+        if(segment != NULL)
+        {
+            addWrittenSegment(segment);
+        }
+        pthread_mutex_unlock(&g_queueMutex);
+        free(queuedReport);
+        return segment != NULL ? reportID : 0;
+    }
+    if(g_queueTail == NULL)
+    {
+        g_queueHead = queuedReport;
+        clock_gettime(CLOCK_REALTIME, &g_oldestQueuedTime);
+    }
+    else
+    {
+        g_queueTail->next = queuedReport;
+    }
+    g_queueTail = queuedReport;
+    g_queueStats.queuedReports++;
+    g_queueStats.queuedBytes += reportLength;
+    if(g_queueStats.queuedReports > g_queueStats.peakQueuedReports)
+    {
+        g_queueStats.peakQueuedReports = g_queueStats.queuedReports;
+    }
+    pthread_cond_signal(&g_queueChanged);
+    pthread_mutex_unlock(&g_queueMutex);
+
+    return reportID;
+}
+
+void clkscrs_setWriteQueue(int maxBatchBytes, double maxBatchDelay, CLKSCrashReportDurability durability)
+{
+    pthread_mutex_lock(&g_queueMutex);
+    g_maxBatchBytes = maxBatchBytes;
+    g_maxBatchDelay = maxBatchDelay > 0 ? maxBatchDelay : 0;
+    g_durability = durability;
+    pthread_cond_signal(&g_queueChanged);
+    pthread_mutex_unlock(&g_queueMutex);
+}
+
+void clkscrs_flushUserReports()
+{
+    flushWriteQueue();
+}
+
+void clkscrs_getWriteQueueStats(CLKSCrashReportWriteQueueStats* stats)
+{
+    pthread_mutex_lock(&g_queueMutex);
+    *stats = g_queueStats;
+    pthread_mutex_unlock(&g_queueMutex);
+}
+
+int64_t clkscrs_getUploadCursor()
+{
+    pthread_mutex_lock(&g_mutex);
+    int64_t cursor = g_uploadCursor;
+    pthread_mutex_unlock(&g_mutex);
+    return cursor;
+}
+
+bool clkscrs_markReportsUploaded(const int64_t* reportIDs, int count)
+{
+    pthread_mutex_lock(&g_mutex);
+    syncIndex();
+    for(int i = 0; i < count; i++)
+    {
+        int index = findInIndex(reportIDs[i]);
+        if(index >= 0 && !g_index[index].metadata.sent)
+        {
+            g_index[index].metadata.sent = 1;
+            g_index[index].metadata.sendAttempts++;
+        }
+    }
+
+    bool isSuccessful = true;
+    int64_t cursor = getSafeUploadCursor();
+    if(cursor > g_uploadCursor)
+    {
+        if(writeUploadCursor(cursor))
+        {
+            g_uploadCursor = cursor;
+        }
+        else
+        {
+            isSuccessful = false;
+        }
+    }
+    for(int i = 0; i < count; i++)
+    {
+        int index = findInIndex(reportIDs[i]);
+        if(index < 0)
+        {
+            continue;
+        }
+        if(reportIDs[i] > g_uploadCursor)
+        {
+            // Nothing else records that this one was sent.
+            isSuccessful &= writeMetadataToDisk(&g_index[index].metadata, true);
+        }
+        else if(g_index[index].segmentID == 0)
+        {
+            writeMetadata(&g_index[index].metadata);
+        }
+    }
+    pthread_mutex_unlock(&g_mutex);
+    return isSuccessful;
+}
+
+void clkscrs_deleteAllReports()
+{
+    pthread_mutex_lock(&g_mutex);
+    flushWriteQueue();
+    freeWrittenSegments(takeWrittenSegments());
+    clksfu_deleteContentsOfPath(g_reportsPath);
+    g_indexCount = 0;
+    g_segmentCount = 0;
+    // The cursor file went with everything else. IDs keep increasing, so nothing gets resent.
+    pthread_mutex_unlock(&g_mutex);
+}
+
+void clkscrs_deleteReportWithID(int64_t reportID)
+{
+    pthread_mutex_lock(&g_mutex);
+    deleteReport(reportID);
+    pthread_mutex_unlock(&g_mutex);
+}
+
+void clkscrs_deleteReportsWithIDs(const int64_t* reportIDs, int count)
+{
+    pthread_mutex_lock(&g_mutex);
+    char path[CLKSCRS_MAX_PATH_LENGTH];
+    // Reports from the same segment come in runs, which get one tombstone write each.
+    int64_t runSegmentID = 0;
+    int runStart = 0;
+    for(int i = 0; i <= count; i++)
+    {
+        int64_t segmentID = 0;
+        if(i < count)
+        {
+            int index = findInIndex(reportIDs[i]);
+            segmentID = index >= 0 ? g_index[index].segmentID : 0;
+        }
+        if(segmentID != runSegmentID)
+        {
+            if(runSegmentID != 0)
+            {
+                deleteFromSegment(runSegmentID, &reportIDs[runStart], i - runStart);
+            }
+            runSegmentID = segmentID;
+            runStart = i;
+        }
+        if(i == count)
+        {
+            break;
+        }
+        if(segmentID == 0)
+        {
+            getCrashReportPathByID(reportIDs[i], path);
+            clksfu_removeFile(path, true);
+        }
+        getMetadataPathByID(reportIDs[i], path);
+        clksfu_removeFile(path, false);
+    }
+    // Compact the index in one pass instead of shifting it once per report.
+    int keptCount = 0;
+    for(int i = 0; i < g_indexCount; i++)
+    {
+        if(bsearch(&g_index[i].metadata.reportID, reportIDs, (size_t)count, sizeof(*reportIDs), compareInt64) == NULL)
+        {
+            g_index[keptCount++] = g_index[i];
+        }
+    }
+    g_indexCount = keptCount;
+    pthread_mutex_unlock(&g_mutex);
+}
+
+void clkscrs_setMaxReportCount(int maxReportCount)
+{
+    g_maxReportCount = maxReportCount;
+}
+
+void clkscrs_setMaxTotalReportSize(int64_t maxTotalReportSize)
+{
+    g_maxTotalReportSize = maxTotalReportSize;
+}
+
+void clkscrs_setCollapsesDuplicates(bool collapsesDuplicates)
+{
+    g_collapsesDuplicates = collapsesDuplicates;
+}
+
+void clkscrs_setMaxReportAge(int64_t maxReportAge)
+{
+    g_maxReportAge = maxReportAge;
 }
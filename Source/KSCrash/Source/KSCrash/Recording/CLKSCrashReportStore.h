@@ -32,10 +32,100 @@ extern "C" {
 #endif
 
 
+#include <stdbool.h>
 #include <stdint.h>
 
 #define CLKSCRS_MAX_PATH_LENGTH 500
 
+/** Maximum length of the crash type recorded in a report's metadata, including the NUL. */
+#define CLKSCRS_MAX_CRASH_TYPE_LENGTH 32
+
+/** What produced a report. */
+typedef enum
+{
+    /** The report predates metadata records, or its record is unreadable. */
+    CLKSCrashReportKindUnknown = 0,
+    CLKSCrashReportKindStandard = 1,
+    /** A standard report that was rewritten after crashing during crash handling. */
+    CLKSCrashReportKindRecrash = 2,
+    /** Added via clkscrs_addUserReport(). */
+    CLKSCrashReportKindUser = 3,
+} CLKSCrashReportKind;
+
+/** Fixed-layout record stored next to each report, so that reports can be
+ * listed and filtered without reading their contents.
+ */
+typedef struct
+{
+    uint32_t magic;
+    uint16_t version;
+    /** A CLKSCrashReportKind. */
+    uint8_t kind;
+    /** Nonzero once the report has been sent successfully. */
+    uint8_t sent;
+    int64_t reportID;
+    /** When the report was written (seconds since the epoch). */
+    int64_t timestamp;
+    /** Size of the report file in bytes. */
+    int64_t reportSize;
+    /** How many times sending has been attempted. */
+    uint32_t sendAttempts;
+    uint32_t reserved;
+    /** Name of the monitor that caught the crash (e.g. "Signal"), or empty. */
+    char crashType[CLKSCRS_MAX_CRASH_TYPE_LENGTH];
+
+    // Version 2
+
+    /** Identifies crashes with the same cause (0 = none). */
+    uint64_t fingerprint;
+    /** When the latest duplicate folded into this report was written (0 = none). */
+    int64_t lastDuplicateTimestamp;
+    /** How many duplicates have been folded into this report. */
+    uint32_t duplicateCount;
+    uint32_t reserved2;
+} CLKSCrashReportMetadata;
+
+/** Criteria for selecting reports by their metadata. Zeroed fields match anything. */
+typedef struct
+{
+    /** Bitmask of (1 << CLKSCrashReportKind) values. */
+    uint32_t kindMask;
+    /** Only match reports that haven't been sent. */
+    bool unsentOnly;
+    /** Only match reports written at or after this time. */
+    int64_t minTimestamp;
+    /** Only match reports with this crash type. */
+    const char* crashType;
+} CLKSCrashReportFilter;
+
+/** How hard the user report writer works to get each batch onto disk. */
+typedef enum
+{
+    /** Leave it to the OS to write the batch back. */
+    CLKSCrashReportDurabilityNone = 0,
+    /** Sync each batch to disk before moving on to the next. */
+    CLKSCrashReportDurabilitySyncPerBatch = 1,
+} CLKSCrashReportDurability;
+
+/** A report opened for reading in pieces. */
+typedef struct CLKSCrashReportReader CLKSCrashReportReader;
+
+/** Counters for the user report write queue. */
+typedef struct
+{
+    /** Reports waiting to be written. */
+    int queuedReports;
+    /** Total size of the reports waiting to be written. */
+    int64_t queuedBytes;
+    /** The most reports that have been waiting at once. */
+    int peakQueuedReports;
+    /** Reports thrown away because the queue was full. */
+    uint64_t droppedReports;
+    /** Segment files written so far, and the reports they held. */
+    uint64_t segmentsWritten;
+    uint64_t reportsWritten;
+} CLKSCrashReportWriteQueueStats;
+
 /** Initialize the report store.
  *
  * @param appName The application's name.
@@ -46,6 +136,9 @@ void clkscrs_initialize(const char* appName, const char* reportsPath);
 /** Get the next crash report to be generated.
  * Max length for paths is CLKSCRS_MAX_PATH_LENGTH
  *
+ * The upload cursor won't move past the report until clkscrs_writeReportMetadata()
+ * has been called for it.
+ *
  * @param crashReportPathBuffer Buffer to store the crash report path.
  *
  * @return the report ID of the next report.
@@ -65,6 +158,85 @@ int clkscrs_getReportCount(void);
  */
 int clkscrs_getReportIDs(int64_t *reportIDs, int count);
 
+/** Write the metadata record for a report that has just been written.
+ * The timestamp is the current time, and the size is taken from the report file.
+ * Any previous send state is reset.
+ *
+ * This function is async-safe.
+ *
+ * @param reportID The report's ID.
+ * @param kind What produced the report.
+ * @param crashType Name of the monitor that caught the crash (NULL = none).
+ * @param fingerprint The crash's fingerprint (0 = none).
+ */
+void clkscrs_writeReportMetadata(int64_t reportID,
+                                 CLKSCrashReportKind kind,
+                                 const char* crashType,
+                                 uint64_t fingerprint);
+
+/** Read the metadata record for a report.
+ * Reports without a usable record get one built from the report file's
+ * attributes, with kind CLKSCrashReportKindUnknown.
+ *
+ * @param reportID The report's ID.
+ * @param metadata Where to store the record.
+ *
+ * @return true if the report exists.
+ */
+bool clkscrs_getReportMetadata(int64_t reportID, CLKSCrashReportMetadata* metadata);
+
+/** Get the metadata records for all reports on disk, ordered by report ID.
+ *
+ * @param metadata An array big enough to hold all records.
+ * @param count How many records the array can hold.
+ *
+ * @return The number of records that were placed in the array.
+ */
+int clkscrs_getAllReportMetadata(CLKSCrashReportMetadata* metadata, int count);
+
+/** Get the IDs of reports whose metadata matches a filter, ordered by report ID.
+ *
+ * @param filter The criteria to match (NULL = match all).
+ * @param reportIDs An array to hold the matching report IDs.
+ * @param count How many reports the array can hold.
+ *
+ * @return The number of report IDs that were placed in the array.
+ */
+int clkscrs_getReportIDsMatching(const CLKSCrashReportFilter* filter, int64_t* reportIDs, int count);
+
+/** Get the total size in bytes of all reports on disk, according to their metadata.
+ */
+int64_t clkscrs_getTotalReportSize(void);
+
+/** Record an attempt to send a report.
+ *
+ * @param reportID The report's ID.
+ * @param sent true if the report was sent successfully.
+ */
+void clkscrs_markReportSendAttempt(int64_t reportID, bool sent);
+
+/** Get the upload cursor. Every report up to and including it has been uploaded.
+ *
+ * @return The report ID, or 0 if nothing has been uploaded.
+ */
+int64_t clkscrs_getUploadCursor(void);
+
+/** Record that reports have been uploaded, and move the upload cursor up to
+ * just before the oldest report that still hasn't been. Crash reports that are
+ * still being written hold the cursor back too, so it never passes a report
+ * that an uploader couldn't have seen.
+ *
+ * The cursor and the records of uploaded reports above it are synced to disk,
+ * so once this returns, those reports won't be uploaded again even if the process dies.
+ *
+ * @param reportIDs The uploaded reports' IDs.
+ * @param count The number of IDs.
+ *
+ * @return false if something couldn't be written, in which case some of the
+ *         reports may be uploaded again.
+ */
+bool clkscrs_markReportsUploaded(const int64_t* reportIDs, int count);
+
 /** Read a report.
  *
  * @param reportID The report's ID.
@@ -74,16 +246,87 @@ int clkscrs_getReportIDs(int64_t *reportIDs, int count);
  */
 char* clkscrs_readReport(int64_t reportID);
 
+/** Open a report for reading in pieces.
+ * Compressed reports are recognized by their magic bytes, and are decompressed
+ * as they're read.
+ *
+ * @param reportID The report's ID.
+ *
+ * @return The reader, or NULL if the report doesn't exist or can't be decoded.
+ *         The reader must be closed with clkscrs_closeReport().
+ */
+CLKSCrashReportReader* clkscrs_openReport(int64_t reportID);
+
+/** Get the length of an open report, after decompression.
+ */
+int64_t clkscrs_getReportLength(const CLKSCrashReportReader* reader);
+
+/** Read the next piece of an open report.
+ *
+ * @param reader The reader.
+ * @param buffer Buffer to store the bytes in.
+ * @param bufferLength The most bytes to read.
+ *
+ * @return The number of bytes read, 0 at the end of the report, or -1 on error.
+ */
+int clkscrs_readReportChunk(CLKSCrashReportReader* reader, char* buffer, int bufferLength);
+
+/** Close a reader opened with clkscrs_openReport().
+ */
+void clkscrs_closeReport(CLKSCrashReportReader* reader);
+
+/** Set how hard to compress reports at rest.
+ *
+ * @param compressionLevel A zlib compression level from 1 to 9 (0 = don't compress).
+ */
+void clkscrs_setCompressionLevel(int compressionLevel);
+
+/** Gzip every report on disk that isn't compressed yet, in place.
+ * Reports are always written uncompressed, so run this some time after launch,
+ * on a background thread. Does nothing if the compression level is 0.
+ * User reports held in segments are left as they are.
+ *
+ * @return The number of reports that were compressed.
+ */
+int clkscrs_compressReports(void);
+
 /** Add a custom report to the store.
+ *
+ * The report is copied into a queue and written in the background, batched
+ * with any other reports queued around the same time into a single segment
+ * file. Reports are read straight from their segment, and the report is
+ * visible to every read function as soon as this returns. A segment is
+ * deleted once all of its reports have been.
  *
  * @param report The report's contents (must be JSON encoded).
  * @param reportLength The length of the report in bytes.
  *
- * @return the new report's ID.
+ * @return the new report's ID, or 0 if the write queue is full.
  */
 int64_t clkscrs_addUserReport(const char *report, int reportLength);
 
-/** Delete all reports on disk.
+/** Configure the user report write queue.
+ *
+ * A batch is written once the queued reports reach maxBatchBytes, or once the
+ * oldest of them has waited maxBatchDelay seconds, whichever comes first.
+ *
+ * @param maxBatchBytes Size at which to write a batch (0 = write every report as soon as possible).
+ * @param maxBatchDelay The longest a report can wait in the queue, in seconds.
+ * @param durability Whether each batch gets synced to disk.
+ */
+void clkscrs_setWriteQueue(int maxBatchBytes, double maxBatchDelay, CLKSCrashReportDurability durability);
+
+/** Write out all queued user reports, and wait until they're on disk.
+ */
+void clkscrs_flushUserReports(void);
+
+/** Get the user report write queue's counters.
+ *
+ * @param stats Where to store the counters.
+ */
+void clkscrs_getWriteQueueStats(CLKSCrashReportWriteQueueStats* stats);
+
+/** Delete all reports on disk, including any user reports still queued.
  */
 void clkscrs_deleteAllReports(void);
 
@@ -93,12 +336,43 @@ void clkscrs_deleteAllReports(void);
  */
 void clkscrs_deleteReportWithID(int64_t reportID);
 
+/** Delete several reports at once.
+ *
+ * @param reportIDs The IDs of the reports to delete, in ascending order.
+ * @param count The number of IDs.
+ */
+void clkscrs_deleteReportsWithIDs(const int64_t* reportIDs, int count);
+
 /** Set the maximum number of reports allowed on disk before old ones get deleted.
+ *
+ * Limits are enforced at initialization and whenever reports are added.
+ * Sent reports are deleted first, then unsent reports whose fingerprint matches
+ * an older unsent report, then recrash reports, then the oldest.
  *
  * @param maxReportCount The maximum number of reports.
  */
     void clkscrs_setMaxReportCount(int maxReportCount);
 
+/** Set the most disk space that reports can use before some get deleted.
+ *
+ * @param maxTotalReportSize The maximum total size in bytes (0 = no limit).
+ */
+void clkscrs_setMaxTotalReportSize(int64_t maxTotalReportSize);
+
+/** Fold unsent reports with the same fingerprint into the oldest of them,
+ * which keeps a count of them and the time of the latest.
+ * Duplicates are folded at initialization and whenever reports are added.
+ *
+ * @param collapsesDuplicates If true, fold duplicates.
+ */
+void clkscrs_setCollapsesDuplicates(bool collapsesDuplicates);
+
+/** Set how long reports are kept before being deleted.
+ *
+ * @param maxReportAge The maximum age in seconds (0 = no limit).
+ */
+void clkscrs_setMaxReportAge(int64_t maxReportAge);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,727 @@
+//
+//  CLKSCrashUploader.c
+//
+//  Copyright (c) 2012 Karl Stenerud. All rights reserved.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall remain in place
+// in this source code.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+
+
+
+#include "CLKSCrashUploader.h"
+#include "CLKSCrashReportFixer.h"
+#include "CLKSCrashReportStore.h"
+#include "CLKSPipeline.h"
+
+//#define CLKSLogger_LocalLevel TRACE
+#include "CLKSLogger.h"
+
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <zlib.h>
+
+
+typedef struct
+{
+    int64_t reportID;
+    /** NULL if the report couldn't be encoded. */
+    char* json;
+    int length;
+} EncodedReport;
+
+typedef struct
+{
+    char* bytes;
+    int length;
+    int capacity;
+} Buffer;
+
+/** Settings, copied at the start of each pass so they can change during one. */
+typedef struct
+{
+    CLKSCrashUploadTransport transport;
+    CLKSCrashUploadEncodeFunction encodeFunction;
+    void* encodeUserData;
+    char* prefix;
+    char* suffix;
+    int maxReports;
+    int maxBytes;
+    int compressionLevel;
+    int encodeConcurrency;
+    bool deletesUploadedReports;
+} Settings;
+
+// Everything here is guarded by g_mutex.
+static pthread_mutex_t g_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_uploadRequested = PTHREAD_COND_INITIALIZER;
+static Settings g_settings =
+{
+    .maxReports = 50,
+    .maxBytes = 1024 * 1024,
+    .compressionLevel = Z_DEFAULT_COMPRESSION,
+    .encodeConcurrency = 1,
+};
+static double g_initialRetryDelay = 1.0;
+static double g_maxRetryDelay = 300.0;
+static CLKSCrashUploadStats g_stats;
+static bool g_isUploaderStarted;
+static bool g_isUploadRequested;
+
+/** Held for the whole of a pass, so that two passes never send the same reports. */
+static pthread_mutex_t g_passMutex = PTHREAD_MUTEX_INITIALIZER;
+
+
+// Utility
+
+static double getCurrentTime()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    return (double)now.tv_sec + (double)now.tv_nsec / 1000000000.0;
+}
+
+static double getMonotonicTime()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec + (double)now.tv_nsec / 1000000000.0;
+}
+
+static char* copyString(const char* string)
+{
+    return strdup(string == NULL ? "" : string);
+}
+
+static bool appendToBuffer(Buffer* buffer, const char* bytes, int length)
+{
+    if(buffer->length + length > buffer->capacity)
+    {
+        int newCapacity = buffer->capacity > 0 ? buffer->capacity : 16384;
+        while(newCapacity < buffer->length + length)
+        {
+            newCapacity *= 2;
+        }
+        char* newBytes = realloc(buffer->bytes, (size_t)newCapacity);
+        if(newBytes == NULL)
+        {
+            CLKSLOG_ERROR("Could not grow batch buffer to %d bytes", newCapacity);
+            return false;
+        }
+        buffer->bytes = newBytes;
+        buffer->capacity = newCapacity;
+    }
+    memcpy(buffer->bytes + buffer->length, bytes, (size_t)length);
+    buffer->length += length;
+    return true;
+}
+
+static int readReportChunk(char* buffer, int bufferLength, void* userData)
+{
+    return clkscrs_readReportChunk((CLKSCrashReportReader*)userData, buffer, bufferLength);
+}
+
+static char* encodeFixedUpReport(int64_t reportID, int* length, __unused void* userData)
+{
+    CLKSCrashReportReader* reader = clkscrs_openReport(reportID);
+    if(reader == NULL)
+    {
+        return NULL;
+    }
+    char* report = clkscrf_fixupCrashReportStream((int)clkscrs_getReportLength(reader), readReportChunk, reader);
+    clkscrs_closeReport(reader);
+    if(report != NULL)
+    {
+        *length = (int)strlen(report);
+    }
+    return report;
+}
+
+/** Gzip a batch.
+ *
+ * @return The compressed batch, or NULL on failure.
+ *         MEMORY MANAGEMENT WARNING: User is responsible for calling free() on the returned value.
+ */
+static char* gzipBatch(const Buffer* batch, int compressionLevel, int* compressedLength)
+{
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    // 16 selects a gzip wrapper.
+    if(deflateInit2(&stream, compressionLevel, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+    {
+        CLKSLOG_ERROR("Could not initialize compressor: %s", stream.msg);
+        return NULL;
+    }
+    uLong bound = deflateBound(&stream, (uLong)batch->length);
+    char* compressed = malloc(bound);
+    if(compressed == NULL)
+    {
+        CLKSLOG_ERROR("Could not allocate %lu bytes for compressed batch", bound);
+        deflateEnd(&stream);
+        return NULL;
+    }
+    stream.next_in = (Bytef*)batch->bytes;
+    stream.avail_in = (uInt)batch->length;
+    stream.next_out = (Bytef*)compressed;
+    stream.avail_out = (uInt)bound;
+    if(deflate(&stream, Z_FINISH) != Z_STREAM_END)
+    {
+        CLKSLOG_ERROR("Could not compress batch: %s", stream.msg);
+        deflateEnd(&stream);
+        free(compressed);
+        return NULL;
+    }
+    *compressedLength = (int)stream.total_out;
+    deflateEnd(&stream);
+    return compressed;
+}
+
+
+// Encoding
+
+static bool encodeReport(void* item, void* userData)
+{
+    const Settings* settings = (const Settings*)userData;
+    EncodedReport* report = (EncodedReport*)item;
+    report->json = settings->encodeFunction(report->reportID, &report->length, settings->encodeUserData);
+    return true;
+}
+
+static void freeEncodedReport(void* item)
+{
+    EncodedReport* report = (EncodedReport*)item;
+    free(report->json);
+    free(report);
+}
+
+/** Queue reports for encoding until the pipeline holds maxQueued of them.
+ *
+ * @return false if a report couldn't be queued.
+ */
+static bool queueReportsForEncoding(CLKSPipeline* pipeline,
+                                    const int64_t* reportIDs,
+                                    int idCount,
+                                    int* nextIDIndex,
+                                    int maxQueued)
+{
+    for(int queued = clkspl_getItemCount(pipeline); queued < maxQueued && *nextIDIndex < idCount; queued++)
+    {
+        EncodedReport* report = calloc(1, sizeof(*report));
+        if(report == NULL)
+        {
+            return false;
+        }
+        report->reportID = reportIDs[(*nextIDIndex)++];
+        if(!clkspl_push(pipeline, report))
+        {
+            free(report);
+            return false;
+        }
+    }
+    return true;
+}
+
+
+// Batches
+
+/** How many of the encoded reports fit in the next batch. Always at least 1.
+ */
+static int getBatchCount(const EncodedReport* reports, int reportCount, int maxReports, int maxBytes, const Settings* settings)
+{
+    int64_t length = (int64_t)strlen(settings->prefix) + (int64_t)strlen(settings->suffix) + 2;
+    int count = 0;
+    while(count < reportCount && count < maxReports)
+    {
+        length += reports[count].length + 1;
+        if(count > 0 && length > maxBytes)
+        {
+            break;
+        }
+        count++;
+    }
+    return count;
+}
+
+static bool buildBatch(Buffer* batch, const EncodedReport* reports, int count, const Settings* settings)
+{
+    batch->length = 0;
+    if(!appendToBuffer(batch, settings->prefix, (int)strlen(settings->prefix)) || !appendToBuffer(batch, "[", 1))
+    {
+        return false;
+    }
+    for(int i = 0; i < count; i++)
+    {
+        if((i > 0 && !appendToBuffer(batch, ",", 1)) || !appendToBuffer(batch, reports[i].json, reports[i].length))
+        {
+            return false;
+        }
+    }
+    return appendToBuffer(batch, "]", 1) && appendToBuffer(batch, settings->suffix, (int)strlen(settings->suffix));
+}
+
+/** Send a batch through the transport, compressed if possible.
+ *
+ * @param sentLength Set to the number of bytes sent.
+ * @param compressTime Incremented by the time spent compressing.
+ * @param sendTime Incremented by the time spent in the transport.
+ *
+ * @return The HTTP status code, or a negative value if there was no response.
+ */
+static int sendBatch(const Buffer* batch, const Settings* settings, int* sentLength, double* compressTime, double* sendTime)
+{
+    char* compressed = NULL;
+    double startTime = getMonotonicTime();
+    if(settings->compressionLevel != 0)
+    {
+        compressed = gzipBatch(batch, settings->compressionLevel, sentLength);
+    }
+    double compressedTime = getMonotonicTime();
+    *compressTime += compressedTime - startTime;
+
+    int statusCode;
+    if(compressed == NULL)
+    {
+        *sentLength = batch->length;
+        statusCode = settings->transport.sendBatch(batch->bytes, batch->length, false, settings->transport.userData);
+    }
+    else
+    {
+        statusCode = settings->transport.sendBatch(compressed, *sentLength, true, settings->transport.userData);
+        free(compressed);
+    }
+    *sendTime += getMonotonicTime() - compressedTime;
+    return statusCode;
+}
+
+static bool isRetryable(int statusCode)
+{
+    // Credentials can be fixed or refreshed, so auth failures don't cost any reports.
+    return statusCode < 0 || statusCode == 401 || statusCode == 403 || statusCode == 408 || statusCode == 429 || statusCode >= 500;
+}
+
+/** The server has the reports (or won't ever take them), so mark them uploaded.
+ *
+ * @param reportIDs Space for count IDs.
+ */
+static void commitBatch(const EncodedReport* reports, int count, int64_t* reportIDs, const Settings* settings)
+{
+    for(int i = 0; i < count; i++)
+    {
+        reportIDs[i] = reports[i].reportID;
+    }
+    if(!clkscrs_markReportsUploaded(reportIDs, count))
+    {
+        // They may be sent again. The server would rather get them twice than not at all.
+        CLKSLOG_ERROR("Could not record upload of %d reports", count);
+        return;
+    }
+    if(settings->deletesUploadedReports)
+    {
+        clkscrs_deleteReportsWithIDs(reportIDs, count);
+    }
+}
+
+static void recordFailure()
+{
+    pthread_mutex_lock(&g_mutex);
+    g_stats.failedAttempts++;
+    g_stats.consecutiveFailures++;
+    double delay = g_initialRetryDelay * pow(2.0, g_stats.consecutiveFailures - 1);
+    if(delay > g_maxRetryDelay)
+    {
+        delay = g_maxRetryDelay;
+    }
+    // Spread out retries from many devices after a server outage.
+    delay *= 0.5 + 0.5 * ((double)random() / (double)RAND_MAX);
+    g_stats.nextRetryTime = getCurrentTime() + delay;
+    pthread_mutex_unlock(&g_mutex);
+}
+
+static void freeReports(EncodedReport* reports, int count)
+{
+    for(int i = 0; i < count; i++)
+    {
+        free(reports[i].json);
+    }
+}
+
+/** Upload every unsent report above the cursor, one batch at a time.
+ * Must be called with g_passMutex held.
+ *
+ * @return The number of reports uploaded, or -1 if a batch couldn't be delivered.
+ */
+static int uploadPendingReports()
+{
+    pthread_mutex_lock(&g_mutex);
+    Settings settings = g_settings;
+    settings.prefix = copyString(g_settings.prefix == NULL ? "{\"reports\":" : g_settings.prefix);
+    settings.suffix = copyString(g_settings.suffix == NULL ? "}" : g_settings.suffix);
+    pthread_mutex_unlock(&g_mutex);
+    if(settings.encodeFunction == NULL)
+    {
+        settings.encodeFunction = encodeFixedUpReport;
+    }
+    if(settings.maxReports < 1)
+    {
+        settings.maxReports = 1;
+    }
+    // Enough to keep every encoder busy while a batch is being sent.
+    const int maxQueued = settings.encodeConcurrency * 2;
+
+    int uploadedCount = 0;
+    int64_t* reportIDs = NULL;
+    int64_t* batchIDs = NULL;
+    EncodedReport* reports = NULL;
+    int encodedCount = 0;
+    Buffer batch = {0};
+    CLKSPipeline* pipeline = NULL;
+    double compressTime = 0;
+    double sendTime = 0;
+
+    if(settings.transport.sendBatch == NULL)
+    {
+        CLKSLOG_ERROR("No upload transport has been set");
+        uploadedCount = -1;
+        goto done;
+    }
+
+    int64_t cursor = clkscrs_getUploadCursor();
+    int idCount = clkscrs_getReportCount();
+    reportIDs = malloc(sizeof(*reportIDs) * (size_t)(idCount > 0 ? idCount : 1));
+    reports = malloc(sizeof(*reports) * (size_t)settings.maxReports);
+    batchIDs = malloc(sizeof(*batchIDs) * (size_t)settings.maxReports);
+    if(reportIDs == NULL || reports == NULL || batchIDs == NULL)
+    {
+        CLKSLOG_ERROR("Could not allocate upload batch");
+        uploadedCount = -1;
+        goto done;
+    }
+    CLKSCrashReportFilter filter = {.unsentOnly = true};
+    idCount = clkscrs_getReportIDsMatching(&filter, reportIDs, idCount);
+    int nextIDIndex = 0;
+    while(nextIDIndex < idCount && reportIDs[nextIDIndex] <= cursor)
+    {
+        nextIDIndex++;
+    }
+
+    CLKSPipelineStage encodeStage =
+    {
+        .name = "CLKSCrash Report Encoder",
+        .process = encodeReport,
+        .userData = &settings,
+        .workerCount = settings.encodeConcurrency,
+        .queueCapacity = maxQueued,
+    };
+    pipeline = clkspl_create(&encodeStage, 1, maxQueued, freeEncodedReport);
+    if(pipeline == NULL)
+    {
+        uploadedCount = -1;
+        goto done;
+    }
+
+    // Lowered when the server says a batch is too large.
+    int maxReports = settings.maxReports;
+    for(;;)
+    {
+        while(encodedCount < settings.maxReports)
+        {
+            if(!queueReportsForEncoding(pipeline, reportIDs, idCount, &nextIDIndex, maxQueued))
+            {
+                CLKSLOG_ERROR("Could not queue reports for encoding");
+                uploadedCount = -1;
+                goto done;
+            }
+            void* item = NULL;
+            if(clkspl_getItemCount(pipeline) == 0 || !clkspl_pop(pipeline, &item))
+            {
+                break;
+            }
+            EncodedReport report = *(EncodedReport*)item;
+            free(item);
+            if(report.json == NULL)
+            {
+                // It stays unsent, so the upload cursor can't pass it. Try again next pass.
+                CLKSLOG_INFO("Skipping report %016llx", report.reportID);
+                clkscrs_markReportSendAttempt(report.reportID, false);
+                pthread_mutex_lock(&g_mutex);
+                g_stats.reportsSkipped++;
+                pthread_mutex_unlock(&g_mutex);
+                if(encodedCount > 0)
+                {
+                    // End the batch here rather than reach across it.
+                    break;
+                }
+                continue;
+            }
+            reports[encodedCount++] = report;
+        }
+        if(encodedCount == 0)
+        {
+            break;
+        }
+
+        int count = getBatchCount(reports, encodedCount, maxReports, settings.maxBytes, &settings);
+        if(!buildBatch(&batch, reports, count, &settings))
+        {
+            uploadedCount = -1;
+            goto done;
+        }
+        CLKSLOG_DEBUG("Sending batch of %d reports (%d bytes)", count, batch.length);
+        int sentLength = 0;
+        int statusCode = sendBatch(&batch, &settings, &sentLength, &compressTime, &sendTime);
+        pthread_mutex_lock(&g_mutex);
+        g_stats.bytesEncoded += (uint64_t)batch.length;
+        g_stats.bytesSent += (uint64_t)sentLength;
+        pthread_mutex_unlock(&g_mutex);
+
+        if(statusCode == 413 && count > 1)
+        {
+            CLKSLOG_DEBUG("Batch of %d reports was too large. Halving.", count);
+            maxReports = count / 2;
+            continue;
+        }
+        if(isRetryable(statusCode))
+        {
+            CLKSLOG_ERROR("Batch of %d reports failed with status %d", count, statusCode);
+            for(int i = 0; i < count; i++)
+            {
+                clkscrs_markReportSendAttempt(reports[i].reportID, false);
+            }
+            recordFailure();
+            uploadedCount = -1;
+            goto done;
+        }
+
+        bool isAccepted = statusCode >= 200 && statusCode < 300;
+        if(!isAccepted)
+        {
+            CLKSLOG_ERROR("Server rejected batch of %d reports with status %d. Dropping it.", count, statusCode);
+        }
+        commitBatch(reports, count, batchIDs, &settings);
+        pthread_mutex_lock(&g_mutex);
+        g_stats.batchesSent++;
+        if(isAccepted)
+        {
+            g_stats.reportsSent += (uint64_t)count;
+        }
+        else
+        {
+            g_stats.reportsRejected += (uint64_t)count;
+        }
+        g_stats.consecutiveFailures = 0;
+        g_stats.nextRetryTime = 0;
+        pthread_mutex_unlock(&g_mutex);
+        if(isAccepted)
+        {
+            uploadedCount += count;
+        }
+
+        freeReports(reports, count);
+        encodedCount -= count;
+        memmove(reports, reports + count, sizeof(*reports) * (size_t)encodedCount);
+        maxReports = settings.maxReports;
+    }
+
+done:
+    if(pipeline != NULL)
+    {
+        CLKSPipelineStageStats encodeStats;
+        clkspl_getStageStats(pipeline, 0, &encodeStats);
+        pthread_mutex_lock(&g_mutex);
+        g_stats.encodeTime += (double)encodeStats.busyNanoseconds / 1000000000.0;
+        pthread_mutex_unlock(&g_mutex);
+        // Any reports still queued are encoded again next pass.
+        clkspl_destroy(pipeline);
+    }
+    pthread_mutex_lock(&g_mutex);
+    g_stats.compressTime += compressTime;
+    g_stats.sendTime += sendTime;
+    pthread_mutex_unlock(&g_mutex);
+    if(reports != NULL)
+    {
+        freeReports(reports, encodedCount);
+    }
+    free(reports);
+    free(batchIDs);
+    free(reportIDs);
+    free(batch.bytes);
+    free(settings.prefix);
+    free(settings.suffix);
+    return uploadedCount;
+}
+
+
+// Uploader thread
+
+static void* runUploader(__unused void* userData)
+{
+#ifdef __APPLE__
+    pthread_setname_np("CLKSCrash Report Uploader");
+#endif
+    pthread_mutex_lock(&g_mutex);
+    for(;;)
+    {
+        while(!g_isUploadRequested)
+        {
+            pthread_cond_wait(&g_uploadRequested, &g_mutex);
+        }
+        while(g_stats.nextRetryTime > 0)
+        {
+            double retryTime = g_stats.nextRetryTime;
+            if(getCurrentTime() >= retryTime)
+            {
+                break;
+            }
+            struct timespec deadline;
+            deadline.tv_sec = (time_t)retryTime;
+            deadline.tv_nsec = (long)((retryTime - (double)deadline.tv_sec) * 1000000000.0);
+            pthread_cond_timedwait(&g_uploadRequested, &g_mutex, &deadline);
+        }
+        g_isUploadRequested = false;
+        pthread_mutex_unlock(&g_mutex);
+
+        pthread_mutex_lock(&g_passMutex);
+        int uploadedCount = uploadPendingReports();
+        pthread_mutex_unlock(&g_passMutex);
+
+        pthread_mutex_lock(&g_mutex);
+        if(uploadedCount < 0 && g_stats.nextRetryTime > 0)
+        {
+            g_isUploadRequested = true;
+        }
+    }
+    return NULL;
+}
+
+/** Must be called with g_mutex held.
+ */
+static bool startUploaderIfNeeded()
+{
+    if(g_isUploaderStarted)
+    {
+        return true;
+    }
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    pthread_t thread;
+    int error = pthread_create(&thread, &attr, runUploader, NULL);
+    pthread_attr_destroy(&attr);
+    if(error != 0)
+    {
+        CLKSLOG_ERROR("Could not start report uploader thread: %s", strerror(error));
+        return false;
+    }
+    g_isUploaderStarted = true;
+    return true;
+}
+
+
+// API
+
+void clkscru_setTransport(const CLKSCrashUploadTransport* transport)
+{
+    pthread_mutex_lock(&g_mutex);
+    g_settings.transport = *transport;
+    pthread_mutex_unlock(&g_mutex);
+}
+
+void clkscru_setEncodeFunction(CLKSCrashUploadEncodeFunction encodeFunction, void* userData)
+{
+    pthread_mutex_lock(&g_mutex);
+    g_settings.encodeFunction = encodeFunction;
+    g_settings.encodeUserData = userData;
+    pthread_mutex_unlock(&g_mutex);
+}
+
+void clkscru_setEnvelope(const char* prefix, const char* suffix)
+{
+    pthread_mutex_lock(&g_mutex);
+    free(g_settings.prefix);
+    free(g_settings.suffix);
+    g_settings.prefix = copyString(prefix);
+    g_settings.suffix = copyString(suffix);
+    pthread_mutex_unlock(&g_mutex);
+}
+
+void clkscru_setBatchLimits(int maxReports, int maxBytes)
+{
+    pthread_mutex_lock(&g_mutex);
+    g_settings.maxReports = maxReports;
+    g_settings.maxBytes = maxBytes;
+    pthread_mutex_unlock(&g_mutex);
+}
+
+void clkscru_setRetryDelays(double initialDelay, double maxDelay)
+{
+    pthread_mutex_lock(&g_mutex);
+    g_initialRetryDelay = initialDelay;
+    g_maxRetryDelay = maxDelay;
+    pthread_mutex_unlock(&g_mutex);
+}
+
+void clkscru_setCompressionLevel(int compressionLevel)
+{
+    pthread_mutex_lock(&g_mutex);
+    g_settings.compressionLevel = compressionLevel;
+    pthread_mutex_unlock(&g_mutex);
+}
+
+void clkscru_setEncodeConcurrency(int workerCount)
+{
+    pthread_mutex_lock(&g_mutex);
+    g_settings.encodeConcurrency = workerCount < 1 ? 1 : workerCount > CLKSPL_MAX_WORKERS ? CLKSPL_MAX_WORKERS : workerCount;
+    pthread_mutex_unlock(&g_mutex);
+}
+
+void clkscru_setDeletesUploadedReports(bool deletesUploadedReports)
+{
+    pthread_mutex_lock(&g_mutex);
+    g_settings.deletesUploadedReports = deletesUploadedReports;
+    pthread_mutex_unlock(&g_mutex);
+}
+
+void clkscru_uploadPendingReports()
+{
+    pthread_mutex_lock(&g_mutex);
+    if(startUploaderIfNeeded())
+    {
+        g_isUploadRequested = true;
+        pthread_cond_signal(&g_uploadRequested);
+    }
+    pthread_mutex_unlock(&g_mutex);
+}
+
+int clkscru_uploadPendingReportsNow()
+{
+    pthread_mutex_lock(&g_passMutex);
+    int uploadedCount = uploadPendingReports();
+    pthread_mutex_unlock(&g_passMutex);
+    return uploadedCount;
+}
+
+void clkscru_getStats(CLKSCrashUploadStats* stats)
+{
+    pthread_mutex_lock(&g_mutex);
+    *stats = g_stats;
+    pthread_mutex_unlock(&g_mutex);
+}
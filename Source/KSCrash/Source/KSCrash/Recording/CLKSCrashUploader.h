@@ -0,0 +1,195 @@
+//
+//  CLKSCrashUploader.h
+//
+//  Copyright (c) 2012 Karl Stenerud. All rights reserved.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall remain in place
+// in this source code.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+
+
+
+/* Uploads stored reports in batches.
+ *
+ * Reports are taken from the report store in ID order, starting after the
+ * store's upload cursor. Each batch is sent as one request: the reports' JSON
+ * is packed into an array, wrapped in a caller-supplied envelope, and gzipped.
+ * The request itself is made by a pluggable transport, so this file doesn't
+ * depend on any networking API.
+ *
+ * Once the server accepts a batch, its reports are marked uploaded, and the
+ * cursor moves past them once everything before them has been uploaded too.
+ * A batch that couldn't be delivered, or was refused for lack of credentials
+ * (401, 403), is retried with exponential backoff.
+ *
+ * Reports are encoded on a pool of worker threads, ahead of the batch being
+ * sent, and are batched in ID order regardless of which finishes first.
+ */
+
+
+#ifndef HDR_CLKSCrashUploader_h
+#define HDR_CLKSCrashUploader_h
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+/** Makes the requests for the uploader. */
+typedef struct
+{
+    /** Send one batch and wait for the server's response.
+     * Called on the uploader's thread, or the thread that called clkscru_uploadPendingReportsNow().
+     *
+     * @param body The request body.
+     * @param bodyLength The length of the body in bytes.
+     * @param isGzipped true if the body is gzipped (send it with Content-Encoding: gzip).
+     * @param userData The transport's userData.
+     *
+     * @return The HTTP status code, or a negative value if there was no response.
+     */
+    int (*sendBatch)(const char* body, int bodyLength, bool isGzipped, void* userData);
+    void* userData;
+} CLKSCrashUploadTransport;
+
+/** Converts a stored report into the JSON that gets uploaded for it.
+ * Called on the uploader's encoding threads. With an encode concurrency
+ * above 1, calls for different reports overlap, so anything the function
+ * reads or writes other than the report itself (userData included) must be
+ * safe to use from several threads at once.
+ *
+ * @param reportID The report's ID.
+ * @param length Set to the length of the JSON.
+ * @param userData The userData passed to clkscru_setEncodeFunction().
+ *
+ * @return The JSON, or NULL to skip the report. Skipped reports stay unsent,
+ *         and are tried again on the next pass.
+ *         MEMORY MANAGEMENT: The uploader calls free() on the returned value.
+ */
+typedef char* (*CLKSCrashUploadEncodeFunction)(int64_t reportID, int* length, void* userData);
+
+/** Counters for the uploader. */
+typedef struct
+{
+    uint64_t batchesSent;
+    uint64_t reportsSent;
+    /** Reports in batches the server refused. These aren't retried. */
+    uint64_t reportsRejected;
+    /** Reports that couldn't be read or encoded. */
+    uint64_t reportsSkipped;
+    /** Size of the batches before and after compression. */
+    uint64_t bytesEncoded;
+    uint64_t bytesSent;
+    /** Attempts that got no response, or a response worth retrying. */
+    uint64_t failedAttempts;
+    int consecutiveFailures;
+    /** When the next retry is due (seconds since the epoch, 0 = not backing off). */
+    double nextRetryTime;
+    /** Total seconds spent in each step. Encoding time is summed across threads. */
+    double encodeTime;
+    double compressTime;
+    double sendTime;
+} CLKSCrashUploadStats;
+
+
+/** Set the transport that sends batches. Nothing is uploaded until one is set.
+ *
+ * @param transport The transport (copied).
+ */
+void clkscru_setTransport(const CLKSCrashUploadTransport* transport);
+
+/** Set how reports are converted for upload.
+ *
+ * @param encodeFunction The converter (NULL = upload the fixed up report as is).
+ * @param userData Passed to encodeFunction.
+ */
+void clkscru_setEncodeFunction(CLKSCrashUploadEncodeFunction encodeFunction, void* userData);
+
+/** Set what goes around the array of reports in each batch.
+ * For example, with the prefix {"key":"abc","reports": and the suffix },
+ * the body is {"key":"abc","reports":[report1,report2,...]}
+ *
+ * @param prefix Text before the array (copied).
+ * @param suffix Text after the array (copied).
+ */
+void clkscru_setEnvelope(const char* prefix, const char* suffix);
+
+/** Set how big a batch can get.
+ * A report that is bigger than maxBytes by itself is sent in a batch of its own.
+ *
+ * @param maxReports The most reports in one batch.
+ * @param maxBytes The most bytes in one batch, before compression.
+ */
+void clkscru_setBatchLimits(int maxReports, int maxBytes);
+
+/** Set how long to wait before retrying a batch that couldn't be delivered.
+ * The delay doubles with each consecutive failure, with some random jitter.
+ *
+ * @param initialDelay The delay after the first failure, in seconds.
+ * @param maxDelay The longest delay, in seconds.
+ */
+void clkscru_setRetryDelays(double initialDelay, double maxDelay);
+
+/** Set how hard to compress batches.
+ *
+ * @param compressionLevel A zlib compression level from 1 to 9 (0 = send uncompressed).
+ */
+void clkscru_setCompressionLevel(int compressionLevel);
+
+/** Set how many reports can be encoded at once. Default 1.
+ * Only raise this if the encode function is thread safe (see
+ * CLKSCrashUploadEncodeFunction). The default fix-up encoder is. Extra
+ * workers mainly help an encoder that waits on I/O; on CPU-bound encoding
+ * they gain little on few cores.
+ *
+ * @param workerCount The number of encoding threads.
+ */
+void clkscru_setEncodeConcurrency(int workerCount);
+
+/** Set whether reports are deleted once uploaded. If not, they are marked sent.
+ */
+void clkscru_setDeletesUploadedReports(bool deletesUploadedReports);
+
+/** Upload pending reports in the background.
+ * If a retry is already scheduled, the upload waits for it.
+ */
+void clkscru_uploadPendingReports(void);
+
+/** Upload pending reports on the calling thread, ignoring any retry schedule.
+ * Stops at the first batch that couldn't be delivered.
+ *
+ * @return The number of reports uploaded, or -1 if a batch couldn't be delivered.
+ */
+int clkscru_uploadPendingReportsNow(void);
+
+/** Get the uploader's counters.
+ *
+ * @param stats Where to store the counters.
+ */
+void clkscru_getStats(CLKSCrashUploadStats* stats);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // HDR_CLKSCrashUploader_h
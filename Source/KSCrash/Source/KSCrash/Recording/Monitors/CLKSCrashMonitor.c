@@ -207,6 +207,18 @@ CLKSCrashMonitorType clkscm_getActiveMonitors()
     return g_activeMonitors;
 }
 
+void clkscm_addContextualInfo(struct CLKSCrash_MonitorContext* context)
+{
+    for(int i = 0; i < g_monitorsCount; i++)
+    {
+        Monitor* monitor = &g_monitors[i];
+        if(isMonitorEnabled(monitor))
+        {
+            addContextualInfoToEvent(monitor, context);
+        }
+    }
+}
+
 
 // ============================================================================
 #pragma mark - Private API -
@@ -235,14 +247,7 @@ void clkscm_handleException(struct CLKSCrash_MonitorContext *context)
     {
         context->crashedDuringCrashHandling = true;
     }
-    for(int i = 0; i < g_monitorsCount; i++)
-    {
-        Monitor* monitor = &g_monitors[i];
-        if(isMonitorEnabled(monitor))
-        {
-            addContextualInfoToEvent(monitor, context);
-        }
-    }
+    clkscm_addContextualInfo(context);
 
     g_onExceptionEvent(context);
 
@@ -65,6 +65,13 @@ CLKSCrashMonitorType clkscm_getActiveMonitors(void);
  */
 void clkscm_setEventCallback(void (*onEvent)(struct CLKSCrash_MonitorContext *monitorContext));
 
+/** Have every active monitor fill in its contextual information (system info,
+ *  app state etc), without handling an exception.
+ *
+ * @param context The context to fill in.
+ */
+void clkscm_addContextualInfo(struct CLKSCrash_MonitorContext* context);
+
 
 // ============================================================================
 #pragma mark - Internal API -
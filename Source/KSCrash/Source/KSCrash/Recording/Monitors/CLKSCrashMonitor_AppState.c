@@ -27,7 +27,6 @@
 
 #include "CLKSCrashMonitor_AppState.h"
 
-#include "CLKSFileUtils.h"
 #include "CLKSJSONCodec.h"
 #include "CLKSCrashMonitorContext.h"
 
@@ -37,8 +36,11 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <inttypes.h>
+#include <stdatomic.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/time.h>
 #include <unistd.h>
 
@@ -47,6 +49,10 @@
 #pragma mark - Constants -
 // ============================================================================
 
+#define kStateFileMagic 0x434c4153 // "CLAS"
+#define kStateFileVersion 1
+
+/** Version of the legacy JSON state file, which is only read for migration. */
 #define kFormatVersion 1
 
 #define kKeyFormatVersion "version"
@@ -59,12 +65,60 @@
 
 
 
+// ============================================================================
+#pragma mark - Types -
+// ============================================================================
+
+/** The persisted portion of CLKSCrash_AppState. */
+typedef struct
+{
+    /** Whether the launch that wrote this record crashed. */
+    uint8_t crashed;
+    uint8_t reserved[3];
+    int32_t launchesSinceLastCrash;
+    int32_t sessionsSinceLastCrash;
+    int32_t reserved2;
+    double activeDurationSinceLastCrash;
+    double backgroundDurationSinceLastCrash;
+} StateRecordData;
+
+typedef struct
+{
+    /** Odd while the record is being written. 0 = never written. */
+    _Atomic(uint32_t) sequence;
+    /** Checksum over the sequence number and data. */
+    uint32_t checksum;
+    StateRecordData data;
+} StateRecord;
+
+/** The state file, mapped into memory.
+ * Saves alternate between the two records, so an interrupted save still
+ * leaves the previous record intact.
+ */
+typedef struct
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t recordSize;
+    uint32_t reserved;
+    StateRecord records[2];
+} StateFile;
+
+_Static_assert(sizeof(StateRecord) % 8 == 0, "StateRecord must keep its doubles aligned");
+
+
 // ============================================================================
 #pragma mark - Globals -
 // ============================================================================
 
-/** Location where stat file is stored. */
-static const char* g_stateFilePath;
+/** The mapped state file, or NULL if it couldn't be mapped. */
+static StateFile* g_stateFile;
+
+/** Sequence number of the most recently written record. */
+static uint32_t g_stateSequence;
+
+/** Index of the record that the next save overwrites. */
+static int g_nextStateRecord;
 
 /** Current state. */
 static CLKSCrash_AppState g_state;
@@ -72,7 +126,7 @@ static CLKSCrash_AppState g_state;
 static volatile bool g_isEnabled = false;
 
 // ============================================================================
-#pragma mark - JSON Encoding -
+#pragma mark - JSON Decoding -
 // ============================================================================
 
 static int onBooleanElement(const char* const name, const bool value, void* const userData)
@@ -161,16 +215,6 @@ static int onEndData(__unused void* const userData)
 }
 
 
-/** Callback for adding JSON data.
- */
-static int addJSONData(const char* const data, const int length, void* const userData)
-{
-    const int fd = *((int*)userData);
-    const bool success = clksfu_writeBytesToFD(fd, data, length);
-    return success ? CLKSJSON_OK : CLKSJSON_ERROR_CANNOT_ADD_DATA;
-}
-
-
 // ============================================================================
 #pragma mark - Utility -
 // ============================================================================
@@ -187,13 +231,14 @@ static double timeSince(double timeInSeconds)
     return getCurentTime() - timeInSeconds;
 }
 
-/** Load the persistent state portion of a crash context.
+/** Load the persistent state portion of a crash context from the JSON state
+ * file used by earlier versions.
  *
  * @param path The path to the file to read.
  *
  * @return true if the operation was successful.
  */
-bool loadState(const char* const path)
+static bool loadLegacyState(const char* const path)
 {
     // Stop if the file doesn't exist.
     // This is expected on the first run of the app.
@@ -202,15 +247,6 @@ bool loadState(const char* const path)
     {
         return false;
     }
-    close(fd);
-
-    char* data;
-    int length;
-    if(!clksfu_readEntireFile(path, &data, &length, 50000))
-    {
-        CLKSLOG_ERROR("%s: Could not load file", path);
-        return false;
-    }
 
     CLKSJSONDecodeCallbacks callbacks;
     callbacks.onBeginArray = onBeginArray;
@@ -222,103 +258,180 @@ bool loadState(const char* const path)
     callbacks.onIntegerElement = onIntegerElement;
     callbacks.onNullElement = onNullElement;
     callbacks.onStringElement = onStringElement;
+    callbacks.onStringSliceElement = NULL;
 
-    int errorOffset = 0;
-
-    char stringBuffer[1000];
-    const int result = clksjson_decode(data,
-                                     (int)length,
-                                     stringBuffer,
-                                     sizeof(stringBuffer),
-                                     &callbacks,
-                                     &g_state,
-                                     &errorOffset);
-    free(data);
+    char scratch[1000];
+    char readBuffer[512];
+    CLKSJSONStreamDecodeContext decodeContext;
+    clksjson_beginDecode(&decodeContext, scratch, sizeof(scratch), &callbacks, &g_state);
+
+    int result = CLKSJSON_OK;
+    int bytesRead;
+    while((bytesRead = (int)read(fd, readBuffer, sizeof(readBuffer))) > 0)
+    {
+        if((result = clksjson_decodeChunk(&decodeContext, readBuffer, bytesRead)) != CLKSJSON_OK)
+        {
+            break;
+        }
+    }
+    if(bytesRead < 0)
+    {
+        CLKSLOG_ERROR("%s: Could not read file: %s", path, strerror(errno));
+        close(fd);
+        return false;
+    }
+    close(fd);
+    if(result == CLKSJSON_OK)
+    {
+        result = clksjson_endDecode(&decodeContext);
+    }
     if(result != CLKSJSON_OK)
     {
         CLKSLOG_ERROR("%s, offset %d: %s",
-                    path, errorOffset, clksjson_stringForError(result));
+                    path, clksjson_decodeOffset(&decodeContext), clksjson_stringForError(result));
         return false;
     }
     return true;
 }
 
-/** Save the persistent state portion of a crash context.
+static uint32_t stateRecordChecksum(uint32_t sequence, const StateRecordData* const data)
+{
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    const uint8_t* bytes = (const uint8_t*)data;
+    for(size_t i = 0; i < sizeof(*data); i++)
+    {
+        hash = (hash ^ bytes[i]) * 16777619u;
+    }
+    return (hash ^ sequence) * 16777619u;
+}
+
+/** Write the persistent state portion of a crash context to the state file.
+ * This function is async-safe and makes no system calls. The mapping is
+ * shared, so the kernel writes it out even if the process dies right after.
  *
- * @param path The path to the file to create.
+ * @param crashed The value to load as "crashed last launch" next time.
  *
  * @return true if the operation was successful.
  */
-bool saveState(const char* const path)
+static bool saveState(bool crashed)
 {
-    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
-    if(fd < 0)
+    StateFile* const stateFile = g_stateFile;
+    if(stateFile == NULL)
     {
-        CLKSLOG_ERROR("Could not open file %s for writing: %s",
-                    path,
-                    strerror(errno));
         return false;
     }
 
-    CLKSJSONEncodeContext JSONContext;
-    clksjson_beginEncode(&JSONContext,
-                       true,
-                       addJSONData,
-                       &fd);
+    StateRecord* const record = &stateFile->records[g_nextStateRecord];
+    const uint32_t sequence = g_stateSequence + 2;
+    atomic_store_explicit(&record->sequence, sequence - 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    StateRecordData* const data = &record->data;
+    data->crashed = crashed;
+    data->launchesSinceLastCrash = g_state.launchesSinceLastCrash;
+    data->sessionsSinceLastCrash = g_state.sessionsSinceLastCrash;
+    data->activeDurationSinceLastCrash = g_state.activeDurationSinceLastCrash;
+    data->backgroundDurationSinceLastCrash = g_state.backgroundDurationSinceLastCrash;
+    record->checksum = stateRecordChecksum(sequence, data);
+
+    atomic_store_explicit(&record->sequence, sequence, memory_order_release);
+    g_stateSequence = sequence;
+    g_nextStateRecord ^= 1;
+    return true;
+}
 
-    int result;
-    if((result = clksjson_beginObject(&JSONContext, NULL)) != CLKSJSON_OK)
-    {
-        goto done;
-    }
-    if((result = clksjson_addIntegerElement(&JSONContext,
-                                          kKeyFormatVersion,
-                                          kFormatVersion)) != CLKSJSON_OK)
+/** Load the persistent state portion of a crash context from the newest
+ * complete record in the state file.
+ *
+ * @return true if a complete record was found.
+ */
+static bool loadState(void)
+{
+    const StateRecord* newest = NULL;
+    for(int i = 0; i < 2; i++)
     {
-        goto done;
+        const StateRecord* record = &g_stateFile->records[i];
+        const uint32_t sequence = atomic_load_explicit(&record->sequence, memory_order_acquire);
+        if(sequence == 0 || (sequence & 1) != 0 ||
+           record->checksum != stateRecordChecksum(sequence, &record->data))
+        {
+            CLKSLOG_DEBUG("State record %d is incomplete", i);
+            continue;
+        }
+        if(newest == NULL || (int32_t)(sequence - atomic_load(&newest->sequence)) > 0)
+        {
+            newest = record;
+        }
     }
-    // Record this launch crashed state into "crashed last launch" field.
-    if((result = clksjson_addBooleanElement(&JSONContext,
-                                          kKeyCrashedLastLaunch,
-                                          g_state.crashedThisLaunch)) != CLKSJSON_OK)
+    if(newest == NULL)
     {
-        goto done;
+        return false;
     }
-    if((result = clksjson_addFloatingPointElement(&JSONContext,
-                                                kKeyActiveDurationSinceLastCrash,
-                                                g_state.activeDurationSinceLastCrash)) != CLKSJSON_OK)
+
+    const StateRecordData* const data = &newest->data;
+    g_state.crashedLastLaunch = data->crashed;
+    g_state.launchesSinceLastCrash = data->launchesSinceLastCrash;
+    g_state.sessionsSinceLastCrash = data->sessionsSinceLastCrash;
+    g_state.activeDurationSinceLastCrash = data->activeDurationSinceLastCrash;
+    g_state.backgroundDurationSinceLastCrash = data->backgroundDurationSinceLastCrash;
+    g_stateSequence = atomic_load(&newest->sequence);
+    g_nextStateRecord = newest == &g_stateFile->records[0] ? 1 : 0;
+    return true;
+}
+
+/** Map the state file into memory, creating or resetting it as needed.
+ *
+ * @param path The path to the state file.
+ *
+ * @return The mapped file, or NULL on error.
+ */
+static StateFile* mapStateFile(const char* const path)
+{
+    const int fd = open(path, O_RDWR | O_CREAT, 0644);
+    if(fd < 0)
     {
-        goto done;
+        CLKSLOG_ERROR("Could not open file %s: %s", path, strerror(errno));
+        return NULL;
     }
-    if((result = clksjson_addFloatingPointElement(&JSONContext,
-                                                kKeyBackgroundDurationSinceLastCrash,
-                                                g_state.backgroundDurationSinceLastCrash)) != CLKSJSON_OK)
+
+    struct stat st;
+    if(fstat(fd, &st) != 0)
     {
-        goto done;
+        CLKSLOG_ERROR("Could not stat file %s: %s", path, strerror(errno));
+        close(fd);
+        return NULL;
     }
-    if((result = clksjson_addIntegerElement(&JSONContext,
-                                          kKeyLaunchesSinceLastCrash,
-                                          g_state.launchesSinceLastCrash)) != CLKSJSON_OK)
+    if(st.st_size != sizeof(StateFile) && ftruncate(fd, sizeof(StateFile)) != 0)
     {
-        goto done;
+        CLKSLOG_ERROR("Could not resize file %s: %s", path, strerror(errno));
+        close(fd);
+        return NULL;
     }
-    if((result = clksjson_addIntegerElement(&JSONContext,
-                                          kKeySessionsSinceLastCrash,
-                                          g_state.sessionsSinceLastCrash)) != CLKSJSON_OK)
+
+    void* memory = mmap(NULL, sizeof(StateFile), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(memory == MAP_FAILED)
     {
-        goto done;
+        CLKSLOG_ERROR("Could not map file %s: %s", path, strerror(errno));
+        return NULL;
     }
-    result = clksjson_endEncode(&JSONContext);
 
-done:
-    close(fd);
-    if(result != CLKSJSON_OK)
+    StateFile* stateFile = memory;
+    if(stateFile->magic != kStateFileMagic ||
+       stateFile->version != kStateFileVersion ||
+       stateFile->recordSize != sizeof(StateRecord))
     {
-        CLKSLOG_ERROR("%s: %s",
-                    path, clksjson_stringForError(result));
-        return false;
+        if(st.st_size != 0)
+        {
+            CLKSLOG_ERROR("%s: Unrecognized state file format. Resetting.", path);
+        }
+        memset(stateFile, 0, sizeof(*stateFile));
+        stateFile->magic = kStateFileMagic;
+        stateFile->version = kStateFileVersion;
+        stateFile->recordSize = sizeof(StateRecord);
     }
-    return true;
+    return stateFile;
 }
 
 
@@ -326,11 +439,21 @@ done:
 #pragma mark - API -
 // ============================================================================
 
-void clkscrashstate_initialize(const char *const stateFilePath)
+void clkscrashstate_initialize(const char* const stateFilePath, const char* const legacyStateFilePath)
 {
-    g_stateFilePath = strdup(stateFilePath);
     memset(&g_state, 0, sizeof(g_state));
-    loadState(g_stateFilePath);
+    g_stateFile = mapStateFile(stateFilePath);
+    if(g_stateFile != NULL && loadState())
+    {
+        return;
+    }
+
+    if(legacyStateFilePath != NULL && loadLegacyState(legacyStateFilePath) && g_stateFile != NULL)
+    {
+        CLKSLOG_DEBUG("Migrating %s to %s", legacyStateFilePath, stateFilePath);
+        saveState(g_state.crashedLastLaunch);
+        unlink(legacyStateFilePath);
+    }
 }
 
 bool clkscrashstate_reset()
@@ -354,7 +477,7 @@ bool clkscrashstate_reset()
         g_state.sessionsSinceLastCrash++;
         g_state.applicationIsInForeground = true;
         
-        return saveState(g_stateFilePath);
+        return saveState(g_state.crashedThisLaunch);
     }
     return false;
 }
@@ -381,8 +504,6 @@ void clkscrashstate_notifyAppInForeground(const bool isInForeground)
 {
     if(g_isEnabled)
     {
-        const char* const stateFilePath = g_stateFilePath;
-
         g_state.applicationIsInForeground = isInForeground;
         if(isInForeground)
         {
@@ -395,7 +516,7 @@ void clkscrashstate_notifyAppInForeground(const bool isInForeground)
         else
         {
             g_state.appStateTransitionTime = getCurentTime();
-            saveState(stateFilePath);
+            saveState(g_state.crashedThisLaunch);
         }
     }
 }
@@ -404,11 +525,9 @@ void clkscrashstate_notifyAppTerminate(void)
 {
     if(g_isEnabled)
     {
-        const char* const stateFilePath = g_stateFilePath;
-
         const double duration = timeSince(g_state.appStateTransitionTime);
         g_state.backgroundDurationSinceLastCrash += duration;
-        saveState(stateFilePath);
+        saveState(g_state.crashedThisLaunch);
     }
 }
 
@@ -416,8 +535,6 @@ void clkscrashstate_notifyAppCrash(void)
 {
     if(g_isEnabled)
     {
-        const char* const stateFilePath = g_stateFilePath;
-
         const double duration = timeSince(g_state.appStateTransitionTime);
         if(g_state.applicationIsActive)
         {
@@ -430,7 +547,7 @@ void clkscrashstate_notifyAppCrash(void)
             g_state.backgroundDurationSinceLastCrash += duration;
         }
         g_state.crashedThisLaunch = true;
-        saveState(stateFilePath);
+        saveState(g_state.crashedThisLaunch);
     }
 }
 
@@ -89,10 +89,17 @@ typedef struct
     
 
 /** Initialize the state monitor.
+ *
+ * The state is kept in a memory-mapped binary file, so state transitions
+ * (including a crash) are recorded without any file I/O.
  *
  * @param stateFilePath Where to store on-disk representation of state.
+ *
+ * @param legacyStateFilePath The JSON state file written by earlier versions
+ *                            (NULL = none). If the state file has no state
+ *                            yet, it is migrated from here and then deleted.
  */
-void clkscrashstate_initialize(const char *stateFilePath);
+void clkscrashstate_initialize(const char* stateFilePath, const char* legacyStateFilePath);
 
 /** Reset the crash state.
  */
@@ -27,7 +27,9 @@
 #include "CLKSID.h"
 #include "CLKSThread.h"
 #include "CLKSMachineContext.h"
+#include "CLKSStackCursor_Backtrace.h"
 #include "CLKSStackCursor_SelfThread.h"
+#include "CLKSThrowTrace.h"
 
 //#define CLKSLogger_LocalLevel TRACE
 #include "CLKSLogger.h"
@@ -40,7 +42,6 @@
 #include <typeinfo>
 
 
-#define STACKTRACE_BUFFER_LENGTH 30
 #define DESCRIPTION_BUFFER_LENGTH 1000
 
 
@@ -65,10 +66,11 @@ static char g_eventID[37];
 
 static CLKSCrash_MonitorContext g_monitorContext;
 
-// TODO: Thread local storage is not supported < ios 9.
-// Find some other way to do thread local. Maybe storage with lookup by tid?
 static CLKSStackCursor g_stackCursor;
 
+/** The throw trace of the crashed thread, walked by g_stackCursor. */
+static uintptr_t g_throwTrace[CLKSTT_MAX_DEPTH];
+
 
 // ============================================================================
 #pragma mark - Callbacks -
@@ -76,6 +78,18 @@ static CLKSStackCursor g_stackCursor;
 
 typedef void (*cxa_throw_type)(void*, std::type_info*, void (*)(void*));
 
+static cxa_throw_type g_originalCxaThrow;
+
+static cxa_throw_type getOriginalCxaThrow()
+{
+    cxa_throw_type originalCxaThrow = g_originalCxaThrow;
+    unlikely_if(originalCxaThrow == NULL)
+    {
+        originalCxaThrow = g_originalCxaThrow = (cxa_throw_type) dlsym(RTLD_NEXT, "__cxa_throw");
+    }
+    return originalCxaThrow;
+}
+
 extern "C"
 {
     void __cxa_throw(void* thrown_exception, std::type_info* tinfo, void (*dest)(void*)) __attribute__ ((weak));
@@ -84,15 +98,9 @@ extern "C"
     {
         if(g_captureNextStackTrace)
         {
-            clkssc_initSelfThread(&g_stackCursor, 1);
-        }
-        
-        static cxa_throw_type orig_cxa_throw = NULL;
-        unlikely_if(orig_cxa_throw == NULL)
-        {
-            orig_cxa_throw = (cxa_throw_type) dlsym(RTLD_NEXT, "__cxa_throw");
+            clkstt_recordThrow(1);
         }
-        orig_cxa_throw(thrown_exception, tinfo, dest);
+        getOriginalCxaThrow()(thrown_exception, tinfo, dest);
         __builtin_unreachable();
     }
 }
@@ -161,6 +169,16 @@ catch(TYPE value)\
         crashContext->crashType = CLKSCrashMonitorTypeCPPException;
         crashContext->eventID = g_eventID;
         crashContext->registersAreValid = false;
+        int throwTraceLength = clkstt_copyLastThrowTrace(g_throwTrace, CLKSTT_MAX_DEPTH);
+        if(throwTraceLength > 0)
+        {
+            clkssc_initWithBacktrace(&g_stackCursor, g_throwTrace, throwTraceLength, 0);
+        }
+        else
+        {
+            // The stack hasn't been unwound yet, so the throw site is still on it.
+            clkssc_initSelfThread(&g_stackCursor, 0);
+        }
         crashContext->stackCursor = &g_stackCursor;
         crashContext->CPPException.name = name;
         crashContext->exceptionName = name;
@@ -191,6 +209,7 @@ static void initialize()
     {
         isInitialized = true;
         clkssc_initCursor(&g_stackCursor, NULL, NULL);
+        getOriginalCxaThrow();
     }
 }
 
@@ -219,6 +238,11 @@ static bool isEnabled()
     return g_isEnabled;
 }
 
+extern "C" void clkscm_setCPPExceptionThrowTraceSampling(int sampleInterval, int maxTracesPerSecond)
+{
+    clkstt_setSampling(sampleInterval, maxTracesPerSecond);
+}
+
 extern "C" CLKSCrashMonitorAPI* clkscm_cppexception_getAPI()
 {
     static CLKSCrashMonitorAPI api =
@@ -32,6 +32,17 @@ extern "C" {
 #include "CLKSCrashMonitor.h"
 
 
+/** Set how often throws record where they were thrown from. A C++ exception
+ * crash whose throw wasn't traced reports the stack at termination instead.
+ * Default is every throw, unlimited.
+ *
+ * @param sampleInterval Trace one in every this many throws on each thread
+ *                       (1 = every throw).
+ *
+ * @param maxTracesPerSecond Maximum number of throws traced per second (0 = unlimited).
+ */
+void clkscm_setCPPExceptionThrowTraceSampling(int sampleInterval, int maxTracesPerSecond);
+
 /** Access the Monitor API.
  */
 CLKSCrashMonitorAPI* clkscm_cppexception_getAPI(void);
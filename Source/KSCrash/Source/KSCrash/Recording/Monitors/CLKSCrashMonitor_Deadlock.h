@@ -48,6 +48,18 @@ extern "C" {
  */
 void clkscm_setDeadlockHandlerWatchdogInterval(double value);
 
+/** Sample the main thread's stack while it is unresponsive, and save each
+ * such hang as a user report containing a call tree of the samples.
+ * Only active while this monitor is enabled.
+ * Default is disabled, with a 0.05 second sample interval.
+ *
+ * @param hangThreshold Seconds the main thread may be unresponsive before
+ *                      sampling starts (0 = disabled).
+ *
+ * @param sampleInterval Seconds between samples (0 = keep current).
+ */
+void clkscm_setMainThreadHangSampling(double hangThreshold, double sampleInterval);
+
 /** Access the Monitor API.
  */
 CLKSCrashMonitorAPI* clkscm_deadlock_getAPI(void);
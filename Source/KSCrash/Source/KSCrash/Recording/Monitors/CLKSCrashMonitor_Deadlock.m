@@ -26,10 +26,19 @@
 
 #import "CLKSCrashMonitor_Deadlock.h"
 #import "CLKSCrashMonitorContext.h"
+#import "CLKSCrashReportFields.h"
+#import "CLKSCrashReportStore.h"
+#import "CLKSCrashReportVersion.h"
+#import "CLKSFileUtils.h"
+#import "CLKSHangSampler.h"
+#import "CLKSHangSampler_Mach.h"
 #import "CLKSID.h"
+#import "CLKSJSONCodec.h"
 #import "CLKSThread.h"
 #import "CLKSStackCursor_MachineContext.h"
+#import "CLKSSymbolicator.h"
 #import <Foundation/Foundation.h>
+#import <pthread.h>
 
 //#define CLKSLogger_LocalLevel TRACE
 #import "CLKSLogger.h"
@@ -37,6 +46,9 @@
 
 #define kIdleInterval 5.0f
 
+/** Samples kept per hang. Longer hangs only keep their beginning. */
+#define kMaxHangSamples 200
+
 
 @class CLKSCrashDeadlockMonitor;
 
@@ -56,6 +68,12 @@ static CLKSThread g_mainQueueThread;
 /** Interval between watchdog pulses. */
 static NSTimeInterval g_watchdogInterval = 0;
 
+/** Time the main thread may be unresponsive before it gets sampled (0 = disabled). */
+static NSTimeInterval g_hangThreshold = 0;
+
+/** Interval between samples of a hung main thread. */
+static NSTimeInterval g_hangSampleInterval = 0.05;
+
 
 // ============================================================================
 #pragma mark - X -
@@ -166,6 +184,121 @@ static NSTimeInterval g_watchdogInterval = 0;
 
 @end
 
+// ============================================================================
+#pragma mark - Hang Sampling -
+// ============================================================================
+
+static int addHangReportData(const char* const data, const int length, void* const userData)
+{
+    NSMutableData* reportData = (__bridge NSMutableData*)userData;
+    [reportData appendBytes:data length:(NSUInteger)length];
+    return CLKSJSON_OK;
+}
+
+static void writeCallTreeNode(CLKSJSONEncodeContext* const context,
+                              const CLKSHangProfile* const profile,
+                              const int nodeIndex)
+{
+    const CLKSHangCallTreeNode* node = &profile->nodes[nodeIndex];
+    clksjson_beginObject(context, NULL);
+    {
+        clksjson_addIntegerElement(context, CLKSCrashField_InstructionAddr, (int64_t)node->address);
+        CLKSStackCursor cursor;
+        cursor.stackEntry.address = node->address;
+        if(clkssymbolicator_symbolicate(&cursor))
+        {
+            if(cursor.stackEntry.imageName != NULL)
+            {
+                clksjson_addStringElement(context, CLKSCrashField_ObjectName, clksfu_lastPathEntry(cursor.stackEntry.imageName), CLKSJSON_SIZE_AUTOMATIC);
+            }
+            clksjson_addIntegerElement(context, CLKSCrashField_ObjectAddr, (int64_t)cursor.stackEntry.imageAddress);
+            if(cursor.stackEntry.symbolName != NULL)
+            {
+                clksjson_addStringElement(context, CLKSCrashField_SymbolName, cursor.stackEntry.symbolName, CLKSJSON_SIZE_AUTOMATIC);
+            }
+            clksjson_addIntegerElement(context, CLKSCrashField_SymbolAddr, (int64_t)cursor.stackEntry.symbolAddress);
+        }
+        clksjson_addIntegerElement(context, CLKSCrashField_SampleCount, node->sampleCount);
+        if(node->firstChild >= 0)
+        {
+            clksjson_beginArray(context, CLKSCrashField_Children);
+            for(int child = node->firstChild; child >= 0; child = profile->nodes[child].nextSibling)
+            {
+                writeCallTreeNode(context, profile, child);
+            }
+            clksjson_endContainer(context);
+        }
+    }
+    clksjson_endContainer(context);
+}
+
+/** Save a hang profile as a user report. Called on the hang sampler thread.
+ */
+static void onMainThreadHang(const CLKSHangProfile* profile, __unused void* userData)
+{
+    @autoreleasepool
+    {
+        char eventID[37];
+        clksid_generate(eventID);
+        NSMutableData* reportData = [NSMutableData data];
+        CLKSJSONEncodeContext context;
+        clksjson_beginEncode(&context, false, addHangReportData, (__bridge void*)reportData);
+        clksjson_beginObject(&context, NULL);
+        {
+            clksjson_beginObject(&context, CLKSCrashField_Report);
+            {
+                clksjson_addStringElement(&context, CLKSCrashField_Version, CLKSCRASH_REPORT_VERSION, CLKSJSON_SIZE_AUTOMATIC);
+                clksjson_addStringElement(&context, CLKSCrashField_ID, eventID, CLKSJSON_SIZE_AUTOMATIC);
+                clksjson_addIntegerElement(&context, CLKSCrashField_Timestamp, (int64_t)profile->startTime);
+                clksjson_addStringElement(&context, CLKSCrashField_Type, CLKSCrashReportType_Hang, CLKSJSON_SIZE_AUTOMATIC);
+            }
+            clksjson_endContainer(&context);
+
+            clksjson_beginObject(&context, CLKSCrashField_Hang);
+            {
+                clksjson_addFloatingPointElement(&context, CLKSCrashField_Duration, profile->duration);
+                clksjson_addFloatingPointElement(&context, CLKSCrashField_SampleInterval, profile->sampleInterval);
+                clksjson_addIntegerElement(&context, CLKSCrashField_SampleCount, profile->sampleCount);
+                clksjson_addIntegerElement(&context, CLKSCrashField_DroppedSampleCount, profile->droppedSampleCount);
+                clksjson_beginArray(&context, CLKSCrashField_CallTree);
+                for(int root = profile->nodes[0].firstChild; root >= 0; root = profile->nodes[root].nextSibling)
+                {
+                    writeCallTreeNode(&context, profile, root);
+                }
+                clksjson_endContainer(&context);
+            }
+            clksjson_endContainer(&context);
+        }
+        if(clksjson_endEncode(&context) != CLKSJSON_OK)
+        {
+            CLKSLOG_ERROR(@"Could not encode hang report");
+            return;
+        }
+        CLKSLOG_DEBUG(@"Main thread was unresponsive for %f seconds. Saving hang report.", profile->duration);
+        clkscrs_addUserReport(reportData.bytes, (int)reportData.length);
+    }
+}
+
+static void requestMainThreadResponse(__unused void* context, uint64_t request)
+{
+    dispatch_async(dispatch_get_main_queue(), ^{clkshs_notifyResponsive(request);});
+}
+
+static void updateHangSampler()
+{
+    if(!g_isEnabled || g_hangThreshold <= 0)
+    {
+        clkshs_stop();
+        return;
+    }
+
+    CLKSHangSamplerBackend backend;
+    clkshs_mach_initBackend(&backend, (CLKSThread)pthread_mach_thread_np(pthread_main_thread_np()));
+    backend.requestResponse = requestMainThreadResponse;
+    clkshs_start(&backend, g_hangThreshold, g_hangSampleInterval, kMaxHangSamples, onMainThreadHang, NULL);
+}
+
+
 // ============================================================================
 #pragma mark - API -
 // ============================================================================
@@ -197,6 +330,7 @@ static void setEnabled(bool isEnabled)
             [g_monitor cancel];
             g_monitor = nil;
         }
+        updateHangSampler();
     }
 }
 
@@ -219,3 +353,13 @@ void clkscm_setDeadlockHandlerWatchdogInterval(double value)
 {
     g_watchdogInterval = value;
 }
+
+void clkscm_setMainThreadHangSampling(double hangThreshold, double sampleInterval)
+{
+    g_hangThreshold = hangThreshold;
+    if(sampleInterval > 0)
+    {
+        g_hangSampleInterval = sampleInterval;
+    }
+    updateHangSampler();
+}
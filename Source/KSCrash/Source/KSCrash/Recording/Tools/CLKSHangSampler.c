@@ -0,0 +1,279 @@
+
+
+#include "CLKSHangSampler.h"
+
+//#define CLKSLogger_LocalLevel TRACE
+#include "CLKSLogger.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <time.h>
+
+
+typedef struct
+{
+    int depth;
+    uintptr_t addresses[CLKSHS_MAX_DEPTH];
+} Sample;
+
+static pthread_mutex_t g_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static pthread_t g_samplerThread;
+static bool g_isRunning;
+static _Atomic(bool) g_isStopping;
+
+static CLKSHangSamplerBackend g_backend;
+static double g_hangThreshold;
+static double g_sampleInterval;
+static CLKSHangSamplerCallback g_onHangEnded;
+static void* g_userData;
+
+/** Preallocated so that nothing is allocated while the watched thread is suspended. */
+static Sample* g_samples;
+static int g_maxSamples;
+
+/** Number of times the watched thread was asked to respond. */
+static _Atomic(uint64_t) g_requestCount;
+
+/** The latest request that the watched thread has responded to. */
+static _Atomic(uint64_t) g_responseCount;
+
+
+// ============================================================================
+#pragma mark - Utility -
+// ============================================================================
+
+static double getCurrentTime(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + (double)tv.tv_usec / 1000000.0;
+}
+
+static void sleepFor(double seconds)
+{
+    struct timespec remaining =
+    {
+        .tv_sec = (time_t)seconds,
+        .tv_nsec = (long)((seconds - (double)(time_t)seconds) * 1000000000.0),
+    };
+    while(nanosleep(&remaining, &remaining) != 0 && errno == EINTR)
+    {
+    }
+}
+
+static bool hasResponded(uint64_t request)
+{
+    return atomic_load(&g_responseCount) >= request;
+}
+
+/** Find or add the child of parent for address.
+ *
+ * @return The child's index.
+ */
+static int getChild(CLKSHangCallTreeNode* nodes, int* nodeCount, int parent, uintptr_t address)
+{
+    for(int i = nodes[parent].firstChild; i >= 0; i = nodes[i].nextSibling)
+    {
+        if(nodes[i].address == address)
+        {
+            return i;
+        }
+    }
+    int child = (*nodeCount)++;
+    nodes[child].address = address;
+    nodes[child].sampleCount = 0;
+    nodes[child].firstChild = -1;
+    nodes[child].nextSibling = nodes[parent].firstChild;
+    nodes[parent].firstChild = child;
+    return child;
+}
+
+/** Merge the samples into a call tree and pass it to the callback. */
+static void reportHang(double startTime, double duration, int sampleCount, int droppedSampleCount)
+{
+    int maxNodeCount = 1;
+    for(int i = 0; i < sampleCount; i++)
+    {
+        maxNodeCount += g_samples[i].depth;
+    }
+    CLKSHangCallTreeNode* nodes = malloc(sizeof(*nodes) * (size_t)maxNodeCount);
+    if(nodes == NULL)
+    {
+        CLKSLOG_ERROR("Could not allocate %d call tree nodes", maxNodeCount);
+        return;
+    }
+
+    nodes[0].address = 0;
+    nodes[0].sampleCount = sampleCount;
+    nodes[0].firstChild = -1;
+    nodes[0].nextSibling = -1;
+    int nodeCount = 1;
+    for(int i = 0; i < sampleCount; i++)
+    {
+        const Sample* sample = &g_samples[i];
+        int node = 0;
+        for(int j = sample->depth - 1; j >= 0; j--)
+        {
+            node = getChild(nodes, &nodeCount, node, sample->addresses[j]);
+            nodes[node].sampleCount++;
+        }
+    }
+
+    CLKSHangProfile profile =
+    {
+        .startTime = startTime,
+        .duration = duration,
+        .sampleInterval = g_sampleInterval,
+        .sampleCount = sampleCount,
+        .droppedSampleCount = droppedSampleCount,
+        .nodes = nodes,
+        .nodeCount = nodeCount,
+    };
+    g_onHangEnded(&profile, g_userData);
+    free(nodes);
+}
+
+static void* runSampler(__unused void* userData)
+{
+#ifdef __APPLE__
+    pthread_setname_np("CLKSCrash Hang Sampler");
+#endif
+    while(!atomic_load(&g_isStopping))
+    {
+        const uint64_t request = atomic_fetch_add(&g_requestCount, 1) + 1;
+        const double requestTime = getCurrentTime();
+        g_backend.requestResponse(g_backend.context, request);
+        sleepFor(g_hangThreshold);
+        if(hasResponded(request))
+        {
+            continue;
+        }
+
+        CLKSLOG_DEBUG("Watched thread missed its deadline. Sampling.");
+        int sampleCount = 0;
+        int droppedSampleCount = 0;
+        while(!hasResponded(request) && !atomic_load(&g_isStopping))
+        {
+            if(sampleCount < g_maxSamples)
+            {
+                Sample* sample = &g_samples[sampleCount];
+                sample->depth = g_backend.sampleStack(g_backend.context, sample->addresses, CLKSHS_MAX_DEPTH);
+                if(sample->depth > 0)
+                {
+                    sampleCount++;
+                }
+            }
+            else
+            {
+                droppedSampleCount++;
+            }
+            sleepFor(g_sampleInterval);
+        }
+        if(!hasResponded(request))
+        {
+            break;
+        }
+
+        const double duration = getCurrentTime() - requestTime;
+        CLKSLOG_DEBUG("Watched thread recovered after %f seconds. %d samples.", duration, sampleCount);
+        if(sampleCount > 0)
+        {
+            reportHang(requestTime, duration, sampleCount, droppedSampleCount);
+        }
+    }
+    return NULL;
+}
+
+static void stopLocked(void)
+{
+    if(g_isRunning)
+    {
+        atomic_store(&g_isStopping, true);
+        pthread_join(g_samplerThread, NULL);
+        g_isRunning = false;
+    }
+    free(g_samples);
+    g_samples = NULL;
+}
+
+
+// ============================================================================
+#pragma mark - API -
+// ============================================================================
+
+bool clkshs_start(const CLKSHangSamplerBackend* backend,
+                  double hangThreshold,
+                  double sampleInterval,
+                  int maxSamples,
+                  CLKSHangSamplerCallback onHangEnded,
+                  void* userData)
+{
+    if(backend == NULL || backend->sampleStack == NULL || backend->requestResponse == NULL ||
+       hangThreshold <= 0 || sampleInterval <= 0 || maxSamples <= 0 || onHangEnded == NULL)
+    {
+        CLKSLOG_ERROR("Invalid hang sampler configuration");
+        return false;
+    }
+
+    bool isSuccessful = false;
+    pthread_mutex_lock(&g_mutex);
+    stopLocked();
+
+    g_samples = malloc(sizeof(*g_samples) * (size_t)maxSamples);
+    if(g_samples == NULL)
+    {
+        CLKSLOG_ERROR("Could not allocate %d hang samples", maxSamples);
+        goto done;
+    }
+    g_maxSamples = maxSamples;
+    g_backend = *backend;
+    g_hangThreshold = hangThreshold;
+    g_sampleInterval = sampleInterval;
+    g_onHangEnded = onHangEnded;
+    g_userData = userData;
+    atomic_store(&g_isStopping, false);
+
+    int error = pthread_create(&g_samplerThread, NULL, runSampler, NULL);
+    if(error != 0)
+    {
+        CLKSLOG_ERROR("Could not start hang sampler thread: %s", strerror(error));
+        free(g_samples);
+        g_samples = NULL;
+        goto done;
+    }
+    g_isRunning = true;
+    isSuccessful = true;
+
+done:
+    pthread_mutex_unlock(&g_mutex);
+    return isSuccessful;
+}
+
+void clkshs_stop(void)
+{
+    pthread_mutex_lock(&g_mutex);
+    stopLocked();
+    pthread_mutex_unlock(&g_mutex);
+}
+
+bool clkshs_isRunning(void)
+{
+    pthread_mutex_lock(&g_mutex);
+    bool isRunning = g_isRunning;
+    pthread_mutex_unlock(&g_mutex);
+    return isRunning;
+}
+
+void clkshs_notifyResponsive(uint64_t request)
+{
+    // A late reply to an old request must not answer a newer one.
+    uint64_t responseCount = atomic_load(&g_responseCount);
+    while(responseCount < request && !atomic_compare_exchange_weak(&g_responseCount, &responseCount, request))
+    {
+    }
+}
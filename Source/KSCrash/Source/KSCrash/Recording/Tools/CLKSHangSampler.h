@@ -0,0 +1,135 @@
+
+
+/* Profiles stalls of a watched thread (usually the main thread).
+ *
+ * A sampler thread regularly asks the watched thread to respond. If it
+ * hasn't responded within the hang threshold, the sampler records its
+ * stack at a fixed interval into a preallocated buffer until it responds
+ * again, then merges the samples into a call tree and hands it over.
+ *
+ * How a thread is asked to respond and how its stack is read are up to
+ * the backend. See CLKSHangSampler_Mach and CLKSHangSampler_Signal.
+ *
+ * This file is platform independent.
+ */
+
+
+#ifndef HDR_CLKSHangSampler_h
+#define HDR_CLKSHangSampler_h
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+/** Maximum number of stack entries recorded per sample. */
+#define CLKSHS_MAX_DEPTH 64
+
+typedef struct
+{
+    /** Suspend the watched thread, copy its stack addresses (innermost
+     * first) and resume it. Called from the sampler thread. Must not
+     * allocate or take locks while the thread is suspended.
+     *
+     * @return The number of addresses copied (0 = could not sample).
+     */
+    int (*sampleStack)(void* context, uintptr_t* addresses, int maxCount);
+
+    /** Arrange for the watched thread to call clkshs_notifyResponsive(request)
+     * as soon as it is free to do so. Called from the sampler thread.
+     */
+    void (*requestResponse)(void* context, uint64_t request);
+
+    /** Passed to the functions above. */
+    void* context;
+} CLKSHangSamplerBackend;
+
+typedef struct
+{
+    /** The stack address this node represents (0 for the root). */
+    uintptr_t address;
+
+    /** The number of samples that passed through this node. */
+    int sampleCount;
+
+    /** Index of this node's first child, or -1. */
+    int firstChild;
+
+    /** Index of the next child of this node's parent, or -1. */
+    int nextSibling;
+} CLKSHangCallTreeNode;
+
+typedef struct
+{
+    /** When the watched thread was last asked to respond (seconds since 1970). */
+    double startTime;
+
+    /** How long the watched thread was unresponsive for, in seconds. */
+    double duration;
+
+    /** Seconds between samples. */
+    double sampleInterval;
+
+    /** The number of samples in the call tree. */
+    int sampleCount;
+
+    /** The number of samples that didn't fit in the buffer. */
+    int droppedSampleCount;
+
+    /** The call tree. nodes[0] is the root, whose children are the outermost frames. */
+    const CLKSHangCallTreeNode* nodes;
+    int nodeCount;
+} CLKSHangProfile;
+
+/** Called on the sampler thread after each hang that got sampled.
+ * The profile is only valid until the callback returns.
+ */
+typedef void (*CLKSHangSamplerCallback)(const CLKSHangProfile* profile, void* userData);
+
+
+/** Start watching a thread. Any previous sampler is stopped first.
+ *
+ * @param backend How to reach the watched thread. Copied.
+ *
+ * @param hangThreshold Seconds without a response before the thread is considered hung.
+ *
+ * @param sampleInterval Seconds between samples during a hang.
+ *
+ * @param maxSamples The number of samples to allocate room for. Longer hangs
+ *                   keep only their first maxSamples samples.
+ *
+ * @param onHangEnded Called after each hang.
+ *
+ * @param userData Passed to onHangEnded.
+ *
+ * @return true if the sampler was started.
+ */
+bool clkshs_start(const CLKSHangSamplerBackend* backend,
+                  double hangThreshold,
+                  double sampleInterval,
+                  int maxSamples,
+                  CLKSHangSamplerCallback onHangEnded,
+                  void* userData);
+
+/** Stop watching, and wait for the sampler thread to exit. */
+void clkshs_stop(void);
+
+/** Check if the sampler is running. */
+bool clkshs_isRunning(void);
+
+/** Called on the watched thread, in response to the backend's requestResponse().
+ *
+ * @param request The request being answered, as passed to requestResponse().
+ */
+void clkshs_notifyResponsive(uint64_t request);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // HDR_CLKSHangSampler_h
@@ -0,0 +1,41 @@
+
+
+#include "CLKSHangSampler_Mach.h"
+#include "CLKSMachineContext.h"
+#include "CLKSStackCursor_MachineContext.h"
+
+//#define CLKSLogger_LocalLevel TRACE
+#include "CLKSLogger.h"
+
+#include <mach/mach.h>
+
+
+static int sampleStack(void* context, uintptr_t* addresses, int maxCount)
+{
+    const thread_t thread = (thread_t)(uintptr_t)context;
+    if(thread_suspend(thread) != KERN_SUCCESS)
+    {
+        return 0;
+    }
+
+    int count = 0;
+    CLKSMC_NEW_CONTEXT(machineContext);
+    if(clksmc_getContextForThread((CLKSThread)thread, machineContext, false))
+    {
+        CLKSStackCursor stackCursor;
+        clkssc_initWithMachineContext(&stackCursor, maxCount, machineContext);
+        while(count < maxCount && stackCursor.advanceCursor(&stackCursor))
+        {
+            addresses[count++] = stackCursor.stackEntry.address;
+        }
+    }
+
+    thread_resume(thread);
+    return count;
+}
+
+void clkshs_mach_initBackend(CLKSHangSamplerBackend* backend, CLKSThread thread)
+{
+    backend->sampleStack = sampleStack;
+    backend->context = (void*)(uintptr_t)thread;
+}
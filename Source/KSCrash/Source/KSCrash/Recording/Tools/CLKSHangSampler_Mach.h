@@ -0,0 +1,30 @@
+
+
+#ifndef HDR_CLKSHangSampler_Mach_h
+#define HDR_CLKSHangSampler_Mach_h
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+#include "CLKSHangSampler.h"
+#include "CLKSThread.h"
+
+
+/** Set up a hang sampler backend that samples a thread by suspending it and
+ * walking its stack from its machine context.
+ * Only sampleStack and context are filled in; requestResponse is up to the caller.
+ *
+ * @param backend The backend to set up.
+ *
+ * @param thread The thread to sample.
+ */
+void clkshs_mach_initBackend(CLKSHangSamplerBackend* backend, CLKSThread thread);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // HDR_CLKSHangSampler_Mach_h
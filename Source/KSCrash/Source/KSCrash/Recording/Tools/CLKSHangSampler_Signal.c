@@ -0,0 +1,158 @@
+
+
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE // pthread_getattr_np()
+#endif
+
+#include "CLKSHangSampler_Signal.h"
+
+//#define CLKSLogger_LocalLevel TRACE
+#include "CLKSLogger.h"
+
+#if defined(__linux__)
+
+#include <errno.h>
+#include <semaphore.h>
+#include <signal.h>
+#include <string.h>
+#include <time.h>
+#include <ucontext.h>
+
+
+/** How long to wait for the signalled thread to record its stack. */
+#define SAMPLE_TIMEOUT_NS 100000000
+
+static pthread_t g_thread;
+static uintptr_t g_stackLow;
+static uintptr_t g_stackHigh;
+
+static uintptr_t* volatile g_sampleAddresses;
+static volatile int g_sampleMaxCount;
+static volatile int g_sampleCount;
+static sem_t g_sampleDone;
+
+
+static void handleSampleSignal(__unused int sigNum, __unused siginfo_t* signalInfo, void* userContext)
+{
+    uintptr_t* const addresses = g_sampleAddresses;
+    if(addresses == NULL || !pthread_equal(pthread_self(), g_thread))
+    {
+        return;
+    }
+
+    const ucontext_t* const context = userContext;
+#if defined(__x86_64__)
+    const uintptr_t pc = (uintptr_t)context->uc_mcontext.gregs[REG_RIP];
+    const uintptr_t* frame = (const uintptr_t*)context->uc_mcontext.gregs[REG_RBP];
+#elif defined(__aarch64__)
+    const uintptr_t pc = (uintptr_t)context->uc_mcontext.pc;
+    const uintptr_t* frame = (const uintptr_t*)context->uc_mcontext.regs[29];
+#else
+    const uintptr_t pc = 0;
+    const uintptr_t* frame = NULL;
+#endif
+
+    const int maxCount = g_sampleMaxCount;
+    int count = 0;
+    if(pc != 0 && count < maxCount)
+    {
+        addresses[count++] = pc;
+    }
+    // Each frame is {previous frame, return address}. Stay within the thread's stack.
+    while(count < maxCount &&
+          (uintptr_t)frame >= g_stackLow &&
+          (uintptr_t)(frame + 2) <= g_stackHigh &&
+          (uintptr_t)frame % sizeof(*frame) == 0 &&
+          frame[1] != 0)
+    {
+        addresses[count++] = frame[1];
+        if(frame[0] <= (uintptr_t)frame)
+        {
+            break;
+        }
+        frame = (const uintptr_t*)frame[0];
+    }
+
+    g_sampleCount = count;
+    g_sampleAddresses = NULL;
+    sem_post(&g_sampleDone);
+}
+
+static int sampleStack(__unused void* context, uintptr_t* addresses, int maxCount)
+{
+    g_sampleCount = 0;
+    g_sampleMaxCount = maxCount;
+    g_sampleAddresses = addresses;
+    if(pthread_kill(g_thread, SIGPROF) != 0)
+    {
+        g_sampleAddresses = NULL;
+        return 0;
+    }
+
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_nsec += SAMPLE_TIMEOUT_NS;
+    if(deadline.tv_nsec >= 1000000000)
+    {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000;
+    }
+    while(sem_timedwait(&g_sampleDone, &deadline) != 0)
+    {
+        if(errno != EINTR)
+        {
+            CLKSLOG_DEBUG("Sampled thread didn't handle SIGPROF in time");
+            g_sampleAddresses = NULL;
+            return 0;
+        }
+    }
+    return g_sampleCount;
+}
+
+bool clkshs_signal_initBackend(CLKSHangSamplerBackend* backend, pthread_t thread)
+{
+    static bool isInitialized = false;
+    if(!isInitialized)
+    {
+        sem_init(&g_sampleDone, 0, 0);
+        struct sigaction action;
+        memset(&action, 0, sizeof(action));
+        action.sa_flags = SA_SIGINFO | SA_RESTART;
+        sigemptyset(&action.sa_mask);
+        action.sa_sigaction = handleSampleSignal;
+        if(sigaction(SIGPROF, &action, NULL) != 0)
+        {
+            CLKSLOG_ERROR("Could not install SIGPROF handler: %s", strerror(errno));
+            return false;
+        }
+        isInitialized = true;
+    }
+
+    g_thread = thread;
+    g_stackLow = g_stackHigh = 0;
+    pthread_attr_t attr;
+    if(pthread_getattr_np(thread, &attr) == 0)
+    {
+        void* address;
+        size_t size;
+        if(pthread_attr_getstack(&attr, &address, &size) == 0)
+        {
+            g_stackLow = (uintptr_t)address;
+            g_stackHigh = g_stackLow + size;
+        }
+        pthread_attr_destroy(&attr);
+    }
+
+    backend->sampleStack = sampleStack;
+    backend->context = NULL;
+    return true;
+}
+
+#else
+
+bool clkshs_signal_initBackend(__unused CLKSHangSamplerBackend* backend, __unused pthread_t thread)
+{
+    return false;
+}
+
+#endif
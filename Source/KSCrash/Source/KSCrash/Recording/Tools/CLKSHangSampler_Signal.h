@@ -0,0 +1,41 @@
+
+
+/* Hang sampler backend for Linux, where threads can't be suspended from
+ * outside. The watched thread is sent SIGPROF instead, and records its own
+ * stack from the signal handler.
+ */
+
+
+#ifndef HDR_CLKSHangSampler_Signal_h
+#define HDR_CLKSHangSampler_Signal_h
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+#include "CLKSHangSampler.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+
+
+/** Set up a hang sampler backend that samples a thread by signalling it.
+ * Only sampleStack and context are filled in; requestResponse is up to the caller.
+ * Installs a SIGPROF handler. Only one thread can be sampled at a time.
+ *
+ * @param backend The backend to set up.
+ *
+ * @param thread The thread to sample.
+ *
+ * @return false if the backend is unavailable on this platform, or the
+ *         handler couldn't be installed.
+ */
+bool clkshs_signal_initBackend(CLKSHangSamplerBackend* backend, pthread_t thread);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // HDR_CLKSHangSampler_Signal_h
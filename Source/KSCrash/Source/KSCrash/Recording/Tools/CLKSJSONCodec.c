@@ -35,6 +35,14 @@
 #include <string.h>
 #include <unistd.h>
 
+#if defined(__aarch64__)
+    #include <arm_neon.h>
+    #define CLKSJSONCODEC_HAS_NEON 1
+#elif defined(__SSSE3__)
+    #include <tmmintrin.h>
+    #define CLKSJSONCODEC_HAS_SSSE3 1
+#endif
+
 
 // ============================================================================
 #pragma mark - Configuration -
@@ -58,6 +66,20 @@
     #define CLKSJSONCODEC_WorkBufferSize 512
 #endif
 
+/** The scratch buffer size to use when embedding JSON from a file.
+ * This limits the length of any single name + string value in the file.
+ */
+#ifndef CLKSJSONCODEC_FileScratchSize
+    #define CLKSJSONCODEC_FileScratchSize 8192
+#endif
+
+/** The read buffer size to use when embedding JSON from a file.
+ * This has no effect on what can be decoded.
+ */
+#ifndef CLKSJSONCODEC_FileReadBufferSize
+    #define CLKSJSONCODEC_FileReadBufferSize 1024
+#endif
+
 
 // ============================================================================
 #pragma mark - Helpers -
@@ -74,6 +96,10 @@ static char g_hexNybbles[] =
     '8', '9', 'A', 'B', 'C', 'D', 'E', 'F'
 };
 
+/** Used for writing base64 string values. */
+static const char g_base64Alphabet[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
 const char* clksjson_stringForError(const int error)
 {
     switch (error)
@@ -318,6 +344,29 @@ int clksjson_addRawJSONData(CLKSJSONEncodeContext* const context,
     return addJSONData(context, data, length);
 }
 
+int clksjson_addRawJSONElements(CLKSJSONEncodeContext* const context,
+                              const char* const data,
+                              const int length)
+{
+    if(length <= 0)
+    {
+        return CLKSJSON_OK;
+    }
+    unlikely_if(context->containerFirstEntry)
+    {
+        context->containerFirstEntry = false;
+    }
+    else
+    {
+        int result = addJSONData(context, ",", 1);
+        unlikely_if(result != CLKSJSON_OK)
+        {
+            return result;
+        }
+    }
+    return addJSONData(context, data, length);
+}
+
 int clksjson_addBooleanElement(CLKSJSONEncodeContext* const context,
                              const char* const name,
                              const bool value)
@@ -397,6 +446,28 @@ int clksjson_addStringElement(CLKSJSONEncodeContext* const context,
     return addQuotedEscapedString(context, value, length);
 }
 
+int clksjson_addPreEscapedStringElement(CLKSJSONEncodeContext* const context,
+                                      const char* const name,
+                                      const char* const value,
+                                      int length)
+{
+    int result = clksjson_beginElement(context, name);
+    unlikely_if(result != CLKSJSON_OK)
+    {
+        return result;
+    }
+    unlikely_if((result = addJSONData(context, "\"", 1)) != CLKSJSON_OK)
+    {
+        return result;
+    }
+    result = addJSONData(context, value, length);
+
+    // Always close string, even if we failed to write its content
+    int closeResult = addJSONData(context, "\"", 1);
+
+    return result || closeResult;
+}
+
 int clksjson_beginStringElement(CLKSJSONEncodeContext* const context,
                               const char* const name)
 {
@@ -438,36 +509,239 @@ int clksjson_addDataElement(CLKSJSONEncodeContext* const context,
     return result;
 }
 
+/** Hex encode bytes.
+ *
+ * @param src The bytes to encode.
+ *
+ * @param length The number of bytes to encode.
+ *
+ * @param dst Where to write the characters (length * 2 of them).
+ */
+static void encodeHex(const uint8_t* const src, const int length, char* const dst)
+{
+    int i = 0;
+#if CLKSJSONCODEC_HAS_NEON
+    const uint8x16_t table = vld1q_u8((const uint8_t*)g_hexNybbles);
+    const uint8x16_t mask = vdupq_n_u8(0x0f);
+    for(; i + 16 <= length; i += 16)
+    {
+        uint8x16_t bytes = vld1q_u8(src + i);
+        uint8x16x2_t chars;
+        chars.val[0] = vqtbl1q_u8(table, vshrq_n_u8(bytes, 4));
+        chars.val[1] = vqtbl1q_u8(table, vandq_u8(bytes, mask));
+        // Interleaving store puts each high nybble before its low nybble.
+        vst2q_u8((uint8_t*)dst + i * 2, chars);
+    }
+#elif CLKSJSONCODEC_HAS_SSSE3
+    const __m128i table = _mm_loadu_si128((const __m128i*)g_hexNybbles);
+    const __m128i mask = _mm_set1_epi8(0x0f);
+    for(; i + 16 <= length; i += 16)
+    {
+        __m128i bytes = _mm_loadu_si128((const __m128i*)(src + i));
+        __m128i high = _mm_shuffle_epi8(table, _mm_and_si128(_mm_srli_epi16(bytes, 4), mask));
+        __m128i low = _mm_shuffle_epi8(table, _mm_and_si128(bytes, mask));
+        _mm_storeu_si128((__m128i*)(dst + i * 2), _mm_unpacklo_epi8(high, low));
+        _mm_storeu_si128((__m128i*)(dst + i * 2 + 16), _mm_unpackhi_epi8(high, low));
+    }
+#endif
+    for(; i < length; i++)
+    {
+        dst[i * 2] = g_hexNybbles[src[i] >> 4];
+        dst[i * 2 + 1] = g_hexNybbles[src[i] & 15];
+    }
+}
+
+/** Base64 encode complete 3 byte groups.
+ *
+ * @param src The bytes to encode.
+ *
+ * @param length The number of bytes to encode. Must be a multiple of 3.
+ *
+ * @param dst Where to write the characters (length / 3 * 4 of them).
+ */
+static void encodeBase64Groups(const uint8_t* src, const int length, char* dst)
+{
+    int i = 0;
+#if CLKSJSONCODEC_HAS_NEON
+    uint8x16x4_t table;
+    table.val[0] = vld1q_u8((const uint8_t*)g_base64Alphabet);
+    table.val[1] = vld1q_u8((const uint8_t*)g_base64Alphabet + 16);
+    table.val[2] = vld1q_u8((const uint8_t*)g_base64Alphabet + 32);
+    table.val[3] = vld1q_u8((const uint8_t*)g_base64Alphabet + 48);
+    const uint8x16_t mask = vdupq_n_u8(0x3f);
+    for(; i + 48 <= length; i += 48)
+    {
+        // De-interleave 16 groups of 3 bytes, then build the 4 sextets of each.
+        uint8x16x3_t in = vld3q_u8(src + i);
+        uint8x16x4_t out;
+        out.val[0] = vshrq_n_u8(in.val[0], 2);
+        out.val[1] = vandq_u8(vorrq_u8(vshlq_n_u8(in.val[0], 4), vshrq_n_u8(in.val[1], 4)), mask);
+        out.val[2] = vandq_u8(vorrq_u8(vshlq_n_u8(in.val[1], 2), vshrq_n_u8(in.val[2], 6)), mask);
+        out.val[3] = vandq_u8(in.val[2], mask);
+        out.val[0] = vqtbl4q_u8(table, out.val[0]);
+        out.val[1] = vqtbl4q_u8(table, out.val[1]);
+        out.val[2] = vqtbl4q_u8(table, out.val[2]);
+        out.val[3] = vqtbl4q_u8(table, out.val[3]);
+        vst4q_u8((uint8_t*)dst, out);
+        dst += 64;
+    }
+#endif
+    for(; i < length; i += 3)
+    {
+        uint32_t group = ((uint32_t)src[i] << 16) | ((uint32_t)src[i + 1] << 8) | src[i + 2];
+        *dst++ = g_base64Alphabet[(group >> 18) & 0x3f];
+        *dst++ = g_base64Alphabet[(group >> 12) & 0x3f];
+        *dst++ = g_base64Alphabet[(group >> 6) & 0x3f];
+        *dst++ = g_base64Alphabet[group & 0x3f];
+    }
+}
+
+/** Hex encode bytes and send them to the data handler, one work buffer at a time.
+ *
+ * @param context The encoding context.
+ *
+ * @param src The bytes to encode.
+ *
+ * @param length The number of bytes to encode.
+ *
+ * @return CLKSJSON_OK if the data was handled successfully.
+ */
+static int appendHexData(CLKSJSONEncodeContext* const context,
+                         const uint8_t* src,
+                         int length)
+{
+    char workBuffer[CLKSJSONCODEC_WorkBufferSize];
+    int result = CLKSJSON_OK;
+    while(length > 0)
+    {
+        int toAdd = length;
+        unlikely_if(toAdd > CLKSJSONCODEC_WorkBufferSize / 2)
+        {
+            toAdd = CLKSJSONCODEC_WorkBufferSize / 2;
+        }
+        encodeHex(src, toAdd, workBuffer);
+        unlikely_if((result = addJSONData(context, workBuffer, toAdd * 2)) != CLKSJSON_OK)
+        {
+            return result;
+        }
+        src += toAdd;
+        length -= toAdd;
+    }
+    return result;
+}
+
+/** Base64 encode bytes and send them to the data handler, one work buffer at
+ * a time. Bytes that don't make up a complete group are held in the context
+ * until the next append or the end of the element.
+ *
+ * @param context The encoding context.
+ *
+ * @param src The bytes to encode.
+ *
+ * @param length The number of bytes to encode.
+ *
+ * @return CLKSJSON_OK if the data was handled successfully.
+ */
+static int appendBase64Data(CLKSJSONEncodeContext* const context,
+                            const uint8_t* src,
+                            int length)
+{
+    char workBuffer[CLKSJSONCODEC_WorkBufferSize];
+    int result = CLKSJSON_OK;
+
+    unlikely_if(context->dataRemainderLength > 0)
+    {
+        while(context->dataRemainderLength < 3 && length > 0)
+        {
+            context->dataRemainder[context->dataRemainderLength++] = *src++;
+            length--;
+        }
+        if(context->dataRemainderLength < 3)
+        {
+            return CLKSJSON_OK;
+        }
+        context->dataRemainderLength = 0;
+        encodeBase64Groups(context->dataRemainder, 3, workBuffer);
+        unlikely_if((result = addJSONData(context, workBuffer, 4)) != CLKSJSON_OK)
+        {
+            return result;
+        }
+    }
+
+    const int maxGroupBytes = CLKSJSONCODEC_WorkBufferSize / 4 * 3;
+    while(length >= 3)
+    {
+        int toAdd = length - length % 3;
+        unlikely_if(toAdd > maxGroupBytes)
+        {
+            toAdd = maxGroupBytes;
+        }
+        encodeBase64Groups(src, toAdd, workBuffer);
+        unlikely_if((result = addJSONData(context, workBuffer, toAdd / 3 * 4)) != CLKSJSON_OK)
+        {
+            return result;
+        }
+        src += toAdd;
+        length -= toAdd;
+    }
+
+    while(length > 0)
+    {
+        context->dataRemainder[context->dataRemainderLength++] = *src++;
+        length--;
+    }
+    return result;
+}
+
 int clksjson_beginDataElement(CLKSJSONEncodeContext* const context,
                             const char* const name)
 {
-    return clksjson_beginStringElement(context, name);
+    int result = clksjson_beginStringElement(context, name);
+    context->dataRemainderLength = 0;
+    likely_if(result == CLKSJSON_OK && context->dataEncoding == CLKSJSONDataEncodingBase64)
+    {
+        result = addJSONData(context,
+                             CLKSJSON_BASE64_DATA_PREFIX,
+                             (int)sizeof(CLKSJSON_BASE64_DATA_PREFIX) - 1);
+    }
+    return result;
 }
 
 int clksjson_appendDataElement(CLKSJSONEncodeContext* const context,
                              const char* const value,
                              int length)
 {
-    unsigned char* currentByte = (unsigned char*)value;
-    unsigned char* end = currentByte + length;
-    char chars[2];
-    int result = CLKSJSON_OK;
-    while(currentByte < end)
+    if(context->dataEncoding == CLKSJSONDataEncodingBase64)
     {
-        chars[0] = g_hexNybbles[(*currentByte>>4)&15];
-        chars[1] = g_hexNybbles[*currentByte&15];
-        result = addJSONData(context, chars, sizeof(chars));
-        if(result != CLKSJSON_OK)
-        {
-            break;
-        }
-        currentByte++;
+        return appendBase64Data(context, (const uint8_t*)value, length);
     }
-    return result;
+    return appendHexData(context, (const uint8_t*)value, length);
 }
 
 int clksjson_endDataElement(CLKSJSONEncodeContext* const context)
 {
+    unlikely_if(context->dataRemainderLength > 0)
+    {
+        // Encode the final partial group as a zero-padded full group,
+        // then overwrite the characters that carry no data with padding.
+        char chars[4];
+        int remainderLength = context->dataRemainderLength;
+        for(int i = remainderLength; i < 3; i++)
+        {
+            context->dataRemainder[i] = 0;
+        }
+        context->dataRemainderLength = 0;
+        encodeBase64Groups(context->dataRemainder, 3, chars);
+        for(int i = remainderLength + 1; i < 4; i++)
+        {
+            chars[i] = '=';
+        }
+        int result = addJSONData(context, chars, sizeof(chars));
+        unlikely_if(result != CLKSJSON_OK)
+        {
+            return result;
+        }
+    }
     return clksjson_endStringElement(context);
 }
 
@@ -551,6 +825,12 @@ void clksjson_beginEncode(CLKSJSONEncodeContext* const context,
     context->containerFirstEntry = true;
 }
 
+void clksjson_setDataEncoding(CLKSJSONEncodeContext* const context,
+                            CLKSJSONDataEncoding dataEncoding)
+{
+    context->dataEncoding = dataEncoding;
+}
+
 int clksjson_endEncode(CLKSJSONEncodeContext* const context)
 {
     int result = CLKSJSON_OK;
@@ -571,25 +851,62 @@ int clksjson_endEncode(CLKSJSONEncodeContext* const context)
 
 #define INV 0x11111
 
-typedef struct
+/** States of the incremental decoder. */
+enum
+{
+    /** Expecting a value. */
+    DecodeStateValue,
+    /** Just after '[': expecting a value or ']'. */
+    DecodeStateArrayStart,
+    /** Just after '{' or ',' in an object: expecting a name or '}'. */
+    DecodeStateObjectStart,
+    /** Expecting an object member name. */
+    DecodeStateName,
+    /** Expecting ':' after an object member name. */
+    DecodeStateColon,
+    /** Expecting ',' or the end of the current container. */
+    DecodeStateAfterValue,
+    /** Inside a string token. */
+    DecodeStateString,
+    /** Inside a number token. */
+    DecodeStateNumber,
+    /** Inside a true/false/null token. */
+    DecodeStateLiteral,
+    /** The top level element has been fully decoded. */
+    DecodeStateDone,
+};
+
+/** Where a number token is in the JSON number grammar:
+ * -? (0 | [1-9][0-9]*) (. [0-9]+)? ([eE] [+-]? [0-9]+)?
+ */
+enum
+{
+    NumberStateInvalid,
+    /** After '-'. */
+    NumberStateMinus,
+    /** After a leading '0'. */
+    NumberStateZero,
+    /** In the integer part. */
+    NumberStateInteger,
+    /** After '.'. */
+    NumberStateDot,
+    /** In the fraction part. */
+    NumberStateFraction,
+    /** After 'e' or 'E'. */
+    NumberStateE,
+    /** After the exponent's sign. */
+    NumberStateExponentSign,
+    /** In the exponent. */
+    NumberStateExponent,
+};
+
+/** Escape states within a string token. */
+enum
 {
-    /** Pointer to current work area in the buffer. */
-    const char* bufferPtr;
-    /** Pointer to the end of the buffer. */
-    const char* bufferEnd;
-    /** Pointer to a buffer for storing a decoded name. */
-    char* nameBuffer;
-    /** Length of the name buffer. */
-    int nameBufferLength;
-    /** Pointer to a buffer for storing a decoded string. */
-    char* stringBuffer;
-    /** Length of the string buffer. */
-    int stringBufferLength;
-    /** The callbacks to call while decoding. */
-    CLKSJSONDecodeCallbacks* const callbacks;
-    /** Data that was specified when calling clksjson_decode(). */
-    void* userData;
-} CLKSJSONDecodeContext;
+    EscapeStateNone,
+    EscapeStateBackslash,
+    EscapeStateUnicode,
+};
 
 /** Lookup table for converting hex values to integers.
  * INV (0x11111) is used to mark invalid characters so that any attempted
@@ -616,52 +933,17 @@ static const unsigned int g_hexConversion[] =
 };
 
 
-/** Encode a UTF-16 character to UTF-8. The dest pointer gets incremented
- * by however many bytes were needed for the conversion (1-4).
- *
- * @param character The UTF-16 character.
- *
- * @param dst Where to write the UTF-8 character.
- *
- * @return CLKSJSON_OK if the encoding was successful.
- */
-static int writeUTF8(unsigned int character, char** dst);
-
-/** Decode a string value.
- *
- * @param context The decoding context.
- *
- * @param dstBuffer Buffer to hold the decoded string.
- *
- * @param dstBufferLength Length of the destination buffer.
- *
- * @return CLKSJSON_OK if successful.
- */
-static int decodeString(CLKSJSONDecodeContext* context, char* dstBuffer, int dstBufferLength);
-
-/** Decode a JSON element.
- *
- * @param name This element's name (or NULL if it has none).
+/** Check if a character is JSON whitespace.
  *
- * @param context The decoding context.
- *
- * @return CLKSJSON_OK if successful.
- */
-static int decodeElement(const char* const name,
-                                CLKSJSONDecodeContext* context);
-
-
-/** Skip past any whitespace.
+ * @param ch The character to test.
  *
- * @param CONTEXT The decoding context.
+ * @return true if the character is whitespace.
  */
-#define SKIP_WHITESPACE(CONTEXT) \
-while(CONTEXT->bufferPtr < CONTEXT->bufferEnd && isspace(*CONTEXT->bufferPtr)) \
-{ \
-    CONTEXT->bufferPtr++; \
+static inline bool isWhitespace(char ch)
+{
+    return ch == ' ' || ch == '\n' || ch == '\r' || ch == '\t';
 }
 
-
 /** Check if a character is valid for representing part of a floating point
  * number.
  *
@@ -682,6 +964,76 @@ static inline bool isFPChar(char ch)
     }
 }
 
+/** Advance through the JSON number grammar by one character.
+ *
+ * @param state The current number state (NumberStateInvalid before the first character).
+ *
+ * @param ch The next character of the number.
+ *
+ * @return The new state, or NumberStateInvalid if the character can't come next.
+ */
+static inline int advanceNumberState(int state, char ch)
+{
+    bool isDigit = ch >= '0' && ch <= '9';
+    switch(state)
+    {
+        case NumberStateInvalid:
+            if(ch == '-')
+            {
+                return NumberStateMinus;
+            }
+            // Fall through
+        case NumberStateMinus:
+            return ch == '0' ? NumberStateZero : isDigit ? NumberStateInteger : NumberStateInvalid;
+        case NumberStateInteger:
+            if(isDigit)
+            {
+                return NumberStateInteger;
+            }
+            // Fall through
+        case NumberStateZero:
+            return ch == '.' ? NumberStateDot : (ch == 'e' || ch == 'E') ? NumberStateE : NumberStateInvalid;
+        case NumberStateDot:
+            return isDigit ? NumberStateFraction : NumberStateInvalid;
+        case NumberStateFraction:
+            return isDigit ? NumberStateFraction : (ch == 'e' || ch == 'E') ? NumberStateE : NumberStateInvalid;
+        case NumberStateE:
+            if(ch == '+' || ch == '-')
+            {
+                return NumberStateExponentSign;
+            }
+            // Fall through
+        case NumberStateExponentSign:
+        case NumberStateExponent:
+            return isDigit ? NumberStateExponent : NumberStateInvalid;
+        default:
+            return NumberStateInvalid;
+    }
+}
+
+/** Check if a number can end in the given state.
+ *
+ * @param state The number state after its last character.
+ *
+ * @return true if the number is complete.
+ */
+static inline bool isNumberComplete(int state)
+{
+    return state == NumberStateZero ||
+           state == NumberStateInteger ||
+           state == NumberStateFraction ||
+           state == NumberStateExponent;
+}
+
+/** Encode a UTF-16 character to UTF-8. The dest pointer gets incremented
+ * by however many bytes were needed for the conversion (1-4).
+ *
+ * @param character The UTF-16 character.
+ *
+ * @param dst Where to write the UTF-8 character.
+ *
+ * @return CLKSJSON_OK if the encoding was successful.
+ */
 static int writeUTF8(unsigned int character, char** dst)
 {
     likely_if(character <= 0x7f)
@@ -721,391 +1073,906 @@ static int writeUTF8(unsigned int character, char** dst)
     return CLKSJSON_ERROR_INVALID_CHARACTER;
 }
 
-static int decodeString(CLKSJSONDecodeContext* context, char* dstBuffer, int dstBufferLength)
+/** Get the name to pass along with the next element, if any.
+ *
+ * @param context The decoding context.
+ *
+ * @return The pending name, or NULL if the element has no name.
+ */
+static inline const char* pendingName(const CLKSJSONStreamDecodeContext* const context)
 {
-    *dstBuffer = '\0';
-    unlikely_if(*context->bufferPtr != '\"')
-    {
-        CLKSLOG_DEBUG("Expected '\"' but got '%c'", *context->bufferPtr);
-        return CLKSJSON_ERROR_INVALID_CHARACTER;
-    }
+    return context->nameLength >= 0 ? context->scratch : NULL;
+}
 
-    const char* src = context->bufferPtr + 1;
-    bool fastCopy = true;
+/** Start a new token in the scratch space (after the pending name, if any).
+ *
+ * @param context The decoding context.
+ *
+ * @param state The state to switch to.
+ */
+static inline void beginToken(CLKSJSONStreamDecodeContext* const context, int state)
+{
+    context->tokenOffset = context->nameLength >= 0 ? context->nameLength + 1 : 0;
+    context->tokenLength = 0;
+    context->state = state;
+}
 
-    for(; src < context->bufferEnd && *src != '\"'; src++)
-    {
-        unlikely_if(*src == '\\')
-        {
-            fastCopy = false;
-            src++;
-        }
-    }
-    unlikely_if(src >= context->bufferEnd)
-    {
-        CLKSLOG_DEBUG("Premature end of data");
-        return CLKSJSON_ERROR_INCOMPLETE;
-    }
-    const char* srcEnd = src;
-    src = context->bufferPtr + 1;
-    int length = (int)(srcEnd - src);
-    if(length >= dstBufferLength)
+/** Make sure there's room for more bytes (plus a NUL terminator) in the
+ * current token.
+ *
+ * @param context The decoding context.
+ *
+ * @param length The number of bytes about to be added.
+ *
+ * @return CLKSJSON_OK if there is room.
+ */
+static inline int reserveToken(const CLKSJSONStreamDecodeContext* const context, int length)
+{
+    unlikely_if(context->tokenOffset + context->tokenLength + length >= context->scratchLength)
     {
-        CLKSLOG_DEBUG("String is too long");
+        CLKSLOG_DEBUG("Token is too long for a %d byte scratch buffer", context->scratchLength);
         return CLKSJSON_ERROR_DATA_TOO_LONG;
     }
+    return CLKSJSON_OK;
+}
 
-    context->bufferPtr = srcEnd + 1;
-
-    // If no escape characters were encountered, we can fast copy.
-    likely_if(fastCopy)
-    {
-        memcpy(dstBuffer, src, length);
-        dstBuffer[length] = 0;
-        return CLKSJSON_OK;
-    }
-
-    char* dst = dstBuffer;
+/** Pointer to the end of the current token in the scratch space. */
+static inline char* tokenEnd(const CLKSJSONStreamDecodeContext* const context)
+{
+    return context->scratch + context->tokenOffset + context->tokenLength;
+}
 
-    for(; src < srcEnd; src++)
+/** Check if callbacks are muted because we're passing through raw JSON.
+ *
+ * @param context The decoding context.
+ *
+ * @return true if inside a passed through element.
+ */
+static inline bool isPassingThrough(const CLKSJSONStreamDecodeContext* const context)
+{
+    return context->rawLevel >= 0;
+}
+
+/** Called after a complete value has been decoded.
+ *
+ * @param context The decoding context.
+ */
+static inline void onValueComplete(CLKSJSONStreamDecodeContext* const context)
+{
+    unlikely_if(context->rawLevel == context->containerLevel)
     {
-        likely_if(*src != '\\')
+        context->rawLevel = -1;
+        context->rawEnded = true;
+    }
+    context->nameLength = -1;
+    context->state = context->containerLevel > 0 ? DecodeStateAfterValue : DecodeStateDone;
+}
+
+/** Open a new container.
+ *
+ * @param context The decoding context.
+ *
+ * @param isObject true if the container is an object.
+ *
+ * @return CLKSJSON_OK if successful.
+ */
+static int beginContainer(CLKSJSONStreamDecodeContext* const context, bool isObject)
+{
+    unlikely_if(context->containerLevel >= CLKSJSON_DECODE_MAX_DEPTH)
+    {
+        CLKSLOG_DEBUG("Containers nested too deeply");
+        return CLKSJSON_ERROR_DATA_TOO_LONG;
+    }
+    const char* name = pendingName(context);
+    int result = CLKSJSON_OK;
+    likely_if(!isPassingThrough(context))
+    {
+        result = isObject ?
+            context->callbacks->onBeginObject(name, context->userData) :
+            context->callbacks->onBeginArray(name, context->userData);
+    }
+    context->isObject[context->containerLevel++] = isObject;
+    context->nameLength = -1;
+    context->state = isObject ? DecodeStateObjectStart : DecodeStateArrayStart;
+    return result;
+}
+
+/** Close the current container.
+ *
+ * @param context The decoding context.
+ *
+ * @param ch The closing character.
+ *
+ * @return CLKSJSON_OK if successful.
+ */
+static int endContainer(CLKSJSONStreamDecodeContext* const context, char ch)
+{
+    unlikely_if(context->isObject[context->containerLevel - 1] != (ch == '}'))
+    {
+        CLKSLOG_DEBUG("Mismatched container end '%c'", ch);
+        return CLKSJSON_ERROR_INVALID_CHARACTER;
+    }
+    context->containerLevel--;
+    int result = CLKSJSON_OK;
+    likely_if(!isPassingThrough(context))
+    {
+        result = context->callbacks->onEndContainer(context->userData);
+    }
+    onValueComplete(context);
+    return result;
+}
+
+/** Begin decoding a value whose first character is ch.
+ *
+ * @param context The decoding context.
+ *
+ * @param ch The first character of the value.
+ *
+ * @return CLKSJSON_OK if successful.
+ */
+static int beginValue(CLKSJSONStreamDecodeContext* const context, char ch)
+{
+    unlikely_if(!isPassingThrough(context) &&
+                context->callbacks->shouldPassThrough != NULL &&
+                context->callbacks->shouldPassThrough(pendingName(context), context->userData))
+    {
+        int result = context->callbacks->onBeginRawElement(pendingName(context), context->userData);
+        unlikely_if(result != CLKSJSON_OK)
         {
-            *dst++ = *src;
+            return result;
         }
-        else
+        context->rawLevel = context->containerLevel;
+        context->rawBegan = true;
+    }
+
+    switch(ch)
+    {
+        case '{':
+            return beginContainer(context, true);
+        case '[':
+            return beginContainer(context, false);
+        case '\"':
+            context->tokenIsName = false;
+            context->tokenNeedsEscaping = false;
+            context->escapeState = EscapeStateNone;
+            context->leadSurrogate = 0;
+            beginToken(context, DecodeStateString);
+            return CLKSJSON_OK;
+        case 't':
+            context->literal = "true";
+            break;
+        case 'f':
+            context->literal = "false";
+            break;
+        case 'n':
+            context->literal = "null";
+            break;
+        case '-':
+        case '0': case '1': case '2': case '3': case '4':
+        case '5': case '6': case '7': case '8': case '9':
         {
-            src++;
-            switch(*src)
+            beginToken(context, DecodeStateNumber);
+            context->numberState = advanceNumberState(NumberStateInvalid, ch);
+            if(isPassingThrough(context))
             {
-                case '"':
-                    *dst++ = '\"';
-                    continue;
-                case '\\':
-                    *dst++ = '\\';
-                    continue;
-                case 'n':
-                    *dst++ = '\n';
-                    continue;
-                case 'r':
-                    *dst++ = '\r';
-                    continue;
-                case '/':
-                    *dst++ = '/';
-                    continue;
-                case 't':
-                    *dst++ = '\t';
-                    continue;
-                case 'b':
-                    *dst++ = '\b';
-                    continue;
-                case 'f':
-                    *dst++ = '\f';
-                    continue;
-                case 'u':
-                {
-                    unlikely_if(src + 5 > srcEnd)
-                    {
-                        CLKSLOG_DEBUG("Premature end of data");
-                        return CLKSJSON_ERROR_INCOMPLETE;
-                    }
-                    unsigned int accum =
-                    g_hexConversion[src[1]] << 12 |
-                    g_hexConversion[src[2]] << 8 |
-                    g_hexConversion[src[3]] << 4 |
-                    g_hexConversion[src[4]];
-                    unlikely_if(accum > 0xffff)
-                    {
-                        CLKSLOG_DEBUG("Invalid unicode sequence: %c%c%c%c",
-                                    src[1], src[2], src[3], src[4]);
-                        return CLKSJSON_ERROR_INVALID_CHARACTER;
-                    }
-
-                    // UTF-16 Trail surrogate on its own.
-                    unlikely_if(accum >= 0xdc00 && accum <= 0xdfff)
-                    {
-                        CLKSLOG_DEBUG("Unexpected trail surrogate: 0x%04x",
-                                    accum);
-                        return CLKSJSON_ERROR_INVALID_CHARACTER;
-                    }
-
-                    // UTF-16 Lead surrogate.
-                    unlikely_if(accum >= 0xd800 && accum <= 0xdbff)
-                    {
-                        // Fetch trail surrogate.
-                        unlikely_if(src + 11 > srcEnd)
-                        {
-                            CLKSLOG_DEBUG("Premature end of data");
-                            return CLKSJSON_ERROR_INCOMPLETE;
-                        }
-                        unlikely_if(src[5] != '\\' ||
-                                    src[6] != 'u')
-                        {
-                            CLKSLOG_DEBUG("Expected \"\\u\" but got: \"%c%c\"",
-                                        src[5], src[6]);
-                            return CLKSJSON_ERROR_INVALID_CHARACTER;
-                        }
-                        src += 6;
-                        unsigned int accum2 =
-                        g_hexConversion[src[1]] << 12 |
-                        g_hexConversion[src[2]] << 8 |
-                        g_hexConversion[src[3]] << 4 |
-                        g_hexConversion[src[4]];
-                        unlikely_if(accum2 < 0xdc00 || accum2 > 0xdfff)
-                        {
-                            CLKSLOG_DEBUG("Invalid trail surrogate: 0x%04x",
-                                        accum2);
-                            return CLKSJSON_ERROR_INVALID_CHARACTER;
-                        }
-                        // And combine 20 bit result.
-                        accum = ((accum - 0xd800) << 10) | (accum2 - 0xdc00);
-                    }
-
-                    int result = writeUTF8(accum, &dst);
-                    unlikely_if(result != CLKSJSON_OK)
-                    {
-                        return result;
-                    }
-                    src += 4;
-                    continue;
-                }
-                default:
-                    CLKSLOG_DEBUG("Invalid control character '%c'", *src);
-                    return CLKSJSON_ERROR_INVALID_CHARACTER;
+                return CLKSJSON_OK;
+            }
+            int result = reserveToken(context, 1);
+            likely_if(result == CLKSJSON_OK)
+            {
+                *tokenEnd(context) = ch;
+                context->tokenLength++;
             }
+            return result;
         }
+        default:
+            CLKSLOG_DEBUG("Invalid character '%c'", ch);
+            return CLKSJSON_ERROR_INVALID_CHARACTER;
     }
+    context->literalIndex = 1;
+    context->state = DecodeStateLiteral;
+    return CLKSJSON_OK;
+}
 
-    *dst = 0;
+/** Begin decoding an object member name.
+ *
+ * @param context The decoding context.
+ */
+static inline void beginName(CLKSJSONStreamDecodeContext* const context)
+{
+    context->nameLength = -1;
+    context->tokenIsName = true;
+    context->escapeState = EscapeStateNone;
+    context->leadSurrogate = 0;
+    beginToken(context, DecodeStateString);
+}
+
+/** Report a string value.
+ *
+ * @param context The decoding context.
+ *
+ * @param value The value (in the source data or the scratch buffer).
+ *
+ * @param length The length of the value.
+ *
+ * @return CLKSJSON_OK if successful.
+ */
+static int reportString(CLKSJSONStreamDecodeContext* const context,
+                        const char* const value,
+                        const int length)
+{
+    int result;
+    if(isPassingThrough(context))
+    {
+        result = CLKSJSON_OK;
+    }
+    else if(context->callbacks->onStringSliceElement != NULL)
+    {
+        result = context->callbacks->onStringSliceElement(pendingName(context),
+                                                          value,
+                                                          length,
+                                                          context->tokenNeedsEscaping,
+                                                          context->userData);
+    }
+    else
+    {
+        result = context->callbacks->onStringElement(pendingName(context),
+                                                     value,
+                                                     context->userData);
+    }
+    onValueComplete(context);
+    return result;
+}
+
+/** Finish a string token, either recording it as a name or reporting it.
+ *
+ * @param context The decoding context.
+ *
+ * @return CLKSJSON_OK if successful.
+ */
+static int endString(CLKSJSONStreamDecodeContext* const context)
+{
+    unlikely_if(context->leadSurrogate != 0)
+    {
+        CLKSLOG_DEBUG("Unpaired lead surrogate: 0x%04x", context->leadSurrogate);
+        return CLKSJSON_ERROR_INVALID_CHARACTER;
+    }
+    *tokenEnd(context) = '\0';
+    if(context->tokenIsName)
+    {
+        context->nameLength = context->tokenLength;
+        context->state = DecodeStateColon;
+        return CLKSJSON_OK;
+    }
+    return reportString(context, context->scratch + context->tokenOffset, context->tokenLength);
+}
+
+/** Handle the character following a backslash in a string.
+ *
+ * @param context The decoding context.
+ *
+ * @param ch The escaped character.
+ *
+ * @return CLKSJSON_OK if successful.
+ */
+static int decodeEscapeChar(CLKSJSONStreamDecodeContext* const context, char ch)
+{
+    char unescaped;
+    switch(ch)
+    {
+        case '"':
+        case '\\':
+        case '/':
+            unescaped = ch;
+            break;
+        case 'n':
+            unescaped = '\n';
+            break;
+        case 'r':
+            unescaped = '\r';
+            break;
+        case 't':
+            unescaped = '\t';
+            break;
+        case 'b':
+            unescaped = '\b';
+            break;
+        case 'f':
+            unescaped = '\f';
+            break;
+        case 'u':
+            context->tokenNeedsEscaping = true;
+            context->unicodeAccum = 0;
+            context->unicodeDigits = 0;
+            context->escapeState = EscapeStateUnicode;
+            return CLKSJSON_OK;
+        default:
+            CLKSLOG_DEBUG("Invalid control character '%c'", ch);
+            return CLKSJSON_ERROR_INVALID_CHARACTER;
+    }
+    unlikely_if(context->leadSurrogate != 0)
+    {
+        CLKSLOG_DEBUG("Expected \"\\u\" but got: \"\\%c\"", ch);
+        return CLKSJSON_ERROR_INVALID_CHARACTER;
+    }
+    context->escapeState = EscapeStateNone;
+    if(isPassingThrough(context))
+    {
+        return CLKSJSON_OK;
+    }
+    int result = reserveToken(context, 1);
+    unlikely_if(result != CLKSJSON_OK)
+    {
+        return result;
+    }
+    *tokenEnd(context) = unescaped;
+    context->tokenLength++;
+    context->tokenNeedsEscaping = true;
     return CLKSJSON_OK;
 }
 
-static int decodeElement(const char* const name, CLKSJSONDecodeContext* context)
+/** Handle one hex digit of a \u escape sequence.
+ *
+ * @param context The decoding context.
+ *
+ * @param ch The hex digit.
+ *
+ * @return CLKSJSON_OK if successful.
+ */
+static int decodeUnicodeDigit(CLKSJSONStreamDecodeContext* const context, char ch)
 {
-    SKIP_WHITESPACE(context);
-    unlikely_if(context->bufferPtr >= context->bufferEnd)
+    unsigned int nybble = g_hexConversion[(unsigned char)ch];
+    unlikely_if(nybble > 0xf)
+    {
+        CLKSLOG_DEBUG("Invalid unicode sequence character: %c", ch);
+        return CLKSJSON_ERROR_INVALID_CHARACTER;
+    }
+    context->unicodeAccum = context->unicodeAccum << 4 | nybble;
+    likely_if(++context->unicodeDigits < 4)
     {
-        CLKSLOG_DEBUG("Premature end of data");
-        return CLKSJSON_ERROR_INCOMPLETE;
+        return CLKSJSON_OK;
     }
 
-    int sign = 1;
-    int result;
+    context->escapeState = EscapeStateNone;
+    unsigned int accum = context->unicodeAccum;
+    if(context->leadSurrogate != 0)
+    {
+        unlikely_if(accum < 0xdc00 || accum > 0xdfff)
+        {
+            CLKSLOG_DEBUG("Invalid trail surrogate: 0x%04x", accum);
+            return CLKSJSON_ERROR_INVALID_CHARACTER;
+        }
+        // Combine 20 bit result.
+        accum = (((context->leadSurrogate - 0xd800) << 10) | (accum - 0xdc00)) + 0x10000;
+        context->leadSurrogate = 0;
+    }
+    else
+    {
+        // UTF-16 Trail surrogate on its own.
+        unlikely_if(accum >= 0xdc00 && accum <= 0xdfff)
+        {
+            CLKSLOG_DEBUG("Unexpected trail surrogate: 0x%04x", accum);
+            return CLKSJSON_ERROR_INVALID_CHARACTER;
+        }
+        // UTF-16 Lead surrogate. Wait for the trail surrogate.
+        unlikely_if(accum >= 0xd800 && accum <= 0xdbff)
+        {
+            context->leadSurrogate = accum;
+            return CLKSJSON_OK;
+        }
+    }
 
-    switch(*context->bufferPtr)
+    if(isPassingThrough(context))
     {
-        case '[':
+        return accum <= 0x10ffff ? CLKSJSON_OK : CLKSJSON_ERROR_INVALID_CHARACTER;
+    }
+    int result = reserveToken(context, 4);
+    unlikely_if(result != CLKSJSON_OK)
+    {
+        return result;
+    }
+    char* dst = tokenEnd(context);
+    char* const start = dst;
+    result = writeUTF8(accum, &dst);
+    context->tokenLength += (int)(dst - start);
+    return result;
+}
+
+/** Decode as much of a string token as is available.
+ *
+ * @param context The decoding context.
+ *
+ * @param ptr Pointer to the current position (gets updated).
+ *
+ * @param end Pointer to the end of the chunk.
+ *
+ * @return CLKSJSON_OK if successful.
+ */
+static int decodeString(CLKSJSONStreamDecodeContext* const context,
+                        const char** const ptr,
+                        const char* const end)
+{
+    const char* src = *ptr;
+    int result = CLKSJSON_OK;
+
+    while(src < end && result == CLKSJSON_OK && context->state == DecodeStateString)
+    {
+        switch(context->escapeState)
+        {
+            case EscapeStateBackslash:
+                result = decodeEscapeChar(context, *src++);
+                continue;
+            case EscapeStateUnicode:
+                result = decodeUnicodeDigit(context, *src++);
+                continue;
+            default:
+                break;
+        }
+
+        // Fast path: take a run of unescaped characters in one go.
+        const char* runStart = src;
+        bool hasControlChars = false;
+        while(src < end && *src != '\"' && *src != '\\')
         {
-            context->bufferPtr++;
-            result = context->callbacks->onBeginArray(name, context->userData);
-            unlikely_if(result != CLKSJSON_OK) return result;
-            while(context->bufferPtr < context->bufferEnd)
+            hasControlChars |= (unsigned char)*src < ' ';
+            src++;
+        }
+        int runLength = (int)(src - runStart);
+        context->tokenNeedsEscaping |= hasControlChars;
+
+        // If the whole value is right here, hand it over without copying.
+        likely_if(src < end &&
+                  *src == '\"' &&
+                  context->tokenLength == 0 &&
+                  context->leadSurrogate == 0 &&
+                  !context->tokenIsName &&
+                  (context->callbacks->onStringSliceElement != NULL || isPassingThrough(context)))
+        {
+            src++;
+            result = reportString(context, runStart, runLength);
+            break;
+        }
+
+        likely_if(runLength > 0)
+        {
+            unlikely_if(context->leadSurrogate != 0)
             {
-                SKIP_WHITESPACE(context);
-                unlikely_if(context->bufferPtr >= context->bufferEnd)
-                {
-                    break;
-                }
-                unlikely_if(*context->bufferPtr == ']')
-                {
-                    context->bufferPtr++;
-                    return context->callbacks->onEndContainer(context->userData);
-                }
-                result = decodeElement(NULL, context);
-                unlikely_if(result != CLKSJSON_OK) return result;
-                SKIP_WHITESPACE(context);
-                unlikely_if(context->bufferPtr >= context->bufferEnd)
+                CLKSLOG_DEBUG("Expected \"\\u\" but got: \"%c\"", *runStart);
+                src = runStart;
+                result = CLKSJSON_ERROR_INVALID_CHARACTER;
+                break;
+            }
+            likely_if(!isPassingThrough(context))
+            {
+                result = reserveToken(context, runLength);
+                unlikely_if(result != CLKSJSON_OK)
                 {
+                    src = runStart;
                     break;
                 }
-                likely_if(*context->bufferPtr == ',')
-                {
-                    context->bufferPtr++;
-                }
+                memcpy(tokenEnd(context), runStart, (size_t)runLength);
+                context->tokenLength += runLength;
             }
-            CLKSLOG_DEBUG("Premature end of data");
-            return CLKSJSON_ERROR_INCOMPLETE;
         }
-        case '{':
+        if(src < end)
         {
-            context->bufferPtr++;
-            result = context->callbacks->onBeginObject(name, context->userData);
-            unlikely_if(result != CLKSJSON_OK) return result;
-            while(context->bufferPtr < context->bufferEnd)
+            if(*src++ == '\\')
             {
-                SKIP_WHITESPACE(context);
-                unlikely_if(context->bufferPtr >= context->bufferEnd)
-                {
-                    break;
-                }
-                unlikely_if(*context->bufferPtr == '}')
-                {
-                    context->bufferPtr++;
-                    return context->callbacks->onEndContainer(context->userData);
-                }
-                result = decodeString(context, context->nameBuffer, context->nameBufferLength);
-                unlikely_if(result != CLKSJSON_OK) return result;
-                SKIP_WHITESPACE(context);
-                unlikely_if(context->bufferPtr >= context->bufferEnd)
-                {
-                    break;
-                }
-                unlikely_if(*context->bufferPtr != ':')
-                {
-                    CLKSLOG_DEBUG("Expected ':' but got '%c'", *context->bufferPtr);
-                    return CLKSJSON_ERROR_INVALID_CHARACTER;
-                }
-                context->bufferPtr++;
-                SKIP_WHITESPACE(context);
-                result = decodeElement(context->nameBuffer, context);
-                unlikely_if(result != CLKSJSON_OK) return result;
-                SKIP_WHITESPACE(context);
-                unlikely_if(context->bufferPtr >= context->bufferEnd)
-                {
-                    break;
-                }
-                likely_if(*context->bufferPtr == ',')
-                {
-                    context->bufferPtr++;
-                }
+                context->escapeState = EscapeStateBackslash;
+            }
+            else
+            {
+                result = endString(context);
             }
-            CLKSLOG_DEBUG("Premature end of data");
-            return CLKSJSON_ERROR_INCOMPLETE;
         }
-        case '\"':
+    }
+    *ptr = src;
+    return result;
+}
+
+/** Finish a number token and report it.
+ *
+ * @param context The decoding context.
+ *
+ * @return CLKSJSON_OK if successful.
+ */
+static int endNumber(CLKSJSONStreamDecodeContext* const context)
+{
+    unlikely_if(!isNumberComplete(context->numberState))
+    {
+        CLKSLOG_DEBUG("Incomplete number");
+        return CLKSJSON_ERROR_INVALID_CHARACTER;
+    }
+    if(isPassingThrough(context))
+    {
+        onValueComplete(context);
+        return CLKSJSON_OK;
+    }
+
+    char* const start = context->scratch + context->tokenOffset;
+    const char* const end = start + context->tokenLength;
+    *tokenEnd(context) = '\0';
+
+    const char* ptr = start;
+    int64_t sign = 1;
+    if(*ptr == '-')
+    {
+        sign = -1;
+        ptr++;
+    }
+    unlikely_if(ptr >= end || !isdigit(*ptr))
+    {
+        CLKSLOG_DEBUG("Not a digit: '%c'", *ptr);
+        return CLKSJSON_ERROR_INVALID_CHARACTER;
+    }
+
+    // Try integer conversion.
+    int64_t accum = 0;
+    for(; ptr < end && isdigit(*ptr); ptr++)
+    {
+        int digit = *ptr - '0';
+        unlikely_if(accum > (INT64_MAX - digit) / 10)
+        {
+            // Overflow
+            break;
+        }
+        accum = accum * 10 + digit;
+    }
+
+    int result;
+    if(ptr == end)
+    {
+        result = context->callbacks->onIntegerElement(pendingName(context),
+                                                      accum * sign,
+                                                      context->userData);
+    }
+    else
+    {
+        double value = 0;
+        sscanf(start, "%lg", &value);
+        result = context->callbacks->onFloatingPointElement(pendingName(context),
+                                                            value,
+                                                            context->userData);
+    }
+    onValueComplete(context);
+    return result;
+}
+
+/** Decode as much of a number token as is available.
+ *
+ * @param context The decoding context.
+ *
+ * @param ptr Pointer to the current position (gets updated).
+ *
+ * @param end Pointer to the end of the chunk.
+ *
+ * @return CLKSJSON_OK if successful.
+ */
+static int decodeNumber(CLKSJSONStreamDecodeContext* const context,
+                        const char** const ptr,
+                        const char* const end)
+{
+    const char* src = *ptr;
+    int state = context->numberState;
+    for(; src < end && isFPChar(*src); src++)
+    {
+        state = advanceNumberState(state, *src);
+        unlikely_if(state == NumberStateInvalid)
+        {
+            CLKSLOG_DEBUG("Invalid character '%c' in number", *src);
+            *ptr = src;
+            return CLKSJSON_ERROR_INVALID_CHARACTER;
+        }
+    }
+    context->numberState = state;
+    likely_if(!isPassingThrough(context))
+    {
+        int length = (int)(src - *ptr);
+        int result = reserveToken(context, length);
+        unlikely_if(result != CLKSJSON_OK)
         {
-            result = decodeString(context, context->stringBuffer, context->stringBufferLength);
-            unlikely_if(result != CLKSJSON_OK) return result;
-            result = context->callbacks->onStringElement(name,
-                                                context->stringBuffer,
-                                                context->userData);
             return result;
         }
+        memcpy(tokenEnd(context), *ptr, (size_t)length);
+        context->tokenLength += length;
+    }
+    *ptr = src;
+
+    if(src < end)
+    {
+        // Hit a delimiter, so the number is complete.
+        return endNumber(context);
+    }
+    return CLKSJSON_OK;
+}
+
+/** Decode as much of a true/false/null token as is available.
+ *
+ * @param context The decoding context.
+ *
+ * @param ptr Pointer to the current position (gets updated).
+ *
+ * @param end Pointer to the end of the chunk.
+ *
+ * @return CLKSJSON_OK if successful.
+ */
+static int decodeLiteral(CLKSJSONStreamDecodeContext* const context,
+                         const char** const ptr,
+                         const char* const end)
+{
+    const char* const literal = context->literal;
+    const char* src = *ptr;
+    for(; src < end && literal[context->literalIndex] != '\0'; src++)
+    {
+        unlikely_if(*src != literal[context->literalIndex])
+        {
+            CLKSLOG_DEBUG("Expected \"%s\" but got '%c' at position %d",
+                        literal, *src, context->literalIndex);
+            *ptr = src;
+            return CLKSJSON_ERROR_INVALID_CHARACTER;
+        }
+        context->literalIndex++;
+    }
+    *ptr = src;
+    if(literal[context->literalIndex] != '\0')
+    {
+        return CLKSJSON_OK;
+    }
+
+    const char* const name = pendingName(context);
+    int result = CLKSJSON_OK;
+    switch(isPassingThrough(context) ? '\0' : *literal)
+    {
+        case 't':
+            result = context->callbacks->onBooleanElement(name, true, context->userData);
+            break;
         case 'f':
-        {
-            unlikely_if(context->bufferEnd - context->bufferPtr < 5)
+            result = context->callbacks->onBooleanElement(name, false, context->userData);
+            break;
+        case 'n':
+            result = context->callbacks->onNullElement(name, context->userData);
+            break;
+    }
+    onValueComplete(context);
+    return result;
+}
+
+/** Pass on a comma that was withheld from a passed through element, now
+ * that another member follows it.
+ *
+ * @param context The decoding context.
+ *
+ * @return CLKSJSON_OK if successful.
+ */
+static int passOnWithheldComma(CLKSJSONStreamDecodeContext* const context)
+{
+    context->rawCommaPending = false;
+    return context->callbacks->onRawData(",", 1, context->userData);
+}
+
+/** Handle one structural character (anything outside of a token).
+ *
+ * @param context The decoding context.
+ *
+ * @param ch The character.
+ *
+ * @return CLKSJSON_OK if successful.
+ */
+static int decodeStructuralChar(CLKSJSONStreamDecodeContext* const context, char ch)
+{
+    switch(context->state)
+    {
+        case DecodeStateArrayStart:
+            if(ch == ']')
             {
-                CLKSLOG_DEBUG("Premature end of data");
-                return CLKSJSON_ERROR_INCOMPLETE;
+                context->rawCommaPending = false;
+                return endContainer(context, ch);
             }
-            unlikely_if(!(context->bufferPtr[1] == 'a' &&
-                          context->bufferPtr[2] == 'l' &&
-                          context->bufferPtr[3] == 's' &&
-                          context->bufferPtr[4] == 'e'))
+            unlikely_if(context->rawCommaPending)
             {
-                CLKSLOG_DEBUG("Expected \"false\" but got \"f%c%c%c%c\"",
-                            context->bufferPtr[1], context->bufferPtr[2], context->bufferPtr[3], context->bufferPtr[4]);
-                return CLKSJSON_ERROR_INVALID_CHARACTER;
+                int result = passOnWithheldComma(context);
+                unlikely_if(result != CLKSJSON_OK)
+                {
+                    return result;
+                }
             }
-            context->bufferPtr += 5;
-            return context->callbacks->onBooleanElement(name, false, context->userData);
-        }
-        case 't':
-        {
-            unlikely_if(context->bufferEnd - context->bufferPtr < 4)
+            // Fall through
+        case DecodeStateValue:
+            return beginValue(context, ch);
+        case DecodeStateObjectStart:
+            if(ch == '}')
             {
-                CLKSLOG_DEBUG("Premature end of data");
-                return CLKSJSON_ERROR_INCOMPLETE;
+                context->rawCommaPending = false;
+                return endContainer(context, ch);
             }
-            unlikely_if(!(context->bufferPtr[1] == 'r' &&
-                          context->bufferPtr[2] == 'u' &&
-                          context->bufferPtr[3] == 'e'))
+            unlikely_if(context->rawCommaPending && ch == '\"')
             {
-                CLKSLOG_DEBUG("Expected \"true\" but got \"t%c%c%c\"",
-                            context->bufferPtr[1], context->bufferPtr[2], context->bufferPtr[3]);
-                return CLKSJSON_ERROR_INVALID_CHARACTER;
+                int result = passOnWithheldComma(context);
+                unlikely_if(result != CLKSJSON_OK)
+                {
+                    return result;
+                }
             }
-            context->bufferPtr += 4;
-            return context->callbacks->onBooleanElement(name, true, context->userData);
-        }
-        case 'n':
-        {
-            unlikely_if(context->bufferEnd - context->bufferPtr < 4)
+            // Fall through
+        case DecodeStateName:
+            likely_if(ch == '\"')
             {
-                CLKSLOG_DEBUG("Premature end of data");
-                return CLKSJSON_ERROR_INCOMPLETE;
+                beginName(context);
+                return CLKSJSON_OK;
             }
-            unlikely_if(!(context->bufferPtr[1] == 'u' &&
-                          context->bufferPtr[2] == 'l' &&
-                          context->bufferPtr[3] == 'l'))
+            CLKSLOG_DEBUG("Expected '\"' but got '%c'", ch);
+            return CLKSJSON_ERROR_INVALID_CHARACTER;
+        case DecodeStateColon:
+            likely_if(ch == ':')
             {
-                CLKSLOG_DEBUG("Expected \"null\" but got \"n%c%c%c\"",
-                            context->bufferPtr[1], context->bufferPtr[2], context->bufferPtr[3]);
-                return CLKSJSON_ERROR_INVALID_CHARACTER;
+                context->state = DecodeStateValue;
+                return CLKSJSON_OK;
             }
-            context->bufferPtr += 4;
-            return context->callbacks->onNullElement(name, context->userData);
-        }
-        case '-':
-            sign = -1;
-            context->bufferPtr++;
-            unlikely_if(!isdigit(*context->bufferPtr))
-        {
-            CLKSLOG_DEBUG("Not a digit: '%c'", *context->bufferPtr);
+            CLKSLOG_DEBUG("Expected ':' but got '%c'", ch);
             return CLKSJSON_ERROR_INVALID_CHARACTER;
-        }
-            // Fall through
-        case '0': case '1': case '2': case '3': case '4':
-        case '5': case '6': case '7': case '8': case '9':
-        {
-            // Try integer conversion.
-            int64_t accum = 0;
-            const char* const start = context->bufferPtr;
-
-            for(; context->bufferPtr < context->bufferEnd && isdigit(*context->bufferPtr); context->bufferPtr++)
+        case DecodeStateAfterValue:
+            likely_if(ch == ',')
             {
-                accum = accum * 10 + (*context->bufferPtr - '0');
-                unlikely_if(accum < 0)
+                // Trailing commas are tolerated. When passing through, the
+                // comma is held back until we know another member follows.
+                bool isObject = context->isObject[context->containerLevel - 1];
+                context->state = isObject ? DecodeStateObjectStart : DecodeStateArrayStart;
+                unlikely_if(isPassingThrough(context))
                 {
-                    // Overflow
-                    break;
+                    context->rawCommaWithheld = true;
+                    context->rawCommaPending = true;
                 }
+                return CLKSJSON_OK;
             }
-
-            unlikely_if(context->bufferPtr >= context->bufferEnd)
+            if(ch == '}' || ch == ']')
             {
-                CLKSLOG_DEBUG("Premature end of data");
-                return CLKSJSON_ERROR_INCOMPLETE;
+                return endContainer(context, ch);
             }
+            CLKSLOG_DEBUG("Expected ',' but got '%c'", ch);
+            return CLKSJSON_ERROR_INVALID_CHARACTER;
+        default:
+            CLKSLOG_DEBUG("Invalid decoder state %d", context->state);
+            return CLKSJSON_ERROR_INVALID_DATA;
+    }
+}
 
-            if(!isFPChar(*context->bufferPtr) && accum >= 0)
-            {
-                accum *= sign;
-                return context->callbacks->onIntegerElement(name, accum, context->userData);
-            }
+void clksjson_beginDecode(CLKSJSONStreamDecodeContext* const context,
+                        char* const scratch,
+                        const int scratchLength,
+                        CLKSJSONDecodeCallbacks* const callbacks,
+                        void* const userData)
+{
+    memset(context, 0, sizeof(*context));
+    context->callbacks = callbacks;
+    context->userData = userData;
+    context->scratch = scratch;
+    context->scratchLength = scratchLength;
+    context->state = DecodeStateValue;
+    context->nameLength = -1;
+    context->rawLevel = -1;
+}
 
-            while(context->bufferPtr < context->bufferEnd && isFPChar(*context->bufferPtr))
-            {
-                context->bufferPtr++;
-            }
+/** Pass raw JSON data through to the callbacks.
+ *
+ * @param context The decoding context.
+ *
+ * @param start The start of the data.
+ *
+ * @param end The end of the data.
+ *
+ * @return CLKSJSON_OK if successful.
+ */
+static inline int passThroughRawData(CLKSJSONStreamDecodeContext* const context,
+                                     const char* const start,
+                                     const char* const end)
+{
+    int length = (int)(end - start);
+    likely_if(length > 0)
+    {
+        return context->callbacks->onRawData(start, length, context->userData);
+    }
+    return CLKSJSON_OK;
+}
 
-            unlikely_if(context->bufferPtr >= context->bufferEnd)
-            {
-                CLKSLOG_DEBUG("Premature end of data");
-                return CLKSJSON_ERROR_INCOMPLETE;
-            }
+int clksjson_decodeChunk(CLKSJSONStreamDecodeContext* const context,
+                       const char* const data,
+                       const int length)
+{
+    const char* ptr = data;
+    const char* const end = data + length;
+    int result = context->result;
+
+    // A passed through element may continue from the last chunk.
+    const char* rawStart = isPassingThrough(context) ? data : NULL;
+
+    while(ptr < end && result == CLKSJSON_OK && context->state != DecodeStateDone)
+    {
+        const char* const stepStart = ptr;
+        switch(context->state)
+        {
+            case DecodeStateString:
+                result = decodeString(context, &ptr, end);
+                break;
+            case DecodeStateNumber:
+                result = decodeNumber(context, &ptr, end);
+                break;
+            case DecodeStateLiteral:
+                result = decodeLiteral(context, &ptr, end);
+                break;
+            default:
+                likely_if(isWhitespace(*ptr))
+                {
+                    ptr++;
+                    break;
+                }
+                result = decodeStructuralChar(context, *ptr);
+                likely_if(result == CLKSJSON_OK)
+                {
+                    ptr++;
+                }
+                break;
+        }
 
-            // our buffer is not necessarily NULL-terminated, so
-            // it would be undefined to call sscanf/sttod etc. directly.
-            // instead we create a temporary string.
-            double value;
-            int len = (int)(context->bufferPtr - start);
-            if(len >= context->stringBufferLength)
+        unlikely_if(context->rawBegan)
+        {
+            context->rawBegan = false;
+            rawStart = stepStart;
+        }
+        unlikely_if(context->rawCommaWithheld)
+        {
+            // Pass on everything before the comma, and resume after it.
+            context->rawCommaWithheld = false;
+            result = passThroughRawData(context, rawStart, stepStart);
+            rawStart = ptr;
+        }
+        unlikely_if(context->rawEnded)
+        {
+            context->rawEnded = false;
+            likely_if(result == CLKSJSON_OK)
             {
-                CLKSLOG_DEBUG("Number is too long.");
-                return CLKSJSON_ERROR_DATA_TOO_LONG;
+                result = passThroughRawData(context, rawStart, ptr);
             }
-            strncpy(context->stringBuffer, start, len);
-            context->stringBuffer[len] = '\0';
+            rawStart = NULL;
+        }
+    }
+
+    unlikely_if(rawStart != NULL && result == CLKSJSON_OK)
+    {
+        result = passThroughRawData(context, rawStart, ptr);
+    }
 
-            sscanf(context->stringBuffer, "%lg", &value);
+    // Don't count data after the top level element as consumed.
+    context->bytesConsumed += (int)(ptr - data);
+    context->result = result;
+    return result;
+}
 
-            value *= sign;
-            return context->callbacks->onFloatingPointElement(name, value, context->userData);
+int clksjson_endDecode(CLKSJSONStreamDecodeContext* const context)
+{
+    likely_if(context->result == CLKSJSON_OK && context->state == DecodeStateNumber)
+    {
+        // Any passed through number has already been handed over in full.
+        context->result = endNumber(context);
+        context->rawEnded = false;
+    }
+    likely_if(context->result == CLKSJSON_OK)
+    {
+        unlikely_if(context->state != DecodeStateDone)
+        {
+            CLKSLOG_DEBUG("Premature end of data");
+            context->result = CLKSJSON_ERROR_INCOMPLETE;
+        }
+        else
+        {
+            context->result = context->callbacks->onEndData(context->userData);
         }
     }
-    CLKSLOG_DEBUG("Invalid character '%c'", *context->bufferPtr);
-    return CLKSJSON_ERROR_INVALID_CHARACTER;
+    return context->result;
+}
+
+int clksjson_decodeOffset(CLKSJSONStreamDecodeContext* const context)
+{
+    return context->bytesConsumed;
 }
 
 int clksjson_decode(const char* const data,
@@ -1116,82 +1983,43 @@ int clksjson_decode(const char* const data,
                   void* const userData,
                   int* const errorOffset)
 {
-    char* nameBuffer = stringBuffer;
-    int nameBufferLength = stringBufferLength / 4;
-    stringBuffer = nameBuffer + nameBufferLength;
-    stringBufferLength -= nameBufferLength;
-    CLKSJSONDecodeContext context =
-    {
-        .bufferPtr = (char*)data,
-        .bufferEnd = (char*)data + length,
-        .nameBuffer = nameBuffer,
-        .nameBufferLength = nameBufferLength,
-        .stringBuffer = stringBuffer,
-        .stringBufferLength = (int)stringBufferLength,
-        .callbacks = callbacks,
-        .userData = userData
-    };
-
-    const char* ptr = data;
+    CLKSJSONStreamDecodeContext context;
+    clksjson_beginDecode(&context, stringBuffer, stringBufferLength, callbacks, userData);
 
-    int result = decodeElement(NULL, &context);
+    int result = clksjson_decodeChunk(&context, data, length);
     likely_if(result == CLKSJSON_OK)
     {
-        result = callbacks->onEndData(userData);
+        result = clksjson_endDecode(&context);
     }
 
     unlikely_if(result != CLKSJSON_OK && errorOffset != NULL)
     {
-        *errorOffset = (int)(ptr - data);
+        *errorOffset = clksjson_decodeOffset(&context);
     }
     return result;
 }
 
-struct JSONFromFileContext;
-typedef void (*UpdateDecoderCallback)(struct JSONFromFileContext* context);
-
-typedef struct JSONFromFileContext
+typedef struct
 {
     CLKSJSONEncodeContext* encodeContext;
-    CLKSJSONDecodeContext* decodeContext;
-    char* bufferStart;
-    const char* sourceFilename;
-    int fd;
-    bool isEOF;
+    /** Name to give the top level element. */
+    const char* topLevelName;
+    /** The encoder's container level when the top level element began. */
+    int baseContainerLevel;
     bool closeLastContainer;
-    UpdateDecoderCallback updateDecoderCallback;
 } JSONFromFileContext;
 
-static void updateDecoder_doNothing(__unused struct JSONFromFileContext* context)
-{
-    
-}
-
-static void updateDecoder_readFile(struct JSONFromFileContext* context)
+/** Get the name to encode an element with, renaming the top level element.
+ *
+ * @param context The embedding context.
+ *
+ * @param name The element's decoded name.
+ *
+ * @return The name to encode.
+ */
+static inline const char* elementName(const JSONFromFileContext* const context, const char* const name)
 {
-    likely_if(!context->isEOF)
-    {
-        const char* end = context->decodeContext->bufferEnd;
-        char* start = context->bufferStart;
-        const char* ptr = context->decodeContext->bufferPtr;
-        int bufferLength = (int)(end - start);
-        int remainingLength = (int)(end - ptr);
-        unlikely_if(remainingLength < bufferLength / 2)
-        {
-            int fillLength = bufferLength - remainingLength;
-            memcpy(start, ptr, remainingLength);
-            context->decodeContext->bufferPtr = start;
-            int bytesRead = (int)read(context->fd, start+remainingLength, (unsigned)fillLength);
-            unlikely_if(bytesRead < fillLength)
-            {
-                if(bytesRead < 0)
-                {
-                    CLKSLOG_ERROR("Error reading file %s: %s", context->sourceFilename, strerror(errno));
-                }
-                context->isEOF = true;
-            }
-        }
-    }
+    return context->encodeContext->containerLevel == context->baseContainerLevel ? context->topLevelName : name;
 }
 
 static int addJSONFromFile_onBooleanElement(const char* const name,
@@ -1199,9 +2027,7 @@ static int addJSONFromFile_onBooleanElement(const char* const name,
                                             void* const userData)
 {
     JSONFromFileContext* context = (JSONFromFileContext*)userData;
-    int result = clksjson_addBooleanElement(context->encodeContext, name, value);
-    context->updateDecoderCallback(context);
-    return result;
+    return clksjson_addBooleanElement(context->encodeContext, elementName(context, name), value);
 }
 
 static int addJSONFromFile_onFloatingPointElement(const char* const name,
@@ -1209,9 +2035,7 @@ static int addJSONFromFile_onFloatingPointElement(const char* const name,
                                                   void* const userData)
 {
     JSONFromFileContext* context = (JSONFromFileContext*)userData;
-    int result = clksjson_addFloatingPointElement(context->encodeContext, name, value);
-    context->updateDecoderCallback(context);
-    return result;
+    return clksjson_addFloatingPointElement(context->encodeContext, elementName(context, name), value);
 }
 
 static int addJSONFromFile_onIntegerElement(const char* const name,
@@ -1219,18 +2043,14 @@ static int addJSONFromFile_onIntegerElement(const char* const name,
                                             void* const userData)
 {
     JSONFromFileContext* context = (JSONFromFileContext*)userData;
-    int result = clksjson_addIntegerElement(context->encodeContext, name, value);
-    context->updateDecoderCallback(context);
-    return result;
+    return clksjson_addIntegerElement(context->encodeContext, elementName(context, name), value);
 }
 
 static int addJSONFromFile_onNullElement(const char* const name,
                                          void* const userData)
 {
     JSONFromFileContext* context = (JSONFromFileContext*)userData;
-    int result = clksjson_addNullElement(context->encodeContext, name);
-    context->updateDecoderCallback(context);
-    return result;
+    return clksjson_addNullElement(context->encodeContext, elementName(context, name));
 }
 
 static int addJSONFromFile_onStringElement(const char* const name,
@@ -1238,27 +2058,35 @@ static int addJSONFromFile_onStringElement(const char* const name,
                                            void* const userData)
 {
     JSONFromFileContext* context = (JSONFromFileContext*)userData;
-    int result = clksjson_addStringElement(context->encodeContext, name, value, (int)strlen(value));
-    context->updateDecoderCallback(context);
-    return result;
+    return clksjson_addStringElement(context->encodeContext, elementName(context, name), value, (int)strlen(value));
+}
+
+static int addJSONFromFile_onStringSliceElement(const char* const name,
+                                                const char* const value,
+                                                const int length,
+                                                const bool needsEscaping,
+                                                void* const userData)
+{
+    JSONFromFileContext* context = (JSONFromFileContext*)userData;
+    if(needsEscaping)
+    {
+        return clksjson_addStringElement(context->encodeContext, elementName(context, name), value, length);
+    }
+    return clksjson_addPreEscapedStringElement(context->encodeContext, elementName(context, name), value, length);
 }
 
 static int addJSONFromFile_onBeginObject(const char* const name,
                                          void* const userData)
 {
     JSONFromFileContext* context = (JSONFromFileContext*)userData;
-    int result = clksjson_beginObject(context->encodeContext, name);
-    context->updateDecoderCallback(context);
-    return result;
+    return clksjson_beginObject(context->encodeContext, elementName(context, name));
 }
 
 static int addJSONFromFile_onBeginArray(const char* const name,
                                         void* const userData)
 {
     JSONFromFileContext* context = (JSONFromFileContext*)userData;
-    int result = clksjson_beginArray(context->encodeContext, name);
-    context->updateDecoderCallback(context);
-    return result;
+    return clksjson_beginArray(context->encodeContext, elementName(context, name));
 }
 
 static int addJSONFromFile_onEndContainer(void* const userData)
@@ -1269,7 +2097,6 @@ static int addJSONFromFile_onEndContainer(void* const userData)
     {
         result = clksjson_endContainer(context->encodeContext);
     }
-    context->updateDecoderCallback(context);
     return result;
 }
 
@@ -1278,60 +2105,117 @@ static int addJSONFromFile_onEndData(__unused void* const userData)
     return CLKSJSON_OK;
 }
 
+static bool addJSONElement_shouldPassThrough(__unused const char* const name,
+                                            void* const userData)
+{
+    JSONFromFileContext* context = (JSONFromFileContext*)userData;
+    // If the top level container is to be left open, the encoder must see it.
+    return context->closeLastContainer ||
+           context->encodeContext->containerLevel > context->baseContainerLevel;
+}
+
+static int addJSONElement_onBeginRawElement(const char* const name,
+                                            void* const userData)
+{
+    JSONFromFileContext* context = (JSONFromFileContext*)userData;
+    return clksjson_beginElement(context->encodeContext, elementName(context, name));
+}
+
+static int addJSONElement_onRawData(const char* const data,
+                                    const int length,
+                                    void* const userData)
+{
+    JSONFromFileContext* context = (JSONFromFileContext*)userData;
+    return clksjson_addRawJSONData(context->encodeContext, data, length);
+}
+
+static CLKSJSONDecodeCallbacks g_addJSONFromFileCallbacks =
+{
+    .onBeginArray = addJSONFromFile_onBeginArray,
+    .onBeginObject = addJSONFromFile_onBeginObject,
+    .onBooleanElement = addJSONFromFile_onBooleanElement,
+    .onEndContainer = addJSONFromFile_onEndContainer,
+    .onEndData = addJSONFromFile_onEndData,
+    .onFloatingPointElement = addJSONFromFile_onFloatingPointElement,
+    .onIntegerElement = addJSONFromFile_onIntegerElement,
+    .onNullElement = addJSONFromFile_onNullElement,
+    .onStringElement = addJSONFromFile_onStringElement,
+    .onStringSliceElement = addJSONFromFile_onStringSliceElement,
+};
+
+/** Embedding well-formed JSON from memory passes elements through verbatim.
+ * This isn't done for files, since they may have been truncated by a crash.
+ */
+static CLKSJSONDecodeCallbacks g_addJSONElementCallbacks =
+{
+    .onBeginArray = addJSONFromFile_onBeginArray,
+    .onBeginObject = addJSONFromFile_onBeginObject,
+    .onBooleanElement = addJSONFromFile_onBooleanElement,
+    .onEndContainer = addJSONFromFile_onEndContainer,
+    .onEndData = addJSONFromFile_onEndData,
+    .onFloatingPointElement = addJSONFromFile_onFloatingPointElement,
+    .onIntegerElement = addJSONFromFile_onIntegerElement,
+    .onNullElement = addJSONFromFile_onNullElement,
+    .onStringElement = addJSONFromFile_onStringElement,
+    .onStringSliceElement = addJSONFromFile_onStringSliceElement,
+    .shouldPassThrough = addJSONElement_shouldPassThrough,
+    .onBeginRawElement = addJSONElement_onBeginRawElement,
+    .onRawData = addJSONElement_onRawData,
+};
+
 int clksjson_addJSONFromFile(CLKSJSONEncodeContext* const encodeContext,
                            const char* restrict const name,
                            const char* restrict const filename,
                            const bool closeLastContainer)
 {
-    CLKSJSONDecodeCallbacks callbacks =
-    {
-        .onBeginArray = addJSONFromFile_onBeginArray,
-        .onBeginObject = addJSONFromFile_onBeginObject,
-        .onBooleanElement = addJSONFromFile_onBooleanElement,
-        .onEndContainer = addJSONFromFile_onEndContainer,
-        .onEndData = addJSONFromFile_onEndData,
-        .onFloatingPointElement = addJSONFromFile_onFloatingPointElement,
-        .onIntegerElement = addJSONFromFile_onIntegerElement,
-        .onNullElement = addJSONFromFile_onNullElement,
-        .onStringElement = addJSONFromFile_onStringElement,
-    };
-    char nameBuffer[100] = {0};
-    char stringBuffer[500] = {0};
-    char fileBuffer[1000] = {0};
-    CLKSJSONDecodeContext decodeContext =
-    {
-        .bufferPtr = fileBuffer,
-        .bufferEnd = fileBuffer + sizeof(fileBuffer),
-        .nameBuffer = nameBuffer,
-        .nameBufferLength = sizeof(nameBuffer),
-        .stringBuffer = stringBuffer,
-        .stringBufferLength = sizeof(stringBuffer),
-        .callbacks = &callbacks,
-        .userData = NULL,
-    };
-
     int fd = open(filename, O_RDONLY);
+    unlikely_if(fd < 0)
+    {
+        CLKSLOG_ERROR("Could not open file %s: %s", filename, strerror(errno));
+        return CLKSJSON_ERROR_CANNOT_ADD_DATA;
+    }
+
+    char scratch[CLKSJSONCODEC_FileScratchSize];
+    char readBuffer[CLKSJSONCODEC_FileReadBufferSize];
     JSONFromFileContext jsonContext =
     {
         .encodeContext = encodeContext,
-        .decodeContext = &decodeContext,
-        .bufferStart = fileBuffer,
-        .sourceFilename = filename,
-        .fd = fd,
+        .topLevelName = name,
+        .baseContainerLevel = encodeContext->containerLevel,
         .closeLastContainer = closeLastContainer,
-        .isEOF = false,
-        .updateDecoderCallback = updateDecoder_readFile,
     };
-    decodeContext.userData = &jsonContext;
-    int containerLevel = encodeContext->containerLevel;
-
-    // Manually trigger a data load.
-    decodeContext.bufferPtr = decodeContext.bufferEnd;
-    jsonContext.updateDecoderCallback(&jsonContext);
+    CLKSJSONStreamDecodeContext decodeContext;
+    clksjson_beginDecode(&decodeContext, scratch, sizeof(scratch), &g_addJSONFromFileCallbacks, &jsonContext);
 
-    int result = decodeElement(name, &decodeContext);
+    int result = CLKSJSON_OK;
+    for(;;)
+    {
+        int bytesRead = (int)read(fd, readBuffer, sizeof(readBuffer));
+        unlikely_if(bytesRead < 0)
+        {
+            if(errno == EINTR)
+            {
+                continue;
+            }
+            CLKSLOG_ERROR("Error reading file %s: %s", filename, strerror(errno));
+            break;
+        }
+        if(bytesRead == 0)
+        {
+            break;
+        }
+        unlikely_if((result = clksjson_decodeChunk(&decodeContext, readBuffer, bytesRead)) != CLKSJSON_OK)
+        {
+            break;
+        }
+    }
     close(fd);
-    while(closeLastContainer && encodeContext->containerLevel > containerLevel)
+    likely_if(result == CLKSJSON_OK)
+    {
+        result = clksjson_endDecode(&decodeContext);
+    }
+
+    while(closeLastContainer && encodeContext->containerLevel > jsonContext.baseContainerLevel)
     {
         clksjson_endContainer(encodeContext);
     }
@@ -1345,51 +2229,130 @@ int clksjson_addJSONElement(CLKSJSONEncodeContext* const encodeContext,
                           const int jsonDataLength,
                           const bool closeLastContainer)
 {
-    CLKSJSONDecodeCallbacks callbacks =
-    {
-        .onBeginArray = addJSONFromFile_onBeginArray,
-        .onBeginObject = addJSONFromFile_onBeginObject,
-        .onBooleanElement = addJSONFromFile_onBooleanElement,
-        .onEndContainer = addJSONFromFile_onEndContainer,
-        .onEndData = addJSONFromFile_onEndData,
-        .onFloatingPointElement = addJSONFromFile_onFloatingPointElement,
-        .onIntegerElement = addJSONFromFile_onIntegerElement,
-        .onNullElement = addJSONFromFile_onNullElement,
-        .onStringElement = addJSONFromFile_onStringElement,
-    };
-    char nameBuffer[100] = {0};
-    char stringBuffer[5000] = {0};
-    CLKSJSONDecodeContext decodeContext =
-    {
-        .bufferPtr = jsonData,
-        .bufferEnd = jsonData + jsonDataLength,
-        .nameBuffer = nameBuffer,
-        .nameBufferLength = sizeof(nameBuffer),
-        .stringBuffer = stringBuffer,
-        .stringBufferLength = sizeof(stringBuffer),
-        .callbacks = &callbacks,
-        .userData = NULL,
-    };
-    
+    char scratch[5000];
     JSONFromFileContext jsonContext =
     {
         .encodeContext = encodeContext,
-        .decodeContext = &decodeContext,
-        .bufferStart = (char*)jsonData,
-        .sourceFilename = NULL,
-        .fd = 0,
+        .topLevelName = name,
+        .baseContainerLevel = encodeContext->containerLevel,
         .closeLastContainer = closeLastContainer,
-        .isEOF = false,
-        .updateDecoderCallback = updateDecoder_doNothing,
     };
-    decodeContext.userData = &jsonContext;
-    int containerLevel = encodeContext->containerLevel;
-    
-    int result = decodeElement(name, &decodeContext);
-    while(closeLastContainer && encodeContext->containerLevel > containerLevel)
+    CLKSJSONStreamDecodeContext decodeContext;
+    clksjson_beginDecode(&decodeContext, scratch, sizeof(scratch), &g_addJSONElementCallbacks, &jsonContext);
+
+    int result = clksjson_decodeChunk(&decodeContext, jsonData, jsonDataLength);
+    likely_if(result == CLKSJSON_OK)
+    {
+        result = clksjson_endDecode(&decodeContext);
+    }
+    while(closeLastContainer && encodeContext->containerLevel > jsonContext.baseContainerLevel)
     {
         clksjson_endContainer(encodeContext);
     }
-    
+
     return result;
 }
+
+/** Get the value of a base64 character.
+ *
+ * @param ch The character.
+ *
+ * @return The character's 6 bit value, or -1 if it isn't a base64 character.
+ */
+static int base64Value(const char ch)
+{
+    if(ch >= 'A' && ch <= 'Z')
+    {
+        return ch - 'A';
+    }
+    if(ch >= 'a' && ch <= 'z')
+    {
+        return ch - 'a' + 26;
+    }
+    if(ch >= '0' && ch <= '9')
+    {
+        return ch - '0' + 52;
+    }
+    if(ch == '+')
+    {
+        return 62;
+    }
+    if(ch == '/')
+    {
+        return 63;
+    }
+    return -1;
+}
+
+static int decodeHexData(const char* value, int length, uint8_t* dst, int dstLength)
+{
+    unlikely_if(length % 2 != 0 || length / 2 > dstLength)
+    {
+        return -1;
+    }
+    for(int i = 0; i < length; i += 2)
+    {
+        unsigned int accum = (g_hexConversion[(unsigned char)value[i]] << 4) |
+                              g_hexConversion[(unsigned char)value[i + 1]];
+        unlikely_if(accum > 0xff)
+        {
+            return -1;
+        }
+        *dst++ = (uint8_t)accum;
+    }
+    return length / 2;
+}
+
+static int decodeBase64Data(const char* value, int length, uint8_t* dst, int dstLength)
+{
+    unlikely_if(length % 4 != 0)
+    {
+        return -1;
+    }
+    int padding = 0;
+    while(padding < 2 && length - padding > 0 && value[length - padding - 1] == '=')
+    {
+        padding++;
+    }
+    const int decodedLength = length / 4 * 3 - padding;
+    unlikely_if(decodedLength > dstLength)
+    {
+        return -1;
+    }
+    int written = 0;
+    for(int i = 0; i < length; i += 4)
+    {
+        uint32_t group = 0;
+        for(int j = 0; j < 4; j++)
+        {
+            int sextet = 0;
+            if(i + j < length - padding)
+            {
+                sextet = base64Value(value[i + j]);
+                unlikely_if(sextet < 0)
+                {
+                    return -1;
+                }
+            }
+            group = (group << 6) | (uint32_t)sextet;
+        }
+        for(int j = 0; j < 3 && written < decodedLength; j++)
+        {
+            dst[written++] = (uint8_t)(group >> (16 - j * 8));
+        }
+    }
+    return decodedLength;
+}
+
+int clksjson_decodeDataElement(const char* value,
+                             int length,
+                             uint8_t* dst,
+                             int dstLength)
+{
+    const int prefixLength = (int)sizeof(CLKSJSON_BASE64_DATA_PREFIX) - 1;
+    if(length >= prefixLength && memcmp(value, CLKSJSON_BASE64_DATA_PREFIX, (size_t)prefixLength) == 0)
+    {
+        return decodeBase64Data(value + prefixLength, length - prefixLength, dst, dstLength);
+    }
+    return decodeHexData(value, length, dst, dstLength);
+}
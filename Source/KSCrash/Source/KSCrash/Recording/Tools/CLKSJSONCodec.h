@@ -99,6 +99,23 @@ const char* clksjson_stringForError(const int error);
  */
 typedef int (*CLKSJSONAddDataFunc)(const char* data, int length, void* userData);
 
+/** How binary data elements get encoded as strings. */
+typedef enum
+{
+    /** Two uppercase hex digits per byte. */
+    CLKSJSONDataEncodingHex = 0,
+
+    /** Standard base64, prefixed with CLKSJSON_BASE64_DATA_PREFIX.
+     * About 33% smaller than hex.
+     */
+    CLKSJSONDataEncodingBase64 = 1,
+} CLKSJSONDataEncoding;
+
+/** Prefix marking a base64 encoded data element.
+ * Hex encoded data elements never contain a ':'.
+ */
+#define CLKSJSON_BASE64_DATA_PREFIX "base64:"
+
 typedef struct
 {
     /** Function to call to add more encoded JSON data. */
@@ -118,6 +135,15 @@ typedef struct
 
     bool prettyPrint;
 
+    /** How data elements get encoded (a CLKSJSONDataEncoding). */
+    int dataEncoding;
+
+    /** Bytes of an incrementally-built base64 data element that don't yet
+     * make up a complete 3 byte group.
+     */
+    uint8_t dataRemainder[3];
+    int dataRemainderLength;
+
 } CLKSJSONEncodeContext;
 
 
@@ -136,6 +162,15 @@ void clksjson_beginEncode(CLKSJSONEncodeContext* context,
                         CLKSJSONAddDataFunc addJSONData,
                         void* userData);
 
+/** Set how data elements get encoded. The default is CLKSJSONDataEncodingHex.
+ *
+ * @param context The encoding context.
+ *
+ * @param dataEncoding The encoding to use.
+ */
+void clksjson_setDataEncoding(CLKSJSONEncodeContext* context,
+                            CLKSJSONDataEncoding dataEncoding);
+
 /** End the encoding process, ending any remaining open containers.
  *
  * @return CLKSJSON_OK if the process was successful.
@@ -212,6 +247,24 @@ int clksjson_addStringElement(CLKSJSONEncodeContext* context,
                             const char* value,
                             int length);
 
+/** Add a string element whose value is already escaped for JSON.
+ * The value is written as-is, without scanning for characters to escape.
+ *
+ * @param context The encoding context.
+ *
+ * @param name The element's name.
+ *
+ * @param value The element's value. MUST NOT CONTAIN UNESCAPED CHARACTERS!
+ *
+ * @param length the length of the string.
+ *
+ * @return CLKSJSON_OK if the process was successful.
+ */
+int clksjson_addPreEscapedStringElement(CLKSJSONEncodeContext* context,
+                                      const char* name,
+                                      const char* value,
+                                      int length);
+
 /** Start an incrementally-built string element.
  *
  * Use this for constructing very large strings.
@@ -247,7 +300,8 @@ int clksjson_appendStringElement(CLKSJSONEncodeContext* context,
  */
 int clksjson_endStringElement(CLKSJSONEncodeContext* context);
 
-/** Add a string element. The element will be converted to string-coded hex.
+/** Add a data element. The data will be converted to a string according to
+ * the context's data encoding.
  *
  * @param context The encoding context.
  *
@@ -264,8 +318,8 @@ int clksjson_addDataElement(CLKSJSONEncodeContext* const context,
                           const char* value,
                           int length);
 
-/** Start an incrementally-built data element. The element will be converted
- * to string-coded hex.
+/** Start an incrementally-built data element. The data will be converted
+ * to a string according to the context's data encoding.
  *
  * Use this for constructing very large data elements.
  *
@@ -368,6 +422,21 @@ int clksjson_addRawJSONData(CLKSJSONEncodeContext* const context,
                           const char* const data,
                           const int length);
 
+/** Add pre-encoded elements to the current container, as though they had been
+ * added one by one. Like clksjson_addRawJSONData(), the data isn't checked.
+ *
+ * @param context The encoding context.
+ *
+ * @param data Comma separated elements, such as "\"a\":1,\"b\":[2]" for an object.
+ *
+ * @param length The length of the data (0 = no elements).
+ *
+ * @return CLKSJSON_OK if the process was successful.
+ */
+int clksjson_addRawJSONElements(CLKSJSONEncodeContext* const context,
+                              const char* const data,
+                              const int length);
+
 /** End the current container and return to the next higher level.
  *
  * @param context The encoding context.
@@ -391,6 +460,23 @@ int clksjson_addJSONFromFile(CLKSJSONEncodeContext* const context,
                            const char* restrict const filename,
                            const bool closeLastContainer);
 
+/** Decode the string value of a data element, in either hex or base64 form.
+ *
+ * @param value The string value.
+ *
+ * @param length The length of the string value.
+ *
+ * @param dst Where to store the decoded data. Must hold at least length * 3 / 4 bytes.
+ *
+ * @param dstLength The length of the destination buffer.
+ *
+ * @return The number of bytes decoded, or -1 if the value is not valid.
+ */
+int clksjson_decodeDataElement(const char* value,
+                             int length,
+                             uint8_t* dst,
+                             int dstLength);
+
 
 // ============================================================================
 // Decode
@@ -399,7 +485,8 @@ int clksjson_addJSONFromFile(CLKSJSONEncodeContext* const context,
 
 /**
  * Callbacks called during a JSON decode process.
- * All function pointers must point to valid functions.
+ * All function pointers except those marked optional must point to valid
+ * functions.
  */
 typedef struct CLKSJSONDecodeCallbacks
 {
@@ -509,17 +596,229 @@ typedef struct CLKSJSONDecodeCallbacks
      */
     int (*onEndData)(void* userData);
 
+    /** Optional. If set, called for string elements instead of onStringElement.
+     *
+     * If the string contains no escape sequences and doesn't span chunks,
+     * value points straight into the source data. Otherwise it points to an
+     * unescaped copy in the scratch buffer. Either way, it is only valid for
+     * the duration of the call and is not guaranteed to be NUL terminated.
+     *
+     * @param name The element's name.
+     *
+     * @param value The element's value.
+     *
+     * @param length The length of the value.
+     *
+     * @param needsEscaping If false, the value contains no characters that
+     *                      need escaping, and can be re-encoded using
+     *                      clksjson_addPreEscapedStringElement().
+     *
+     * @param userData Data that was specified when calling clksjson_decode().
+     *
+     * @return CLKSJSON_OK if decoding should continue.
+     */
+    int (*onStringSliceElement)(const char* name,
+                                const char* value,
+                                int length,
+                                bool needsEscaping,
+                                void* userData);
+
+    /** Optional. Called before each element is decoded, to decide whether
+     * it should be passed through as raw JSON instead. A passed through
+     * element is still checked for well-formedness (trailing commas are
+     * tolerated, and left out of the raw data), but none of the other
+     * callbacks get called for it or anything inside it.
+     *
+     * @param name The element's name.
+     *
+     * @param userData Data that was specified when calling clksjson_decode().
+     *
+     * @return true if the element should be passed through.
+     */
+    bool (*shouldPassThrough)(const char* name,
+                              void* userData);
+
+    /** Called when a passed through element begins.
+     * Required if shouldPassThrough is set.
+     *
+     * @param name The element's name.
+     *
+     * @param userData Data that was specified when calling clksjson_decode().
+     *
+     * @return CLKSJSON_OK if decoding should continue.
+     */
+    int (*onBeginRawElement)(const char* name,
+                             void* userData);
+
+    /** Called with the raw JSON of a passed through element, exactly as it
+     * appears in the source data. This may be called several times for one
+     * element if it spans chunks. Required if shouldPassThrough is set.
+     *
+     * @param data The raw JSON data.
+     *
+     * @param length The length of the data.
+     *
+     * @param userData Data that was specified when calling clksjson_decode().
+     *
+     * @return CLKSJSON_OK if decoding should continue.
+     */
+    int (*onRawData)(const char* data,
+                     int length,
+                     void* userData);
+
 } CLKSJSONDecodeCallbacks;
 
 
+/** The maximum container depth supported by the decoder. */
+#define CLKSJSON_DECODE_MAX_DEPTH 200
+
+/**
+ * State for an incremental (push-mode) decode.
+ * Treat all fields as private; use clksjson_beginDecode() to initialize.
+ */
+typedef struct
+{
+    /** The callbacks to call while decoding. */
+    CLKSJSONDecodeCallbacks* callbacks;
+
+    /** Data to pass to the callbacks. */
+    void* userData;
+
+    /** Caller-provided space for decoding names, strings and numbers. */
+    char* scratch;
+
+    /** The length of the scratch space. */
+    int scratchLength;
+
+    /** Current state of the parser state machine. */
+    int state;
+
+    /** How many containers deep we are. */
+    int containerLevel;
+
+    /** Whether or not each open container is an object. */
+    bool isObject[CLKSJSON_DECODE_MAX_DEPTH];
+
+    /** Length of the pending element name in scratch, or -1 if none. */
+    int nameLength;
+
+    /** Offset in scratch where the current token starts. */
+    int tokenOffset;
+
+    /** Length of the current token decoded so far. */
+    int tokenLength;
+
+    /** true if the current string token is an object member name. */
+    bool tokenIsName;
+
+    /** true if the current string token will need escaping to re-encode. */
+    bool tokenNeedsEscaping;
+
+    /** Escape sequence state within a string token. */
+    int escapeState;
+
+    /** Accumulated \u escape value and digit count. */
+    unsigned int unicodeAccum;
+    int unicodeDigits;
+
+    /** A UTF-16 lead surrogate awaiting its trail surrogate. */
+    unsigned int leadSurrogate;
+
+    /** Where the current number token is in the JSON number grammar. */
+    int numberState;
+
+    /** The literal (true/false/null) being matched. */
+    const char* literal;
+    int literalIndex;
+
+    /** Container level of the element being passed through, or -1 if none. */
+    int rawLevel;
+
+    /** true when a passed through element has just begun or ended. */
+    bool rawBegan;
+    bool rawEnded;
+
+    /** true when a comma inside a passed through element has just been
+     * withheld from the raw data, and while it stays withheld. It is only
+     * passed on once another member follows, so trailing commas are dropped. */
+    bool rawCommaWithheld;
+    bool rawCommaPending;
+
+    /** Total bytes consumed across all chunks. */
+    int bytesConsumed;
+
+    /** Sticky result. Once an error occurs, all further calls return it. */
+    int result;
+
+} CLKSJSONStreamDecodeContext;
+
+
+/** Begin an incremental decode.
+ *
+ * The decoder keeps all of its state in the context and the scratch space,
+ * so data may be pushed in chunks of any size, split at any byte.
+ * Names and string/number values are limited only by the scratch length
+ * (a name and its value must fit together).
+ *
+ * @param context The decoding context.
+ *
+ * @param scratch A buffer to use for decoding names, strings and numbers.
+ *
+ * @param scratchLength The length of the scratch buffer.
+ *
+ * @param callbacks The callbacks to call while decoding.
+ *
+ * @param userData Any data you would like passed to the callbacks.
+ */
+void clksjson_beginDecode(CLKSJSONStreamDecodeContext* context,
+                        char* scratch,
+                        int scratchLength,
+                        CLKSJSONDecodeCallbacks* callbacks,
+                        void* userData);
+
+/** Decode the next chunk of JSON data.
+ *
+ * Any data following the end of the top level element is ignored.
+ *
+ * @param context The decoding context.
+ *
+ * @param data UTF-8 encoded JSON data.
+ *
+ * @param length Length of the data.
+ *
+ * @return CLKSJSON_OK if succesful so far. An error code otherwise.
+ */
+int clksjson_decodeChunk(CLKSJSONStreamDecodeContext* context,
+                       const char* data,
+                       int length);
+
+/** End an incremental decode, calling onEndData if the data was complete.
+ *
+ * @param context The decoding context.
+ *
+ * @return CLKSJSON_OK if a complete top level element was decoded.
+ *         CLKSJSON_ERROR_INCOMPLETE if the data ended prematurely.
+ */
+int clksjson_endDecode(CLKSJSONStreamDecodeContext* context);
+
+/** Get the offset into the data pushed so far where decoding stopped.
+ * After an error, this is the offset of the offending character.
+ *
+ * @param context The decoding context.
+ *
+ * @return The offset.
+ */
+int clksjson_decodeOffset(CLKSJSONStreamDecodeContext* context);
+
+
 /** Read a JSON encoded file from the specified FD.
  *
  * @param data UTF-8 encoded JSON data.
  *
  * @param length Length of the data.
  *
- * @param stringBuffer A buffer to use for decoding strings.
- *                     Note: 1/4 of this buffer will be used for dictionary name decoding.
+ * @param stringBuffer A buffer to use for decoding names, strings and numbers.
+ *                     A name and its value must fit together in this buffer.
  *
  * @param stringBufferLength The length of the string buffer.
  *
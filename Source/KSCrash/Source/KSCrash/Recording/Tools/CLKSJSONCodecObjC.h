@@ -102,4 +102,13 @@ typedef enum
       options:(CLKSJSONDecodeOption) options
         error:(NSError**) error;
 
+/** Decode the string value of a data element (such as stack contents),
+ * which may be hex or base64 encoded.
+ *
+ * @param string The string value.
+ *
+ * @return The decoded data or nil if the string is not a valid data element.
+ */
++ (NSData*) decodeDataElement:(NSString*) string;
+
 @end
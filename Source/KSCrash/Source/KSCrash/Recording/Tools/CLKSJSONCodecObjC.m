@@ -127,7 +127,7 @@
     if((self = [super init]))
     {
         self.containerStack = [NSMutableArray array];
-        self.callbacks = malloc(sizeof(*self.callbacks));
+        self.callbacks = calloc(1, sizeof(*self.callbacks));
         self.callbacks->onBeginArray = onBeginArray;
         self.callbacks->onBeginObject = onBeginObject;
         self.callbacks->onBooleanElement = onBooleanElement;
@@ -137,6 +137,7 @@
         self.callbacks->onIntegerElement = onIntegerElement;
         self.callbacks->onNullElement = onNullElement;
         self.callbacks->onStringElement = onStringElement;
+        self.callbacks->onStringSliceElement = onStringSliceElement;
         self.prettyPrint = (encodeOptions & CLKSJSONEncodeOptionPretty) != 0;
         self.sorted = (encodeOptions & CLKSJSONEncodeOptionSorted) != 0;
         self.ignoreNullsInArrays = (decodeOptions & CLKSJSONDecodeOptionIgnoreNullInArray) != 0;
@@ -256,6 +257,20 @@ static int onStringElement(const char* const cName, const char* const value, voi
     return onElement(codec, name, element);
 }
 
+static int onStringSliceElement(const char* const cName,
+                                const char* const value,
+                                const int length,
+                                __unused const bool needsEscaping,
+                                void* const userData)
+{
+    NSString* name = stringFromCString(cName);
+    id element = [[NSString alloc] initWithBytes:value
+                                          length:(NSUInteger)length
+                                        encoding:NSUTF8StringEncoding];
+    CLKSJSONCodec* codec = (__bridge CLKSJSONCodec*)userData;
+    return onElement(codec, name, element);
+}
+
 static int onBeginObject(const char* const cName, void* const userData)
 {
     NSString* name = stringFromCString(cName);
@@ -463,4 +478,21 @@ static int encodeObject(CLKSJSONCodec* codec, id object, NSString* name, CLKSJSO
     return codec.topLevelContainer;
 }
 
++ (NSData*) decodeDataElement:(NSString*) string
+{
+    NSData* stringData = [string dataUsingEncoding:NSUTF8StringEncoding];
+    // Big enough for either form: hex decodes to half its length, base64 to three quarters.
+    NSMutableData* data = [NSMutableData dataWithLength:stringData.length * 3 / 4 + 1];
+    int length = clksjson_decodeDataElement(stringData.bytes,
+                                          (int)stringData.length,
+                                          data.mutableBytes,
+                                          (int)data.length);
+    if(length < 0)
+    {
+        return nil;
+    }
+    data.length = (NSUInteger)length;
+    return data;
+}
+
 @end
@@ -75,6 +75,27 @@ static void writeFmtToLog(const char* fmt, ...);
  */
 static void writeFmtArgsToLog(const char* fmt, va_list args);
 
+/** Write a complete log entry, followed by a newline.
+ *
+ * @param level The level name (NULL = write the message with no context).
+ *
+ * @param file The source file.
+ *
+ * @param line The line number.
+ *
+ * @param function The function name.
+ *
+ * @param fmt The format string.
+ *
+ * @param args The variable arguments.
+ */
+static void writeEntryToLog(const char* level,
+                            const char* file,
+                            int line,
+                            const char* function,
+                            const char* fmt,
+                            va_list args);
+
 /** Flush the log stream.
  */
 static void flushLog(void);
@@ -96,15 +117,390 @@ static inline void writeFmtToLog(const char* fmt, ...)
 
 #if CLKSLOGGER_CBufferSize > 0
 
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
 /** The file descriptor where log entries get written. */
 static int g_fd = -1;
 
+/** Lines written to g_fd, or -1 if it already had unknown contents. */
+static _Atomic(int64_t) g_fdLineCount = -1;
 
-static void writeToLog(const char* const str)
+static inline void setLogFD(int fd)
+{
+    if(g_fd >= 0 && g_fd != STDOUT_FILENO && g_fd != STDERR_FILENO && g_fd != STDIN_FILENO)
+    {
+        close(g_fd);
+    }
+    g_fd = fd;
+}
+
+
+// ===========================================================================
+#pragma mark - Ring -
+// ===========================================================================
+
+#define RING_MAGIC 0x434c4b52
+#define RING_VERSION 1
+#define RING_SLOT_SIZE 128
+#define RING_SLOT_TEXT_SIZE (RING_SLOT_SIZE - 8)
+#define RING_MIN_SLOT_COUNT 16
+#define RING_DRAIN_INTERVAL_USECS 100000
+#define RING_DRAIN_MAX_STALLS 10
+
+/** One fixed-size piece of a log entry. Entries longer than a slot's text
+ * span several consecutive slots.
+ */
+typedef struct
+{
+    /** The slot's index + 1 once its text is complete, 0 while it's being written. */
+    _Atomic(uint32_t) sequence;
+    uint16_t length;
+    uint16_t reserved;
+    char text[RING_SLOT_TEXT_SIZE];
+} RingSlot;
+
+typedef struct
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t slotCount;
+    uint32_t reserved;
+    /** The next slot index to be reserved. Never wraps. */
+    _Atomic(uint64_t) head;
+    /** The first slot index written since the ring was last cleared. */
+    _Atomic(uint64_t) start;
+    /** Lines appended since the ring was last cleared. */
+    _Atomic(uint64_t) lineCount;
+    uint8_t padding[RING_SLOT_SIZE - 40];
+} RingHeader;
+
+typedef struct
+{
+    RingHeader header;
+    RingSlot slots[];
+} Ring;
+
+/** The ring being logged to, or NULL to log to g_fd. */
+static _Atomic(Ring*) g_ring;
+
+static int countLines(const char* const str, const int length)
+{
+    int lineCount = 0;
+    for(const char* pos = str; (pos = memchr(pos, '\n', (size_t)(str + length - pos))) != NULL; pos++)
+    {
+        lineCount++;
+    }
+    return lineCount;
+}
+
+static void appendToRing(Ring* const ring, const char* str, int length)
+{
+    const uint32_t slotCount = ring->header.slotCount;
+    const int maxLength = (int)(slotCount / 2) * RING_SLOT_TEXT_SIZE;
+    if(length > maxLength)
+    {
+        length = maxLength;
+    }
+    const int slotsNeeded = length <= RING_SLOT_TEXT_SIZE ? 1 : (length + RING_SLOT_TEXT_SIZE - 1) / RING_SLOT_TEXT_SIZE;
+    atomic_fetch_add_explicit(&ring->header.lineCount, (uint64_t)countLines(str, length), memory_order_relaxed);
+    uint64_t index = atomic_fetch_add_explicit(&ring->header.head, (uint64_t)slotsNeeded, memory_order_relaxed);
+    for(int i = 0; i < slotsNeeded; i++, index++)
+    {
+        RingSlot* const slot = &ring->slots[index & (slotCount - 1)];
+        const int chunkLength = length < RING_SLOT_TEXT_SIZE ? length : RING_SLOT_TEXT_SIZE;
+        atomic_store_explicit(&slot->sequence, 0, memory_order_relaxed);
+        atomic_thread_fence(memory_order_release);
+        memcpy(slot->text, str, (size_t)chunkLength);
+        slot->length = (uint16_t)chunkLength;
+        atomic_store_explicit(&slot->sequence, (uint32_t)(index + 1), memory_order_release);
+        str += chunkLength;
+        length -= chunkLength;
+    }
+}
+
+/** Copy the text of the slot at index, if it's complete and hasn't been overwritten.
+ *
+ * @param dst Where to copy up to RING_SLOT_TEXT_SIZE bytes.
+ *
+ * @return The number of bytes copied, or -1 if the slot isn't readable.
+ */
+static int readRingSlot(Ring* const ring, const uint64_t index, char* const dst)
+{
+    RingSlot* const slot = &ring->slots[index & (ring->header.slotCount - 1)];
+    const uint32_t expected = (uint32_t)(index + 1);
+    if(atomic_load_explicit(&slot->sequence, memory_order_acquire) != expected)
+    {
+        return -1;
+    }
+    int length = slot->length;
+    if(length > RING_SLOT_TEXT_SIZE)
+    {
+        length = RING_SLOT_TEXT_SIZE;
+    }
+    memcpy(dst, slot->text, (size_t)length);
+    atomic_thread_fence(memory_order_acquire);
+    if(atomic_load_explicit(&slot->sequence, memory_order_relaxed) != expected)
+    {
+        return -1;
+    }
+    return length;
+}
+
+static int copyRingTail(Ring* const ring, char* const dst, const int maxLength)
+{
+    if(maxLength <= 0)
+    {
+        return 0;
+    }
+    const int capacity = maxLength - 1;
+    const uint64_t slotCount = ring->header.slotCount;
+    const uint64_t head = atomic_load(&ring->header.head);
+    uint64_t start = atomic_load(&ring->header.start);
+    bool isTruncated = false;
+    if(head - start > slotCount)
+    {
+        start = head - slotCount;
+        isTruncated = true;
+    }
+
+    // Work backwards to find the oldest slot that still fits.
+    char text[RING_SLOT_TEXT_SIZE];
+    uint64_t first = head;
+    int totalLength = 0;
+    while(first > start)
+    {
+        int length = readRingSlot(ring, first - 1, text);
+        if(length > 0)
+        {
+            if(totalLength + length > capacity)
+            {
+                isTruncated = true;
+                break;
+            }
+            totalLength += length;
+        }
+        first--;
+    }
+
+    // Slots may have changed since, so re-check the space as we go.
+    int copied = 0;
+    for(uint64_t index = first; index < head; index++)
+    {
+        int length = readRingSlot(ring, index, text);
+        if(length <= 0)
+        {
+            continue;
+        }
+        if(copied + length > capacity)
+        {
+            break;
+        }
+        memcpy(dst + copied, text, (size_t)length);
+        copied += length;
+    }
+
+    if(isTruncated)
+    {
+        const char* lineEnd = memchr(dst, '\n', (size_t)copied);
+        if(lineEnd != NULL)
+        {
+            int skipLength = (int)(lineEnd + 1 - dst);
+            copied -= skipLength;
+            memmove(dst, lineEnd + 1, (size_t)copied);
+        }
+    }
+    dst[copied] = '\0';
+    return copied;
+}
+
+static void* drainRing(void* const userData)
+{
+    Ring* const ring = userData;
+    const uint64_t slotCount = ring->header.slotCount;
+    char buffer[RING_SLOT_TEXT_SIZE * 32];
+    uint64_t index = 0;
+    int stallCount = 0;
+
+    while(atomic_load(&g_ring) == ring)
+    {
+        const uint64_t head = atomic_load(&ring->header.head);
+        if(head - index > slotCount)
+        {
+            int length = snprintf(buffer, sizeof(buffer), "CLKSLogger: %llu log entries dropped\n",
+                                  (unsigned long long)(head - slotCount - index));
+            write(STDOUT_FILENO, buffer, (size_t)length);
+            index = head - slotCount;
+        }
+
+        int length = 0;
+        while(index < head)
+        {
+            if(length > (int)sizeof(buffer) - RING_SLOT_TEXT_SIZE)
+            {
+                write(STDOUT_FILENO, buffer, (size_t)length);
+                length = 0;
+            }
+            int slotLength = readRingSlot(ring, index, buffer + length);
+            if(slotLength < 0)
+            {
+                // Still being written, or already overwritten. Give a slow
+                // writer some time, but not forever.
+                if(head - index < slotCount && stallCount++ < RING_DRAIN_MAX_STALLS)
+                {
+                    break;
+                }
+                slotLength = 0;
+            }
+            stallCount = 0;
+            length += slotLength;
+            index++;
+        }
+        if(length > 0)
+        {
+            write(STDOUT_FILENO, buffer, (size_t)length);
+        }
+        usleep(RING_DRAIN_INTERVAL_USECS);
+    }
+    return NULL;
+}
+
+bool clkslog_setLogRing(const char* filename, int capacityBytes, bool drainToStdout)
+{
+    uint32_t slotCount = RING_MIN_SLOT_COUNT;
+    while((int64_t)slotCount * 2 * RING_SLOT_SIZE <= capacityBytes)
+    {
+        slotCount *= 2;
+    }
+    const size_t size = sizeof(RingHeader) + sizeof(RingSlot) * slotCount;
+
+    int fd = open(filename, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    unlikely_if(fd < 0)
+    {
+        writeFmtToLog("CLKSLogger: Could not open %s: %s\n", filename, strerror(errno));
+        return false;
+    }
+    unlikely_if(ftruncate(fd, (off_t)size) != 0)
+    {
+        writeFmtToLog("CLKSLogger: Could not resize %s: %s\n", filename, strerror(errno));
+        close(fd);
+        return false;
+    }
+    void* memory = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    unlikely_if(memory == MAP_FAILED)
+    {
+        writeFmtToLog("CLKSLogger: Could not map %s: %s\n", filename, strerror(errno));
+        return false;
+    }
+
+    Ring* ring = memory;
+    ring->header.magic = RING_MAGIC;
+    ring->header.version = RING_VERSION;
+    ring->header.slotCount = slotCount;
+
+    // Any previous ring stays mapped, since other threads may still be appending to it.
+    atomic_store(&g_ring, ring);
+    setLogFD(-1);
+
+    if(drainToStdout)
+    {
+        pthread_t thread;
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+        int error = pthread_create(&thread, &attr, &drainRing, ring);
+        if(error != 0)
+        {
+            writeFmtToLog("CLKSLogger: Could not start log drain thread: %s\n", strerror(error));
+        }
+        pthread_attr_destroy(&attr);
+    }
+    return true;
+}
+
+bool clkslog_isLogRingActive()
 {
+    return atomic_load(&g_ring) != NULL;
+}
+
+int clkslog_copyLogRingTail(char* dst, int maxLength)
+{
+    Ring* ring = atomic_load(&g_ring);
+    if(ring == NULL)
+    {
+        if(maxLength > 0)
+        {
+            dst[0] = '\0';
+        }
+        return 0;
+    }
+    return copyRingTail(ring, dst, maxLength);
+}
+
+int clkslog_readLogRingFile(const char* filename, char* dst, int maxLength)
+{
+    int fd = open(filename, O_RDONLY);
+    if(fd < 0)
+    {
+        return -1;
+    }
+    struct stat st;
+    if(fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(RingHeader))
+    {
+        close(fd);
+        return -1;
+    }
+    void* memory = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(memory == MAP_FAILED)
+    {
+        return -1;
+    }
+
+    int result = -1;
+    Ring* ring = memory;
+    const uint32_t slotCount = ring->header.slotCount;
+    if(ring->header.magic == RING_MAGIC &&
+       ring->header.version == RING_VERSION &&
+       slotCount > 0 && (slotCount & (slotCount - 1)) == 0 &&
+       (off_t)(sizeof(RingHeader) + sizeof(RingSlot) * slotCount) <= st.st_size)
+    {
+        result = copyRingTail(ring, dst, maxLength);
+    }
+    munmap(memory, (size_t)st.st_size);
+    return result;
+}
+
+
+// ===========================================================================
+#pragma mark - File -
+// ===========================================================================
+
+static void writeBytesToLog(const char* const str, const int length)
+{
+    Ring* ring = atomic_load_explicit(&g_ring, memory_order_acquire);
+    likely_if(ring != NULL)
+    {
+        appendToRing(ring, str, length);
+        return;
+    }
+
     if(g_fd >= 0)
     {
-        int bytesToWrite = (int)strlen(str);
+        int64_t lineCount = atomic_load_explicit(&g_fdLineCount, memory_order_relaxed);
+        while(lineCount >= 0 &&
+              !atomic_compare_exchange_weak_explicit(&g_fdLineCount,
+                                                     &lineCount,
+                                                     lineCount + countLines(str, length),
+                                                     memory_order_relaxed,
+                                                     memory_order_relaxed))
+        {
+        }
+        int bytesToWrite = length;
         const char* pos = str;
         while(bytesToWrite > 0)
         {
@@ -117,7 +513,12 @@ static void writeToLog(const char* const str)
             pos += bytesWritten;
         }
     }
-    write(STDOUT_FILENO, str, strlen(str));
+    write(STDOUT_FILENO, str, (size_t)length);
+}
+
+static void writeToLog(const char* const str)
+{
+    writeBytesToLog(str, (int)strlen(str));
 }
 
 static inline void writeFmtArgsToLog(const char* fmt, va_list args)
@@ -134,18 +535,34 @@ static inline void writeFmtArgsToLog(const char* fmt, va_list args)
     }
 }
 
-static inline void flushLog(void)
+static void writeEntryToLog(const char* const level,
+                            const char* const file,
+                            const int line,
+                            const char* const function,
+                            const char* const fmt,
+                            va_list args)
 {
-    // Nothing to do.
+    // Format the whole entry first so that it goes out in a single write.
+    char buffer[CLKSLOGGER_CBufferSize];
+    const int maxLength = (int)sizeof(buffer) - 1;
+    int length = 0;
+    if(level != NULL)
+    {
+        length = snprintf(buffer, (size_t)maxLength, "%s: %s (%u): %s: ", level, lastPathEntry(file), line, function);
+        length = length < 0 ? 0 : length < maxLength ? length : maxLength - 1;
+    }
+    int messageLength = fmt == NULL ? snprintf(buffer + length, (size_t)(maxLength - length), "(null)")
+                                    : vsnprintf(buffer + length, (size_t)(maxLength - length), fmt, args);
+    messageLength = messageLength < 0 ? 0 : messageLength;
+    length += messageLength < maxLength - length ? messageLength : maxLength - length - 1;
+    buffer[length++] = '\n';
+    buffer[length] = '\0';
+    writeBytesToLog(buffer, length);
 }
 
-static inline void setLogFD(int fd)
+static inline void flushLog(void)
 {
-    if(g_fd >= 0 && g_fd != STDOUT_FILENO && g_fd != STDERR_FILENO && g_fd != STDIN_FILENO)
-    {
-        close(g_fd);
-    }
-    g_fd = fd;
+    // Nothing to do.
 }
 
 bool clkslog_setLogFilename(const char* filename, bool overwrite)
@@ -170,10 +587,34 @@ bool clkslog_setLogFilename(const char* filename, bool overwrite)
         }
     }
     
+    atomic_store(&g_ring, NULL);
     setLogFD(fd);
+    g_fdLineCount = overwrite ? 0 : -1;
     return true;
 }
 
+int64_t clkslog_getLogFileLineCount()
+{
+    Ring* ring = atomic_load(&g_ring);
+    if(ring != NULL)
+    {
+        return (int64_t)atomic_load(&ring->header.lineCount);
+    }
+    return g_fd >= 0 ? atomic_load(&g_fdLineCount) : -1;
+}
+
+bool clkslog_clearLogFile()
+{
+    Ring* ring = atomic_load(&g_ring);
+    if(ring != NULL)
+    {
+        atomic_store(&ring->header.start, atomic_load(&ring->header.head));
+        atomic_store(&ring->header.lineCount, 0);
+        return true;
+    }
+    return clkslog_setLogFilename(g_logFilename, true);
+}
+
 #else // if CLKSLogger_CBufferSize <= 0
 
 static FILE* g_file = NULL;
@@ -213,6 +654,21 @@ static inline void writeFmtArgsToLog(const char* fmt, va_list args)
     }
 }
 
+static void writeEntryToLog(const char* const level,
+                            const char* const file,
+                            const int line,
+                            const char* const function,
+                            const char* const fmt,
+                            va_list args)
+{
+    if(level != NULL)
+    {
+        writeFmtToLog("%s: %s (%u): %s: ", level, lastPathEntry(file), line, function);
+    }
+    writeFmtArgsToLog(fmt, args);
+    writeToLog("\n");
+}
+
 static inline void flushLog(void)
 {
     fflush(g_file);
@@ -245,13 +701,43 @@ bool clkslog_setLogFilename(const char* filename, bool overwrite)
     return true;
 }
 
-#endif
-
 bool clkslog_clearLogFile()
 {
     return clkslog_setLogFilename(g_logFilename, true);
 }
 
+bool clkslog_setLogRing(__unused const char* filename, __unused int capacityBytes, __unused bool drainToStdout)
+{
+    writeToLog("CLKSLogger: Log rings require CLKSLOGGER_CBufferSize > 0\n");
+    return false;
+}
+
+bool clkslog_isLogRingActive()
+{
+    return false;
+}
+
+int64_t clkslog_getLogFileLineCount()
+{
+    return -1;
+}
+
+int clkslog_copyLogRingTail(char* dst, int maxLength)
+{
+    if(maxLength > 0)
+    {
+        dst[0] = '\0';
+    }
+    return 0;
+}
+
+int clkslog_readLogRingFile(__unused const char* filename, __unused char* dst, __unused int maxLength)
+{
+    return -1;
+}
+
+#endif
+
 
 // ===========================================================================
 #pragma mark - C -
@@ -261,9 +747,8 @@ void i_kslog_logCBasic(const char* const fmt, ...)
 {
     va_list args;
     va_start(args,fmt);
-    writeFmtArgsToLog(fmt, args);
+    writeEntryToLog(NULL, NULL, 0, NULL, fmt, args);
     va_end(args);
-    writeToLog("\n");
     flushLog();
 }
 
@@ -273,12 +758,10 @@ void i_kslog_logC(const char* const level,
                   const char* const function,
                   const char* const fmt, ...)
 {
-    writeFmtToLog("%s: %s (%u): %s: ", level, lastPathEntry(file), line, function);
     va_list args;
     va_start(args,fmt);
-    writeFmtArgsToLog(fmt, args);
+    writeEntryToLog(level, file, line, function, fmt, args);
     va_end(args);
-    writeToLog("\n");
     flushLog();
 }
 
@@ -153,6 +153,7 @@ extern "C" {
 
 
 #include <stdbool.h>
+#include <stdint.h>
 
 
 #ifdef __OBJC__
@@ -261,6 +262,56 @@ bool clkslog_setLogFilename(const char* filename, bool overwrite);
 /** Clear the log file. */
 bool clkslog_clearLogFile(void);
 
+/** Get the number of lines written to the log file or ring since it was last cleared.
+ * This function is async-safe.
+ *
+ * @return The line count, or -1 if unknown (appending to an existing file).
+ */
+int64_t clkslog_getLogFileLineCount(void);
+
+/** Log into a fixed-size, memory-mapped ring file instead of a growing log file.
+ *
+ * Each log entry is a single lock-free append into the ring, with no syscalls.
+ * Once the ring is full, the oldest entries are overwritten.
+ * Calling clkslog_setLogFilename() switches back to plain file logging.
+ *
+ * @param filename The ring file to create. Any existing file is overwritten.
+ *
+ * @param capacityBytes The approximate size of the ring.
+ *
+ * @param drainToStdout If true, a background thread copies new entries to stdout.
+ *
+ * @return true if the ring is now in use.
+ */
+bool clkslog_setLogRing(const char* filename, int capacityBytes, bool drainToStdout);
+
+/** Check if logging is going to a ring (see clkslog_setLogRing()). */
+bool clkslog_isLogRingActive(void);
+
+/** Copy the most recent text from the active log ring.
+ * Starts at the beginning of a line whenever older text had to be left out.
+ * This function is async-safe.
+ *
+ * @param dst The buffer to copy into. It will be NUL terminated.
+ *
+ * @param maxLength The length of dst.
+ *
+ * @return The number of bytes copied, not counting the NUL terminator.
+ */
+int clkslog_copyLogRingTail(char* dst, int maxLength);
+
+/** Copy the most recent text from a ring file written by a previous session.
+ *
+ * @param filename The ring file.
+ *
+ * @param dst The buffer to copy into. It will be NUL terminated.
+ *
+ * @param maxLength The length of dst.
+ *
+ * @return The number of bytes copied, or -1 if the file isn't a valid ring.
+ */
+int clkslog_readLogRingFile(const char* filename, char* dst, int maxLength);
+
 /** Tests if the logger would print at the specified level.
  *
  * @param LEVEL The level to test for. One of:
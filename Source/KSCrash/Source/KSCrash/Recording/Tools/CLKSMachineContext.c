@@ -47,6 +47,7 @@
 static CLKSThread g_reservedThreads[10];
 static int g_reservedThreadsMaxIndex = sizeof(g_reservedThreads) / sizeof(g_reservedThreads[0]) - 1;
 static int g_reservedThreadsCount = 0;
+static volatile bool g_isEnvironmentSuspended = false;
 
 
 
@@ -200,6 +201,7 @@ void clksmc_suspendEnvironment()
         mach_port_deallocate(thisTask, threads[i]);
     }
     vm_deallocate(thisTask, (vm_address_t)threads, sizeof(thread_t) * numThreads);
+    g_isEnvironmentSuspended = true;
     
     CLKSLOG_DEBUG("Suspend complete.");
 #endif
@@ -209,6 +211,7 @@ void clksmc_resumeEnvironment()
 {
 #if CLKSCRASH_HAS_THREADS_API
     CLKSLOG_DEBUG("Resuming environment.");
+    g_isEnvironmentSuspended = false;
     kern_return_t kr;
     const task_t thisTask = mach_task_self();
     const thread_t thisThread = (thread_t) clksthread_self();
@@ -244,6 +247,11 @@ void clksmc_resumeEnvironment()
 #endif
 }
 
+bool clksmc_isEnvironmentSuspended()
+{
+    return g_isEnvironmentSuspended;
+}
+
 int clksmc_getThreadCount(const struct CLKSMachineContext *const context)
 {
     return context->threadCount;
@@ -43,6 +43,10 @@ void clksmc_suspendEnvironment(void);
  */
 void clksmc_resumeEnvironment(void);
 
+/** Check whether every other thread is currently suspended.
+ */
+bool clksmc_isEnvironmentSuspended(void);
+
 /** Create a new machine context on the stack.
  * This macro creates a storage object on the stack, as well as a pointer of type
  * struct CLKSMachineContext* in the current scope, which points to the storage object.
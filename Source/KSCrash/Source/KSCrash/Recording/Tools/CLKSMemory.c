@@ -25,16 +25,78 @@
 //
 
 
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+    // For process_vm_readv()
+    #define _GNU_SOURCE
+#endif
+
 #include "CLKSMemory.h"
 
 //#define CLKSLogger_LocalLevel TRACE
 #include "CLKSLogger.h"
 
-#include <mach/mach.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
 
+#if defined(__APPLE__)
+    #include <mach/mach.h>
+#elif defined(__linux__)
+    #include <sys/uio.h>
+    #include <unistd.h>
+#endif
 
-static inline int copySafely(const void* restrict const src, void* restrict const dst, const int byteCount)
+
+/** Granularity of the page cache. This is the smallest page size we run on,
+ * so it never spans two pages with different protections.
+ */
+#define PAGE_CACHE_GRANULE 4096
+
+/** Number of entries in the page cache. Must be a power of 2. */
+#define PAGE_CACHE_SIZE 512
+
+/** How far to probe for a page cache entry before giving up. */
+#define PAGE_CACHE_MAX_PROBES 8
+
+/** Ranges spanning more pages than this bypass the page cache. */
+#define PAGE_CACHE_MAX_RANGE_PAGES 16
+
+#if defined(__linux__)
+/** Maximum number of copies to send to the kernel in one call. */
+#define MAX_BATCH_COUNT 64
+#endif
+
+typedef enum
 {
+    ReadabilityUnknown,
+    ReadabilityReadable,
+    ReadabilityUnreadable,
+} Readability;
+
+/** Open-addressed table of page readability.
+ * Each entry is ((page number + 1) << 1) | readable, with 0 meaning empty.
+ */
+static uintptr_t g_pageCache[PAGE_CACHE_SIZE];
+static volatile bool g_pageCacheEnabled = false;
+/** The thread that enabled the cache. Nobody else may use it. */
+static pthread_t g_pageCacheOwner;
+static CLKSMemoryReadFunc g_reader = NULL;
+static volatile uint64_t g_syscallsSaved = 0;
+
+
+// ============================================================================
+#pragma mark - Readers -
+// ============================================================================
+
+/** Copy memory using the kernel, so that unreadable memory results in an
+ * error rather than a fault.
+ *
+ * @return The number of bytes copied. This can be less than byteCount if the
+ *         backend supports partial reads.
+ */
+static int kernelCopy(const void* src, void* dst, int byteCount)
+{
+#if defined(__APPLE__)
     vm_size_t bytesCopied = 0;
     kern_return_t result = vm_read_overwrite(mach_task_self(),
                                              (vm_address_t)src,
@@ -46,6 +108,164 @@ static inline int copySafely(const void* restrict const src, void* restrict cons
         return 0;
     }
     return (int)bytesCopied;
+#elif defined(__linux__)
+    // Reading our own process still goes through the kernel's page checks.
+    struct iovec local = { .iov_base = dst, .iov_len = (size_t)byteCount };
+    struct iovec remote = { .iov_base = (void*)src, .iov_len = (size_t)byteCount };
+    ssize_t bytesCopied = process_vm_readv(getpid(), &local, 1, &remote, 1, 0);
+    if(bytesCopied < 0)
+    {
+        return 0;
+    }
+    return (int)bytesCopied;
+#else
+    #error "No safe memory reader for this platform"
+#endif
+}
+
+static inline int readerCopy(const void* src, void* dst, int byteCount)
+{
+    CLKSMemoryReadFunc reader = g_reader;
+    if(reader != NULL)
+    {
+        return reader(src, dst, byteCount);
+    }
+    return kernelCopy(src, dst, byteCount);
+}
+
+
+// ============================================================================
+#pragma mark - Page Cache -
+// ============================================================================
+
+static inline uintptr_t pageOf(const void* address)
+{
+    return (uintptr_t)address / PAGE_CACHE_GRANULE;
+}
+
+static inline bool isPageCacheActive(void)
+{
+    return g_pageCacheEnabled && pthread_equal(g_pageCacheOwner, pthread_self());
+}
+
+static inline int pageSlot(uintptr_t page)
+{
+    // Fibonacci hashing spreads out the mostly-sequential page numbers.
+    return (int)(((uint64_t)page * 0x9E3779B97F4A7C15ull) >> 32) & (PAGE_CACHE_SIZE - 1);
+}
+
+static Readability getPageReadability(uintptr_t page)
+{
+    const uintptr_t key = page + 1;
+    int slot = pageSlot(page);
+    for(int i = 0; i < PAGE_CACHE_MAX_PROBES; i++)
+    {
+        uintptr_t entry = g_pageCache[slot];
+        if(entry == 0)
+        {
+            break;
+        }
+        if((entry >> 1) == key)
+        {
+            return (entry & 1) ? ReadabilityReadable : ReadabilityUnreadable;
+        }
+        slot = (slot + 1) & (PAGE_CACHE_SIZE - 1);
+    }
+    return ReadabilityUnknown;
+}
+
+static void setPageReadability(uintptr_t page, bool isReadable)
+{
+    const uintptr_t key = page + 1;
+    const uintptr_t newEntry = (key << 1) | (isReadable ? 1 : 0);
+    int slot = pageSlot(page);
+    for(int i = 0; i < PAGE_CACHE_MAX_PROBES; i++)
+    {
+        uintptr_t entry = g_pageCache[slot];
+        if(entry == 0 || (entry >> 1) == key)
+        {
+            g_pageCache[slot] = newEntry;
+            return;
+        }
+        slot = (slot + 1) & (PAGE_CACHE_SIZE - 1);
+    }
+    // Table is crowded here. Not caching is always safe.
+}
+
+static Readability getRangeReadability(const void* src, int byteCount)
+{
+    if(byteCount <= 0)
+    {
+        return ReadabilityUnknown;
+    }
+    const uintptr_t firstPage = pageOf(src);
+    const uintptr_t lastPage = pageOf((const uint8_t*)src + byteCount - 1);
+    if(lastPage < firstPage || lastPage - firstPage >= PAGE_CACHE_MAX_RANGE_PAGES)
+    {
+        return ReadabilityUnknown;
+    }
+    for(uintptr_t page = firstPage; page <= lastPage; page++)
+    {
+        Readability readability = getPageReadability(page);
+        if(readability != ReadabilityReadable)
+        {
+            // One unreadable page makes the whole range unreadable.
+            return readability;
+        }
+    }
+    return ReadabilityReadable;
+}
+
+/** Record the outcome of reading a range.
+ *
+ * @param src The start of the range.
+ *
+ * @param byteCount The number of bytes that were requested.
+ *
+ * @param bytesCopied The number of bytes that were actually copied.
+ */
+static void recordRead(const void* src, int byteCount, int bytesCopied)
+{
+    if(bytesCopied > 0)
+    {
+        const uintptr_t lastPage = pageOf((const uint8_t*)src + bytesCopied - 1);
+        uintptr_t page = pageOf(src);
+        for(int i = 0; i < PAGE_CACHE_MAX_RANGE_PAGES && page <= lastPage; i++, page++)
+        {
+            setPageReadability(page, true);
+        }
+    }
+    else if(byteCount > 0 && pageOf(src) == pageOf((const uint8_t*)src + byteCount - 1))
+    {
+        // Only a failed single-page read tells us which page is unreadable.
+        setPageReadability(pageOf(src), false);
+    }
+}
+
+static inline int copySafely(const void* restrict const src, void* restrict const dst, const int byteCount)
+{
+    if(isPageCacheActive())
+    {
+        switch(getRangeReadability(src, byteCount))
+        {
+            case ReadabilityReadable:
+                g_syscallsSaved++;
+                memcpy(dst, src, (size_t)byteCount);
+                return byteCount;
+            case ReadabilityUnreadable:
+                g_syscallsSaved++;
+                return 0;
+            case ReadabilityUnknown:
+                break;
+        }
+    }
+
+    int bytesCopied = readerCopy(src, dst, byteCount);
+    if(isPageCacheActive())
+    {
+        recordRead(src, byteCount, bytesCopied);
+    }
+    return bytesCopied;
 }
 
 static inline int copyMaxPossible(const void* restrict const src, void* restrict const dst, const int byteCount)
@@ -98,21 +318,122 @@ static inline int copyMaxPossible(const void* restrict const src, void* restrict
 static char g_memoryTestBuffer[10240];
 static inline bool isMemoryReadable(const void* const memory, const int byteCount)
 {
+    if(isPageCacheActive())
+    {
+        Readability readability = getRangeReadability(memory, byteCount);
+        if(readability != ReadabilityUnknown)
+        {
+            g_syscallsSaved++;
+            return readability == ReadabilityReadable;
+        }
+    }
+
     const int testBufferSize = sizeof(g_memoryTestBuffer);
+    const uint8_t* currentPosition = memory;
     int bytesRemaining = byteCount;
     
     while(bytesRemaining > 0)
     {
         int bytesToCopy = bytesRemaining > testBufferSize ? testBufferSize : bytesRemaining;
-        if(copySafely(memory, g_memoryTestBuffer, bytesToCopy) != bytesToCopy)
+        if(copySafely(currentPosition, g_memoryTestBuffer, bytesToCopy) != bytesToCopy)
         {
             break;
         }
+        currentPosition += bytesToCopy;
         bytesRemaining -= bytesToCopy;
     }
     return bytesRemaining == 0;
 }
 
+#if defined(__linux__)
+/** Copy a batch using one process_vm_readv() call per unreadable region,
+ * rather than one per request.
+ */
+static void kernelCopyMany(CLKSMemoryCopyRequest** requests, int count)
+{
+    struct iovec local[MAX_BATCH_COUNT];
+    struct iovec remote[MAX_BATCH_COUNT];
+    int index = 0;
+    while(index < count)
+    {
+        int batchCount = count - index;
+        if(batchCount > MAX_BATCH_COUNT)
+        {
+            batchCount = MAX_BATCH_COUNT;
+        }
+        for(int i = 0; i < batchCount; i++)
+        {
+            CLKSMemoryCopyRequest* request = requests[index + i];
+            local[i].iov_base = request->dst;
+            local[i].iov_len = (size_t)request->byteCount;
+            remote[i].iov_base = (void*)request->src;
+            remote[i].iov_len = (size_t)request->byteCount;
+        }
+        ssize_t bytesCopied = process_vm_readv(getpid(), local, (unsigned long)batchCount, remote, (unsigned long)batchCount, 0);
+        if(bytesCopied < 0)
+        {
+            bytesCopied = 0;
+        }
+
+        // The kernel stops at the first failure, so everything before it succeeded.
+        int completedCount = 0;
+        while(completedCount < batchCount && bytesCopied >= requests[index + completedCount]->byteCount)
+        {
+            CLKSMemoryCopyRequest* request = requests[index + completedCount];
+            request->succeeded = true;
+            bytesCopied -= request->byteCount;
+            if(isPageCacheActive())
+            {
+                recordRead(request->src, request->byteCount, request->byteCount);
+            }
+            completedCount++;
+        }
+        g_syscallsSaved += (uint64_t)(completedCount > 0 ? completedCount - 1 : 0);
+        if(completedCount < batchCount)
+        {
+            CLKSMemoryCopyRequest* request = requests[index + completedCount];
+            request->succeeded = false;
+            if(isPageCacheActive())
+            {
+                recordRead(request->src, request->byteCount, (int)bytesCopied);
+            }
+            completedCount++;
+        }
+        index += completedCount;
+    }
+}
+#endif
+
+
+// ============================================================================
+#pragma mark - API -
+// ============================================================================
+
+void clksmem_setReader(CLKSMemoryReadFunc reader)
+{
+    g_reader = reader;
+}
+
+bool clksmem_setPageCacheEnabled(bool enabled)
+{
+    bool wasEnabled = isPageCacheActive();
+    g_pageCacheEnabled = false;
+    memset(g_pageCache, 0, sizeof(g_pageCache));
+    g_pageCacheOwner = pthread_self();
+    g_pageCacheEnabled = enabled;
+    return wasEnabled;
+}
+
+bool clksmem_isKnownUnreadable(const void* const memory, const int byteCount)
+{
+    return isPageCacheActive() && getRangeReadability(memory, byteCount) == ReadabilityUnreadable;
+}
+
+uint64_t clksmem_getSyscallsSaved()
+{
+    return g_syscallsSaved;
+}
+
 int clksmem_maxReadableBytes(const void* const memory, const int tryByteCount)
 {
     const int testBufferSize = sizeof(g_memoryTestBuffer);
@@ -128,7 +449,7 @@ int clksmem_maxReadableBytes(const void* const memory, const int tryByteCount)
         currentPosition += testBufferSize;
         bytesRemaining -= testBufferSize;
     }
-    bytesRemaining -= copyMaxPossible(currentPosition, g_memoryTestBuffer, testBufferSize);
+    bytesRemaining -= copyMaxPossible(currentPosition, g_memoryTestBuffer, bytesRemaining);
     return tryByteCount - bytesRemaining;
 }
 
@@ -144,5 +465,65 @@ int clksmem_copyMaxPossible(const void* restrict const src, void* restrict const
 
 bool clksmem_copySafely(const void* restrict const src, void* restrict const dst, const int byteCount)
 {
-    return copySafely(src, dst, byteCount);
+    return copySafely(src, dst, byteCount) == byteCount;
+}
+
+/** Copy requests that the page cache couldn't answer.
+ */
+static void copyPending(CLKSMemoryCopyRequest** requests, int count)
+{
+#if defined(__linux__)
+    if(g_reader == NULL)
+    {
+        kernelCopyMany(requests, count);
+        return;
+    }
+#endif
+    for(int i = 0; i < count; i++)
+    {
+        CLKSMemoryCopyRequest* request = requests[i];
+        request->succeeded = copySafely(request->src, request->dst, request->byteCount) == request->byteCount;
+    }
+}
+
+int clksmem_copySafelyMany(CLKSMemoryCopyRequest* requests, int count)
+{
+    // Fixed size, since this runs in crash handlers and count can be anything.
+    CLKSMemoryCopyRequest* pending[MAX_BATCH_COUNT];
+    int pendingCount = 0;
+    for(int i = 0; i < count; i++)
+    {
+        CLKSMemoryCopyRequest* request = &requests[i];
+        request->succeeded = false;
+        Readability readability = isPageCacheActive() ? getRangeReadability(request->src, request->byteCount) : ReadabilityUnknown;
+        if(readability == ReadabilityReadable)
+        {
+            g_syscallsSaved++;
+            memcpy(request->dst, request->src, (size_t)request->byteCount);
+            request->succeeded = true;
+        }
+        else if(readability == ReadabilityUnreadable)
+        {
+            g_syscallsSaved++;
+        }
+        else
+        {
+            pending[pendingCount++] = request;
+        }
+        if(pendingCount == MAX_BATCH_COUNT || (i == count - 1 && pendingCount > 0))
+        {
+            copyPending(pending, pendingCount);
+            pendingCount = 0;
+        }
+    }
+
+    int succeededCount = 0;
+    for(int i = 0; i < count; i++)
+    {
+        if(requests[i].succeeded)
+        {
+            succeededCount++;
+        }
+    }
+    return succeededCount;
 }
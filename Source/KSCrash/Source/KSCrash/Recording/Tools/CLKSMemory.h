@@ -25,7 +25,7 @@
 //
 
 
-/* Utility functions for querying the mach kernel.
+/* Utility functions for safely reading memory via the kernel.
  */
 
 
@@ -38,6 +38,69 @@ extern "C" {
 
 
 #include <stdbool.h>
+#include <stdint.h>
+
+
+/** Reads memory without faulting if it is inaccessible.
+ *
+ * @param src The source location to copy from.
+ *
+ * @param dst The location to copy to.
+ *
+ * @param byteCount The number of bytes to copy.
+ *
+ * @return The number of bytes actually copied (0 if the memory is not readable).
+ */
+typedef int (*CLKSMemoryReadFunc)(const void* src, void* dst, int byteCount);
+
+/** One copy in a batch passed to clksmem_copySafelyMany(). */
+typedef struct
+{
+    const void* src;
+    void* dst;
+    int byteCount;
+
+    /** Set to true if all bytes were copied. */
+    bool succeeded;
+} CLKSMemoryCopyRequest;
+
+
+/** Replace the function used to read memory (for testing, or for reading
+ * from another process).
+ *
+ * @param reader The reader to use (NULL = the default kernel-based reader).
+ */
+void clksmem_setReader(CLKSMemoryReadFunc reader);
+
+/** Enable or disable the page readability cache, clearing it either way.
+ * While enabled, pages that have been read successfully are copied directly
+ * and pages known to be unreadable fail immediately, without calling the reader.
+ *
+ * Only enable this while the environment is suspended (e.g. while writing a
+ * crash report), since a page's readability can otherwise change at any time.
+ * The cache belongs to the calling thread; reads from other threads (such as
+ * the hang sampler, which keeps running) always go to the reader.
+ *
+ * @param enabled If true, enable the cache.
+ *
+ * @return true if the cache was enabled for the calling thread before this call.
+ */
+bool clksmem_setPageCacheEnabled(bool enabled);
+
+/** Check whether the page cache knows a region to be unreadable.
+ * This never reads memory.
+ *
+ * @param memory A pointer to the memory to check.
+ * @param byteCount The number of bytes to check.
+ *
+ * @return true if at least one page in the region is known to be unreadable.
+ */
+bool clksmem_isKnownUnreadable(const void* const memory, const int byteCount);
+
+/** Get the number of reader calls (normally system calls) that were avoided,
+ * either by answering from the page cache or by batching.
+ */
+uint64_t clksmem_getSyscallsSaved(void);
 
 
 /** Test if the specified memory is safe to read from.
@@ -84,6 +147,16 @@ bool clksmem_copySafely(const void* restrict const src, void* restrict const dst
  */
 int clksmem_copyMaxPossible(const void* restrict const src, void* restrict const dst, int byteCount);
 
+/** Copy several regions of memory safely, using as few reads as possible.
+ *
+ * @param requests The copies to make. Each request's succeeded field is set.
+ *
+ * @param count The number of requests.
+ *
+ * @return The number of requests that succeeded.
+ */
+int clksmem_copySafelyMany(CLKSMemoryCopyRequest* requests, int count);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,399 @@
+//
+//  CLKSMultipartEncoder.c
+//
+//  Copyright (c) 2012 Karl Stenerud. All rights reserved.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall remain in place
+// in this source code.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+
+
+
+#include "CLKSMultipartEncoder.h"
+#include "CLKSID.h"
+
+//#define CLKSLogger_LocalLevel TRACE
+#include "CLKSLogger.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+// ============================================================================
+#pragma mark - Utility -
+// ============================================================================
+
+/** Append a string to a header, escaping any quotes.
+ *
+ * @return false if it doesn't fit.
+ */
+static bool appendEscaped(char* header, int* headerLength, const char* string)
+{
+    for(const char* ch = string; *ch != '\0'; ch++)
+    {
+        if(*ch == '"')
+        {
+            if(*headerLength >= CLKSMP_MAX_HEADER_LENGTH - 1)
+            {
+                return false;
+            }
+            header[(*headerLength)++] = '\\';
+        }
+        if(*headerLength >= CLKSMP_MAX_HEADER_LENGTH - 1)
+        {
+            return false;
+        }
+        header[(*headerLength)++] = *ch;
+    }
+    header[*headerLength] = '\0';
+    return true;
+}
+
+static bool appendString(char* header, int* headerLength, const char* string)
+{
+    int length = (int)strlen(string);
+    if(*headerLength + length >= CLKSMP_MAX_HEADER_LENGTH)
+    {
+        return false;
+    }
+    memcpy(header + *headerLength, string, (size_t)length + 1);
+    *headerLength += length;
+    return true;
+}
+
+/** Start a new field, with its headers filled in.
+ *
+ * @return The field, or NULL if the encoder is full or the headers don't fit.
+ */
+static CLKSMultipartField* addField(CLKSMultipartEncoder* encoder,
+                                    const char* name,
+                                    const char* contentType,
+                                    const char* filename)
+{
+    if(encoder->fieldCount >= CLKSMP_MAX_FIELDS)
+    {
+        CLKSLOG_ERROR("Multipart body already has %d fields. Dropping field %s", CLKSMP_MAX_FIELDS, name);
+        return NULL;
+    }
+    CLKSMultipartField* field = &encoder->fields[encoder->fieldCount];
+    memset(field, 0, sizeof(*field));
+    field->fd = -1;
+
+    char* header = field->header;
+    int length = 0;
+    bool fits = (encoder->fieldCount == 0 || appendString(header, &length, "\r\n")) &&
+                appendString(header, &length, "--") &&
+                appendString(header, &length, encoder->boundary) &&
+                appendString(header, &length, "\r\nContent-Disposition: form-data; name=\"") &&
+                appendEscaped(header, &length, name) &&
+                appendString(header, &length, "\"");
+    if(fits && filename != NULL)
+    {
+        fits = appendString(header, &length, "; filename=\"") &&
+               appendEscaped(header, &length, filename) &&
+               appendString(header, &length, "\"");
+    }
+    fits = fits && appendString(header, &length, "\r\n");
+    if(fits && contentType != NULL)
+    {
+        fits = appendString(header, &length, "Content-Type: ") &&
+               appendString(header, &length, contentType) &&
+               appendString(header, &length, "\r\n");
+    }
+    fits = fits && appendString(header, &length, "\r\n");
+    if(!fits)
+    {
+        CLKSLOG_ERROR("Headers for multipart field %s are longer than %d bytes", name, CLKSMP_MAX_HEADER_LENGTH);
+        return NULL;
+    }
+    field->headerLength = length;
+    encoder->fieldCount++;
+    return field;
+}
+
+static int readFromFD(CLKSMultipartField* field, int64_t offset, char* buffer, int length)
+{
+    for(;;)
+    {
+        ssize_t bytesRead = pread(field->fd, buffer, (size_t)length, (off_t)(field->fdOffset + offset));
+        if(bytesRead >= 0)
+        {
+            return (int)bytesRead;
+        }
+        if(errno != EINTR)
+        {
+            CLKSLOG_ERROR("Could not read multipart field contents: %s", strerror(errno));
+            return -1;
+        }
+    }
+}
+
+/** Read part of a field's contents.
+ *
+ * @return The number of bytes read, or -1 on error. Short reads are an error,
+ *         since the content length has already been promised.
+ */
+static int readContents(CLKSMultipartField* field, int64_t offset, char* buffer, int length)
+{
+    switch(field->source)
+    {
+        case CLKSMultipartSourceBytes:
+            memcpy(buffer, field->bytes + offset, (size_t)length);
+            return length;
+        case CLKSMultipartSourceFD:
+        case CLKSMultipartSourceFunction:
+        {
+            int totalRead = 0;
+            while(totalRead < length)
+            {
+                int bytesRead = field->source == CLKSMultipartSourceFD ?
+                    readFromFD(field, offset + totalRead, buffer + totalRead, length - totalRead) :
+                    field->readFunction(buffer + totalRead, length - totalRead, field->userData);
+                if(bytesRead <= 0)
+                {
+                    CLKSLOG_ERROR("Multipart field contents ended %lld bytes early",
+                                  field->length - offset - totalRead);
+                    return -1;
+                }
+                totalRead += bytesRead;
+            }
+            return totalRead;
+        }
+    }
+    return -1;
+}
+
+
+// ============================================================================
+#pragma mark - API -
+// ============================================================================
+
+bool clksmp_initialize(CLKSMultipartEncoder* encoder, const char* boundary)
+{
+    memset(encoder, 0, sizeof(*encoder));
+    if(boundary == NULL)
+    {
+        char uuid[37];
+        clksid_generate(uuid);
+        int length = 0;
+        for(const char* ch = uuid; *ch != '\0'; ch++)
+        {
+            if(*ch != '-')
+            {
+                encoder->boundary[length++] = (char)tolower(*ch);
+            }
+        }
+        encoder->boundary[length] = '\0';
+    }
+    else
+    {
+        if(strlen(boundary) > CLKSMP_MAX_BOUNDARY_LENGTH)
+        {
+            CLKSLOG_ERROR("Multipart boundary is longer than %d characters", CLKSMP_MAX_BOUNDARY_LENGTH);
+            return false;
+        }
+        strcpy(encoder->boundary, boundary);
+    }
+    snprintf(encoder->contentType, sizeof(encoder->contentType), "multipart/form-data; boundary=%s", encoder->boundary);
+    encoder->trailerLength = snprintf(encoder->trailer, sizeof(encoder->trailer), "\r\n--%s--\r\n", encoder->boundary);
+    return true;
+}
+
+bool clksmp_addBytes(CLKSMultipartEncoder* encoder,
+                     const char* name,
+                     const char* contentType,
+                     const char* filename,
+                     const void* bytes,
+                     int64_t length)
+{
+    CLKSMultipartField* field = addField(encoder, name, contentType, filename);
+    if(field == NULL)
+    {
+        return false;
+    }
+    field->source = CLKSMultipartSourceBytes;
+    field->bytes = bytes;
+    field->length = length;
+    return true;
+}
+
+bool clksmp_addFile(CLKSMultipartEncoder* encoder,
+                    const char* name,
+                    const char* contentType,
+                    const char* filename,
+                    const char* path)
+{
+    int fd = open(path, O_RDONLY);
+    if(fd < 0)
+    {
+        CLKSLOG_ERROR("Could not open %s: %s", path, strerror(errno));
+        return false;
+    }
+    if(!clksmp_addFD(encoder, name, contentType, filename, fd, 0, -1))
+    {
+        close(fd);
+        return false;
+    }
+    encoder->fields[encoder->fieldCount - 1].ownsFD = true;
+    return true;
+}
+
+bool clksmp_addFD(CLKSMultipartEncoder* encoder,
+                  const char* name,
+                  const char* contentType,
+                  const char* filename,
+                  int fd,
+                  int64_t offset,
+                  int64_t length)
+{
+    if(length < 0)
+    {
+        struct stat st;
+        if(fstat(fd, &st) < 0)
+        {
+            CLKSLOG_ERROR("Could not stat fd %d: %s", fd, strerror(errno));
+            return false;
+        }
+        length = (int64_t)st.st_size - offset;
+        if(length < 0)
+        {
+            length = 0;
+        }
+    }
+    CLKSMultipartField* field = addField(encoder, name, contentType, filename);
+    if(field == NULL)
+    {
+        return false;
+    }
+    field->source = CLKSMultipartSourceFD;
+    field->fd = fd;
+    field->fdOffset = offset;
+    field->length = length;
+    return true;
+}
+
+bool clksmp_addReadFunction(CLKSMultipartEncoder* encoder,
+                            const char* name,
+                            const char* contentType,
+                            const char* filename,
+                            int64_t length,
+                            CLKSMultipartReadFunction readFunction,
+                            void* userData)
+{
+    CLKSMultipartField* field = addField(encoder, name, contentType, filename);
+    if(field == NULL)
+    {
+        return false;
+    }
+    field->source = CLKSMultipartSourceFunction;
+    field->length = length;
+    field->readFunction = readFunction;
+    field->userData = userData;
+    return true;
+}
+
+const char* clksmp_getContentType(const CLKSMultipartEncoder* encoder)
+{
+    return encoder->contentType;
+}
+
+int64_t clksmp_getContentLength(const CLKSMultipartEncoder* encoder)
+{
+    int64_t length = encoder->trailerLength;
+    for(int i = 0; i < encoder->fieldCount; i++)
+    {
+        length += encoder->fields[i].headerLength + encoder->fields[i].length;
+    }
+    return length;
+}
+
+int clksmp_read(CLKSMultipartEncoder* encoder, char* buffer, int bufferLength)
+{
+    if(encoder->hasFailed)
+    {
+        return -1;
+    }
+    int totalLength = 0;
+    const int trailerPart = encoder->fieldCount * 2;
+    while(totalLength < bufferLength && encoder->part <= trailerPart)
+    {
+        CLKSMultipartField* field = encoder->part < trailerPart ? &encoder->fields[encoder->part / 2] : NULL;
+        bool isContents = field != NULL && (encoder->part & 1) != 0;
+        int64_t partLength = field == NULL ? encoder->trailerLength :
+                             isContents ? field->length : field->headerLength;
+        int64_t remaining = partLength - encoder->partOffset;
+        int length = remaining < bufferLength - totalLength ? (int)remaining : bufferLength - totalLength;
+        if(length > 0)
+        {
+            if(isContents)
+            {
+                if(readContents(field, encoder->partOffset, buffer + totalLength, length) < 0)
+                {
+                    encoder->hasFailed = true;
+                    return -1;
+                }
+            }
+            else
+            {
+                const char* text = field == NULL ? encoder->trailer : field->header;
+                memcpy(buffer + totalLength, text + encoder->partOffset, (size_t)length);
+            }
+            totalLength += length;
+            encoder->partOffset += length;
+        }
+        if(encoder->partOffset >= partLength)
+        {
+            encoder->part++;
+            encoder->partOffset = 0;
+        }
+    }
+    return totalLength;
+}
+
+bool clksmp_rewind(CLKSMultipartEncoder* encoder)
+{
+    for(int i = 0; i < encoder->fieldCount; i++)
+    {
+        if(encoder->fields[i].source == CLKSMultipartSourceFunction)
+        {
+            return false;
+        }
+    }
+    encoder->part = 0;
+    encoder->partOffset = 0;
+    encoder->hasFailed = false;
+    return true;
+}
+
+void clksmp_close(CLKSMultipartEncoder* encoder)
+{
+    for(int i = 0; i < encoder->fieldCount; i++)
+    {
+        CLKSMultipartField* field = &encoder->fields[i];
+        if(field->ownsFD && field->fd >= 0)
+        {
+            close(field->fd);
+            field->fd = -1;
+        }
+    }
+}
@@ -0,0 +1,208 @@
+//
+//  CLKSMultipartEncoder.h
+//
+//  Copyright (c) 2012 Karl Stenerud. All rights reserved.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall remain in place
+// in this source code.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+
+
+
+/* Encodes a multipart/form-data HTTP body in pieces.
+ *
+ * Field contents are read from memory, file descriptors, or a read function
+ * only as each piece is requested, so encoding a body takes no more memory
+ * than the buffer it's read into. The total length is known up front, for
+ * the Content-Length header.
+ */
+
+
+#ifndef HDR_CLKSMultipartEncoder_h
+#define HDR_CLKSMultipartEncoder_h
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+/** Maximum number of fields in a body. */
+#define CLKSMP_MAX_FIELDS 16
+
+/** Maximum length of a field's headers (name, filename and content type included). */
+#define CLKSMP_MAX_HEADER_LENGTH 512
+
+/** Maximum length of a boundary, excluding the NUL terminator. */
+#define CLKSMP_MAX_BOUNDARY_LENGTH 70
+
+/** Reads the next piece of a field's contents into a buffer.
+ *
+ * @return The number of bytes read, 0 at the end, or -1 on error.
+ */
+typedef int (*CLKSMultipartReadFunction)(char* buffer, int bufferLength, void* userData);
+
+typedef enum
+{
+    CLKSMultipartSourceBytes,
+    CLKSMultipartSourceFD,
+    CLKSMultipartSourceFunction,
+} CLKSMultipartSource;
+
+typedef struct
+{
+    char header[CLKSMP_MAX_HEADER_LENGTH];
+    int headerLength;
+    CLKSMultipartSource source;
+    int64_t length;
+    const char* bytes;
+    int fd;
+    bool ownsFD;
+    int64_t fdOffset;
+    CLKSMultipartReadFunction readFunction;
+    void* userData;
+} CLKSMultipartField;
+
+typedef struct
+{
+    char boundary[CLKSMP_MAX_BOUNDARY_LENGTH + 1];
+    char contentType[CLKSMP_MAX_BOUNDARY_LENGTH + 31];
+    char trailer[CLKSMP_MAX_BOUNDARY_LENGTH + 9];
+    int trailerLength;
+    CLKSMultipartField fields[CLKSMP_MAX_FIELDS];
+    int fieldCount;
+
+    /** Read position: a field's header is part (2 * index), its contents
+     * (2 * index + 1), and the trailer (2 * fieldCount). */
+    int part;
+    int64_t partOffset;
+    bool hasFailed;
+} CLKSMultipartEncoder;
+
+
+/** Initialize an encoder.
+ *
+ * @param encoder The encoder.
+ * @param boundary The boundary between fields (NULL = generate one).
+ *
+ * @return false if the boundary is too long.
+ */
+bool clksmp_initialize(CLKSMultipartEncoder* encoder, const char* boundary);
+
+/** Add a field whose contents are in memory. The bytes aren't copied, and
+ * must stay valid until the encoder is closed.
+ *
+ * @param encoder The encoder.
+ * @param name The field's name.
+ * @param contentType The field's content type (NULL = omit).
+ * @param filename The field's filename (NULL = omit).
+ * @param bytes The field's contents.
+ * @param length The length of the contents.
+ *
+ * @return false if the encoder is full or the headers are too long.
+ */
+bool clksmp_addBytes(CLKSMultipartEncoder* encoder,
+                     const char* name,
+                     const char* contentType,
+                     const char* filename,
+                     const void* bytes,
+                     int64_t length);
+
+/** Add a field whose contents are a file. The file is opened now, and
+ * read as the body is.
+ *
+ * @return false if the file can't be opened, the encoder is full, or the headers are too long.
+ */
+bool clksmp_addFile(CLKSMultipartEncoder* encoder,
+                    const char* name,
+                    const char* contentType,
+                    const char* filename,
+                    const char* path);
+
+/** Add a field whose contents are part of an open file. The caller keeps
+ * ownership of the file descriptor, whose position isn't used or changed.
+ *
+ * @param fd The file descriptor.
+ * @param offset Where the contents start in the file.
+ * @param length The length of the contents (-1 = up to the end of the file).
+ *
+ * @return false if the file can't be read, the encoder is full, or the headers are too long.
+ */
+bool clksmp_addFD(CLKSMultipartEncoder* encoder,
+                  const char* name,
+                  const char* contentType,
+                  const char* filename,
+                  int fd,
+                  int64_t offset,
+                  int64_t length);
+
+/** Add a field whose contents come from a read function, which must supply
+ * exactly the given length. A body with one of these can't be rewound.
+ *
+ * @param length The length of the contents.
+ * @param readFunction Called to get each piece of the contents.
+ * @param userData Passed to readFunction.
+ *
+ * @return false if the encoder is full or the headers are too long.
+ */
+bool clksmp_addReadFunction(CLKSMultipartEncoder* encoder,
+                            const char* name,
+                            const char* contentType,
+                            const char* filename,
+                            int64_t length,
+                            CLKSMultipartReadFunction readFunction,
+                            void* userData);
+
+/** Get the Content-Type header for the body.
+ */
+const char* clksmp_getContentType(const CLKSMultipartEncoder* encoder);
+
+/** Get the length of the whole body.
+ */
+int64_t clksmp_getContentLength(const CLKSMultipartEncoder* encoder);
+
+/** Encode the next piece of the body.
+ *
+ * @param encoder The encoder.
+ * @param buffer Buffer to store the piece in.
+ * @param bufferLength The most bytes to encode.
+ *
+ * @return The number of bytes encoded, 0 at the end of the body, or -1 if
+ *         a field couldn't be read or was shorter than its declared length.
+ */
+int clksmp_read(CLKSMultipartEncoder* encoder, char* buffer, int bufferLength);
+
+/** Go back to the start of the body, so it can be sent again.
+ *
+ * @return false if the body has a field with a read function.
+ */
+bool clksmp_rewind(CLKSMultipartEncoder* encoder);
+
+/** Close any files the encoder opened.
+ */
+void clksmp_close(CLKSMultipartEncoder* encoder);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // HDR_CLKSMultipartEncoder_h
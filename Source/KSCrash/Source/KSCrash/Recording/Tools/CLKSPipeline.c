@@ -0,0 +1,409 @@
+//
+//  CLKSPipeline.c
+//
+//  Copyright (c) 2012 Karl Stenerud. All rights reserved.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall remain in place
+// in this source code.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+
+
+
+#include "CLKSPipeline.h"
+
+//#define CLKSLogger_LocalLevel TRACE
+#include "CLKSLogger.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+
+typedef struct
+{
+    void* item;
+    /** true once the item has been through every stage it's going through. */
+    bool isDone;
+} Slot;
+
+typedef struct
+{
+    CLKSPipelineStage config;
+    CLKSPipeline* pipeline;
+    int index;
+
+    /** Ring buffer of the sequence numbers of items waiting for this stage. */
+    int64_t* queue;
+    int queueHead;
+    int queueCount;
+    pthread_cond_t notEmpty;
+    pthread_cond_t notFull;
+
+    pthread_t threads[CLKSPL_MAX_WORKERS];
+    int threadCount;
+    CLKSPipelineStageStats stats;
+} Stage;
+
+struct CLKSPipeline
+{
+    /** Guards everything here except the items themselves. */
+    pthread_mutex_t mutex;
+    pthread_cond_t outputReady;
+    pthread_cond_t spaceAvailable;
+
+    Stage stages[CLKSPL_MAX_STAGES];
+    int stageCount;
+
+    /** Items in the pipeline, indexed by sequence number modulo maxItems. */
+    Slot* slots;
+    int maxItems;
+    int64_t nextPushSequence;
+    int64_t nextPopSequence;
+    bool isFinished;
+    bool isCancelled;
+
+    CLKSPipelineFreeFunction freeFunction;
+    uint64_t pushBlockedNanoseconds;
+};
+
+
+// ============================================================================
+#pragma mark - Utility -
+// ============================================================================
+
+static uint64_t getNanoseconds()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ull + (uint64_t)now.tv_nsec;
+}
+
+static inline Slot* getSlot(CLKSPipeline* pipeline, int64_t sequence)
+{
+    return &pipeline->slots[sequence % pipeline->maxItems];
+}
+
+static void enqueue(Stage* stage, int64_t sequence)
+{
+    int tail = (stage->queueHead + stage->queueCount) % stage->config.queueCapacity;
+    stage->queue[tail] = sequence;
+    stage->queueCount++;
+    if(stage->queueCount > stage->stats.peakQueueDepth)
+    {
+        stage->stats.peakQueueDepth = stage->queueCount;
+    }
+    pthread_cond_signal(&stage->notEmpty);
+}
+
+static int64_t dequeue(Stage* stage)
+{
+    int64_t sequence = stage->queue[stage->queueHead];
+    stage->queueHead = (stage->queueHead + 1) % stage->config.queueCapacity;
+    stage->queueCount--;
+    pthread_cond_signal(&stage->notFull);
+    return sequence;
+}
+
+static inline bool isQueueFull(const Stage* stage)
+{
+    return stage->queueCount >= stage->config.queueCapacity;
+}
+
+
+// ============================================================================
+#pragma mark - Workers -
+// ============================================================================
+
+static void* runWorker(void* userData)
+{
+    Stage* stage = (Stage*)userData;
+    CLKSPipeline* pipeline = stage->pipeline;
+#ifdef __APPLE__
+    if(stage->config.name != NULL)
+    {
+        pthread_setname_np(stage->config.name);
+    }
+#endif
+
+    pthread_mutex_lock(&pipeline->mutex);
+    for(;;)
+    {
+        while(stage->queueCount == 0 && !pipeline->isCancelled)
+        {
+            pthread_cond_wait(&stage->notEmpty, &pipeline->mutex);
+        }
+        if(pipeline->isCancelled)
+        {
+            break;
+        }
+        int64_t sequence = dequeue(stage);
+        Slot* slot = getSlot(pipeline, sequence);
+        // The slot isn't reused until its item is popped, so it can be read unlocked.
+        pthread_mutex_unlock(&pipeline->mutex);
+
+        uint64_t startTime = getNanoseconds();
+        bool shouldContinue = stage->config.process(slot->item, stage->config.userData);
+        uint64_t endTime = getNanoseconds();
+
+        pthread_mutex_lock(&pipeline->mutex);
+        stage->stats.itemsProcessed++;
+        stage->stats.busyNanoseconds += endTime - startTime;
+        if(!shouldContinue)
+        {
+            stage->stats.itemsStopped++;
+        }
+
+        Stage* nextStage = shouldContinue && stage->index + 1 < pipeline->stageCount ? stage + 1 : NULL;
+        if(nextStage == NULL)
+        {
+            slot->isDone = true;
+            pthread_cond_broadcast(&pipeline->outputReady);
+            continue;
+        }
+        if(isQueueFull(nextStage))
+        {
+            while(isQueueFull(nextStage) && !pipeline->isCancelled)
+            {
+                pthread_cond_wait(&nextStage->notFull, &pipeline->mutex);
+            }
+            stage->stats.blockedNanoseconds += getNanoseconds() - endTime;
+            if(pipeline->isCancelled)
+            {
+                break;
+            }
+        }
+        enqueue(nextStage, sequence);
+    }
+    pthread_mutex_unlock(&pipeline->mutex);
+    return NULL;
+}
+
+
+// ============================================================================
+#pragma mark - API -
+// ============================================================================
+
+CLKSPipeline* clkspl_create(const CLKSPipelineStage* stages, int stageCount, int maxItems, CLKSPipelineFreeFunction freeFunction)
+{
+    if(stageCount < 1 || stageCount > CLKSPL_MAX_STAGES)
+    {
+        CLKSLOG_ERROR("A pipeline must have 1 to %d stages, not %d", CLKSPL_MAX_STAGES, stageCount);
+        return NULL;
+    }
+
+    CLKSPipeline* pipeline = calloc(1, sizeof(*pipeline));
+    if(pipeline == NULL)
+    {
+        return NULL;
+    }
+    pthread_mutex_init(&pipeline->mutex, NULL);
+    pthread_cond_init(&pipeline->outputReady, NULL);
+    pthread_cond_init(&pipeline->spaceAvailable, NULL);
+    pipeline->stageCount = stageCount;
+    pipeline->maxItems = maxItems < 1 ? 1 : maxItems;
+    pipeline->freeFunction = freeFunction;
+    pipeline->slots = calloc((size_t)pipeline->maxItems, sizeof(*pipeline->slots));
+    bool isSuccessful = pipeline->slots != NULL;
+
+    for(int i = 0; i < stageCount; i++)
+    {
+        Stage* stage = &pipeline->stages[i];
+        stage->config = stages[i];
+        stage->pipeline = pipeline;
+        stage->index = i;
+        if(stage->config.workerCount < 1)
+        {
+            stage->config.workerCount = 1;
+        }
+        if(stage->config.workerCount > CLKSPL_MAX_WORKERS)
+        {
+            stage->config.workerCount = CLKSPL_MAX_WORKERS;
+        }
+        if(stage->config.queueCapacity < 1)
+        {
+            stage->config.queueCapacity = 1;
+        }
+        stage->stats.name = stage->config.name;
+        stage->stats.workerCount = stage->config.workerCount;
+        pthread_cond_init(&stage->notEmpty, NULL);
+        pthread_cond_init(&stage->notFull, NULL);
+        stage->queue = malloc(sizeof(*stage->queue) * (size_t)stage->config.queueCapacity);
+        isSuccessful = isSuccessful && stage->queue != NULL;
+    }
+
+    for(int i = 0; i < stageCount && isSuccessful; i++)
+    {
+        Stage* stage = &pipeline->stages[i];
+        while(stage->threadCount < stage->config.workerCount)
+        {
+            int error = pthread_create(&stage->threads[stage->threadCount], NULL, runWorker, stage);
+            if(error != 0)
+            {
+                CLKSLOG_ERROR("Could not start pipeline worker for stage %s: %s", stage->config.name, strerror(error));
+                isSuccessful = false;
+                break;
+            }
+            stage->threadCount++;
+        }
+    }
+
+    if(!isSuccessful)
+    {
+        clkspl_destroy(pipeline);
+        return NULL;
+    }
+    return pipeline;
+}
+
+void clkspl_destroy(CLKSPipeline* pipeline)
+{
+    if(pipeline == NULL)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&pipeline->mutex);
+    pipeline->isCancelled = true;
+    for(int i = 0; i < pipeline->stageCount; i++)
+    {
+        pthread_cond_broadcast(&pipeline->stages[i].notEmpty);
+        pthread_cond_broadcast(&pipeline->stages[i].notFull);
+    }
+    pthread_mutex_unlock(&pipeline->mutex);
+
+    for(int i = 0; i < pipeline->stageCount; i++)
+    {
+        Stage* stage = &pipeline->stages[i];
+        for(int j = 0; j < stage->threadCount; j++)
+        {
+            pthread_join(stage->threads[j], NULL);
+        }
+        pthread_cond_destroy(&stage->notEmpty);
+        pthread_cond_destroy(&stage->notFull);
+        free(stage->queue);
+    }
+
+    if(pipeline->slots != NULL && pipeline->freeFunction != NULL)
+    {
+        for(int64_t sequence = pipeline->nextPopSequence; sequence < pipeline->nextPushSequence; sequence++)
+        {
+            pipeline->freeFunction(getSlot(pipeline, sequence)->item);
+        }
+    }
+    free(pipeline->slots);
+    pthread_cond_destroy(&pipeline->outputReady);
+    pthread_cond_destroy(&pipeline->spaceAvailable);
+    pthread_mutex_destroy(&pipeline->mutex);
+    free(pipeline);
+}
+
+bool clkspl_push(CLKSPipeline* pipeline, void* item)
+{
+    Stage* firstStage = &pipeline->stages[0];
+    pthread_mutex_lock(&pipeline->mutex);
+    uint64_t startTime = 0;
+    while(!pipeline->isFinished &&
+          (pipeline->nextPushSequence - pipeline->nextPopSequence >= pipeline->maxItems || isQueueFull(firstStage)))
+    {
+        if(startTime == 0)
+        {
+            startTime = getNanoseconds();
+        }
+        // Whichever frees up first; both are signalled on the pipeline's mutex.
+        pthread_cond_wait(isQueueFull(firstStage) ? &firstStage->notFull : &pipeline->spaceAvailable, &pipeline->mutex);
+    }
+    if(startTime != 0)
+    {
+        pipeline->pushBlockedNanoseconds += getNanoseconds() - startTime;
+    }
+    if(pipeline->isFinished)
+    {
+        pthread_mutex_unlock(&pipeline->mutex);
+        return false;
+    }
+
+    int64_t sequence = pipeline->nextPushSequence++;
+    Slot* slot = getSlot(pipeline, sequence);
+    slot->item = item;
+    slot->isDone = false;
+    enqueue(firstStage, sequence);
+    pthread_mutex_unlock(&pipeline->mutex);
+    return true;
+}
+
+void clkspl_finish(CLKSPipeline* pipeline)
+{
+    pthread_mutex_lock(&pipeline->mutex);
+    pipeline->isFinished = true;
+    pthread_cond_broadcast(&pipeline->outputReady);
+    pthread_cond_broadcast(&pipeline->spaceAvailable);
+    pthread_cond_broadcast(&pipeline->stages[0].notFull);
+    pthread_mutex_unlock(&pipeline->mutex);
+}
+
+bool clkspl_pop(CLKSPipeline* pipeline, void** item)
+{
+    pthread_mutex_lock(&pipeline->mutex);
+    for(;;)
+    {
+        if(pipeline->nextPopSequence < pipeline->nextPushSequence)
+        {
+            Slot* slot = getSlot(pipeline, pipeline->nextPopSequence);
+            if(slot->isDone)
+            {
+                *item = slot->item;
+                slot->item = NULL;
+                slot->isDone = false;
+                pipeline->nextPopSequence++;
+                pthread_cond_signal(&pipeline->spaceAvailable);
+                pthread_mutex_unlock(&pipeline->mutex);
+                return true;
+            }
+        }
+        else if(pipeline->isFinished)
+        {
+            pthread_mutex_unlock(&pipeline->mutex);
+            return false;
+        }
+        pthread_cond_wait(&pipeline->outputReady, &pipeline->mutex);
+    }
+}
+
+int clkspl_getItemCount(CLKSPipeline* pipeline)
+{
+    pthread_mutex_lock(&pipeline->mutex);
+    int count = (int)(pipeline->nextPushSequence - pipeline->nextPopSequence);
+    pthread_mutex_unlock(&pipeline->mutex);
+    return count;
+}
+
+void clkspl_getStageStats(CLKSPipeline* pipeline, int stageIndex, CLKSPipelineStageStats* stats)
+{
+    pthread_mutex_lock(&pipeline->mutex);
+    *stats = pipeline->stages[stageIndex].stats;
+    pthread_mutex_unlock(&pipeline->mutex);
+}
+
+uint64_t clkspl_getPushBlockedNanoseconds(CLKSPipeline* pipeline)
+{
+    pthread_mutex_lock(&pipeline->mutex);
+    uint64_t nanoseconds = pipeline->pushBlockedNanoseconds;
+    pthread_mutex_unlock(&pipeline->mutex);
+    return nanoseconds;
+}
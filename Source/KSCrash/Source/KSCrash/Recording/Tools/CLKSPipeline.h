@@ -0,0 +1,160 @@
+//
+//  CLKSPipeline.h
+//
+//  Copyright (c) 2012 Karl Stenerud. All rights reserved.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall remain in place
+// in this source code.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+
+
+
+/* A multi-stage processing pipeline with a pool of worker threads per stage.
+ *
+ * Items pushed into the pipeline go through each stage in turn, and come
+ * out in the order they went in, no matter which worker finished first.
+ * Stages are connected by bounded queues: a worker that finishes an item
+ * waits for room in the next stage's queue, and pushing waits while the
+ * pipeline holds its maximum number of items. So a slow stage or a slow
+ * consumer holds back the stages before it instead of letting work pile up.
+ *
+ * Each stage keeps counters for how long its workers spent processing and
+ * how long they were held back.
+ */
+
+
+#ifndef HDR_CLKSPipeline_h
+#define HDR_CLKSPipeline_h
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+/** Maximum number of stages in a pipeline. */
+#define CLKSPL_MAX_STAGES 8
+
+/** Maximum number of workers in one stage. */
+#define CLKSPL_MAX_WORKERS 16
+
+typedef struct CLKSPipeline CLKSPipeline;
+
+/** Processes an item in place. Called on a stage's worker threads, so it
+ * must be safe to call concurrently with other items.
+ *
+ * @param item The item.
+ * @param userData The stage's userData.
+ *
+ * @return false to skip the rest of the stages. The item still comes out of the pipeline.
+ */
+typedef bool (*CLKSPipelineStageFunction)(void* item, void* userData);
+
+/** Frees an item that never came out of the pipeline. */
+typedef void (*CLKSPipelineFreeFunction)(void* item);
+
+typedef struct
+{
+    /** Name for logging and thread names (not copied). */
+    const char* name;
+    CLKSPipelineStageFunction process;
+    void* userData;
+    /** Number of worker threads (minimum 1). */
+    int workerCount;
+    /** Most items waiting for this stage (minimum 1). */
+    int queueCapacity;
+} CLKSPipelineStage;
+
+typedef struct
+{
+    const char* name;
+    int workerCount;
+    /** Items this stage has finished with. */
+    uint64_t itemsProcessed;
+    /** Items for which this stage returned false. */
+    uint64_t itemsStopped;
+    /** Total time spent in the stage function, across all workers. */
+    uint64_t busyNanoseconds;
+    /** Total time workers spent waiting for room in the next queue. */
+    uint64_t blockedNanoseconds;
+    /** Most items that have been waiting in this stage's queue at once. */
+    int peakQueueDepth;
+} CLKSPipelineStageStats;
+
+
+/** Create a pipeline and start its workers.
+ *
+ * @param stages The stages, in order (copied).
+ * @param stageCount The number of stages.
+ * @param maxItems The most items that can be in the pipeline at once, from
+ *                 being pushed until being popped (minimum 1).
+ * @param freeFunction Frees items left in the pipeline when it's destroyed (NULL = leave them).
+ *
+ * @return The pipeline, or NULL if a worker couldn't be started.
+ */
+CLKSPipeline* clkspl_create(const CLKSPipelineStage* stages, int stageCount, int maxItems, CLKSPipelineFreeFunction freeFunction);
+
+/** Stop the workers and free the pipeline, and any items still in it.
+ * Waits for items currently being processed.
+ */
+void clkspl_destroy(CLKSPipeline* pipeline);
+
+/** Push an item into the first stage.
+ * Waits while the pipeline holds maxItems items. A thread that both pushes
+ * and pops must not push more than maxItems ahead of its pops.
+ *
+ * @return false if the pipeline has been finished.
+ */
+bool clkspl_push(CLKSPipeline* pipeline, void* item);
+
+/** Mark that no more items will be pushed. */
+void clkspl_finish(CLKSPipeline* pipeline);
+
+/** Pop the next item out of the last stage, in the order items were pushed.
+ * Waits until it's ready.
+ *
+ * @param pipeline The pipeline.
+ * @param item Set to the item.
+ *
+ * @return false if the pipeline has been finished and every item popped.
+ */
+bool clkspl_pop(CLKSPipeline* pipeline, void** item);
+
+/** Get the number of items pushed but not yet popped. */
+int clkspl_getItemCount(CLKSPipeline* pipeline);
+
+/** Get the counters for a stage.
+ *
+ * @param pipeline The pipeline.
+ * @param stageIndex The stage.
+ * @param stats Where to store the counters.
+ */
+void clkspl_getStageStats(CLKSPipeline* pipeline, int stageIndex, CLKSPipelineStageStats* stats);
+
+/** Get how long pushing has waited for room in the pipeline, in total. */
+uint64_t clkspl_getPushBlockedNanoseconds(CLKSPipeline* pipeline);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // HDR_CLKSPipeline_h
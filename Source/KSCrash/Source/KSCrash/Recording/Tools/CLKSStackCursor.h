@@ -34,6 +34,7 @@ extern "C" {
 #include "CLKSMachineContext.h"
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <sys/types.h>
 
 #define CLKSSC_CONTEXT_SIZE 100
@@ -28,12 +28,22 @@
 #include "CLKSCPU.h"
 #include "CLKSMemory.h"
 
+#include <stdatomic.h>
 #include <stdlib.h>
+#include <string.h>
 
 #define CLKSLogger_LocalLevel TRACE
 #include "CLKSLogger.h"
 
 
+/** How much of a thread's stack to copy in one read when walking its frames.
+ * A frame outside the copied window causes a new window to be read from that frame.
+ */
+#ifndef CLKSSC_STACK_SNAPSHOT_SIZE
+    #define CLKSSC_STACK_SNAPSHOT_SIZE 16384
+#endif
+
+
 /** Represents an entry in a frame list.
  * This is modeled after the various i386/x64 frame walkers in the xnu source,
  * and seems to work fine in ARM as well. I haven't included the args pointer
@@ -57,8 +67,68 @@ typedef struct
     uintptr_t instructionAddress;
     uintptr_t linkRegister;
     bool isPastFramePointer;
+    /** Generation of the stack snapshot this cursor last filled (0 = none). */
+    uint32_t snapshotGeneration;
 } MachineContextCursor;
 
+/** A local copy of part of a stack, shared by all machine context cursors.
+ * Cursors are copied by value, so a cursor only trusts the snapshot if it
+ * was the last one to fill it.
+ */
+static struct
+{
+    uint8_t bytes[CLKSSC_STACK_SNAPSHOT_SIZE];
+    uintptr_t start;
+    int length;
+    uint32_t generation;
+} g_stackSnapshot;
+
+/** Held while a cursor reads or fills the snapshot. Other cursors read frames directly instead. */
+static atomic_flag g_stackSnapshotInUse = ATOMIC_FLAG_INIT;
+
+/** Read a frame entry from the stack snapshot, refilling the snapshot
+ * starting at the frame if it isn't already there.
+ *
+ * @param context The cursor context.
+ *
+ * @param address The address of the frame entry.
+ *
+ * @param frame Where to store the frame entry.
+ *
+ * @return true if the frame entry was readable.
+ */
+static bool readFrame(MachineContextCursor* context, const FrameEntry* address, FrameEntry* frame)
+{
+    if(atomic_flag_test_and_set_explicit(&g_stackSnapshotInUse, memory_order_acquire))
+    {
+        return clksmem_copySafely(address, frame, sizeof(*frame));
+    }
+
+    const uintptr_t frameStart = (uintptr_t)address;
+    bool isInSnapshot = context->snapshotGeneration != 0 &&
+                        context->snapshotGeneration == g_stackSnapshot.generation &&
+                        frameStart >= g_stackSnapshot.start &&
+                        frameStart - g_stackSnapshot.start + sizeof(*frame) <= (uintptr_t)g_stackSnapshot.length;
+    if(!isInSnapshot)
+    {
+        g_stackSnapshot.start = frameStart;
+        g_stackSnapshot.length = clksmem_copyMaxPossible(address, g_stackSnapshot.bytes, sizeof(g_stackSnapshot.bytes));
+        if(++g_stackSnapshot.generation == 0)
+        {
+            g_stackSnapshot.generation = 1;
+        }
+        context->snapshotGeneration = g_stackSnapshot.generation;
+        isInSnapshot = g_stackSnapshot.length >= (int)sizeof(*frame);
+    }
+    if(isInSnapshot)
+    {
+        memcpy(frame, g_stackSnapshot.bytes + (frameStart - g_stackSnapshot.start), sizeof(*frame));
+    }
+
+    atomic_flag_clear_explicit(&g_stackSnapshotInUse, memory_order_release);
+    return isInSnapshot;
+}
+
 static bool advanceCursor(CLKSStackCursor *cursor)
 {
     MachineContextCursor* context = (MachineContextCursor*)cursor->context;
@@ -102,7 +172,7 @@ static bool advanceCursor(CLKSStackCursor *cursor)
         context->isPastFramePointer = true;
     }
 
-    if(!clksmem_copySafely(context->currentFrame.previous, &context->currentFrame, sizeof(context->currentFrame)))
+    if(!readFrame(context, context->currentFrame.previous, &context->currentFrame))
     {
         return false;
     }
@@ -128,6 +198,7 @@ static void resetCursor(CLKSStackCursor* cursor)
     context->instructionAddress = 0;
     context->linkRegister = 0;
     context->isPastFramePointer = 0;
+    context->snapshotGeneration = 0;
 }
 
 void clkssc_initWithMachineContext(CLKSStackCursor *cursor, int maxStackDepth, const struct CLKSMachineContext *machineContext)
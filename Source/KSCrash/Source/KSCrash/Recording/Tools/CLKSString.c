@@ -175,3 +175,24 @@ bool clksstring_extractHexValue(const char* string, int stringLength, uint64_t*
     }
     return false;
 }
+
+int clksstring_writeHexAddress(uintptr_t value, char* dst)
+{
+    static const char hexDigits[] = "0123456789abcdef";
+    int digitCount = 1;
+    for(uintptr_t remaining = value >> 4; remaining != 0; remaining >>= 4)
+    {
+        digitCount++;
+    }
+
+    dst[0] = '0';
+    dst[1] = 'x';
+    char* digit = dst + 2 + digitCount;
+    *digit = '\0';
+    while(digit > dst + 2)
+    {
+        *--digit = hexDigits[value & 15];
+        value >>= 4;
+    }
+    return 2 + digitCount;
+}
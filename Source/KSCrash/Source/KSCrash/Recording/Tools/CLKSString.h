@@ -58,6 +58,21 @@ bool clksstring_isNullTerminatedUTF8String(const void* memory, int minLength, in
  */
 bool clksstring_extractHexValue(const char* string, int stringLength, uint64_t* result);
 
+/** Write a value as "0x" followed by lowercase hex digits without leading
+ * zeroes, the same as printf's "%p". This function is async-safe.
+ *
+ * @param value The value to write.
+ *
+ * @param dst The buffer to write to, which must hold at least
+ *            CLKSSTRING_MAX_HEX_ADDRESS_LENGTH bytes. The result is NUL terminated.
+ *
+ * @return The number of characters written, excluding the NUL terminator.
+ */
+int clksstring_writeHexAddress(uintptr_t value, char* dst);
+
+/** Buffer size needed by clksstring_writeHexAddress(). */
+#define CLKSSTRING_MAX_HEX_ADDRESS_LENGTH (2 + (int)sizeof(uintptr_t) * 2 + 1)
+
 
 #ifdef __cplusplus
 }
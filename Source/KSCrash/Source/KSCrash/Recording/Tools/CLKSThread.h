@@ -34,6 +34,7 @@ extern "C" {
 
 #include <sys/types.h>
 #include <stdbool.h>
+#include <stdint.h>
 
 
 typedef uintptr_t CLKSThread;
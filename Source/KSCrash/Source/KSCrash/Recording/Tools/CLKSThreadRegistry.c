@@ -0,0 +1,324 @@
+//
+//  CLKSThreadRegistry.c
+//
+//  Copyright (c) 2012 Karl Stenerud. All rights reserved.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall remain in place
+// in this source code.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+
+
+#include "CLKSThreadRegistry.h"
+
+//#define CLKSLogger_LocalLevel TRACE
+#include "CLKSLogger.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <string.h>
+
+
+/** Number of slots in a snapshot's hash index. Must be a power of 2 larger than CLKSTREG_MAX_THREADS. */
+#define INDEX_SIZE (CLKSTREG_MAX_THREADS * 2)
+
+/** Number of published snapshots. A writer fills whichever one isn't current. */
+#define SNAPSHOT_COUNT 2
+
+typedef struct
+{
+    char name[CLKSTREG_MAX_NAME_LENGTH];
+    char queueName[CLKSTREG_MAX_NAME_LENGTH];
+} ThreadNames;
+
+struct CLKSThreadRegistrySnapshot
+{
+    uint64_t epoch;
+    int threadCount;
+    CLKSThread threads[CLKSTREG_MAX_THREADS];
+    ThreadNames names[CLKSTREG_MAX_THREADS];
+
+    /** Open-addressed hash from thread to (index into threads + 1). 0 = empty. */
+    uint16_t index[INDEX_SIZE];
+};
+
+/** The writers' working copy. Its index is not maintained. Guarded by g_mutex. */
+static CLKSThreadRegistrySnapshot g_master;
+
+static CLKSThreadRegistrySnapshot g_snapshots[SNAPSHOT_COUNT];
+static _Atomic(CLKSThreadRegistrySnapshot*) g_currentSnapshot = &g_snapshots[0];
+static _Atomic(int) g_readerCounts[SNAPSHOT_COUNT];
+/** Set while the master copy has changes that couldn't be published yet. */
+static _Atomic(bool) g_publishPending;
+static uint64_t g_epoch;
+static pthread_mutex_t g_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+
+// ============================================================================
+#pragma mark - Utility -
+// ============================================================================
+
+static inline int indexSlot(CLKSThread thread)
+{
+    // Thread IDs are often small sequential numbers or aligned pointers.
+    return (int)(((uint64_t)thread * 0x9E3779B97F4A7C15ull) >> 40) & (INDEX_SIZE - 1);
+}
+
+static int findInSnapshot(const CLKSThreadRegistrySnapshot* snapshot, CLKSThread thread)
+{
+    int slot = indexSlot(thread);
+    for(int i = 0; i < INDEX_SIZE; i++)
+    {
+        int entry = snapshot->index[slot];
+        if(entry == 0)
+        {
+            return -1;
+        }
+        if(snapshot->threads[entry - 1] == thread)
+        {
+            return entry - 1;
+        }
+        slot = (slot + 1) & (INDEX_SIZE - 1);
+    }
+    return -1;
+}
+
+static int findInMaster(CLKSThread thread)
+{
+    for(int i = 0; i < g_master.threadCount; i++)
+    {
+        if(g_master.threads[i] == thread)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static void copyName(char* dst, const char* src)
+{
+    if(src == NULL)
+    {
+        dst[0] = '\0';
+        return;
+    }
+    strncpy(dst, src, CLKSTREG_MAX_NAME_LENGTH - 1);
+    dst[CLKSTREG_MAX_NAME_LENGTH - 1] = '\0';
+}
+
+static void setMasterEntry(int entryIndex, CLKSThread thread, const char* name, const char* queueName)
+{
+    g_master.threads[entryIndex] = thread;
+    copyName(g_master.names[entryIndex].name, name);
+    copyName(g_master.names[entryIndex].queueName, queueName);
+}
+
+/** Publish the master copy as a new snapshot.
+ * Must be called with g_mutex held.
+ */
+static void publish(void)
+{
+    CLKSThreadRegistrySnapshot* current = atomic_load(&g_currentSnapshot);
+    int nextIndex = (int)(current - g_snapshots + 1) % SNAPSHOT_COUNT;
+    CLKSThreadRegistrySnapshot* next = &g_snapshots[nextIndex];
+    // Flag it before checking, so that a reader releasing the snapshot
+    // concurrently is guaranteed to see the flag and retry.
+    atomic_store(&g_publishPending, true);
+    if(atomic_load(&g_readerCounts[nextIndex]) != 0)
+    {
+        // Still held from before the last publish. The master copy keeps the
+        // change, and it gets published once the reader lets go.
+        CLKSLOG_DEBUG("Snapshot %d still held. Deferring publish.", nextIndex);
+        return;
+    }
+    atomic_store(&g_publishPending, false);
+
+    const int count = g_master.threadCount;
+    next->threadCount = count;
+    memcpy(next->threads, g_master.threads, sizeof(*next->threads) * (size_t)count);
+    memcpy(next->names, g_master.names, sizeof(*next->names) * (size_t)count);
+    memset(next->index, 0, sizeof(next->index));
+    for(int i = 0; i < count; i++)
+    {
+        int slot = indexSlot(next->threads[i]);
+        while(next->index[slot] != 0)
+        {
+            slot = (slot + 1) & (INDEX_SIZE - 1);
+        }
+        next->index[slot] = (uint16_t)(i + 1);
+    }
+    next->epoch = ++g_epoch;
+
+    atomic_store(&g_currentSnapshot, next);
+}
+
+/** Publish changes that were deferred because a reader held the snapshot.
+ * Never blocks: if a writer holds the lock, it will publish on its own, and
+ * otherwise the next read retries.
+ */
+static void publishIfPending(void)
+{
+    if(atomic_load(&g_publishPending) && pthread_mutex_trylock(&g_mutex) == 0)
+    {
+        if(atomic_load(&g_publishPending))
+        {
+            publish();
+        }
+        pthread_mutex_unlock(&g_mutex);
+    }
+}
+
+
+// ============================================================================
+#pragma mark - Writer API -
+// ============================================================================
+
+void clkstreg_reset()
+{
+    pthread_mutex_lock(&g_mutex);
+    g_master.threadCount = 0;
+    publish();
+    pthread_mutex_unlock(&g_mutex);
+}
+
+bool clkstreg_setThread(CLKSThread thread, const char* name, const char* queueName)
+{
+    bool isSuccessful = true;
+    pthread_mutex_lock(&g_mutex);
+    int entryIndex = findInMaster(thread);
+    if(entryIndex < 0)
+    {
+        if(g_master.threadCount >= CLKSTREG_MAX_THREADS)
+        {
+            CLKSLOG_ERROR("Thread registry is full. Dropping thread %p", (void*)thread);
+            isSuccessful = false;
+            goto done;
+        }
+        entryIndex = g_master.threadCount++;
+    }
+    setMasterEntry(entryIndex, thread, name, queueName);
+    publish();
+
+done:
+    pthread_mutex_unlock(&g_mutex);
+    return isSuccessful;
+}
+
+void clkstreg_removeThread(CLKSThread thread)
+{
+    pthread_mutex_lock(&g_mutex);
+    int entryIndex = findInMaster(thread);
+    if(entryIndex >= 0)
+    {
+        int lastIndex = --g_master.threadCount;
+        if(entryIndex != lastIndex)
+        {
+            g_master.threads[entryIndex] = g_master.threads[lastIndex];
+            g_master.names[entryIndex] = g_master.names[lastIndex];
+        }
+        publish();
+    }
+    pthread_mutex_unlock(&g_mutex);
+}
+
+void clkstreg_replaceAllThreads(const CLKSThread* threads,
+                                const char* const* names,
+                                const char* const* queueNames,
+                                int count)
+{
+    if(count > CLKSTREG_MAX_THREADS)
+    {
+        CLKSLOG_ERROR("Thread registry is full. Dropping %d threads", count - CLKSTREG_MAX_THREADS);
+        count = CLKSTREG_MAX_THREADS;
+    }
+    pthread_mutex_lock(&g_mutex);
+    g_master.threadCount = count;
+    for(int i = 0; i < count; i++)
+    {
+        setMasterEntry(i,
+                       threads[i],
+                       names == NULL ? NULL : names[i],
+                       queueNames == NULL ? NULL : queueNames[i]);
+    }
+    publish();
+    pthread_mutex_unlock(&g_mutex);
+}
+
+
+// ============================================================================
+#pragma mark - Reader API -
+// ============================================================================
+
+const CLKSThreadRegistrySnapshot* clkstreg_acquireSnapshot()
+{
+    publishIfPending();
+    for(;;)
+    {
+        CLKSThreadRegistrySnapshot* snapshot = atomic_load(&g_currentSnapshot);
+        int snapshotIndex = (int)(snapshot - g_snapshots);
+        atomic_fetch_add(&g_readerCounts[snapshotIndex], 1);
+        // If it's still current, no writer can have started filling it.
+        if(atomic_load(&g_currentSnapshot) == snapshot)
+        {
+            return snapshot;
+        }
+        atomic_fetch_sub(&g_readerCounts[snapshotIndex], 1);
+    }
+}
+
+void clkstreg_releaseSnapshot(const CLKSThreadRegistrySnapshot* snapshot)
+{
+    if(snapshot != NULL)
+    {
+        atomic_fetch_sub(&g_readerCounts[snapshot - g_snapshots], 1);
+        publishIfPending();
+    }
+}
+
+const CLKSThread* clkstreg_getThreads(const CLKSThreadRegistrySnapshot* snapshot, int* threadCount)
+{
+    if(threadCount != NULL)
+    {
+        *threadCount = snapshot->threadCount;
+    }
+    return snapshot->threads;
+}
+
+const char* clkstreg_getThreadName(const CLKSThreadRegistrySnapshot* snapshot, CLKSThread thread)
+{
+    int entryIndex = findInSnapshot(snapshot, thread);
+    if(entryIndex < 0 || snapshot->names[entryIndex].name[0] == '\0')
+    {
+        return NULL;
+    }
+    return snapshot->names[entryIndex].name;
+}
+
+const char* clkstreg_getQueueName(const CLKSThreadRegistrySnapshot* snapshot, CLKSThread thread)
+{
+    int entryIndex = findInSnapshot(snapshot, thread);
+    if(entryIndex < 0 || snapshot->names[entryIndex].queueName[0] == '\0')
+    {
+        return NULL;
+    }
+    return snapshot->names[entryIndex].queueName;
+}
+
+uint64_t clkstreg_getEpoch(const CLKSThreadRegistrySnapshot* snapshot)
+{
+    return snapshot->epoch;
+}
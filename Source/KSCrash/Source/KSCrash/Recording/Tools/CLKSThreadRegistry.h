@@ -0,0 +1,139 @@
+//
+//  CLKSThreadRegistry.h
+//
+//  Copyright (c) 2012 Karl Stenerud. All rights reserved.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall remain in place
+// in this source code.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+
+
+/* Registry of live threads and their names.
+ *
+ * Writers (thread start/exit/rename events) serialize on a mutex and publish
+ * immutable snapshots. Readers (including crash handlers) acquire the current
+ * snapshot without locking or allocating, and a snapshot is never modified
+ * while a reader holds it. A change made while the other snapshot is still
+ * held is published when that reader releases it, or on the next acquire.
+ *
+ * This file is platform independent. The thread events come from CLKSCrashCachedData.
+ */
+
+
+#ifndef HDR_CLKSThreadRegistry_h
+#define HDR_CLKSThreadRegistry_h
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+#include "CLKSThread.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+/** Maximum number of threads that can be registered. Further threads are dropped. */
+#define CLKSTREG_MAX_THREADS 512
+
+/** Maximum length of a thread or queue name, including the NUL terminator. */
+#define CLKSTREG_MAX_NAME_LENGTH 64
+
+typedef struct CLKSThreadRegistrySnapshot CLKSThreadRegistrySnapshot;
+
+
+#pragma mark - Writer API -
+
+/** Remove all threads. */
+void clkstreg_reset(void);
+
+/** Add a thread, or update it if already registered.
+ *
+ * @param thread The thread.
+ * @param name The thread's name (NULL or empty = no name).
+ * @param queueName The thread's dispatch queue name (NULL or empty = no name).
+ *
+ * @return false if the registry is full.
+ */
+bool clkstreg_setThread(CLKSThread thread, const char* name, const char* queueName);
+
+/** Remove a thread.
+ *
+ * @param thread The thread.
+ */
+void clkstreg_removeThread(CLKSThread thread);
+
+/** Add, update and remove many threads with a single published snapshot.
+ *
+ * @param threads The threads that exist.
+ * @param names Each thread's name (NULL = no names).
+ * @param queueNames Each thread's queue name (NULL = no queue names).
+ * @param count The number of threads.
+ */
+void clkstreg_replaceAllThreads(const CLKSThread* threads,
+                                const char* const* names,
+                                const char* const* queueNames,
+                                int count);
+
+
+#pragma mark - Reader API -
+
+/** Acquire the current snapshot. It won't change until released.
+ * This function is async-safe and lock-free.
+ *
+ * @return The snapshot. Never NULL.
+ */
+const CLKSThreadRegistrySnapshot* clkstreg_acquireSnapshot(void);
+
+/** Release a snapshot acquired with clkstreg_acquireSnapshot().
+ * This function is async-safe and never blocks.
+ */
+void clkstreg_releaseSnapshot(const CLKSThreadRegistrySnapshot* snapshot);
+
+/** Get the threads in a snapshot.
+ *
+ * @param snapshot The snapshot.
+ * @param threadCount Set to the number of threads (ignored if NULL).
+ *
+ * @return The threads.
+ */
+const CLKSThread* clkstreg_getThreads(const CLKSThreadRegistrySnapshot* snapshot, int* threadCount);
+
+/** Get a thread's name from a snapshot, in constant time.
+ *
+ * @return The name, or NULL if the thread has no name or isn't registered.
+ */
+const char* clkstreg_getThreadName(const CLKSThreadRegistrySnapshot* snapshot, CLKSThread thread);
+
+/** Get a thread's queue name from a snapshot, in constant time.
+ *
+ * @return The queue name, or NULL if the thread has none or isn't registered.
+ */
+const char* clkstreg_getQueueName(const CLKSThreadRegistrySnapshot* snapshot, CLKSThread thread);
+
+/** Get the epoch of a snapshot. Every published snapshot has a higher epoch than the last.
+ */
+uint64_t clkstreg_getEpoch(const CLKSThreadRegistrySnapshot* snapshot);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // HDR_CLKSThreadRegistry_h
@@ -0,0 +1,265 @@
+
+
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE // pthread_getattr_np()
+#endif
+
+#include "CLKSThrowTrace.h"
+
+//#define CLKSLogger_LocalLevel TRACE
+#include "CLKSLogger.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <time.h>
+
+
+// Compiler hints for "if" statements
+#define likely_if(x) if(__builtin_expect(x,1))
+#define unlikely_if(x) if(__builtin_expect(x,0))
+
+
+typedef struct
+{
+    /** Which throw on this thread the trace is for. 0 = being written. */
+    uint64_t throwNumber;
+    int addressCount;
+    uintptr_t addresses[CLKSTT_MAX_DEPTH];
+} ThrowTrace;
+
+typedef struct
+{
+    _Atomic(bool) isInUse;
+    uintptr_t stackLow;
+    uintptr_t stackHigh;
+    uint64_t throwCount;
+    int nextTrace;
+    ThrowTrace traces[CLKSTT_TRACES_PER_THREAD];
+} ThreadTraces;
+
+static ThreadTraces g_threadTraces[CLKSTT_MAX_THREADS];
+
+/** Given to threads that throw once all of g_threadTraces are taken. Never written. */
+static ThreadTraces g_untracedThread;
+
+static pthread_key_t g_threadTracesKey;
+static pthread_once_t g_threadTracesKeyOnce = PTHREAD_ONCE_INIT;
+static _Atomic(bool) g_threadTracesKeyCreated;
+
+static int g_sampleInterval = 1;
+static int g_maxTracesPerSecond = 0;
+
+/** The current second in the high 32 bits, and the number of traces taken during it in the low 32. */
+static _Atomic(int64_t) g_rateWindow;
+
+
+// ============================================================================
+#pragma mark - Utility -
+// ============================================================================
+
+static void getStackBounds(uintptr_t* low, uintptr_t* high)
+{
+    *low = *high = 0;
+#ifdef __APPLE__
+    pthread_t self = pthread_self();
+    *high = (uintptr_t)pthread_get_stackaddr_np(self);
+    *low = *high - pthread_get_stacksize_np(self);
+#else
+    pthread_attr_t attr;
+    if(pthread_getattr_np(pthread_self(), &attr) == 0)
+    {
+        void* address;
+        size_t size;
+        if(pthread_attr_getstack(&attr, &address, &size) == 0)
+        {
+            *low = (uintptr_t)address;
+            *high = *low + size;
+        }
+        pthread_attr_destroy(&attr);
+    }
+#endif
+}
+
+static void releaseThreadTraces(void* value)
+{
+    ThreadTraces* threadTraces = value;
+    atomic_store_explicit(&threadTraces->isInUse, false, memory_order_release);
+}
+
+static void createThreadTracesKey(void)
+{
+    int error = pthread_key_create(&g_threadTracesKey, releaseThreadTraces);
+    if(error != 0)
+    {
+        CLKSLOG_ERROR("Could not create thread key: %d", error);
+        return;
+    }
+    atomic_store(&g_threadTracesKeyCreated, true);
+}
+
+/** Get the current thread's traces, claiming a free entry on its first throw. */
+static ThreadTraces* claimThreadTraces(void)
+{
+    pthread_once(&g_threadTracesKeyOnce, createThreadTracesKey);
+    unlikely_if(!atomic_load_explicit(&g_threadTracesKeyCreated, memory_order_relaxed))
+    {
+        return &g_untracedThread;
+    }
+    ThreadTraces* threadTraces = pthread_getspecific(g_threadTracesKey);
+    likely_if(threadTraces != NULL)
+    {
+        return threadTraces;
+    }
+
+    threadTraces = &g_untracedThread;
+    for(int i = 0; i < CLKSTT_MAX_THREADS; i++)
+    {
+        bool expected = false;
+        if(atomic_compare_exchange_strong(&g_threadTraces[i].isInUse, &expected, true))
+        {
+            threadTraces = &g_threadTraces[i];
+            threadTraces->throwCount = 0;
+            threadTraces->nextTrace = 0;
+            for(int j = 0; j < CLKSTT_TRACES_PER_THREAD; j++)
+            {
+                threadTraces->traces[j].throwNumber = 0;
+            }
+            getStackBounds(&threadTraces->stackLow, &threadTraces->stackHigh);
+            break;
+        }
+    }
+    if(threadTraces == &g_untracedThread)
+    {
+        CLKSLOG_DEBUG("All %d thread trace entries are in use. Not tracing throws on this thread.", CLKSTT_MAX_THREADS);
+    }
+    pthread_setspecific(g_threadTracesKey, threadTraces);
+    return threadTraces;
+}
+
+static bool takeRateToken(int maxTracesPerSecond)
+{
+    const int64_t second = (int64_t)time(NULL);
+    int64_t window = atomic_load_explicit(&g_rateWindow, memory_order_relaxed);
+    for(;;)
+    {
+        int64_t nextWindow = (window >> 32) == second ? window + 1 : (second << 32) | 1;
+        if((nextWindow & 0xffffffff) > maxTracesPerSecond)
+        {
+            return false;
+        }
+        if(atomic_compare_exchange_weak_explicit(&g_rateWindow, &window, nextWindow,
+                                                 memory_order_relaxed, memory_order_relaxed))
+        {
+            return true;
+        }
+    }
+}
+
+/** Walk the frame pointer chain, reading only from within the thread's own stack.
+ * Each frame is laid out as {previous frame, return address}.
+ */
+static int walkStack(const ThreadTraces* const threadTraces,
+                     const uintptr_t* frame,
+                     int skipFrames,
+                     uintptr_t* const addresses)
+{
+    int count = 0;
+    while(count < CLKSTT_MAX_DEPTH)
+    {
+        const uintptr_t framePointer = (uintptr_t)frame;
+        if(framePointer < threadTraces->stackLow ||
+           framePointer + sizeof(*frame) * 2 > threadTraces->stackHigh ||
+           framePointer % sizeof(*frame) != 0)
+        {
+            break;
+        }
+        const uintptr_t returnAddress = frame[1];
+        if(returnAddress == 0)
+        {
+            break;
+        }
+        if(skipFrames > 0)
+        {
+            skipFrames--;
+        }
+        else
+        {
+            addresses[count++] = returnAddress;
+        }
+        const uintptr_t* nextFrame = (const uintptr_t*)frame[0];
+        if((uintptr_t)nextFrame <= framePointer)
+        {
+            break;
+        }
+        frame = nextFrame;
+    }
+    return count;
+}
+
+
+// ============================================================================
+#pragma mark - API -
+// ============================================================================
+
+void clkstt_setSampling(int sampleInterval, int maxTracesPerSecond)
+{
+    g_sampleInterval = sampleInterval < 1 ? 1 : sampleInterval;
+    g_maxTracesPerSecond = maxTracesPerSecond < 0 ? 0 : maxTracesPerSecond;
+}
+
+void clkstt_recordThrow(int skipFrames)
+{
+    ThreadTraces* const threadTraces = claimThreadTraces();
+    unlikely_if(threadTraces == &g_untracedThread)
+    {
+        return;
+    }
+
+    const uint64_t throwNumber = ++threadTraces->throwCount;
+    const int sampleInterval = g_sampleInterval;
+    if(sampleInterval > 1 && (throwNumber - 1) % (uint64_t)sampleInterval != 0)
+    {
+        return;
+    }
+    const int maxTracesPerSecond = g_maxTracesPerSecond;
+    if(maxTracesPerSecond > 0 && !takeRateToken(maxTracesPerSecond))
+    {
+        return;
+    }
+
+    ThrowTrace* const trace = &threadTraces->traces[threadTraces->nextTrace];
+    threadTraces->nextTrace = (threadTraces->nextTrace + 1) % CLKSTT_TRACES_PER_THREAD;
+    trace->throwNumber = 0;
+    atomic_signal_fence(memory_order_release);
+    // Start from our own frame, whose return address is in the caller.
+    trace->addressCount = walkStack(threadTraces, __builtin_frame_address(0), skipFrames, trace->addresses);
+    atomic_signal_fence(memory_order_release);
+    trace->throwNumber = throwNumber;
+}
+
+int clkstt_copyLastThrowTrace(uintptr_t* addresses, int maxCount)
+{
+    if(!atomic_load(&g_threadTracesKeyCreated))
+    {
+        return 0;
+    }
+    const ThreadTraces* const threadTraces = pthread_getspecific(g_threadTracesKey);
+    if(threadTraces == NULL || threadTraces == &g_untracedThread)
+    {
+        return 0;
+    }
+
+    const int lastTrace = (threadTraces->nextTrace + CLKSTT_TRACES_PER_THREAD - 1) % CLKSTT_TRACES_PER_THREAD;
+    const ThrowTrace* const trace = &threadTraces->traces[lastTrace];
+    if(trace->throwNumber == 0 || trace->throwNumber != threadTraces->throwCount)
+    {
+        return 0;
+    }
+    int count = trace->addressCount < maxCount ? trace->addressCount : maxCount;
+    for(int i = 0; i < count; i++)
+    {
+        addresses[i] = trace->addresses[i];
+    }
+    return count;
+}
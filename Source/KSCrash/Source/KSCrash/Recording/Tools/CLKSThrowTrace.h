@@ -0,0 +1,94 @@
+//
+//  CLKSThrowTrace.h
+//
+//  Copyright (c) 2012 Karl Stenerud. All rights reserved.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall remain in place
+// in this source code.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+
+
+
+/* Records where C++ exceptions are thrown.
+ *
+ * Each thread that throws gets its own small ring of recent traces, so
+ * concurrent throws never overwrite each other. A trace is only the raw
+ * return addresses found by walking the frame pointers on the throwing
+ * thread's stack; nothing is symbolicated until a report is written.
+ *
+ * This file is platform independent.
+ */
+
+
+#ifndef HDR_CLKSThrowTrace_h
+#define HDR_CLKSThrowTrace_h
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+#include <stdint.h>
+
+
+/** Maximum number of addresses recorded per throw. */
+#define CLKSTT_MAX_DEPTH 32
+
+/** Number of recent throws kept per thread. */
+#define CLKSTT_TRACES_PER_THREAD 4
+
+/** Maximum number of threads that can hold traces at the same time.
+ * Throws on further threads are not traced.
+ */
+#define CLKSTT_MAX_THREADS 64
+
+
+/** Set how often throws are traced.
+ *
+ * @param sampleInterval Trace one in every this many throws on each thread
+ *                       (1 or less = trace every throw).
+ *
+ * @param maxTracesPerSecond Maximum number of throws traced per second
+ *                           across all threads (0 = unlimited).
+ */
+void clkstt_setSampling(int sampleInterval, int maxTracesPerSecond);
+
+/** Record a throw on the current thread.
+ *
+ * @param skipFrames The number of calling frames to leave out of the trace.
+ */
+void clkstt_recordThrow(int skipFrames) __attribute__((noinline));
+
+/** Copy the trace of the most recent throw on the current thread.
+ * This function is async-safe.
+ *
+ * @param addresses The buffer to copy the return addresses into.
+ *
+ * @param maxCount The size of the buffer.
+ *
+ * @return The number of addresses copied, or 0 if the most recent throw
+ *         on this thread was not traced.
+ */
+int clkstt_copyLastThrowTrace(uintptr_t* addresses, int maxCount);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // HDR_CLKSThrowTrace_h
@@ -406,15 +406,14 @@ crashDescriptionKeys:(NSArray*) crashDescriptionKeys
     request.cachePolicy = NSURLRequestReloadIgnoringLocalCacheData;
     request.timeoutInterval = 15;
     request.HTTPMethod = @"POST";
-    request.HTTPBody = [body data];
     [request setValue:@"Quincy/iOS" forHTTPHeaderField:@"User-Agent"];
     [request setValue:@"gzip" forHTTPHeaderField:@"Accept-Encoding"];
-    [request setValue:body.contentType forHTTPHeaderField:@"Content-type"];
     
     dispatch_block_t sendOperation = ^
     {
         CLKSLOG_TRACE(@"Sending request to %@", request.URL);
         [[CLKSHTTPRequestSender sender] sendRequest:request
+                                             body:body
                                         onSuccess:^(__unused NSHTTPURLResponse* response,
                                                     __unused NSData* data)
          {
@@ -101,8 +101,6 @@
 //                  filename:nil];
 
     request.HTTPMethod = @"POST";
-    request.HTTPBody = [body data];
-    [request setValue:body.contentType forHTTPHeaderField:@"Content-Type"];
     [request setValue:@"CLKSCrashReporter" forHTTPHeaderField:@"User-Agent"];
 
 //    [request setHTTPBody:[[body data] gzippedWithError:nil]];
@@ -113,6 +111,7 @@
                                                                        block:^
     {
         [[CLKSHTTPRequestSender sender] sendRequest:request
+                                             body:body
                                         onSuccess:^(__unused NSHTTPURLResponse* response, __unused NSData* data)
          {
              clkscrash_callCompletion(onCompletion, reports, YES, nil);
@@ -42,9 +42,27 @@
  */
 + (CLKSHTTPMultipartPostBody*) body;
 
-/** This body's data, encoded for sending in an HTTP request. */
+/** This body's data, encoded for sending in an HTTP request.
+ * File fields are read into memory, so prefer writeToFile:error: for large bodies.
+ *
+ * @return The data, or nil if a field couldn't be read.
+ */
 - (NSData*) data;
 
+/** The length of this body once encoded. */
+- (unsigned long long) contentLength;
+
+/** Encode this body to a file, a piece at a time. Field contents are never
+ * held in memory all at once.
+ *
+ * @param path The file to write (replaced if it exists).
+ *
+ * @param error Filled with an error if the body couldn't be written (ignored if nil).
+ *
+ * @return YES if the body was written.
+ */
+- (BOOL) writeToFile:(NSString*) path error:(NSError**) error;
+
 /** Append a new data field to the body.
  *
  * @param data The data to append.
@@ -75,4 +93,20 @@
               contentType:(NSString*) contentType
                  filename:(NSString*) filename;
 
+/** Append a new field whose contents are a file. The file isn't read until
+ * the body is encoded.
+ *
+ * @param path The file containing the field's contents.
+ *
+ * @param name The field name.
+ *
+ * @param contentType The field's content-type (nil = omit).
+ *
+ * @param filename The field's filename (nil = omit).
+ */
+- (void) appendFileAtPath:(NSString*) path
+                     name:(NSString*) name
+              contentType:(NSString*) contentType
+                 filename:(NSString*) filename;
+
 @end
@@ -27,8 +27,16 @@
 
 #import "CLKSHTTPMultipartPostBody.h"
 
-#import "NSMutableData+AppendUTF8.h"
-#import "NSString+URLEncode.h"
+#import "CLKSMultipartEncoder.h"
+#import "NSError+CRLFSimpleConstructor.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+
+/** Size of the buffer the body is encoded through when writing it to a file. */
+#define kWriteChunkSize (64 * 1024)
 
 
 /**
@@ -36,9 +44,12 @@
  */
 @interface CLKSHTTPPostField: NSObject
 
-/** This field's binary encoded contents. */
+/** This field's binary encoded contents (nil if the contents are in a file). */
 @property(nonatomic,readonly,retain) NSData* data;
 
+/** Path to the file holding this field's contents (nil if the contents are in data). */
+@property(nonatomic,readonly,retain) NSString* path;
+
 /** This field's name. */
 @property(nonatomic,readonly,retain) NSString* name;
 
@@ -49,11 +60,13 @@
 @property(nonatomic,readonly,retain) NSString* filename;
 
 + (CLKSHTTPPostField*) data:(NSData*) data
-                     name:(NSString*) name
-              contentType:(NSString*) contentType
-                 filename:(NSString*) filename;
+                       path:(NSString*) path
+                       name:(NSString*) name
+                contentType:(NSString*) contentType
+                   filename:(NSString*) filename;
 
 - (id) initWithData:(NSData*) data
+               path:(NSString*) path
                name:(NSString*) name
         contentType:(NSString*) contentType
            filename:(NSString*) filename;
@@ -64,32 +77,37 @@
 @implementation CLKSHTTPPostField
 
 @synthesize data = _data;
+@synthesize path = _path;
 @synthesize name = _name;
 @synthesize contentType = _contentType;
 @synthesize filename = _filename;
 
 + (CLKSHTTPPostField*) data:(NSData*) data
-                     name:(NSString*) name
-              contentType:(NSString*) contentType
-                 filename:(NSString*) filename
+                       path:(NSString*) path
+                       name:(NSString*) name
+                contentType:(NSString*) contentType
+                   filename:(NSString*) filename
 {
     return [[self alloc] initWithData:data
+                                 path:path
                                  name:name
                           contentType:contentType
                              filename:filename];
 }
 
 - (id) initWithData:(NSData*) data
+               path:(NSString*) path
                name:(NSString*) name
         contentType:(NSString*) contentType
            filename:(NSString*) filename
 {
-    NSParameterAssert(data);
+    NSParameterAssert(data != nil || path != nil);
     NSParameterAssert(name);
     
     if((self = [super init]))
     {
         _data = data;
+        _path = path;
         _name = name;
         _contentType = contentType;
         _filename = filename;
@@ -137,9 +155,10 @@
            filename:(NSString*) filename
 {
     [_fields addObject:[CLKSHTTPPostField data:data
-                                        name:name
-                                 contentType:contentType
-                                    filename:filename]];
+                                          path:nil
+                                          name:name
+                                   contentType:contentType
+                                      filename:filename]];
 }
 
 - (void) appendUTF8String:(NSString*) string
@@ -154,51 +173,136 @@
             filename:filename];
 }
 
-- (NSString*) toStringWithQuotesEscaped:(NSString*) value
+- (void) appendFileAtPath:(NSString*) path
+                     name:(NSString*) name
+              contentType:(NSString*) contentType
+                 filename:(NSString*) filename
 {
-    return [value stringByReplacingOccurrencesOfString:@"\"" withString:@"\\\""];
+    [_fields addObject:[CLKSHTTPPostField data:nil
+                                          path:path
+                                          name:name
+                                   contentType:contentType
+                                      filename:filename]];
 }
 
-- (NSData*) data
+/** Set up an encoder for this body. The encoder must be closed afterwards,
+ * even if this fails.
+ */
+- (BOOL) prepareEncoder:(CLKSMultipartEncoder*) encoder error:(NSError**) error
 {
-    NSUInteger baseSize = 0;
-    for(CLKSHTTPPostField* desc in _fields)
-    {
-        baseSize += [desc.data length] + 200;
-    }
-    
-    NSMutableData* data = [NSMutableData dataWithCapacity:baseSize];
-    BOOL firstFieldSent = NO;
+    clksmp_initialize(encoder, [_boundary UTF8String]);
     for(CLKSHTTPPostField* field in _fields)
     {
-        if (firstFieldSent) {
-            [data appendUTF8String:@"\r\n"];
-        } else {
-            firstFieldSent = YES;
-        }
-        [data appendUTF8Format:@"--%@\r\n", _boundary];
-        if(field.filename != nil)
+        const char* name = [field.name UTF8String];
+        const char* contentType = [field.contentType UTF8String];
+        const char* filename = [field.filename UTF8String];
+        BOOL added = field.path != nil ?
+            clksmp_addFile(encoder, name, contentType, filename, [field.path fileSystemRepresentation]) :
+            clksmp_addBytes(encoder, name, contentType, filename, field.data.bytes, (int64_t)field.data.length);
+        if(!added)
         {
-            [data appendUTF8Format:@"Content-Disposition: form-data; name=\"%@\"; filename=\"%@\"\r\n",
-             [self toStringWithQuotesEscaped:field.name],
-             [self toStringWithQuotesEscaped:field.filename]];
+            return [NSError crlf_fillError:error
+                                withDomain:[[self class] description]
+                                      code:0
+                               description:@"Could not add field %@ to multipart body", field.name];
         }
-        else
+    }
+    return YES;
+}
+
+- (unsigned long long) contentLength
+{
+    CLKSMultipartEncoder encoder;
+    unsigned long long length = 0;
+    if([self prepareEncoder:&encoder error:nil])
+    {
+        length = (unsigned long long)clksmp_getContentLength(&encoder);
+    }
+    clksmp_close(&encoder);
+    return length;
+}
+
+- (NSData*) data
+{
+    CLKSMultipartEncoder encoder;
+    NSMutableData* data = nil;
+    if([self prepareEncoder:&encoder error:nil])
+    {
+        NSUInteger length = (NSUInteger)clksmp_getContentLength(&encoder);
+        data = [NSMutableData dataWithLength:length];
+        if(clksmp_read(&encoder, data.mutableBytes, (int)length) != (int)length)
         {
-            [data appendUTF8Format:@"Content-Disposition: form-data; name=\"%@\"\r\n",
-             [self toStringWithQuotesEscaped:field.name]];
+            data = nil;
         }
-        if(field.contentType != nil)
+    }
+    clksmp_close(&encoder);
+    return data;
+}
+
+- (BOOL) writeToFile:(NSString*) path error:(NSError**) error
+{
+    CLKSMultipartEncoder encoder;
+    if(![self prepareEncoder:&encoder error:error])
+    {
+        clksmp_close(&encoder);
+        return NO;
+    }
+
+    BOOL isSuccessful = NO;
+    char* buffer = malloc(kWriteChunkSize);
+    int fd = open([path fileSystemRepresentation], O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(fd < 0)
+    {
+        [NSError crlf_fillError:error
+                     withDomain:[[self class] description]
+                           code:errno
+                    description:@"Could not open %@: %s", path, strerror(errno)];
+        goto done;
+    }
+
+    int bytesEncoded;
+    while((bytesEncoded = clksmp_read(&encoder, buffer, kWriteChunkSize)) > 0)
+    {
+        for(int offset = 0; offset < bytesEncoded;)
         {
-            [data appendUTF8Format:@"Content-Type: %@\r\n", field.contentType];
+            ssize_t bytesWritten = write(fd, buffer + offset, (size_t)(bytesEncoded - offset));
+            if(bytesWritten < 0)
+            {
+                if(errno == EINTR)
+                {
+                    continue;
+                }
+                [NSError crlf_fillError:error
+                             withDomain:[[self class] description]
+                                   code:errno
+                            description:@"Could not write to %@: %s", path, strerror(errno)];
+                goto done;
+            }
+            offset += (int)bytesWritten;
         }
-        [data appendUTF8Format:@"\r\n", _boundary];
-        [data appendData:field.data];
     }
-    [data appendUTF8Format:@"\r\n--%@--\r\n", _boundary];
-    
-    return data;
+    if(bytesEncoded < 0)
+    {
+        [NSError crlf_fillError:error
+                     withDomain:[[self class] description]
+                           code:0
+                    description:@"Could not read the contents of a multipart field"];
+        goto done;
+    }
+    isSuccessful = YES;
+
+done:
+    if(fd >= 0)
+    {
+        close(fd);
+    }
+    if(!isSuccessful)
+    {
+        unlink([path fileSystemRepresentation]);
+    }
+    free(buffer);
+    clksmp_close(&encoder);
+    return isSuccessful;
 }
 
 @end
-
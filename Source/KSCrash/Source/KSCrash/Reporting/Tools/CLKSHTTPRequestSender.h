@@ -27,6 +27,8 @@
 
 #import <Foundation/Foundation.h>
 
+@class CLKSHTTPMultipartPostBody;
+
 
 /**
  * Sends HTTP requests via the global dispatch queue, informing the caller of
@@ -57,4 +59,28 @@
            onFailure:(void(^)(NSHTTPURLResponse* response, NSData* data)) failureBlock
              onError:(void(^)(NSError* error)) errorBlock;
 
+/** Send an HTTP request with a multipart body.
+ * The body is encoded to a temporary file and uploaded from there, so large
+ * file fields are never loaded into memory. The Content-Type and
+ * Content-Length headers are set from the body.
+ *
+ * @param request The request to send. Its own body is ignored.
+ *
+ * @param body The body to send.
+ *
+ * @param successBlock Gets executed when the request completes successfully.
+ *
+ * @param failureBlock Gets executed if the request fails or receives an HTTP
+ *                     response indicating failure.
+ *
+ * @param errorBlock Gets executed if the body can't be encoded, an error
+ *                   prevents the request from being sent, or an invalid
+ *                   (non-HTTP) response is received.
+ */
+- (void) sendRequest:(NSURLRequest*) request
+                body:(CLKSHTTPMultipartPostBody*) body
+           onSuccess:(void(^)(NSHTTPURLResponse* response, NSData* data)) successBlock
+           onFailure:(void(^)(NSHTTPURLResponse* response, NSData* data)) failureBlock
+             onError:(void(^)(NSError* error)) errorBlock;
+
 @end
@@ -26,6 +26,7 @@
 
 
 #import "CLKSHTTPRequestSender.h"
+#import "CLKSHTTPMultipartPostBody.h"
 #import "NSError+CRLFSimpleConstructor.h"
 
 
@@ -120,4 +121,51 @@
 #endif
 }
 
+- (void) sendRequest:(NSURLRequest*) request
+                body:(CLKSHTTPMultipartPostBody*) body
+           onSuccess:(void(^)(NSHTTPURLResponse* response, NSData* data)) successBlock
+           onFailure:(void(^)(NSHTTPURLResponse* response, NSData* data)) failureBlock
+             onError:(void(^)(NSError* error)) errorBlock
+{
+    dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^
+    {
+        @autoreleasepool {
+            NSString* bodyPath = [NSTemporaryDirectory() stringByAppendingPathComponent:
+                                  [NSString stringWithFormat:@"CLKSHTTPBody-%@", [[NSUUID UUID] UUIDString]]];
+            NSError* error = nil;
+            if(![body writeToFile:bodyPath error:&error])
+            {
+                [self handleResponse:nil data:nil error:error onSuccess:successBlock onFailure:failureBlock onError:errorBlock];
+                return;
+            }
+
+            NSMutableURLRequest* bodyRequest = [request mutableCopy];
+            bodyRequest.HTTPBody = nil;
+            [bodyRequest setValue:body.contentType forHTTPHeaderField:@"Content-Type"];
+            unsigned long long bodyLength = [[[NSFileManager defaultManager] attributesOfItemAtPath:bodyPath error:nil] fileSize];
+            [bodyRequest setValue:[NSString stringWithFormat:@"%llu", bodyLength]
+               forHTTPHeaderField:@"Content-Length"];
+
+#if __IPHONE_OS_VERSION_MAX_ALLOWED < 70000
+            bodyRequest.HTTPBodyStream = [NSInputStream inputStreamWithFileAtPath:bodyPath];
+            NSURLResponse* response = nil;
+            NSData* data = [NSURLConnection sendSynchronousRequest:bodyRequest
+                                                 returningResponse:&response
+                                                             error:&error];
+            [[NSFileManager defaultManager] removeItemAtPath:bodyPath error:nil];
+            [self handleResponse:response data:data error:error onSuccess:successBlock onFailure:failureBlock onError:errorBlock];
+#else
+            NSURLSession* session = [NSURLSession sharedSession];
+            NSURLSessionTask* task = [session uploadTaskWithRequest:bodyRequest
+                                                           fromFile:[NSURL fileURLWithPath:bodyPath]
+                                                  completionHandler:^(NSData * _Nullable data, NSURLResponse * _Nullable response, NSError * _Nullable taskError) {
+                [[NSFileManager defaultManager] removeItemAtPath:bodyPath error:nil];
+                [self handleResponse:response data:data error:taskError onSuccess:successBlock onFailure:failureBlock onError:errorBlock];
+            }];
+            [task resume];
+#endif
+        }
+    });
+}
+
 @end
@@ -25,6 +25,10 @@ NS_ASSUME_NONNULL_BEGIN
 - (instancetype)initWithKSCrashReport:(NSDictionary *)ksCrashReport;
 @property (nonatomic, copy, readonly) NSString *uuidString;
 @property (nonatomic, copy, readonly) NSString *occurredAtString;
+@property (nonatomic, copy, readonly, nullable) NSString *fingerprint;
+/// Number of later crashes with the same fingerprint that were folded into this report
+@property (nonatomic, readonly) NSUInteger duplicateCount;
+@property (nonatomic, copy, readonly, nullable) NSString *lastOccurredAtString;
 - (NSArray *)denormalizedThreads;
 - (NSArray *)denormalizedException;
 @end
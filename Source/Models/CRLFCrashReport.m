@@ -35,6 +35,9 @@
 @property (nonatomic) CRLFCrashError *crashError;
 @property (nonatomic, copy) NSString *uuidString;
 @property (nonatomic, copy) NSString *occurredAtString;
+@property (nonatomic, copy, nullable) NSString *fingerprint;
+@property (nonatomic) NSUInteger duplicateCount;
+@property (nonatomic, copy, nullable) NSString *lastOccurredAtString;
 - (CRLFBinaryImage *)binaryImageAtAddress:(NSInteger)address;
 @end
 
@@ -66,6 +69,10 @@
         NSDictionary *reportDict = ksCrashReport[@CLKSCrashField_Report];
         _uuidString = reportDict[@"id"];
         _occurredAtString = reportDict[@"timestamp"]; //TODO: make sure this timestamp is readable on the backend
+        _fingerprint = reportDict[@CLKSCrashField_Fingerprint];
+        NSDictionary *duplicates = reportDict[@CLKSCrashField_Duplicates];
+        _duplicateCount = [duplicates[@CLKSCrashField_Count] unsignedIntegerValue];
+        _lastOccurredAtString = duplicates[@CLKSCrashField_LastTimestamp];
         
     }
     return self;
@@ -80,6 +87,9 @@
         
         // find the first start address that's larger than the target address, and then take the previous one
         if (result == NSOrderedDescending) {
+            if (i == 0) {
+                return nil; // below every image
+            }
             return self.binariesByStartAddress[self.orderedStartAddresses[i-1]];
         }
     }
@@ -161,6 +171,9 @@
         [exception crlf_safeSetObject:self.crashDict[@CLKSCrashField_Reason] forKey:@"message"];
         //TODO should this be a separate field?
     }
+    if (exception.count == 0) {
+        return @[]; // e.g. a logged error, which has a backtrace but no exception
+    }
     return @[[NSDictionary dictionaryWithDictionary:exception]];
 }
 @end
@@ -21,6 +21,17 @@
     });
     return dateFormatter;
 }
++ (NSDateFormatter *)utcDateFormatter { // Footprints written at crash time use UTC ("Z")
+    static NSDateFormatter *dateFormatter = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        NSDateFormatter *iso8601DateFormatter = [[NSDateFormatter alloc] init];
+        [iso8601DateFormatter setDateFormat:@"yyyy-MM-dd'T'HH:mm:ssZZZZZ"];
+        [iso8601DateFormatter setLocale:[NSLocale localeWithLocaleIdentifier:@"en_US_POSIX"]];
+        dateFormatter = iso8601DateFormatter;
+    });
+    return dateFormatter;
+}
 - (instancetype)initWithName:(NSString *)name attributes:(NSDictionary *)attributes {
     self = [super init];
     if (self != nil) {
@@ -47,6 +58,9 @@
     footprint.name = jsonDict[@"name"];
     NSString *dateString = jsonDict[@"left_at"];
     footprint.date = [[CRLFFootprint dateFormatter] dateFromString:dateString];
+    if (footprint.date == nil && dateString != nil) {
+        footprint.date = [[CRLFFootprint utcDateFormatter] dateFromString:dateString];
+    }
     footprint.attributes = [CRLFAttribute mutableAttributesFromJSONArray:jsonDict[@"metadata"]];
     return footprint;
 }
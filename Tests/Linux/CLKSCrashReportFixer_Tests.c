@@ -0,0 +1,140 @@
+//
+//  CLKSCrashReportFixer_Tests.c
+//
+//  Copyright (c) 2012 Karl Stenerud. All rights reserved.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall remain in place
+// in this source code.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+
+
+
+/* Fixes up reports whose stack dumps are stored as base64, which come out
+ * as hex and so grow, and checks that the parts that aren't fixed up are
+ * copied through unchanged.
+ */
+
+
+#include "CLKSCrashReportFixer.h"
+#include "CLKSJSONCodec.h"
+#include "CLKSTestCheck.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct
+{
+    char* text;
+    int length;
+    int capacity;
+} Output;
+
+static int addToOutput(const char* data, int length, void* userData)
+{
+    Output* output = userData;
+    if(output->length + length >= output->capacity)
+    {
+        output->capacity = (output->length + length) * 2;
+        output->text = realloc(output->text, (size_t)output->capacity);
+    }
+    memcpy(output->text + output->length, data, (size_t)length);
+    output->length += length;
+    output->text[output->length] = '\0';
+    return CLKSJSON_OK;
+}
+
+/** Build a report with the given number of threads, each with a base64 stack dump. */
+static char* buildReport(int threadCount, int stackLength, const uint8_t* stack)
+{
+    Output output = {0};
+    CLKSJSONEncodeContext context;
+    clksjson_beginEncode(&context, false, addToOutput, &output);
+    clksjson_setDataEncoding(&context, CLKSJSONDataEncodingBase64);
+    clksjson_beginObject(&context, NULL);
+    clksjson_beginObject(&context, "report");
+    clksjson_addIntegerElement(&context, "timestamp", 1700000000);
+    clksjson_endContainer(&context);
+    clksjson_beginObject(&context, "crash");
+    clksjson_beginArray(&context, "threads");
+    for(int i = 0; i < threadCount; i++)
+    {
+        clksjson_beginObject(&context, NULL);
+        clksjson_addIntegerElement(&context, "index", i);
+        clksjson_beginObject(&context, "stack");
+        clksjson_addDataElement(&context, "contents", (const char*)stack, stackLength);
+        clksjson_endContainer(&context);
+        clksjson_endContainer(&context);
+    }
+    clksjson_endContainer(&context);
+    clksjson_endContainer(&context);
+    clksjson_addJSONElement(&context, "user", "{\"a\":[1,2,3],\"b\":\"base64:AAAA\"}", 31, true);
+    clksjson_endEncode(&context);
+    return output.text;
+}
+
+
+static void testStackDumpsBecomeHex(void)
+{
+    const int stackLength = 64 * 1024;
+    uint8_t* stack = malloc((size_t)stackLength);
+    for(int i = 0; i < stackLength; i++)
+    {
+        stack[i] = (uint8_t)(i * 13 + 7);
+    }
+    char* hex = malloc((size_t)stackLength * 2 + 1);
+    for(int i = 0; i < stackLength; i++)
+    {
+        snprintf(hex + i * 2, 3, "%02X", stack[i]);
+    }
+
+    // Almost all stack dump, so the hex comes out about twice the size of the report.
+    char* report = buildReport(8, stackLength, stack);
+    char* fixedReport = clkscrf_fixupCrashReport(report);
+    CLKSTEST_CHECK(fixedReport != NULL);
+    if(fixedReport != NULL)
+    {
+        CLKSTEST_CHECK(strlen(fixedReport) > strlen(report) * 3 / 2);
+        // Only stack dumps are converted.
+        CLKSTEST_CHECK(strstr(fixedReport, "base64:") == strstr(fixedReport, "\"base64:AAAA\"") + 1);
+        int hexCount = 0;
+        for(const char* found = strstr(fixedReport, hex); found != NULL; found = strstr(found + 1, hex))
+        {
+            hexCount++;
+        }
+        CLKSTEST_CHECK(hexCount == 8);
+        CLKSTEST_CHECK(strstr(fixedReport, "\"timestamp\": \"2023-11-14T22:13:20Z\"") != NULL);
+    }
+    free(fixedReport);
+    free(report);
+    free(hex);
+    free(stack);
+}
+
+static void testInvalidReport(void)
+{
+    CLKSTEST_CHECK(clkscrf_fixupCrashReport(NULL) == NULL);
+    CLKSTEST_CHECK(clkscrf_fixupCrashReport("{\"crash\": {\"threads\": [") == NULL);
+}
+
+
+int main(void)
+{
+    testStackDumpsBecomeHex();
+    testInvalidReport();
+    return CLKSTEST_RESULT();
+}
@@ -0,0 +1,474 @@
+//
+//  CLKSCrashReportStore_Tests.c
+//
+//  Copyright (c) 2012 Karl Stenerud. All rights reserved.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall remain in place
+// in this source code.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+
+
+/* Checks the user report write queue: reading reports straight from synced
+ * segments, deletes that stick when segments are read again at launch, and
+ * that moving the upload cursor never marks a report sent that an uploader
+ * couldn't have seen yet. Also checks compression at rest, including reports
+ * whose gzip trailer lies about their length, and that crash reports reach
+ * the index without the reports directory being walked again, and that
+ * eviction gives up repeats of a crash before crashes seen only once, and
+ * that the upload cursor waits for crash reports that are still being written.
+ */
+
+
+#include "CLKSCrashReportStore.h"
+#include "CLKSTestCheck.h"
+
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define ADDER_THREAD_COUNT 4
+#define REPORTS_PER_ADDER 200
+/** Big enough that copying a report takes a while, giving the committer a chance to slip in. */
+#define REPORT_SIZE (64 * 1024)
+#define MAX_REPORTS (ADDER_THREAD_COUNT * REPORTS_PER_ADDER)
+
+static char g_reportsPath[] = "/tmp/CLKSCrashReportStore_Tests.XXXXXX";
+
+static int64_t g_addedIDs[ADDER_THREAD_COUNT][REPORTS_PER_ADDER];
+static _Atomic(int) g_runningAdderCount;
+
+/** IDs that the "uploader" listed as unsent before moving the cursor past them. */
+static int64_t g_uploadedIDs[MAX_REPORTS];
+static int g_uploadedCount;
+
+static int countFilesWithSuffix(const char* suffix)
+{
+    int count = 0;
+    DIR* dir = opendir(g_reportsPath);
+    struct dirent* ent;
+    while(dir != NULL && (ent = readdir(dir)) != NULL)
+    {
+        size_t length = strlen(ent->d_name);
+        if(length >= strlen(suffix) && strcmp(ent->d_name + length - strlen(suffix), suffix) == 0)
+        {
+            count++;
+        }
+    }
+    if(dir != NULL)
+    {
+        closedir(dir);
+    }
+    return count;
+}
+
+static bool isReport(int64_t reportID, int index)
+{
+    char expected[64];
+    snprintf(expected, sizeof(expected), "{\"index\":%d}", index);
+    char* report = clkscrs_readReport(reportID);
+    bool isMatch = report != NULL && strcmp(report, expected) == 0;
+    free(report);
+    return isMatch;
+}
+
+static void testSyncedSegments(void)
+{
+    clkscrs_setWriteQueue(4096, 0.01, CLKSCrashReportDurabilitySyncPerBatch);
+    for(int i = 0; i < 50; i++)
+    {
+        char report[64];
+        int length = snprintf(report, sizeof(report), "{\"index\":%d}", i);
+        CLKSTEST_CHECK(clkscrs_addUserReport(report, length) != 0);
+    }
+    CLKSTEST_CHECK(clkscrs_getReportCount() == 50);
+    // Nothing is split out of the segments.
+    CLKSTEST_CHECK(countFilesWithSuffix(".json") == 0);
+    CLKSTEST_CHECK(countFilesWithSuffix(".meta") == 0);
+    CLKSTEST_CHECK(countFilesWithSuffix(".seg") > 0);
+
+    int64_t reportIDs[50];
+    CLKSTEST_CHECK(clkscrs_getReportIDs(reportIDs, 50) == 50);
+    CLKSTEST_CHECK(isReport(reportIDs[0], 0));
+    CLKSTEST_CHECK(isReport(reportIDs[49], 49));
+    CLKSCrashReportMetadata metadata;
+    CLKSTEST_CHECK(clkscrs_getReportMetadata(reportIDs[7], &metadata));
+    CLKSTEST_CHECK(metadata.kind == CLKSCrashReportKindUser);
+    CLKSTEST_CHECK(metadata.reportSize == (int64_t)strlen("{\"index\":7}"));
+
+    clkscrs_deleteAllReports();
+    clkscrs_setWriteQueue(64 * 1024, 0.01, CLKSCrashReportDurabilityNone);
+}
+
+static void testSegmentDeletesSurviveRelaunch(void)
+{
+    enum { REPORT_COUNT = 10 };
+    clkscrs_setWriteQueue(1024 * 1024, 10, CLKSCrashReportDurabilityNone);
+    for(int i = 0; i < REPORT_COUNT; i++)
+    {
+        char report[64];
+        int length = snprintf(report, sizeof(report), "{\"index\":%d}", i);
+        clkscrs_addUserReport(report, length);
+    }
+    clkscrs_flushUserReports();
+    CLKSTEST_CHECK(countFilesWithSuffix(".seg") == 1);
+
+    int64_t reportIDs[REPORT_COUNT];
+    CLKSTEST_CHECK(clkscrs_getReportIDs(reportIDs, REPORT_COUNT) == REPORT_COUNT);
+    clkscrs_deleteReportWithID(reportIDs[2]);
+    clkscrs_deleteReportsWithIDs(&reportIDs[5], 2);
+    clkscrs_markReportSendAttempt(reportIDs[0], true);
+    clkscrs_markReportSendAttempt(reportIDs[1], false);
+
+    // A report file left over from when segments were split into them wins over the segment's copy.
+    char path[600];
+    snprintf(path, sizeof(path), "%s/Tests-report-%016llx.json", g_reportsPath, (long long)reportIDs[9]);
+    FILE* file = fopen(path, "w");
+    fputs("{\"index\":99}", file);
+    fclose(file);
+
+    // Relaunch, reading the segment again.
+    clkscrs_initialize("Tests", g_reportsPath);
+    CLKSTEST_CHECK(clkscrs_getReportCount() == REPORT_COUNT - 3);
+    CLKSCrashReportMetadata metadata;
+    CLKSTEST_CHECK(!clkscrs_getReportMetadata(reportIDs[2], &metadata));
+    CLKSTEST_CHECK(!clkscrs_getReportMetadata(reportIDs[6], &metadata));
+    CLKSTEST_CHECK(clkscrs_getReportMetadata(reportIDs[0], &metadata) && metadata.sent);
+    CLKSTEST_CHECK(clkscrs_getReportMetadata(reportIDs[1], &metadata) && !metadata.sent && metadata.sendAttempts == 1);
+    CLKSTEST_CHECK(isReport(reportIDs[8], 8));
+    CLKSTEST_CHECK(isReport(reportIDs[9], 99));
+
+    // The segment goes with its last report.
+    int64_t remainingIDs[REPORT_COUNT];
+    int remainingCount = clkscrs_getReportIDs(remainingIDs, REPORT_COUNT);
+    CLKSTEST_CHECK(countFilesWithSuffix(".del") == 1);
+    clkscrs_deleteReportsWithIDs(remainingIDs, remainingCount);
+    CLKSTEST_CHECK(clkscrs_getReportCount() == 0);
+    CLKSTEST_CHECK(countFilesWithSuffix(".seg") == 0);
+    CLKSTEST_CHECK(countFilesWithSuffix(".del") == 0);
+    CLKSTEST_CHECK(countFilesWithSuffix(".meta") == 0);
+
+    clkscrs_deleteAllReports();
+    clkscrs_setWriteQueue(64 * 1024, 0.01, CLKSCrashReportDurabilityNone);
+}
+
+/** Write a crash report the way the crash handler does. */
+static int64_t writeCrashReportWithFingerprint(const char* contents, char* path, uint64_t fingerprint)
+{
+    int64_t reportID = clkscrs_getNextCrashReport(path);
+    FILE* file = fopen(path, "w");
+    fputs(contents, file);
+    fclose(file);
+    clkscrs_writeReportMetadata(reportID, CLKSCrashReportKindStandard, "Signal", fingerprint);
+    return reportID;
+}
+
+static int64_t writeCrashReport(const char* contents, char* path)
+{
+    return writeCrashReportWithFingerprint(contents, path, 0);
+}
+
+static void setGzipTrailerLength(const char* path, uint32_t length)
+{
+    FILE* file = fopen(path, "r+b");
+    fseek(file, -4, SEEK_END);
+    uint8_t trailer[4] = {(uint8_t)length, (uint8_t)(length >> 8), (uint8_t)(length >> 16), (uint8_t)(length >> 24)};
+    fwrite(trailer, 1, sizeof(trailer), file);
+    fclose(file);
+}
+
+static void testCompressionAtRest(void)
+{
+    enum { ENTRY_COUNT = 2000 };
+    static char contents[ENTRY_COUNT * 16 + 16];
+    int length = sprintf(contents, "[");
+    for(int i = 0; i < ENTRY_COUNT; i++)
+    {
+        length += sprintf(contents + length, "%s{\"index\":%d}", i == 0 ? "" : ",", i);
+    }
+    sprintf(contents + length, "]");
+
+    char path[CLKSCRS_MAX_PATH_LENGTH];
+    char tinyPath[CLKSCRS_MAX_PATH_LENGTH];
+    int64_t reportID = writeCrashReport(contents, path);
+    int64_t tinyReportID = writeCrashReport("{}", tinyPath);
+    clkscrs_setCompressionLevel(6);
+    // Gzipping the tiny one would only make it bigger.
+    CLKSTEST_CHECK(clkscrs_compressReports() == 1);
+    clkscrs_setCompressionLevel(0);
+
+    CLKSCrashReportMetadata metadata;
+    CLKSTEST_CHECK(clkscrs_getReportMetadata(reportID, &metadata));
+    CLKSTEST_CHECK(metadata.reportSize < (int64_t)strlen(contents) / 4);
+    char* report = clkscrs_readReport(reportID);
+    CLKSTEST_CHECK(report != NULL && strcmp(report, contents) == 0);
+    free(report);
+    report = clkscrs_readReport(tinyReportID);
+    CLKSTEST_CHECK(report != NULL && strcmp(report, "{}") == 0);
+    free(report);
+
+    // Read in small pieces, and stop cleanly at the end.
+    CLKSCrashReportReader* reader = clkscrs_openReport(reportID);
+    CLKSTEST_CHECK(reader != NULL && clkscrs_getReportLength(reader) == (int64_t)strlen(contents));
+    int offset = 0;
+    int bytesRead = 0;
+    static char readBack[sizeof(contents)];
+    while(reader != NULL && (bytesRead = clkscrs_readReportChunk(reader, readBack + offset, 100)) > 0)
+    {
+        offset += bytesRead;
+    }
+    CLKSTEST_CHECK(offset == (int)strlen(contents) && memcmp(readBack, contents, (size_t)offset) == 0);
+    clkscrs_closeReport(reader);
+
+    // A trailer that claims too much is refused before anything is allocated.
+    setGzipTrailerLength(path, 0xfffffff0u);
+    CLKSTEST_CHECK(clkscrs_openReport(reportID) == NULL);
+    CLKSTEST_CHECK(clkscrs_readReport(reportID) == NULL);
+    // One that's wrong either way fails the read instead of cutting it short or overrunning.
+    setGzipTrailerLength(path, (uint32_t)strlen(contents) - 10);
+    CLKSTEST_CHECK(clkscrs_readReport(reportID) == NULL);
+    reader = clkscrs_openReport(reportID);
+    offset = 0;
+    while(reader != NULL && (bytesRead = clkscrs_readReportChunk(reader, readBack + offset, 100)) > 0)
+    {
+        offset += bytesRead;
+    }
+    CLKSTEST_CHECK(bytesRead < 0 && offset == (int)strlen(contents) - 10);
+    clkscrs_closeReport(reader);
+    setGzipTrailerLength(path, (uint32_t)strlen(contents) + 10);
+    CLKSTEST_CHECK(clkscrs_readReport(reportID) == NULL);
+
+    clkscrs_deleteAllReports();
+}
+
+static void testCrashReportsIndexedWithoutRebuild(void)
+{
+    char path[CLKSCRS_MAX_PATH_LENGTH];
+    CLKSTEST_CHECK(clkscrs_getReportCount() == 0);
+    int64_t reportID = writeCrashReport("{}", path);
+    // Left behind by something other than the store, so only a rebuild would find it.
+    int64_t strayID = reportID - 1;
+    snprintf(path, sizeof(path), "%s/Tests-report-%016llx.json", g_reportsPath, (unsigned long long)strayID);
+    FILE* file = fopen(path, "w");
+    fputs("{}", file);
+    fclose(file);
+
+    CLKSTEST_CHECK(clkscrs_getReportCount() == 1);
+    CLKSCrashReportMetadata metadata;
+    CLKSTEST_CHECK(clkscrs_getReportMetadata(reportID, &metadata) && metadata.kind == CLKSCrashReportKindStandard);
+    CLKSTEST_CHECK(!clkscrs_getReportMetadata(strayID, &metadata));
+
+    // More than the index can be handed at once falls back to a rebuild.
+    for(int i = 0; i < 40; i++)
+    {
+        writeCrashReport("{}", path);
+    }
+    CLKSTEST_CHECK(clkscrs_getReportCount() == 42);
+    CLKSTEST_CHECK(clkscrs_getReportMetadata(strayID, &metadata) && metadata.kind == CLKSCrashReportKindUnknown);
+
+    clkscrs_deleteAllReports();
+}
+
+static void testEvictionPrefersDuplicates(void)
+{
+    char path[CLKSCRS_MAX_PATH_LENGTH];
+    clkscrs_setMaxReportCount(3);
+    int64_t firstID = writeCrashReportWithFingerprint("{}", path, 1);
+    int64_t uniqueID = writeCrashReportWithFingerprint("{}", path, 2);
+    int64_t repeatID = writeCrashReportWithFingerprint("{}", path, 1);
+    int64_t newestID = writeCrashReportWithFingerprint("{}", path, 3);
+
+    // Not collapsed, but the repeat still goes before the oldest report.
+    CLKSCrashReportMetadata metadata;
+    CLKSTEST_CHECK(clkscrs_getReportCount() == 3);
+    CLKSTEST_CHECK(clkscrs_getReportMetadata(firstID, &metadata) && metadata.duplicateCount == 0);
+    CLKSTEST_CHECK(clkscrs_getReportMetadata(uniqueID, &metadata));
+    CLKSTEST_CHECK(!clkscrs_getReportMetadata(repeatID, &metadata));
+    CLKSTEST_CHECK(clkscrs_getReportMetadata(newestID, &metadata));
+
+    clkscrs_deleteAllReports();
+    clkscrs_setMaxReportCount(MAX_REPORTS * 2);
+}
+
+static int64_t addUserReport(void)
+{
+    int64_t reportID = clkscrs_addUserReport("{}", 2);
+    clkscrs_flushUserReports();
+    return reportID;
+}
+
+static void testCursorWaitsForCrashReports(void)
+{
+    char path[CLKSCRS_MAX_PATH_LENGTH];
+    CLKSCrashReportMetadata metadata;
+    int64_t firstID = addUserReport();
+    int64_t crashID = clkscrs_getNextCrashReport(path);
+    int64_t secondID = addUserReport();
+
+    // The crash report isn't written yet, so the cursor has to wait for it.
+    int64_t uploadedIDs[] = {firstID, secondID};
+    CLKSTEST_CHECK(clkscrs_markReportsUploaded(uploadedIDs, 2));
+    CLKSTEST_CHECK(clkscrs_getUploadCursor() == firstID);
+    FILE* file = fopen(path, "w");
+    fputs("{}", file);
+    fclose(file);
+    clkscrs_writeReportMetadata(crashID, CLKSCrashReportKindStandard, "Signal", 0);
+    CLKSTEST_CHECK(clkscrs_getReportMetadata(crashID, &metadata) && !metadata.sent);
+    CLKSTEST_CHECK(clkscrs_getReportMetadata(secondID, &metadata) && metadata.sent);
+
+    CLKSTEST_CHECK(clkscrs_markReportsUploaded(&crashID, 1));
+    CLKSTEST_CHECK(clkscrs_getUploadCursor() == secondID);
+
+    // Uploaded reports above the cursor stay uploaded after a relaunch.
+    int64_t thirdID = addUserReport();
+    int64_t fourthID = addUserReport();
+    CLKSTEST_CHECK(clkscrs_markReportsUploaded(&fourthID, 1));
+    CLKSTEST_CHECK(clkscrs_getUploadCursor() == secondID);
+    clkscrs_initialize("Tests", g_reportsPath);
+    CLKSTEST_CHECK(clkscrs_getUploadCursor() == secondID);
+    CLKSTEST_CHECK(clkscrs_getReportMetadata(crashID, &metadata) && metadata.sent);
+    CLKSTEST_CHECK(clkscrs_getReportMetadata(thirdID, &metadata) && !metadata.sent);
+    CLKSTEST_CHECK(clkscrs_getReportMetadata(fourthID, &metadata) && metadata.sent);
+
+    CLKSTEST_CHECK(clkscrs_markReportsUploaded(&thirdID, 1));
+    CLKSTEST_CHECK(clkscrs_getUploadCursor() == fourthID);
+    clkscrs_deleteAllReports();
+}
+
+static void* addReports(void* userData)
+{
+    int64_t* addedIDs = userData;
+    char* report = malloc(REPORT_SIZE);
+    memset(report, ' ', REPORT_SIZE);
+    report[0] = '{';
+    report[REPORT_SIZE - 1] = '}';
+    for(int i = 0; i < REPORTS_PER_ADDER; i++)
+    {
+        // The queue fills up faster than it can be written, so wait for room.
+        while((addedIDs[i] = clkscrs_addUserReport(report, REPORT_SIZE)) == 0)
+        {
+            clkscrs_flushUserReports();
+        }
+        // Let the queue drain now and then, so that the committer doesn't
+        // spend the whole test waiting for it to empty.
+        sched_yield();
+    }
+    free(report);
+    atomic_fetch_sub(&g_runningAdderCount, 1);
+    return NULL;
+}
+
+/** Do what the uploader does: "upload" the unsent reports past the cursor,
+ * and mark them uploaded.
+ */
+static void uploadUnsentReports(void)
+{
+    static int64_t reportIDs[MAX_REPORTS];
+    const int64_t cursor = clkscrs_getUploadCursor();
+    CLKSCrashReportFilter filter;
+    memset(&filter, 0, sizeof(filter));
+    filter.unsentOnly = true;
+    int count = clkscrs_getReportIDsMatching(&filter, reportIDs, MAX_REPORTS);
+    int uploadedCount = 0;
+    for(int i = 0; i < count; i++)
+    {
+        if(reportIDs[i] > cursor)
+        {
+            reportIDs[uploadedCount++] = reportIDs[i];
+            g_uploadedIDs[g_uploadedCount++] = reportIDs[i];
+        }
+    }
+    if(uploadedCount > 0)
+    {
+        clkscrs_markReportsUploaded(reportIDs, uploadedCount);
+    }
+}
+
+static int compareIDs(const void* a, const void* b)
+{
+    int64_t diff = *(const int64_t*)a - *(const int64_t*)b;
+    return diff < 0 ? -1 : diff > 0 ? 1 : 0;
+}
+
+static void testAddWhileCommitting(void)
+{
+    clkscrs_setWriteQueue(512, 0.001, CLKSCrashReportDurabilityNone);
+    atomic_store(&g_runningAdderCount, ADDER_THREAD_COUNT);
+    pthread_t threads[ADDER_THREAD_COUNT];
+    for(int i = 0; i < ADDER_THREAD_COUNT; i++)
+    {
+        pthread_create(&threads[i], NULL, addReports, g_addedIDs[i]);
+    }
+
+    // Keep committing while the reports are coming in.
+    while(atomic_load(&g_runningAdderCount) > 0)
+    {
+        uploadUnsentReports();
+    }
+    for(int i = 0; i < ADDER_THREAD_COUNT; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+    uploadUnsentReports();
+
+    qsort(g_uploadedIDs, (size_t)g_uploadedCount, sizeof(*g_uploadedIDs), compareIDs);
+    int missingCount = 0;
+    int addedCount = 0;
+    for(int t = 0; t < ADDER_THREAD_COUNT; t++)
+    {
+        for(int i = 0; i < REPORTS_PER_ADDER; i++)
+        {
+            int64_t reportID = g_addedIDs[t][i];
+            addedCount += reportID != 0;
+            if(bsearch(&reportID, g_uploadedIDs, (size_t)g_uploadedCount, sizeof(*g_uploadedIDs), compareIDs) == NULL)
+            {
+                missingCount++;
+            }
+        }
+    }
+    CLKSTEST_CHECK(addedCount == MAX_REPORTS);
+    CLKSTEST_CHECK(missingCount == 0);
+    CLKSTEST_CHECK(g_uploadedCount == addedCount);
+}
+
+int main(void)
+{
+    if(mkdtemp(g_reportsPath) == NULL)
+    {
+        perror("mkdtemp");
+        return 1;
+    }
+    clkscrs_initialize("Tests", g_reportsPath);
+    clkscrs_setMaxReportCount(MAX_REPORTS * 2);
+
+    testSyncedSegments();
+    testSegmentDeletesSurviveRelaunch();
+    testCompressionAtRest();
+    testCrashReportsIndexedWithoutRebuild();
+    testEvictionPrefersDuplicates();
+    testCursorWaitsForCrashReports();
+    testAddWhileCommitting();
+
+    clkscrs_deleteAllReports();
+    rmdir(g_reportsPath);
+    return CLKSTEST_RESULT();
+}
@@ -0,0 +1,170 @@
+//
+//  CLKSCrashUploader_Benchmark.c
+//
+//  Copyright (c) 2012 Karl Stenerud. All rights reserved.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall remain in place
+// in this source code.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+
+
+
+/* Measures upload throughput at different encode concurrencies, with the
+ * default fix-up encoder and with one that also waits 2 ms per report, the
+ * way an encoder that reads other storage would.
+ *
+ *     build/CLKSCrashUploader_Benchmark [reportCount]
+ */
+
+
+#include "CLKSCrashReportFixer.h"
+#include "CLKSCrashReportStore.h"
+#include "CLKSCrashUploader.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+static char g_reportsPath[] = "/tmp/CLKSCrashUploader_Benchmark.XXXXXX";
+
+
+static double now(void)
+{
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (double)time.tv_sec + (double)time.tv_nsec / 1e9;
+}
+
+/** Add reports shaped like real ones: a few symbolicated threads and a console log. */
+static void addReports(int count)
+{
+    const int capacity = 1024 * 1024;
+    char* buffer = malloc(capacity);
+    for(int report = 0; report < count; report++)
+    {
+        int length = snprintf(buffer, capacity,
+                              "{\"report\":{\"id\":\"%d\",\"timestamp\":1700000000},\"crash\":{\"threads\":[",
+                              report);
+        for(int thread = 0; thread < 3; thread++)
+        {
+            length += snprintf(buffer + length, capacity - length, "%s{\"index\":%d,\"backtrace\":{\"contents\":[",
+                               thread > 0 ? "," : "", thread);
+            for(int frame = 0; frame < 25; frame++)
+            {
+                length += snprintf(buffer + length, capacity - length,
+                                   "%s{\"instruction_addr\":%llu,\"object_name\":\"Module%d\","
+                                   "\"symbol_name\":\"_$s6Module%dC4funcyyF%d\",\"symbol_addr\":%llu}",
+                                   frame > 0 ? "," : "",
+                                   0x100000000ull + (unsigned long long)(report * 7919 + frame * 31),
+                                   frame % 5, frame % 5, frame,
+                                   0x100000000ull + (unsigned long long)(frame * 16));
+            }
+            length += snprintf(buffer + length, capacity - length, "]}}");
+        }
+        length += snprintf(buffer + length, capacity - length, "]},\"console_log\":\"");
+        for(int line = 0; line < 300; line++)
+        {
+            length += snprintf(buffer + length, capacity - length,
+                               "2024-01-01 12:00:%02d.%03d App[123:4567] line %d of the console log\\n",
+                               line % 60, line, line);
+        }
+        length += snprintf(buffer + length, capacity - length, "\"}");
+        while(!clkscrs_addUserReport(buffer, length))
+        {
+            clkscrs_flushUserReports();
+        }
+    }
+    clkscrs_flushUserReports();
+    free(buffer);
+}
+
+static char* encodeWithLatency(int64_t reportID, int* length, __unused void* userData)
+{
+    char* report = clkscrs_readReport(reportID);
+    char* fixedReport = report == NULL ? NULL : clkscrf_fixupCrashReport(report);
+    free(report);
+    usleep(2000);
+    if(fixedReport != NULL)
+    {
+        *length = (int)strlen(fixedReport);
+    }
+    return fixedReport;
+}
+
+static int discardBatch(__unused const char* body, __unused int bodyLength, __unused bool isGzipped,
+                        __unused void* userData)
+{
+    return 200;
+}
+
+
+int main(int argc, char** argv)
+{
+    int reportCount = argc > 1 ? atoi(argv[1]) : 400;
+    if(mkdtemp(g_reportsPath) == NULL)
+    {
+        perror("mkdtemp");
+        return 1;
+    }
+    clkscrs_setMaxReportCount(100000);
+    clkscrs_setWriteQueue(8 * 1024 * 1024, 0.01, CLKSCrashReportDurabilityNone);
+    clkscrs_initialize("Benchmark", g_reportsPath);
+
+    CLKSCrashUploadTransport transport = {.sendBatch = discardBatch};
+    clkscru_setTransport(&transport);
+    clkscru_setDeletesUploadedReports(true);
+
+    printf("%ld cores\n", sysconf(_SC_NPROCESSORS_ONLN));
+    for(int withLatency = 0; withLatency < 2; withLatency++)
+    {
+        clkscru_setEncodeFunction(withLatency ? encodeWithLatency : NULL, NULL);
+        double baseTime = 0;
+        for(int concurrency = 1; concurrency <= 4; concurrency *= 2)
+        {
+            addReports(reportCount);
+            clkscru_setEncodeConcurrency(concurrency);
+            CLKSCrashUploadStats before;
+            CLKSCrashUploadStats after;
+            clkscru_getStats(&before);
+            double startTime = now();
+            int uploadedCount = clkscru_uploadPendingReportsNow();
+            double elapsedTime = now() - startTime;
+            clkscru_getStats(&after);
+            if(concurrency == 1)
+            {
+                baseTime = elapsedTime;
+            }
+            printf("%s concurrency %d: %d reports in %.3fs, %.0f reports/s, %.2fx | encode %.3fs compress %.3fs send %.3fs\n",
+                   withLatency ? "fix-up + 2ms" : "fix-up      ",
+                   concurrency,
+                   uploadedCount,
+                   elapsedTime,
+                   uploadedCount / elapsedTime,
+                   baseTime / elapsedTime,
+                   after.encodeTime - before.encodeTime,
+                   after.compressTime - before.compressTime,
+                   after.sendTime - before.sendTime);
+        }
+    }
+
+    clkscrs_deleteAllReports();
+    rmdir(g_reportsPath);
+    return 0;
+}
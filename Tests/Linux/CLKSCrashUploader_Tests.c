@@ -0,0 +1,447 @@
+//
+//  CLKSCrashUploader_Tests.c
+//
+//  Copyright (c) 2012 Karl Stenerud. All rights reserved.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall remain in place
+// in this source code.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+
+
+/* Uploads user reports through a scripted in-process transport, covering
+ * batching, compression, retries with backoff, batch splitting, rejected
+ * batches and upload cursor recovery.
+ */
+
+
+#include "CLKSCrashReportStore.h"
+#include "CLKSCrashUploader.h"
+#include "CLKSTestCheck.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#define MAX_REPORT_NUMBER 1000
+#define MAX_SCRIPT_LENGTH 16
+
+static char g_reportsPath[] = "/tmp/CLKSCrashUploader_Tests.XXXXXX";
+
+// The "server". Guarded by g_serverMutex.
+static pthread_mutex_t g_serverMutex = PTHREAD_MUTEX_INITIALIZER;
+/** Status codes to answer with, in order. After that, 200. */
+static int g_script[MAX_SCRIPT_LENGTH];
+static int g_scriptLength;
+static int g_requestCount;
+static int g_largestBodyLength;
+static bool g_wasLastGzipped;
+static bool g_hadBadEnvelope;
+static bool g_wasOutOfOrder;
+static int g_lastReceivedNumber = -1;
+/** How many times each report number was accepted. */
+static int g_acceptCounts[MAX_REPORT_NUMBER];
+
+
+// ============================================================================
+#pragma mark - Server -
+// ============================================================================
+
+static void setScript(int count, const int* statusCodes)
+{
+    pthread_mutex_lock(&g_serverMutex);
+    memcpy(g_script, statusCodes, sizeof(*statusCodes) * (size_t)count);
+    g_scriptLength = count;
+    pthread_mutex_unlock(&g_serverMutex);
+}
+
+static char* gunzip(const char* body, int length)
+{
+    const int capacity = 16 * 1024 * 1024;
+    char* plain = malloc(capacity);
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    inflateInit2(&stream, 16 + MAX_WBITS);
+    stream.next_in = (Bytef*)body;
+    stream.avail_in = (uInt)length;
+    stream.next_out = (Bytef*)plain;
+    stream.avail_out = capacity - 1;
+    int result = inflate(&stream, Z_FINISH);
+    plain[stream.total_out] = '\0';
+    inflateEnd(&stream);
+    if(result != Z_STREAM_END)
+    {
+        free(plain);
+        return NULL;
+    }
+    return plain;
+}
+
+static int sendBatch(const char* body, int bodyLength, bool isGzipped, __unused void* userData)
+{
+    char* plain;
+    if(isGzipped)
+    {
+        plain = gunzip(body, bodyLength);
+    }
+    else
+    {
+        plain = malloc((size_t)bodyLength + 1);
+        memcpy(plain, body, (size_t)bodyLength);
+        plain[bodyLength] = '\0';
+    }
+
+    pthread_mutex_lock(&g_serverMutex);
+    int statusCode = 200;
+    if(g_scriptLength > 0)
+    {
+        statusCode = g_script[0];
+        memmove(g_script, g_script + 1, sizeof(*g_script) * (size_t)--g_scriptLength);
+    }
+    g_requestCount++;
+    g_wasLastGzipped = isGzipped;
+    if(plain == NULL)
+    {
+        g_hadBadEnvelope = true;
+        pthread_mutex_unlock(&g_serverMutex);
+        return 400;
+    }
+    int plainLength = (int)strlen(plain);
+    if(plainLength > g_largestBodyLength)
+    {
+        g_largestBodyLength = plainLength;
+    }
+    if(strncmp(plain, "{\"reports\":[", 12) != 0 || strcmp(plain + plainLength - 2, "]}") != 0)
+    {
+        g_hadBadEnvelope = true;
+    }
+    if(statusCode == 200)
+    {
+        for(const char* pos = plain; (pos = strstr(pos, "{\"n\":")) != NULL; pos++)
+        {
+            int number = atoi(pos + 5);
+            if(number >= 0 && number < MAX_REPORT_NUMBER)
+            {
+                g_acceptCounts[number]++;
+                g_wasOutOfOrder |= number <= g_lastReceivedNumber;
+                g_lastReceivedNumber = number;
+            }
+        }
+    }
+    pthread_mutex_unlock(&g_serverMutex);
+    free(plain);
+    return statusCode;
+}
+
+static int countAccepted(int first, int count)
+{
+    int acceptedCount = 0;
+    pthread_mutex_lock(&g_serverMutex);
+    for(int i = first; i < first + count; i++)
+    {
+        acceptedCount += g_acceptCounts[i] == 1;
+    }
+    pthread_mutex_unlock(&g_serverMutex);
+    return acceptedCount;
+}
+
+
+// ============================================================================
+#pragma mark - Utility -
+// ============================================================================
+
+static char* encodeReport(int64_t reportID, int* length, __unused void* userData)
+{
+    char* report = clkscrs_readReport(reportID);
+    if(report != NULL)
+    {
+        *length = (int)strlen(report);
+    }
+    return report;
+}
+
+/** Like encodeReport(), but fails for report number 701. */
+static char* encodeAllBut701(int64_t reportID, int* length, void* userData)
+{
+    char* report = encodeReport(reportID, length, userData);
+    if(report != NULL && strstr(report, "{\"n\":701,") != NULL)
+    {
+        free(report);
+        return NULL;
+    }
+    return report;
+}
+
+static void addReports(int first, int count)
+{
+    char report[512];
+    for(int i = first; i < first + count; i++)
+    {
+        int length = snprintf(report, sizeof(report), "{\"n\":%d,\"pad\":\"%0200d\"}", i, i);
+        clkscrs_addUserReport(report, length);
+    }
+    clkscrs_flushUserReports();
+}
+
+static double getCurrentTime(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1000000000.0;
+}
+
+static CLKSCrashUploadStats getStats(void)
+{
+    CLKSCrashUploadStats stats;
+    clkscru_getStats(&stats);
+    return stats;
+}
+
+
+// ============================================================================
+#pragma mark - Tests -
+// ============================================================================
+
+static void testBatching(void)
+{
+    addReports(0, 230);
+    CLKSTEST_CHECK(clkscru_uploadPendingReportsNow() == 230);
+    CLKSTEST_CHECK(countAccepted(0, 230) == 230);
+    CLKSTEST_CHECK(g_wasLastGzipped);
+    CLKSTEST_CHECK(!g_hadBadEnvelope);
+    CLKSTEST_CHECK(!g_wasOutOfOrder);
+    CLKSTEST_CHECK(g_requestCount == 5);
+    CLKSTEST_CHECK(clkscrs_getReportCount() == 0);
+}
+
+static void testEncodeConcurrency(void)
+{
+    clkscru_setEncodeConcurrency(4);
+    addReports(230, 120);
+    CLKSTEST_CHECK(clkscru_uploadPendingReportsNow() == 120);
+    CLKSTEST_CHECK(countAccepted(230, 120) == 120);
+    CLKSTEST_CHECK(!g_wasOutOfOrder);
+    clkscru_setEncodeConcurrency(1);
+}
+
+static void testRetryWithBackoff(void)
+{
+    const uint64_t failedAttempts = getStats().failedAttempts;
+    const int statusCodes[] = {503, 500, 429};
+    setScript(3, statusCodes);
+    addReports(350, 100);
+
+    const double startTime = getCurrentTime();
+    clkscru_uploadPendingReports();
+    while(clkscrs_getReportCount() > 0 && getCurrentTime() - startTime < 5)
+    {
+        usleep(1000);
+    }
+    const double duration = getCurrentTime() - startTime;
+    CLKSTEST_CHECK(countAccepted(350, 100) == 100);
+    CLKSTEST_CHECK(getStats().failedAttempts - failedAttempts == 3);
+    CLKSTEST_CHECK(getStats().consecutiveFailures == 0);
+    // Three backoffs starting at 0.05 seconds, doubling, with jitter.
+    CLKSTEST_CHECK(duration >= 0.15);
+}
+
+static void testTooLargeSplitsBatch(void)
+{
+    const int statusCodes[] = {413, 413};
+    setScript(2, statusCodes);
+    const int requestCount = g_requestCount;
+    addReports(450, 100);
+    CLKSTEST_CHECK(clkscru_uploadPendingReportsNow() == 100);
+    CLKSTEST_CHECK(countAccepted(450, 100) == 100);
+    // 50 and 25 are refused, 12 goes through, then back to full batches of 50 and 38.
+    CLKSTEST_CHECK(g_requestCount - requestCount == 2 + 3);
+}
+
+static void testRejectedBatchIsDropped(void)
+{
+    const uint64_t rejectedCount = getStats().reportsRejected;
+    clkscru_setBatchLimits(10, 1024 * 1024);
+    const int statusCodes[] = {400};
+    setScript(1, statusCodes);
+    addReports(550, 25);
+    CLKSTEST_CHECK(clkscru_uploadPendingReportsNow() == 15);
+    CLKSTEST_CHECK(countAccepted(550, 10) == 0);
+    CLKSTEST_CHECK(countAccepted(560, 15) == 15);
+    CLKSTEST_CHECK(getStats().reportsRejected - rejectedCount == 10);
+    CLKSTEST_CHECK(clkscrs_getReportCount() == 0);
+}
+
+static void testByteLimit(void)
+{
+    clkscru_setBatchLimits(1000, 4000);
+    const int requestCount = g_requestCount;
+    g_largestBodyLength = 0;
+    addReports(575, 40);
+    CLKSTEST_CHECK(clkscru_uploadPendingReportsNow() == 40);
+    CLKSTEST_CHECK(countAccepted(575, 40) == 40);
+    CLKSTEST_CHECK(g_largestBodyLength <= 4000);
+    CLKSTEST_CHECK(g_requestCount - requestCount >= 40 * 200 / 4000);
+    clkscru_setBatchLimits(100, 1024 * 1024);
+}
+
+static void testSkippedReportIsKept(void)
+{
+    const uint64_t skippedCount = getStats().reportsSkipped;
+    addReports(700, 5);
+    int64_t reportIDs[5];
+    CLKSTEST_CHECK(clkscrs_getReportIDs(reportIDs, 5) == 5);
+    clkscru_setEncodeFunction(encodeAllBut701, NULL);
+    CLKSTEST_CHECK(clkscru_uploadPendingReportsNow() == 4);
+    CLKSTEST_CHECK(countAccepted(700, 1) == 1 && countAccepted(701, 1) == 0 && countAccepted(702, 3) == 3);
+    CLKSTEST_CHECK(getStats().reportsSkipped - skippedCount == 1);
+    // Not deleted, and the cursor can't pass it.
+    CLKSTEST_CHECK(clkscrs_getReportCount() == 1);
+    CLKSTEST_CHECK(clkscrs_getUploadCursor() == reportIDs[0]);
+
+    clkscru_setEncodeFunction(encodeReport, NULL);
+    CLKSTEST_CHECK(clkscru_uploadPendingReportsNow() == 1);
+    CLKSTEST_CHECK(countAccepted(701, 1) == 1);
+    CLKSTEST_CHECK(clkscrs_getUploadCursor() == reportIDs[1]);
+    CLKSTEST_CHECK(clkscrs_getReportCount() == 0);
+}
+
+static void testAuthFailureIsRetried(void)
+{
+    const int statusCodes[] = {401, 403};
+    setScript(2, statusCodes);
+    addReports(710, 5);
+    CLKSTEST_CHECK(clkscru_uploadPendingReportsNow() == -1);
+    CLKSTEST_CHECK(clkscru_uploadPendingReportsNow() == -1);
+    CLKSTEST_CHECK(clkscrs_getReportCount() == 5);
+    CLKSTEST_CHECK(getStats().nextRetryTime > 0);
+    CLKSTEST_CHECK(clkscru_uploadPendingReportsNow() == 5);
+    CLKSTEST_CHECK(countAccepted(710, 5) == 5);
+}
+
+static int failToSend(__unused const char* body, __unused int bodyLength, __unused bool isGzipped, __unused void* userData)
+{
+    return -1;
+}
+
+static void testNoResponseKeepsReports(void)
+{
+    addReports(615, 5);
+    CLKSCrashUploadTransport transport = {.sendBatch = failToSend};
+    clkscru_setTransport(&transport);
+    CLKSTEST_CHECK(clkscru_uploadPendingReportsNow() == -1);
+    transport.sendBatch = sendBatch;
+    clkscru_setTransport(&transport);
+
+    CLKSCrashReportMetadata metadata[8];
+    CLKSTEST_CHECK(clkscrs_getAllReportMetadata(metadata, 8) == 5);
+    CLKSTEST_CHECK(metadata[0].sendAttempts >= 1);
+    CLKSTEST_CHECK(!metadata[0].sent);
+}
+
+static void testKeepsSentReports(void)
+{
+    clkscru_setDeletesUploadedReports(false);
+    CLKSTEST_CHECK(clkscru_uploadPendingReportsNow() == 5);
+    CLKSTEST_CHECK(countAccepted(615, 5) == 5);
+
+    CLKSCrashReportMetadata metadata[8];
+    CLKSTEST_CHECK(clkscrs_getAllReportMetadata(metadata, 8) == 5);
+    CLKSTEST_CHECK(metadata[0].sent && metadata[4].sent);
+    CLKSTEST_CHECK(clkscrs_getUploadCursor() == metadata[4].reportID);
+
+    // Nothing new, so nothing to send.
+    CLKSTEST_CHECK(clkscru_uploadPendingReportsNow() == 0);
+    clkscrs_deleteAllReports();
+    clkscru_setDeletesUploadedReports(true);
+}
+
+static void writeCursorFile(const char* contents)
+{
+    char path[512];
+    snprintf(path, sizeof(path), "%s/Tests-upload.cursor", g_reportsPath);
+    FILE* file = fopen(path, "w");
+    fputs(contents, file);
+    fclose(file);
+}
+
+static void testCursorRecovery(void)
+{
+    addReports(620, 4);
+    int64_t reportIDs[4];
+    CLKSTEST_CHECK(clkscrs_getReportIDs(reportIDs, 4) == 4);
+
+    // Simulate dying after moving the cursor, but before marking the reports.
+    char cursor[32];
+    snprintf(cursor, sizeof(cursor), "%016llx\n", (unsigned long long)reportIDs[1]);
+    writeCursorFile(cursor);
+    clkscrs_initialize("Tests", g_reportsPath);
+    CLKSTEST_CHECK(clkscrs_getUploadCursor() == reportIDs[1]);
+
+    CLKSCrashReportMetadata metadata[4];
+    CLKSTEST_CHECK(clkscrs_getAllReportMetadata(metadata, 4) == 4);
+    CLKSTEST_CHECK(metadata[0].sent && metadata[1].sent);
+    CLKSTEST_CHECK(!metadata[2].sent && !metadata[3].sent);
+
+    CLKSTEST_CHECK(clkscru_uploadPendingReportsNow() == 2);
+    CLKSTEST_CHECK(countAccepted(620, 2) == 0);
+    CLKSTEST_CHECK(countAccepted(622, 2) == 2);
+
+    writeCursorFile("not a cursor\n");
+    clkscrs_initialize("Tests", g_reportsPath);
+    CLKSTEST_CHECK(clkscrs_getUploadCursor() == 0);
+}
+
+int main(void)
+{
+    if(mkdtemp(g_reportsPath) == NULL)
+    {
+        perror("mkdtemp");
+        return 1;
+    }
+    clkscrs_setMaxReportCount(10000);
+    clkscrs_setWriteQueue(1024 * 1024, 0.01, CLKSCrashReportDurabilityNone);
+    clkscrs_initialize("Tests", g_reportsPath);
+
+    CLKSCrashUploadTransport transport = {.sendBatch = sendBatch};
+    clkscru_setTransport(&transport);
+    clkscru_setEncodeFunction(encodeReport, NULL);
+    clkscru_setEnvelope("{\"reports\":", "}");
+    clkscru_setBatchLimits(50, 1024 * 1024);
+    clkscru_setCompressionLevel(6);
+    clkscru_setRetryDelays(0.05, 0.2);
+    clkscru_setDeletesUploadedReports(true);
+
+    testBatching();
+    testEncodeConcurrency();
+    testRetryWithBackoff();
+    testTooLargeSplitsBatch();
+    testRejectedBatchIsDropped();
+    testByteLimit();
+    testSkippedReportIsKept();
+    testAuthFailureIsRetried();
+    testNoResponseKeepsReports();
+    testKeepsSentReports();
+    testCursorRecovery();
+
+    clkscrs_deleteAllReports();
+    rmdir(g_reportsPath);
+    return CLKSTEST_RESULT();
+}
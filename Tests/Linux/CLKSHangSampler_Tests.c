@@ -0,0 +1,170 @@
+//
+//  CLKSHangSampler_Tests.c
+//
+//  Copyright (c) 2012 Karl Stenerud. All rights reserved.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall remain in place
+// in this source code.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+
+
+/* Watches the main thread with the signal backend, and checks that hangs
+ * are detected, profiled and ended by the right replies.
+ */
+
+
+#include "CLKSHangSampler.h"
+#include "CLKSHangSampler_Signal.h"
+#include "CLKSTestCheck.h"
+
+#include <dlfcn.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+/** The latest request from the sampler. Replying to it stands in for running a queued main-thread block. */
+static _Atomic(uint64_t) g_latestRequest;
+
+static int g_hangCount;
+static double g_lastHangDuration;
+static bool g_lastHangHadSpinA;
+static bool g_lastHangHadSpinB;
+
+volatile long g_sink;
+
+static double getCurrentTime(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + (double)tv.tv_usec / 1000000.0;
+}
+
+static void requestResponse(__unused void* context, uint64_t request)
+{
+    atomic_store(&g_latestRequest, request);
+}
+
+/** Run the watched thread's "event loop", replying to requests for a while.
+ *
+ * @param replyLag Reply to this many requests before the latest one (0 = reply properly).
+ */
+static void runLoop(double seconds, uint64_t replyLag)
+{
+    const double endTime = getCurrentTime() + seconds;
+    while(getCurrentTime() < endTime)
+    {
+        uint64_t request = atomic_load(&g_latestRequest);
+        if(request > replyLag)
+        {
+            clkshs_notifyResponsive(request - replyLag);
+        }
+        usleep(1000);
+    }
+}
+
+// Not static, so that dladdr() can find them (see LDFLAGS).
+__attribute__((noinline)) void spinUntil(double endTime)
+{
+    while(getCurrentTime() < endTime)
+    {
+        g_sink++;
+    }
+}
+
+__attribute__((noinline)) void spinA(double endTime)
+{
+    spinUntil(endTime);
+    g_sink++;
+}
+
+__attribute__((noinline)) void spinB(double endTime)
+{
+    spinUntil(endTime);
+    g_sink++;
+}
+
+static void hang(double seconds)
+{
+    const double startTime = getCurrentTime();
+    spinA(startTime + seconds / 2);
+    spinB(startTime + seconds);
+}
+
+static bool treeContains(const CLKSHangProfile* profile, int node, void* function)
+{
+    for(int child = profile->nodes[node].firstChild; child >= 0; child = profile->nodes[child].nextSibling)
+    {
+        Dl_info info;
+        if(dladdr((void*)(profile->nodes[child].address - 1), &info) != 0 && info.dli_saddr == function)
+        {
+            return true;
+        }
+        if(treeContains(profile, child, function))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void onHangEnded(const CLKSHangProfile* profile, __unused void* userData)
+{
+    g_hangCount++;
+    g_lastHangDuration = profile->duration;
+    g_lastHangHadSpinA = treeContains(profile, 0, (void*)spinA);
+    g_lastHangHadSpinB = treeContains(profile, 0, (void*)spinB);
+    CLKSTEST_CHECK(profile->sampleCount > 0);
+    CLKSTEST_CHECK(profile->nodes[0].sampleCount == profile->sampleCount);
+}
+
+int main(void)
+{
+    CLKSHangSamplerBackend backend;
+    memset(&backend, 0, sizeof(backend));
+    CLKSTEST_CHECK(clkshs_signal_initBackend(&backend, pthread_self()));
+    backend.requestResponse = requestResponse;
+    CLKSTEST_CHECK(clkshs_start(&backend, 0.2, 0.01, 50, onHangEnded, NULL));
+    CLKSTEST_CHECK(clkshs_isRunning());
+
+    runLoop(0.6, 0);
+    CLKSTEST_CHECK(g_hangCount == 0);
+
+    hang(1.0);
+    runLoop(0.5, 0);
+    CLKSTEST_CHECK(g_hangCount == 1);
+    CLKSTEST_CHECK(g_lastHangDuration >= 0.8);
+    CLKSTEST_CHECK(g_lastHangHadSpinA);
+    CLKSTEST_CHECK(g_lastHangHadSpinB);
+
+    // Below the threshold.
+    hang(0.05);
+    runLoop(0.5, 0);
+    CLKSTEST_CHECK(g_hangCount == 1);
+
+    // Replies that only ever answer an older request must not end a hang.
+    runLoop(0.6, 1);
+    CLKSTEST_CHECK(g_hangCount == 1);
+    runLoop(0.5, 0);
+    CLKSTEST_CHECK(g_hangCount == 2);
+    CLKSTEST_CHECK(g_lastHangDuration >= 0.4);
+
+    clkshs_stop();
+    CLKSTEST_CHECK(!clkshs_isRunning());
+    return CLKSTEST_RESULT();
+}
@@ -0,0 +1,443 @@
+//
+//  CLKSJSONCodec_Tests.c
+//
+//  Copyright (c) 2012 Karl Stenerud. All rights reserved.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall remain in place
+// in this source code.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+
+
+
+/* Checks the incremental JSON decoder against the same documents decoded in
+ * one piece, split at every byte, and one byte at a time. Also covers
+ * surrogate pairs, passing elements through as raw JSON, trailing commas,
+ * and round trips of hex and base64 data elements.
+ */
+
+
+#include "CLKSJSONCodec.h"
+#include "CLKSTestCheck.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define LOG_CAPACITY 16384
+
+/** Everything the decode callbacks were called with, as text. */
+typedef struct
+{
+    char text[LOG_CAPACITY];
+    int length;
+} EventLog;
+
+/** Output of an encoder. */
+typedef struct
+{
+    char text[LOG_CAPACITY];
+    int length;
+} Output;
+
+
+// ============================================================================
+#pragma mark - Helpers -
+// ============================================================================
+
+static void logEvent(EventLog* log, const char* name, const char* kind, const char* value, int valueLength)
+{
+    log->length += snprintf(log->text + log->length, (size_t)(LOG_CAPACITY - log->length),
+                            "%s %s=%.*s\n", name == NULL ? "-" : name, kind, valueLength, value);
+}
+
+static int onBoolean(const char* name, bool value, void* userData)
+{
+    logEvent(userData, name, "bool", value ? "true" : "false", 5);
+    return CLKSJSON_OK;
+}
+
+static int onFloatingPoint(const char* name, double value, void* userData)
+{
+    char text[40];
+    int length = snprintf(text, sizeof(text), "%.17g", value);
+    logEvent(userData, name, "float", text, length);
+    return CLKSJSON_OK;
+}
+
+static int onInteger(const char* name, int64_t value, void* userData)
+{
+    char text[40];
+    int length = snprintf(text, sizeof(text), "%lld", (long long)value);
+    logEvent(userData, name, "int", text, length);
+    return CLKSJSON_OK;
+}
+
+static int onNull(const char* name, void* userData)
+{
+    logEvent(userData, name, "null", "", 0);
+    return CLKSJSON_OK;
+}
+
+static int onString(const char* name, const char* value, void* userData)
+{
+    logEvent(userData, name, "string", value, (int)strlen(value));
+    return CLKSJSON_OK;
+}
+
+static int onStringSlice(const char* name, const char* value, int length, __unused bool needsEscaping, void* userData)
+{
+    logEvent(userData, name, "string", value, length);
+    return CLKSJSON_OK;
+}
+
+static int onBeginObject(const char* name, void* userData)
+{
+    logEvent(userData, name, "{", "", 0);
+    return CLKSJSON_OK;
+}
+
+static int onBeginArray(const char* name, void* userData)
+{
+    logEvent(userData, name, "[", "", 0);
+    return CLKSJSON_OK;
+}
+
+static int onEndContainer(void* userData)
+{
+    logEvent(userData, NULL, "end", "", 0);
+    return CLKSJSON_OK;
+}
+
+static int onEndData(void* userData)
+{
+    logEvent(userData, NULL, "done", "", 0);
+    return CLKSJSON_OK;
+}
+
+static CLKSJSONDecodeCallbacks g_callbacks =
+{
+    .onBooleanElement = onBoolean,
+    .onFloatingPointElement = onFloatingPoint,
+    .onIntegerElement = onInteger,
+    .onNullElement = onNull,
+    .onStringElement = onString,
+    .onBeginObject = onBeginObject,
+    .onBeginArray = onBeginArray,
+    .onEndContainer = onEndContainer,
+    .onEndData = onEndData,
+};
+
+static CLKSJSONDecodeCallbacks g_sliceCallbacks =
+{
+    .onBooleanElement = onBoolean,
+    .onFloatingPointElement = onFloatingPoint,
+    .onIntegerElement = onInteger,
+    .onNullElement = onNull,
+    .onStringElement = onString,
+    .onStringSliceElement = onStringSlice,
+    .onBeginObject = onBeginObject,
+    .onBeginArray = onBeginArray,
+    .onEndContainer = onEndContainer,
+    .onEndData = onEndData,
+};
+
+/** Decode JSON pushed in chunks.
+ *
+ * @param chunkLengths Lengths of the chunks before the last, which gets the rest (0 terminated).
+ */
+static int decodeInChunks(const char* json, const int* chunkLengths, CLKSJSONDecodeCallbacks* callbacks, EventLog* log)
+{
+    char scratch[1000];
+    CLKSJSONStreamDecodeContext context;
+    log->length = 0;
+    clksjson_beginDecode(&context, scratch, sizeof(scratch), callbacks, log);
+    const int length = (int)strlen(json);
+    int offset = 0;
+    for(; chunkLengths != NULL && *chunkLengths != 0; chunkLengths++)
+    {
+        clksjson_decodeChunk(&context, json + offset, *chunkLengths);
+        offset += *chunkLengths;
+    }
+    clksjson_decodeChunk(&context, json + offset, length - offset);
+    return clksjson_endDecode(&context);
+}
+
+static int addToOutput(const char* data, int length, void* userData)
+{
+    Output* output = userData;
+    if(output->length + length >= LOG_CAPACITY)
+    {
+        return CLKSJSON_ERROR_CANNOT_ADD_DATA;
+    }
+    memcpy(output->text + output->length, data, (size_t)length);
+    output->length += length;
+    output->text[output->length] = '\0';
+    return CLKSJSON_OK;
+}
+
+/** Embed JSON in an object as the member "user", the way userInfo is. */
+static int embedJSON(const char* json, Output* output)
+{
+    CLKSJSONEncodeContext context;
+    output->length = 0;
+    clksjson_beginEncode(&context, false, addToOutput, output);
+    clksjson_beginObject(&context, NULL);
+    int result = clksjson_addJSONElement(&context, "user", json, (int)strlen(json), true);
+    clksjson_endEncode(&context);
+    return result;
+}
+
+static bool isSameLog(const EventLog* a, const EventLog* b)
+{
+    return a->length == b->length && memcmp(a->text, b->text, (size_t)a->length) == 0;
+}
+
+
+// ============================================================================
+#pragma mark - Tests -
+// ============================================================================
+
+static const char g_document[] =
+    "{\"name\": \"Crash \\\"quoted\\\"\\n\\ttab \\u00e9 \\ud83d\\ude00 end\","
+    " \"plain\":\"no escapes here\",\"empty\":\"\","
+    " \"numbers\": [0, -1, 42, 9223372036854775807, 99999999999999999999, -0.5, 1.25e3, 2E-2],"
+    " \"literals\": [true, false, null],"
+    " \"nested\": {\"a\": {\"b\": [[], {}, [1, [2, [3]]]]}},"
+    " \"trailing\": [1, 2, ], \"last\": 7}";
+
+static void testSplitAtEveryByte(void)
+{
+    CLKSJSONDecodeCallbacks* callbackSets[] = {&g_callbacks, &g_sliceCallbacks};
+    for(int set = 0; set < 2; set++)
+    {
+        EventLog whole;
+        EventLog split;
+        CLKSTEST_CHECK(decodeInChunks(g_document, NULL, callbackSets[set], &whole) == CLKSJSON_OK);
+        CLKSTEST_CHECK(strstr(whole.text, "name string=Crash \"quoted\"\n\ttab \xc3\xa9 \xf0\x9f\x98\x80 end\n") != NULL);
+        CLKSTEST_CHECK(strstr(whole.text, "- int=9223372036854775807\n") != NULL);
+        CLKSTEST_CHECK(strstr(whole.text, "- float=1e+20\n") != NULL);
+        CLKSTEST_CHECK(strstr(whole.text, "- float=1250\n") != NULL);
+        CLKSTEST_CHECK(strstr(whole.text, "empty string=\n") != NULL);
+        CLKSTEST_CHECK(strstr(whole.text, "last int=7\n- end=\n- done=\n") != NULL);
+
+        int mismatchCount = 0;
+        const int length = (int)strlen(g_document);
+        for(int splitOffset = 1; splitOffset < length; splitOffset++)
+        {
+            int chunkLengths[] = {splitOffset, 0};
+            int result = decodeInChunks(g_document, chunkLengths, callbackSets[set], &split);
+            mismatchCount += result != CLKSJSON_OK || !isSameLog(&whole, &split);
+        }
+        CLKSTEST_CHECK(mismatchCount == 0);
+
+        int* byteLengths = malloc(sizeof(*byteLengths) * (size_t)length);
+        for(int i = 0; i < length - 1; i++)
+        {
+            byteLengths[i] = 1;
+        }
+        byteLengths[length - 1] = 0;
+        CLKSTEST_CHECK(decodeInChunks(g_document, byteLengths, callbackSets[set], &split) == CLKSJSON_OK);
+        CLKSTEST_CHECK(isSameLog(&whole, &split));
+        free(byteLengths);
+    }
+}
+
+static void testSurrogates(void)
+{
+    EventLog log;
+    CLKSTEST_CHECK(decodeInChunks("[\"\\ud83d\\ude00\"]", NULL, &g_callbacks, &log) == CLKSJSON_OK);
+    CLKSTEST_CHECK(strstr(log.text, "string=\xf0\x9f\x98\x80\n") != NULL);
+    // Split between the two halves of the pair.
+    int chunkLengths[] = {8, 0};
+    CLKSTEST_CHECK(decodeInChunks("[\"\\ud83d\\ude00\"]", chunkLengths, &g_sliceCallbacks, &log) == CLKSJSON_OK);
+    CLKSTEST_CHECK(strstr(log.text, "string=\xf0\x9f\x98\x80\n") != NULL);
+
+    CLKSTEST_CHECK(decodeInChunks("[\"\\ud83d\"]", NULL, &g_callbacks, &log) == CLKSJSON_ERROR_INVALID_CHARACTER);
+    CLKSTEST_CHECK(decodeInChunks("[\"\\ud83dx\"]", NULL, &g_callbacks, &log) == CLKSJSON_ERROR_INVALID_CHARACTER);
+    CLKSTEST_CHECK(decodeInChunks("[\"\\ud83d\\n\"]", NULL, &g_callbacks, &log) == CLKSJSON_ERROR_INVALID_CHARACTER);
+    CLKSTEST_CHECK(decodeInChunks("[\"\\ud83d\\u0041\"]", NULL, &g_callbacks, &log) == CLKSJSON_ERROR_INVALID_CHARACTER);
+    CLKSTEST_CHECK(decodeInChunks("[\"\\ude00\"]", NULL, &g_callbacks, &log) == CLKSJSON_ERROR_INVALID_CHARACTER);
+
+    // Passed through strings are checked the same way.
+    Output output;
+    CLKSTEST_CHECK(embedJSON("[\"\\ud83d\\ude00\"]", &output) == CLKSJSON_OK);
+    CLKSTEST_CHECK(strcmp(output.text, "{\"user\":[\"\\ud83d\\ude00\"]}") == 0);
+    CLKSTEST_CHECK(embedJSON("[\"\\ud83d\"]", &output) != CLKSJSON_OK);
+    CLKSTEST_CHECK(embedJSON("[\"\\ude00\"]", &output) != CLKSJSON_OK);
+}
+
+static void testPassThroughValidation(void)
+{
+    const char* valid[][2] =
+    {
+        {"12", "12"},
+        {"-0", "-0"},
+        {"[0, -1.5, 1e5, -0.5E-3, 2e+10]", "[0, -1.5, 1e5, -0.5E-3, 2e+10]"},
+        {"{\"a\": [true, false, null], \"b\": \"x\\\"y\"}", "{\"a\": [true, false, null], \"b\": \"x\\\"y\"}"},
+    };
+    for(size_t i = 0; i < sizeof(valid) / sizeof(*valid); i++)
+    {
+        Output output;
+        char expected[200];
+        snprintf(expected, sizeof(expected), "{\"user\":%s}", valid[i][1]);
+        CLKSTEST_CHECK(embedJSON(valid[i][0], &output) == CLKSJSON_OK);
+        CLKSTEST_CHECK(strcmp(output.text, expected) == 0);
+    }
+
+    const char* invalid[] =
+    {
+        "-", "[-]", "[1.2.3]", "[01]", "[-01]", "[1.]", "[.5]", "[1e]", "[1e+]", "[1-2]", "[+1]",
+        "[1,,2]", "[,1]", "{\"a\":1,,}", "{,}", "[tru]", "[\"open]", "{\"a\" 1}", "[1}", "[1",
+    };
+    for(size_t i = 0; i < sizeof(invalid) / sizeof(*invalid); i++)
+    {
+        Output output;
+        EventLog log;
+        int result = embedJSON(invalid[i], &output);
+        CLKSTEST_CHECK(result != CLKSJSON_OK);
+        if(result == CLKSJSON_OK)
+        {
+            fprintf(stderr, "    accepted %s as %s\n", invalid[i], output.text);
+        }
+        // The decoder refuses it too.
+        CLKSTEST_CHECK(decodeInChunks(invalid[i], NULL, &g_callbacks, &log) != CLKSJSON_OK);
+    }
+}
+
+static void testTrailingCommas(void)
+{
+    const char* cases[][2] =
+    {
+        {"[1,2,]", "[1,2]"},
+        {"{\"a\":1,}", "{\"a\":1}"},
+        {"[ 1 , 2 , ]", "[ 1 , 2  ]"},
+        {"{\"a\":[1,],\"b\":{\"c\":3,},}", "{\"a\":[1],\"b\":{\"c\":3}}"},
+        {"[[1,],[2,],]", "[[1],[2]]"},
+    };
+    for(size_t i = 0; i < sizeof(cases) / sizeof(*cases); i++)
+    {
+        Output output;
+        char expected[200];
+        snprintf(expected, sizeof(expected), "{\"user\":%s}", cases[i][1]);
+        CLKSTEST_CHECK(embedJSON(cases[i][0], &output) == CLKSJSON_OK);
+        CLKSTEST_CHECK(strcmp(output.text, expected) == 0);
+
+        // Split just after each comma, so it's withheld across chunks.
+        EventLog whole;
+        EventLog split;
+        CLKSTEST_CHECK(decodeInChunks(cases[i][0], NULL, &g_callbacks, &whole) == CLKSJSON_OK);
+        for(const char* comma = strchr(cases[i][0], ','); comma != NULL; comma = strchr(comma + 1, ','))
+        {
+            int chunkLengths[] = {(int)(comma - cases[i][0]) + 1, 0};
+            CLKSTEST_CHECK(decodeInChunks(cases[i][0], chunkLengths, &g_callbacks, &split) == CLKSJSON_OK);
+            CLKSTEST_CHECK(isSameLog(&whole, &split));
+        }
+    }
+}
+
+/** Encode data as the value of a one member object, and pull the string back out. */
+static int encodeData(const uint8_t* data, int length, CLKSJSONDataEncoding encoding, int fragmentLength, char* value)
+{
+    Output output;
+    output.length = 0;
+    CLKSJSONEncodeContext context;
+    clksjson_beginEncode(&context, false, addToOutput, &output);
+    clksjson_setDataEncoding(&context, encoding);
+    clksjson_beginObject(&context, NULL);
+    if(fragmentLength == 0)
+    {
+        clksjson_addDataElement(&context, "d", (const char*)data, length);
+    }
+    else
+    {
+        clksjson_beginDataElement(&context, "d");
+        for(int offset = 0; offset < length; offset += fragmentLength)
+        {
+            int remaining = length - offset;
+            clksjson_appendDataElement(&context, (const char*)data + offset,
+                                       remaining < fragmentLength ? remaining : fragmentLength);
+        }
+        clksjson_endDataElement(&context);
+    }
+    clksjson_endEncode(&context);
+    // {"d":"..."}
+    int valueLength = output.length - 8;
+    memcpy(value, output.text + 6, (size_t)valueLength);
+    value[valueLength] = '\0';
+    return valueLength;
+}
+
+static void testDataRoundTrips(void)
+{
+    uint8_t data[100];
+    for(int i = 0; i < (int)sizeof(data); i++)
+    {
+        data[i] = (uint8_t)(i * 37 + 11);
+    }
+
+    int mismatchCount = 0;
+    for(int length = 0; length <= (int)sizeof(data); length++)
+    {
+        for(int fragmentLength = 0; fragmentLength <= 4; fragmentLength++)
+        {
+            char value[300];
+            uint8_t decoded[100];
+
+            int valueLength = encodeData(data, length, CLKSJSONDataEncodingHex, fragmentLength, value);
+            mismatchCount += valueLength != length * 2;
+            int decodedLength = clksjson_decodeDataElement(value, valueLength, decoded, sizeof(decoded));
+            mismatchCount += decodedLength != length || memcmp(decoded, data, (size_t)length) != 0;
+
+            valueLength = encodeData(data, length, CLKSJSONDataEncodingBase64, fragmentLength, value);
+            mismatchCount += strncmp(value, CLKSJSON_BASE64_DATA_PREFIX, strlen(CLKSJSON_BASE64_DATA_PREFIX)) != 0;
+            mismatchCount += valueLength != (int)strlen(CLKSJSON_BASE64_DATA_PREFIX) + (length + 2) / 3 * 4;
+            decodedLength = clksjson_decodeDataElement(value, valueLength, decoded, sizeof(decoded));
+            mismatchCount += decodedLength != length || memcmp(decoded, data, (size_t)length) != 0;
+        }
+    }
+    CLKSTEST_CHECK(mismatchCount == 0);
+
+    char value[100];
+    encodeData((const uint8_t*)"Man", 3, CLKSJSONDataEncodingBase64, 0, value);
+    CLKSTEST_CHECK(strcmp(value, "base64:TWFu") == 0);
+    encodeData((const uint8_t*)"Ma", 2, CLKSJSONDataEncodingBase64, 1, value);
+    CLKSTEST_CHECK(strcmp(value, "base64:TWE=") == 0);
+    encodeData((const uint8_t*)"\x01\xab", 2, CLKSJSONDataEncodingHex, 0, value);
+    CLKSTEST_CHECK(strcmp(value, "01AB") == 0);
+
+    uint8_t decoded[10];
+    CLKSTEST_CHECK(clksjson_decodeDataElement("01ab", 4, decoded, sizeof(decoded)) == 2);
+    CLKSTEST_CHECK(decoded[0] == 0x01 && decoded[1] == 0xab);
+    CLKSTEST_CHECK(clksjson_decodeDataElement("01A", 3, decoded, sizeof(decoded)) == -1);
+    CLKSTEST_CHECK(clksjson_decodeDataElement("0G", 2, decoded, sizeof(decoded)) == -1);
+    CLKSTEST_CHECK(clksjson_decodeDataElement("base64:TWE", 10, decoded, sizeof(decoded)) == -1);
+    CLKSTEST_CHECK(clksjson_decodeDataElement("base64:TW!=", 11, decoded, sizeof(decoded)) == -1);
+    // Too big for the destination.
+    CLKSTEST_CHECK(clksjson_decodeDataElement("base64:TWFuTWFu", 15, decoded, 5) == -1);
+    CLKSTEST_CHECK(clksjson_decodeDataElement("0102030405", 10, decoded, 4) == -1);
+}
+
+
+int main(void)
+{
+    testSplitAtEveryByte();
+    testSurrogates();
+    testPassThroughValidation();
+    testTrailingCommas();
+    testDataRoundTrips();
+    return CLKSTEST_RESULT();
+}
@@ -0,0 +1,234 @@
+//
+//  CLKSMemory_Tests.c
+//
+//  Copyright (c) 2012 Karl Stenerud. All rights reserved.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall remain in place
+// in this source code.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+
+
+
+/* Checks the safe memory reader: page cache hits and known-unreadable pages,
+ * that the cache belongs to the thread that enabled it, batched copies, and
+ * partial copies up to an unreadable page.
+ */
+
+
+#include "CLKSMemory.h"
+#include "CLKSTestCheck.h"
+
+#include <pthread.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+static int g_readCount;
+static long g_pageSize;
+/** A readable page followed by an unreadable one. */
+static uint8_t* g_pages;
+
+
+// ============================================================================
+#pragma mark - Helpers -
+// ============================================================================
+
+/** The kernel reader, counting calls. */
+static int countingReader(const void* src, void* dst, int byteCount)
+{
+    __atomic_add_fetch(&g_readCount, 1, __ATOMIC_RELAXED);
+    struct iovec local = { .iov_base = dst, .iov_len = (size_t)byteCount };
+    struct iovec remote = { .iov_base = (void*)src, .iov_len = (size_t)byteCount };
+    ssize_t bytesCopied = process_vm_readv(getpid(), &local, 1, &remote, 1, 0);
+    return bytesCopied < 0 ? 0 : (int)bytesCopied;
+}
+
+static void setUp(void)
+{
+    g_pageSize = sysconf(_SC_PAGESIZE);
+    g_pages = mmap(NULL, (size_t)g_pageSize * 2, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    for(long i = 0; i < g_pageSize; i++)
+    {
+        g_pages[i] = (uint8_t)i;
+    }
+    mprotect(g_pages + g_pageSize, (size_t)g_pageSize, PROT_NONE);
+}
+
+
+// ============================================================================
+#pragma mark - Tests -
+// ============================================================================
+
+static void testPageCacheHit(void)
+{
+    uint8_t buffer[64];
+    clksmem_setReader(countingReader);
+    g_readCount = 0;
+    CLKSTEST_CHECK(!clksmem_setPageCacheEnabled(true));
+
+    CLKSTEST_CHECK(clksmem_copySafely(g_pages, buffer, sizeof(buffer)));
+    CLKSTEST_CHECK(g_readCount == 1);
+
+    // The page is now known to be readable, so the next read is a plain copy.
+    uint64_t syscallsSaved = clksmem_getSyscallsSaved();
+    g_pages[100] = 0xee;
+    CLKSTEST_CHECK(clksmem_copySafely(g_pages + 100, buffer, sizeof(buffer)));
+    CLKSTEST_CHECK(g_readCount == 1);
+    CLKSTEST_CHECK(clksmem_getSyscallsSaved() == syscallsSaved + 1);
+    CLKSTEST_CHECK(buffer[0] == 0xee && buffer[1] == 101);
+    CLKSTEST_CHECK(clksmem_isMemoryReadable(g_pages, (int)g_pageSize));
+    CLKSTEST_CHECK(g_readCount == 1);
+    g_pages[100] = 100;
+
+    // Disabling clears the cache.
+    CLKSTEST_CHECK(clksmem_setPageCacheEnabled(false));
+    CLKSTEST_CHECK(clksmem_copySafely(g_pages, buffer, sizeof(buffer)));
+    CLKSTEST_CHECK(clksmem_copySafely(g_pages, buffer, sizeof(buffer)));
+    CLKSTEST_CHECK(g_readCount == 3);
+    clksmem_setReader(NULL);
+}
+
+static void testPageCacheFail(void)
+{
+    uint8_t buffer[64];
+    uint8_t* unreadable = g_pages + g_pageSize;
+    clksmem_setReader(countingReader);
+    g_readCount = 0;
+    clksmem_setPageCacheEnabled(true);
+
+    CLKSTEST_CHECK(!clksmem_isKnownUnreadable(unreadable, sizeof(buffer)));
+    CLKSTEST_CHECK(!clksmem_copySafely(unreadable, buffer, sizeof(buffer)));
+    CLKSTEST_CHECK(g_readCount == 1);
+    CLKSTEST_CHECK(clksmem_isKnownUnreadable(unreadable, sizeof(buffer)));
+
+    // Known to fail, so the reader isn't asked again.
+    uint64_t syscallsSaved = clksmem_getSyscallsSaved();
+    CLKSTEST_CHECK(!clksmem_copySafely(unreadable + 8, buffer, sizeof(buffer)));
+    CLKSTEST_CHECK(!clksmem_isMemoryReadable(unreadable, 1));
+    CLKSTEST_CHECK(g_readCount == 1);
+    CLKSTEST_CHECK(clksmem_getSyscallsSaved() == syscallsSaved + 2);
+
+    // A range spanning a known readable page and the unreadable one is unreadable.
+    CLKSTEST_CHECK(!clksmem_isKnownUnreadable(g_pages + g_pageSize - 8, 16));
+    CLKSTEST_CHECK(clksmem_copySafely(g_pages, buffer, sizeof(buffer)));
+    CLKSTEST_CHECK(clksmem_isKnownUnreadable(g_pages + g_pageSize - 8, 16));
+    CLKSTEST_CHECK(!clksmem_isKnownUnreadable(g_pages, 16));
+
+    clksmem_setPageCacheEnabled(false);
+    CLKSTEST_CHECK(!clksmem_isKnownUnreadable(unreadable, sizeof(buffer)));
+    clksmem_setReader(NULL);
+}
+
+static void* otherThreadReads(void* userData)
+{
+    bool* passed = userData;
+    uint8_t buffer[64];
+    int readCount = g_readCount;
+    *passed = clksmem_copySafely(g_pages, buffer, sizeof(buffer)) &&
+              !clksmem_copySafely(g_pages + g_pageSize, buffer, sizeof(buffer)) &&
+              !clksmem_isKnownUnreadable(g_pages + g_pageSize, sizeof(buffer)) &&
+              g_readCount == readCount + 2;
+    return NULL;
+}
+
+static void testPageCacheOwnedByThread(void)
+{
+    uint8_t buffer[64];
+    clksmem_setReader(countingReader);
+    clksmem_setPageCacheEnabled(true);
+    clksmem_copySafely(g_pages, buffer, sizeof(buffer));
+    clksmem_copySafely(g_pages + g_pageSize, buffer, sizeof(buffer));
+
+    // Another thread always goes to the reader, even for pages the owner knows.
+    bool passed = false;
+    pthread_t thread;
+    pthread_create(&thread, NULL, otherThreadReads, &passed);
+    pthread_join(thread, NULL);
+    CLKSTEST_CHECK(passed);
+
+    clksmem_setPageCacheEnabled(false);
+    clksmem_setReader(NULL);
+}
+
+static void testCopySafelyMany(void)
+{
+    enum { REQUEST_COUNT = 100, UNREADABLE_INDEX = 70 };
+    static uint8_t buffers[REQUEST_COUNT][16];
+    CLKSMemoryCopyRequest requests[REQUEST_COUNT];
+    for(int i = 0; i < REQUEST_COUNT; i++)
+    {
+        const uint8_t* src = i == UNREADABLE_INDEX ? g_pages + g_pageSize : g_pages + i * 32;
+        requests[i] = (CLKSMemoryCopyRequest){ .src = src, .dst = buffers[i], .byteCount = sizeof(buffers[i]) };
+    }
+    memset(buffers, 0, sizeof(buffers));
+
+    // The default reader batches, so most requests don't need their own call.
+    uint64_t syscallsSaved = clksmem_getSyscallsSaved();
+    CLKSTEST_CHECK(clksmem_copySafelyMany(requests, REQUEST_COUNT) == REQUEST_COUNT - 1);
+    CLKSTEST_CHECK(clksmem_getSyscallsSaved() - syscallsSaved >= REQUEST_COUNT - 4);
+    int mismatchCount = 0;
+    for(int i = 0; i < REQUEST_COUNT; i++)
+    {
+        if(requests[i].succeeded != (i != UNREADABLE_INDEX) ||
+           (requests[i].succeeded && memcmp(buffers[i], g_pages + i * 32, sizeof(buffers[i])) != 0))
+        {
+            mismatchCount++;
+        }
+    }
+    CLKSTEST_CHECK(mismatchCount == 0);
+
+    // A replaced reader gets one call per request.
+    clksmem_setReader(countingReader);
+    g_readCount = 0;
+    CLKSTEST_CHECK(clksmem_copySafelyMany(requests, REQUEST_COUNT) == REQUEST_COUNT - 1);
+    CLKSTEST_CHECK(g_readCount == REQUEST_COUNT);
+
+    // With the cache on, a second pass is answered entirely from the cache.
+    clksmem_setPageCacheEnabled(true);
+    clksmem_copySafelyMany(requests, REQUEST_COUNT);
+    g_readCount = 0;
+    CLKSTEST_CHECK(clksmem_copySafelyMany(requests, REQUEST_COUNT) == REQUEST_COUNT - 1);
+    CLKSTEST_CHECK(g_readCount == 0);
+    clksmem_setPageCacheEnabled(false);
+    clksmem_setReader(NULL);
+}
+
+static void testPartialCopies(void)
+{
+    static uint8_t buffer[256];
+    uint8_t* nearEnd = g_pages + g_pageSize - 100;
+    CLKSTEST_CHECK(clksmem_copyMaxPossible(nearEnd, buffer, sizeof(buffer)) == 100);
+    CLKSTEST_CHECK(memcmp(buffer, nearEnd, 100) == 0);
+    CLKSTEST_CHECK(clksmem_maxReadableBytes(nearEnd, sizeof(buffer)) == 100);
+    CLKSTEST_CHECK(clksmem_maxReadableBytes(g_pages, (int)g_pageSize * 2) == (int)g_pageSize);
+    CLKSTEST_CHECK(!clksmem_copySafely(nearEnd, buffer, sizeof(buffer)));
+    CLKSTEST_CHECK(clksmem_copyMaxPossible(g_pages + g_pageSize, buffer, sizeof(buffer)) == 0);
+}
+
+
+int main(void)
+{
+    setUp();
+    testPageCacheHit();
+    testPageCacheFail();
+    testPageCacheOwnedByThread();
+    testCopySafelyMany();
+    testPartialCopies();
+    return CLKSTEST_RESULT();
+}
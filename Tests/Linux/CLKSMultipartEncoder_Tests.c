@@ -0,0 +1,398 @@
+//
+//  CLKSMultipartEncoder_Tests.c
+//
+//  Copyright (c) 2012 Karl Stenerud. All rights reserved.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall remain in place
+// in this source code.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+
+
+
+/* Streams multipart bodies through buffers of various sizes and compares them
+ * against bodies built in one piece here, covering every kind of field
+ * source, rewinding, large files and short reads.
+ */
+
+
+#include "CLKSMultipartEncoder.h"
+#include "CLKSTestCheck.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define BOUNDARY "BOUNDARY"
+#define FILE_LENGTH 3000
+#define LARGE_FILE_LENGTH (8 * 1024 * 1024)
+
+static char g_directory[] = "/tmp/CLKSMultipartEncoder_Tests.XXXXXX";
+static char g_filePath[100];
+static char g_fileContents[FILE_LENGTH];
+
+
+// ============================================================================
+#pragma mark - Expected Bodies -
+// ============================================================================
+
+typedef struct
+{
+    char* bytes;
+    int length;
+    int capacity;
+} Body;
+
+static void append(Body* body, const char* bytes, int length)
+{
+    if(body->length + length > body->capacity)
+    {
+        body->capacity = (body->length + length) * 2;
+        body->bytes = realloc(body->bytes, (size_t)body->capacity);
+    }
+    memcpy(body->bytes + body->length, bytes, (size_t)length);
+    body->length += length;
+}
+
+static void appendString(Body* body, const char* string)
+{
+    append(body, string, (int)strlen(string));
+}
+
+static void appendQuoted(Body* body, const char* string)
+{
+    appendString(body, "\"");
+    for(const char* ch = string; *ch != '\0'; ch++)
+    {
+        if(*ch == '"')
+        {
+            appendString(body, "\\");
+        }
+        append(body, ch, 1);
+    }
+    appendString(body, "\"");
+}
+
+/** Append a field the way RFC 7578 lays it out. */
+static void appendField(Body* body, const char* name, const char* contentType, const char* filename,
+                        const char* contents, int length)
+{
+    if(body->length > 0)
+    {
+        appendString(body, "\r\n");
+    }
+    appendString(body, "--" BOUNDARY "\r\nContent-Disposition: form-data; name=");
+    appendQuoted(body, name);
+    if(filename != NULL)
+    {
+        appendString(body, "; filename=");
+        appendQuoted(body, filename);
+    }
+    appendString(body, "\r\n");
+    if(contentType != NULL)
+    {
+        appendString(body, "Content-Type: ");
+        appendString(body, contentType);
+        appendString(body, "\r\n");
+    }
+    appendString(body, "\r\n");
+    append(body, contents, length);
+}
+
+static void appendTrailer(Body* body)
+{
+    appendString(body, "\r\n--" BOUNDARY "--\r\n");
+}
+
+
+// ============================================================================
+#pragma mark - Helpers -
+// ============================================================================
+
+typedef struct
+{
+    const char* contents;
+    int length;
+    int offset;
+} Reader;
+
+/** Hands out at most 3 bytes at a time, to exercise partial reads. */
+static int readFunction(char* buffer, int bufferLength, void* userData)
+{
+    Reader* reader = userData;
+    int length = reader->length - reader->offset;
+    if(length > bufferLength)
+    {
+        length = bufferLength;
+    }
+    if(length > 3)
+    {
+        length = 3;
+    }
+    memcpy(buffer, reader->contents + reader->offset, (size_t)length);
+    reader->offset += length;
+    return length;
+}
+
+/** Read a whole body, chunkSize bytes at a time.
+ *
+ * @return The last value clksmp_read() returned (0 at the end, -1 on failure).
+ */
+static int readBody(CLKSMultipartEncoder* encoder, int chunkSize, Body* body)
+{
+    char* buffer = malloc((size_t)chunkSize);
+    int bytesRead;
+    bool overran = false;
+    while((bytesRead = clksmp_read(encoder, buffer, chunkSize)) > 0)
+    {
+        overran = overran || bytesRead > chunkSize;
+        append(body, buffer, bytesRead);
+    }
+    CLKSTEST_CHECK(!overran);
+    free(buffer);
+    return bytesRead;
+}
+
+static bool writeFile(const char* path, const char* contents, int length)
+{
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(fd < 0)
+    {
+        return false;
+    }
+    bool succeeded = write(fd, contents, (size_t)length) == length;
+    close(fd);
+    return succeeded;
+}
+
+
+// ============================================================================
+#pragma mark - Tests -
+// ============================================================================
+
+static void testEveryFieldSource(void)
+{
+    Body expected = {0};
+    appendField(&expected, "na\"me", "text/plain", NULL, "hello", 5);
+    appendField(&expected, "report", "application/json", "rep\"ort.json", g_fileContents, FILE_LENGTH);
+    appendField(&expected, "slice", NULL, "s.bin", g_fileContents + 3, 10);
+    appendField(&expected, "fn", NULL, NULL, "function-data", 13);
+    appendTrailer(&expected);
+
+    const int chunkSizes[] = {1, 2, 3, 7, 64, 1000, 65536};
+    for(size_t i = 0; i < sizeof(chunkSizes) / sizeof(*chunkSizes); i++)
+    {
+        int fd = open(g_filePath, O_RDONLY);
+        lseek(fd, 100, SEEK_SET);
+        Reader reader = {"function-data", 13, 0};
+
+        CLKSMultipartEncoder encoder;
+        CLKSTEST_CHECK(clksmp_initialize(&encoder, BOUNDARY));
+        CLKSTEST_CHECK(clksmp_addBytes(&encoder, "na\"me", "text/plain", NULL, "hello", 5));
+        CLKSTEST_CHECK(clksmp_addFile(&encoder, "report", "application/json", "rep\"ort.json", g_filePath));
+        CLKSTEST_CHECK(clksmp_addFD(&encoder, "slice", NULL, "s.bin", fd, 3, 10));
+        CLKSTEST_CHECK(clksmp_addReadFunction(&encoder, "fn", NULL, NULL, 13, readFunction, &reader));
+        CLKSTEST_CHECK(strcmp(clksmp_getContentType(&encoder), "multipart/form-data; boundary=" BOUNDARY) == 0);
+        CLKSTEST_CHECK(clksmp_getContentLength(&encoder) == expected.length);
+
+        Body body = {0};
+        CLKSTEST_CHECK(readBody(&encoder, chunkSizes[i], &body) == 0);
+        CLKSTEST_CHECK(body.length == expected.length);
+        CLKSTEST_CHECK(body.length == expected.length && memcmp(body.bytes, expected.bytes, (size_t)body.length) == 0);
+        // The caller's file position is left alone.
+        CLKSTEST_CHECK(lseek(fd, 0, SEEK_CUR) == 100);
+        // A read function can't be read twice.
+        CLKSTEST_CHECK(!clksmp_rewind(&encoder));
+
+        clksmp_close(&encoder);
+        close(fd);
+        free(body.bytes);
+    }
+    free(expected.bytes);
+}
+
+static void testRewind(void)
+{
+    Body expected = {0};
+    appendField(&expected, "f", NULL, NULL, g_fileContents, FILE_LENGTH);
+    appendField(&expected, "b", NULL, NULL, "bytes", 5);
+    appendTrailer(&expected);
+
+    CLKSMultipartEncoder encoder;
+    clksmp_initialize(&encoder, BOUNDARY);
+    clksmp_addFile(&encoder, "f", NULL, NULL, g_filePath);
+    clksmp_addBytes(&encoder, "b", NULL, NULL, "bytes", 5);
+
+    // Stop partway through, then start again.
+    char buffer[100];
+    CLKSTEST_CHECK(clksmp_read(&encoder, buffer, sizeof(buffer)) == sizeof(buffer));
+    CLKSTEST_CHECK(clksmp_rewind(&encoder));
+    for(int pass = 0; pass < 2; pass++)
+    {
+        Body body = {0};
+        CLKSTEST_CHECK(readBody(&encoder, 777, &body) == 0);
+        CLKSTEST_CHECK(body.length == expected.length && memcmp(body.bytes, expected.bytes, (size_t)body.length) == 0);
+        CLKSTEST_CHECK(clksmp_rewind(&encoder));
+        free(body.bytes);
+    }
+    clksmp_close(&encoder);
+    free(expected.bytes);
+}
+
+static void testShortFile(void)
+{
+    char path[200];
+    snprintf(path, sizeof(path), "%s/short", g_directory);
+    writeFile(path, g_fileContents, FILE_LENGTH);
+
+    CLKSMultipartEncoder encoder;
+    clksmp_initialize(&encoder, BOUNDARY);
+    clksmp_addFile(&encoder, "f", NULL, NULL, path);
+    // The file shrinks after its length was promised.
+    truncate(path, 5);
+    Body body = {0};
+    CLKSTEST_CHECK(readBody(&encoder, 1000, &body) == -1);
+    CLKSTEST_CHECK(body.length < clksmp_getContentLength(&encoder));
+    // Failure sticks until a rewind.
+    char buffer[10];
+    CLKSTEST_CHECK(clksmp_read(&encoder, buffer, sizeof(buffer)) == -1);
+
+    clksmp_close(&encoder);
+    unlink(path);
+    free(body.bytes);
+}
+
+static void testLargeFileStreams(void)
+{
+    char path[200];
+    snprintf(path, sizeof(path), "%s/large", g_directory);
+    char* contents = malloc(LARGE_FILE_LENGTH);
+    for(int i = 0; i < LARGE_FILE_LENGTH; i++)
+    {
+        contents[i] = (char)(i * 7);
+    }
+    writeFile(path, contents, LARGE_FILE_LENGTH);
+
+    Body expected = {0};
+    appendField(&expected, "a", NULL, NULL, "xx", 2);
+    appendField(&expected, "file", "application/octet-stream", "large.bin", contents, LARGE_FILE_LENGTH);
+    appendTrailer(&expected);
+
+    CLKSMultipartEncoder encoder;
+    clksmp_initialize(&encoder, BOUNDARY);
+    clksmp_addBytes(&encoder, "a", NULL, NULL, "xx", 2);
+    clksmp_addFile(&encoder, "file", "application/octet-stream", "large.bin", path);
+    CLKSTEST_CHECK(clksmp_getContentLength(&encoder) == expected.length);
+
+    // Compare a piece at a time, so the body is never held whole.
+    char buffer[65536];
+    int offset = 0;
+    bool matches = true;
+    int bytesRead;
+    while((bytesRead = clksmp_read(&encoder, buffer, sizeof(buffer))) > 0)
+    {
+        matches = matches && offset + bytesRead <= expected.length &&
+                  memcmp(buffer, expected.bytes + offset, (size_t)bytesRead) == 0;
+        offset += bytesRead;
+    }
+    CLKSTEST_CHECK(bytesRead == 0);
+    CLKSTEST_CHECK(matches);
+    CLKSTEST_CHECK(offset == expected.length);
+
+    clksmp_close(&encoder);
+    unlink(path);
+    free(contents);
+    free(expected.bytes);
+}
+
+static void testGeneratedBoundary(void)
+{
+    CLKSMultipartEncoder encoder;
+    CLKSTEST_CHECK(clksmp_initialize(&encoder, NULL));
+    const char* prefix = "multipart/form-data; boundary=";
+    const char* contentType = clksmp_getContentType(&encoder);
+    CLKSTEST_CHECK(strncmp(contentType, prefix, strlen(prefix)) == 0);
+    const char* boundary = contentType + strlen(prefix);
+    CLKSTEST_CHECK(strlen(boundary) == 32);
+
+    clksmp_addBytes(&encoder, "a", NULL, NULL, "x", 1);
+    Body body = {0};
+    readBody(&encoder, 64, &body);
+    char opening[100];
+    snprintf(opening, sizeof(opening), "--%s\r\n", boundary);
+    char closing[100];
+    int closingLength = snprintf(closing, sizeof(closing), "\r\n--%s--\r\n", boundary);
+    CLKSTEST_CHECK(body.length > closingLength && strncmp(body.bytes, opening, strlen(opening)) == 0);
+    CLKSTEST_CHECK(body.length > closingLength &&
+                   memcmp(body.bytes + body.length - closingLength, closing, (size_t)closingLength) == 0);
+    clksmp_close(&encoder);
+    free(body.bytes);
+}
+
+static void testLimits(void)
+{
+    CLKSMultipartEncoder encoder;
+    char boundary[CLKSMP_MAX_BOUNDARY_LENGTH + 2];
+    memset(boundary, 'b', sizeof(boundary) - 1);
+    boundary[sizeof(boundary) - 1] = '\0';
+    CLKSTEST_CHECK(!clksmp_initialize(&encoder, boundary));
+    boundary[CLKSMP_MAX_BOUNDARY_LENGTH] = '\0';
+    CLKSTEST_CHECK(clksmp_initialize(&encoder, boundary));
+
+    char name[CLKSMP_MAX_HEADER_LENGTH];
+    memset(name, 'n', sizeof(name) - 1);
+    name[sizeof(name) - 1] = '\0';
+    CLKSTEST_CHECK(!clksmp_addBytes(&encoder, name, NULL, NULL, "x", 1));
+    CLKSTEST_CHECK(!clksmp_addFile(&encoder, "missing", NULL, NULL, "/nonexistent/file"));
+
+    for(int i = 0; i < CLKSMP_MAX_FIELDS; i++)
+    {
+        CLKSTEST_CHECK(clksmp_addBytes(&encoder, "f", NULL, NULL, "x", 1));
+    }
+    CLKSTEST_CHECK(!clksmp_addBytes(&encoder, "f", NULL, NULL, "x", 1));
+    CLKSTEST_CHECK(encoder.fieldCount == CLKSMP_MAX_FIELDS);
+    clksmp_close(&encoder);
+}
+
+
+int main(void)
+{
+    if(mkdtemp(g_directory) == NULL)
+    {
+        perror("mkdtemp");
+        return 1;
+    }
+    snprintf(g_filePath, sizeof(g_filePath), "%s/report.json", g_directory);
+    for(int i = 0; i < FILE_LENGTH; i++)
+    {
+        g_fileContents[i] = "{\"abc\": [1, 2, 3]}\n"[i % 19];
+    }
+    writeFile(g_filePath, g_fileContents, FILE_LENGTH);
+
+    testEveryFieldSource();
+    testRewind();
+    testShortFile();
+    testLargeFileStreams();
+    testGeneratedBoundary();
+    testLimits();
+
+    unlink(g_filePath);
+    rmdir(g_directory);
+    return CLKSTEST_RESULT();
+}
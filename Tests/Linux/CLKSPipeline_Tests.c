@@ -0,0 +1,245 @@
+//
+//  CLKSPipeline_Tests.c
+//
+//  Copyright (c) 2012 Karl Stenerud. All rights reserved.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall remain in place
+// in this source code.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+
+
+
+/* Runs items through pipelines with several workers per stage, checking
+ * that they come out in order, that every stage sees them in turn, that the
+ * item limit holds, and that destroying a busy pipeline frees what's left.
+ */
+
+
+#include "CLKSPipeline.h"
+#include "CLKSTestCheck.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#define ITEM_COUNT 3000
+#define MAX_ITEMS 16
+
+typedef struct
+{
+    int number;
+    /** Bit n is set by stage n. */
+    int marks;
+} Item;
+
+static CLKSPipeline* g_pipeline;
+static _Atomic(int) g_liveItemCount;
+static _Atomic(int) g_peakItemCount;
+static _Atomic(int) g_freedItemCount;
+static _Atomic(bool) g_wasOutOfStageOrder;
+
+
+// ============================================================================
+#pragma mark - Stages -
+// ============================================================================
+
+static Item* newItem(int number)
+{
+    Item* item = calloc(1, sizeof(*item));
+    item->number = number;
+    atomic_fetch_add(&g_liveItemCount, 1);
+    return item;
+}
+
+static void freeItem(void* item)
+{
+    atomic_fetch_add(&g_liveItemCount, -1);
+    atomic_fetch_add(&g_freedItemCount, 1);
+    free(item);
+}
+
+static void notePeak(void)
+{
+    int count = clkspl_getItemCount(g_pipeline);
+    int peak = atomic_load(&g_peakItemCount);
+    while(count > peak && !atomic_compare_exchange_weak(&g_peakItemCount, &peak, count))
+    {
+    }
+}
+
+/** Takes a random short time, so workers finish out of order. */
+static bool sleepingStage(void* item, __unused void* userData)
+{
+    usleep((useconds_t)(rand() % 300));
+    ((Item*)item)->marks |= 1;
+    notePeak();
+    return true;
+}
+
+/** Stops every 7th item. */
+static bool filteringStage(void* item, __unused void* userData)
+{
+    Item* typedItem = item;
+    if(typedItem->marks != 1)
+    {
+        atomic_store(&g_wasOutOfStageOrder, true);
+    }
+    typedItem->marks |= 2;
+    return typedItem->number % 7 != 0;
+}
+
+/** Spins for an amount of time that depends on the item. */
+static bool spinningStage(void* item, __unused void* userData)
+{
+    Item* typedItem = item;
+    volatile long sum = 0;
+    for(int i = 0; i < (typedItem->number % 13) * 2000; i++)
+    {
+        sum += i;
+    }
+    typedItem->marks |= 4;
+    return true;
+}
+
+static bool slowStage(__unused void* item, __unused void* userData)
+{
+    usleep(20000);
+    return true;
+}
+
+static void* pushItems(void* pipeline)
+{
+    for(int i = 0; i < ITEM_COUNT; i++)
+    {
+        if(!clkspl_push(pipeline, newItem(i)))
+        {
+            break;
+        }
+    }
+    clkspl_finish(pipeline);
+    return NULL;
+}
+
+
+// ============================================================================
+#pragma mark - Tests -
+// ============================================================================
+
+static void testItemsComeOutInOrder(void)
+{
+    CLKSPipelineStage stages[] =
+    {
+        {.name = "sleeping", .process = sleepingStage, .workerCount = 3, .queueCapacity = 2},
+        {.name = "filtering", .process = filteringStage, .workerCount = 2, .queueCapacity = 2},
+        {.name = "spinning", .process = spinningStage, .workerCount = 4, .queueCapacity = 2},
+    };
+    CLKSPipeline* pipeline = clkspl_create(stages, 3, MAX_ITEMS, freeItem);
+    CLKSTEST_CHECK(pipeline != NULL);
+    g_pipeline = pipeline;
+
+    pthread_t thread;
+    pthread_create(&thread, NULL, pushItems, pipeline);
+    int expectedNumber = 0;
+    int outOfOrderCount = 0;
+    int badMarksCount = 0;
+    void* item;
+    while(clkspl_pop(pipeline, &item))
+    {
+        Item* typedItem = item;
+        outOfOrderCount += typedItem->number != expectedNumber++;
+        // Stopped items skip the last stage.
+        badMarksCount += typedItem->marks != (typedItem->number % 7 == 0 ? 3 : 7);
+        if(typedItem->number % 500 == 0)
+        {
+            // A slow consumer holds the whole pipeline back.
+            usleep(5000);
+        }
+        freeItem(item);
+    }
+    pthread_join(thread, NULL);
+
+    CLKSTEST_CHECK(expectedNumber == ITEM_COUNT);
+    CLKSTEST_CHECK(outOfOrderCount == 0);
+    CLKSTEST_CHECK(badMarksCount == 0);
+    CLKSTEST_CHECK(!atomic_load(&g_wasOutOfStageOrder));
+    CLKSTEST_CHECK(atomic_load(&g_peakItemCount) <= MAX_ITEMS);
+    CLKSTEST_CHECK(clkspl_getItemCount(pipeline) == 0);
+
+    CLKSPipelineStageStats stats;
+    clkspl_getStageStats(pipeline, 0, &stats);
+    CLKSTEST_CHECK(stats.workerCount == 3);
+    CLKSTEST_CHECK(stats.itemsProcessed == ITEM_COUNT);
+    CLKSTEST_CHECK(stats.itemsStopped == 0);
+    CLKSTEST_CHECK(stats.busyNanoseconds > 0);
+    CLKSTEST_CHECK(stats.peakQueueDepth <= 2);
+    clkspl_getStageStats(pipeline, 1, &stats);
+    CLKSTEST_CHECK(stats.itemsProcessed == ITEM_COUNT);
+    CLKSTEST_CHECK(stats.itemsStopped == (ITEM_COUNT + 6) / 7);
+    clkspl_getStageStats(pipeline, 2, &stats);
+    CLKSTEST_CHECK(stats.itemsProcessed == ITEM_COUNT - (ITEM_COUNT + 6) / 7);
+    clkspl_destroy(pipeline);
+}
+
+static void testDestroyFreesRemainingItems(void)
+{
+    CLKSPipelineStage stages[] =
+    {
+        {.name = "slow", .process = slowStage, .workerCount = 2, .queueCapacity = 3},
+        {.name = "sleeping", .process = sleepingStage, .workerCount = 1, .queueCapacity = 1},
+    };
+    CLKSPipeline* pipeline = clkspl_create(stages, 2, 10, freeItem);
+    g_pipeline = pipeline;
+    atomic_store(&g_freedItemCount, 0);
+    for(int i = 0; i < 10; i++)
+    {
+        clkspl_push(pipeline, newItem(i));
+    }
+    void* item;
+    CLKSTEST_CHECK(clkspl_pop(pipeline, &item));
+    CLKSTEST_CHECK(((Item*)item)->number == 0);
+    freeItem(item);
+
+    // The rest are queued or being worked on.
+    clkspl_destroy(pipeline);
+    CLKSTEST_CHECK(atomic_load(&g_freedItemCount) == 10);
+    CLKSTEST_CHECK(atomic_load(&g_liveItemCount) == 0);
+}
+
+static void testFinishedPipeline(void)
+{
+    CLKSPipelineStage stage = {.name = "slow", .process = slowStage, .workerCount = 1, .queueCapacity = 1};
+    CLKSPipeline* pipeline = clkspl_create(&stage, 1, 4, freeItem);
+    clkspl_finish(pipeline);
+    Item item = {0};
+    CLKSTEST_CHECK(!clkspl_push(pipeline, &item));
+    void* popped;
+    CLKSTEST_CHECK(!clkspl_pop(pipeline, &popped));
+    clkspl_destroy(pipeline);
+
+    CLKSTEST_CHECK(clkspl_create(&stage, 0, 4, freeItem) == NULL);
+}
+
+
+int main(void)
+{
+    testItemsComeOutInOrder();
+    testDestroyFreesRemainingItems();
+    testFinishedPipeline();
+    return CLKSTEST_RESULT();
+}
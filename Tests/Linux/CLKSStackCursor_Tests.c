@@ -0,0 +1,302 @@
+//
+//  CLKSStackCursor_Tests.c
+//
+//  Copyright (c) 2012 Karl Stenerud. All rights reserved.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall remain in place
+// in this source code.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+
+
+
+/* Walks frame chains with the machine context stack cursor and checks every
+ * frame against a walk that reads one frame at a time, covering chains that
+ * fit in one stack snapshot, chains that leave it, unreadable frames, two
+ * cursors taking turns, and this thread's real stack.
+ */
+
+
+#include "CLKSMemory.h"
+#include "CLKSStackCursor_MachineContext.h"
+#include "CLKSTestCheck.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#define MAX_FRAMES 200
+
+typedef struct FrameEntry
+{
+    struct FrameEntry* previous;
+    uintptr_t returnAddress;
+} FrameEntry;
+
+/** Just enough of a machine context for the cursor. */
+struct CLKSMachineContext
+{
+    uintptr_t instructionAddress;
+    uintptr_t framePointer;
+};
+
+static int g_readCount;
+
+
+// ============================================================================
+#pragma mark - Stubs -
+// ============================================================================
+
+uintptr_t clkscpu_instructionAddress(const struct CLKSMachineContext* const context)
+{
+    return context->instructionAddress;
+}
+
+uintptr_t clkscpu_framePointer(const struct CLKSMachineContext* const context)
+{
+    return context->framePointer;
+}
+
+uintptr_t clkscpu_linkRegister(__unused const struct CLKSMachineContext* const context)
+{
+    return 0;
+}
+
+uintptr_t clkscpu_normaliseInstructionPointer(uintptr_t ip)
+{
+    return ip;
+}
+
+bool clkssymbolicator_symbolicate(__unused CLKSStackCursor* cursor)
+{
+    return false;
+}
+
+/** The kernel reader, counting calls. */
+static int countingReader(const void* src, void* dst, int byteCount)
+{
+    g_readCount++;
+    clksmem_setReader(NULL);
+    int bytesCopied = clksmem_copyMaxPossible(src, dst, byteCount);
+    clksmem_setReader(countingReader);
+    return bytesCopied;
+}
+
+
+// ============================================================================
+#pragma mark - Helpers -
+// ============================================================================
+
+/** Walk a chain one safe read per frame, the way the cursor used to. */
+static int walkPerFrame(const struct CLKSMachineContext* context, uintptr_t* addresses)
+{
+    int count = 0;
+    addresses[count++] = context->instructionAddress;
+    FrameEntry frame = {.previous = (FrameEntry*)context->framePointer};
+    while(count < MAX_FRAMES && clksmem_copySafely(frame.previous, &frame, sizeof(frame)))
+    {
+        if(frame.previous == NULL || frame.returnAddress == 0)
+        {
+            break;
+        }
+        addresses[count++] = frame.returnAddress;
+    }
+    return count;
+}
+
+static int walkWithCursor(const struct CLKSMachineContext* context, uintptr_t* addresses)
+{
+    CLKSStackCursor cursor;
+    clkssc_initWithMachineContext(&cursor, MAX_FRAMES, context);
+    int count = 0;
+    while(cursor.advanceCursor(&cursor))
+    {
+        addresses[count++] = cursor.stackEntry.address;
+    }
+    return count;
+}
+
+/** Walk both ways and compare.
+ *
+ * @return The number of frames, or -1 if the walks differ.
+ */
+static int checkWalk(const struct CLKSMachineContext* context, int* cursorReadCount)
+{
+    uintptr_t expected[MAX_FRAMES];
+    uintptr_t actual[MAX_FRAMES];
+    int expectedCount = walkPerFrame(context, expected);
+    g_readCount = 0;
+    clksmem_setReader(countingReader);
+    int actualCount = walkWithCursor(context, actual);
+    clksmem_setReader(NULL);
+    if(cursorReadCount != NULL)
+    {
+        *cursorReadCount = g_readCount;
+    }
+    if(actualCount != expectedCount || memcmp(actual, expected, sizeof(*actual) * (size_t)actualCount) != 0)
+    {
+        return -1;
+    }
+    return actualCount;
+}
+
+/** Link frames spaced evenly through a buffer, ending the chain after count frames. */
+static FrameEntry* buildChain(uint8_t* buffer, int count, int spacing, uintptr_t firstReturnAddress)
+{
+    for(int i = 0; i < count; i++)
+    {
+        FrameEntry* frame = (FrameEntry*)(buffer + i * spacing);
+        frame->previous = i + 1 < count ? (FrameEntry*)(buffer + (i + 1) * spacing) : NULL;
+        frame->returnAddress = firstReturnAddress + (uintptr_t)i;
+    }
+    return (FrameEntry*)buffer;
+}
+
+
+// ============================================================================
+#pragma mark - Tests -
+// ============================================================================
+
+static void testChainInOneSnapshot(void)
+{
+    uint8_t* stack = calloc(1, 16384);
+    struct CLKSMachineContext context =
+    {
+        .instructionAddress = 0x1000,
+        .framePointer = (uintptr_t)buildChain(stack, 150, 64, 0x2000),
+    };
+    int readCount;
+    // The last frame ends the chain, so its return address isn't reported.
+    CLKSTEST_CHECK(checkWalk(&context, &readCount) == 150);
+    // One snapshot instead of 150 single frame reads (copyMaxPossible probes first).
+    CLKSTEST_CHECK(readCount <= 2);
+    free(stack);
+}
+
+static void testChainLeavesSnapshot(void)
+{
+    // Frames 20 KB apart, so every one needs a new snapshot.
+    const int spacing = 20 * 1024;
+    uint8_t* stack = calloc(10, (size_t)spacing);
+    FrameEntry* chain = buildChain(stack, 10, spacing, 0x2000);
+    // Then a jump to a separate block.
+    uint8_t* other = calloc(1, 4096);
+    FrameEntry* lastFrame = (FrameEntry*)(stack + 9 * spacing);
+    lastFrame->previous = buildChain(other, 20, 32, 0x3000);
+
+    struct CLKSMachineContext context = {.instructionAddress = 0x1000, .framePointer = (uintptr_t)chain};
+    CLKSTEST_CHECK(checkWalk(&context, NULL) == 1 + 10 + 19);
+    free(other);
+    free(stack);
+}
+
+static void testUnreadableFrame(void)
+{
+    const long pageSize = sysconf(_SC_PAGESIZE);
+    uint8_t* pages = mmap(NULL, (size_t)pageSize * 2, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    // Frames run up to the end of the readable page, then point into the guard page.
+    const int frameCount = (int)(pageSize / (long)sizeof(FrameEntry));
+    FrameEntry* chain = buildChain(pages, frameCount, sizeof(FrameEntry), 0x2000);
+    chain[frameCount - 1].previous = (FrameEntry*)(pages + pageSize);
+    mprotect(pages + pageSize, (size_t)pageSize, PROT_NONE);
+
+    struct CLKSMachineContext context = {.instructionAddress = 0x1000, .framePointer = (uintptr_t)chain};
+    int frameLimit = frameCount + 1 < MAX_FRAMES ? frameCount + 1 : MAX_FRAMES;
+    CLKSTEST_CHECK(checkWalk(&context, NULL) == frameLimit);
+
+    // A frame pointer that is unreadable from the start.
+    context.framePointer = (uintptr_t)(pages + pageSize);
+    CLKSTEST_CHECK(checkWalk(&context, NULL) == 1);
+    munmap(pages, (size_t)pageSize * 2);
+}
+
+static void testCursorsTakingTurns(void)
+{
+    uint8_t* stackA = calloc(1, 8192);
+    uint8_t* stackB = calloc(1, 8192);
+    struct CLKSMachineContext contextA = {.instructionAddress = 0x1000, .framePointer = (uintptr_t)buildChain(stackA, 60, 64, 0xa000)};
+    struct CLKSMachineContext contextB = {.instructionAddress = 0x1000, .framePointer = (uintptr_t)buildChain(stackB, 90, 64, 0xb000)};
+
+    // Each refill of the shared snapshot must not confuse the other cursor.
+    CLKSStackCursor cursorA;
+    CLKSStackCursor cursorB;
+    clkssc_initWithMachineContext(&cursorA, MAX_FRAMES, &contextA);
+    clkssc_initWithMachineContext(&cursorB, MAX_FRAMES, &contextB);
+    int countA = 0;
+    int countB = 0;
+    int mismatchCount = 0;
+    bool hasMoreA = true;
+    bool hasMoreB = true;
+    while(hasMoreA || hasMoreB)
+    {
+        if(hasMoreA && (hasMoreA = cursorA.advanceCursor(&cursorA)))
+        {
+            mismatchCount += cursorA.stackEntry.address != (countA == 0 ? 0x1000 : 0xa000 + (uintptr_t)countA - 1);
+            countA++;
+        }
+        if(hasMoreB && (hasMoreB = cursorB.advanceCursor(&cursorB)))
+        {
+            mismatchCount += cursorB.stackEntry.address != (countB == 0 ? 0x1000 : 0xb000 + (uintptr_t)countB - 1);
+            countB++;
+        }
+    }
+    CLKSTEST_CHECK(countA == 60);
+    CLKSTEST_CHECK(countB == 90);
+    CLKSTEST_CHECK(mismatchCount == 0);
+    free(stackA);
+    free(stackB);
+}
+
+static int walkRealStack(int depth, int* frameCount);
+
+/** Called through here so the compiler can't fold the recursion into a loop. */
+static int (*volatile g_walkRealStack)(int depth, int* frameCount) = walkRealStack;
+
+static int __attribute__((noinline)) walkRealStack(int depth, int* frameCount)
+{
+    if(depth > 0)
+    {
+        // Not a tail call, so every level keeps its frame.
+        return g_walkRealStack(depth - 1, frameCount) + 1;
+    }
+    struct CLKSMachineContext context =
+    {
+        .instructionAddress = (uintptr_t)__builtin_return_address(0),
+        .framePointer = (uintptr_t)__builtin_frame_address(0),
+    };
+    *frameCount = checkWalk(&context, NULL);
+    return 0;
+}
+
+static void testRealStack(void)
+{
+    int frameCount = 0;
+    walkRealStack(40, &frameCount);
+    CLKSTEST_CHECK(frameCount > 40);
+}
+
+
+int main(void)
+{
+    testChainInOneSnapshot();
+    testChainLeavesSnapshot();
+    testUnreadableFrame();
+    testCursorsTakingTurns();
+    testRealStack();
+    return CLKSTEST_RESULT();
+}
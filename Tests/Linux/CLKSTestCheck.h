@@ -0,0 +1,56 @@
+//
+//  CLKSTestCheck.h
+//
+//  Copyright (c) 2012 Karl Stenerud. All rights reserved.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall remain in place
+// in this source code.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+
+
+/* Minimal checks for the Linux test programs in this directory.
+ *
+ * A failed check prints its location and keeps going, so one run shows every
+ * failure. Return CLKSTEST_RESULT() from main().
+ */
+
+
+#ifndef HDR_CLKSTestCheck_h
+#define HDR_CLKSTestCheck_h
+
+#include <stdio.h>
+
+static int g_checkCount;
+static int g_checkFailureCount;
+
+#define CLKSTEST_CHECK(CONDITION) \
+    do \
+    { \
+        g_checkCount++; \
+        if(!(CONDITION)) \
+        { \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #CONDITION); \
+            g_checkFailureCount++; \
+        } \
+    } while(0)
+
+#define CLKSTEST_RESULT() \
+    (fprintf(stderr, "%s: %d of %d checks passed\n", __FILE__, g_checkCount - g_checkFailureCount, g_checkCount), \
+     g_checkFailureCount == 0 ? 0 : 1)
+
+#endif // HDR_CLKSTestCheck_h
@@ -0,0 +1,316 @@
+//
+//  CLKSThreadRegistry_Tests.c
+//
+//  Copyright (c) 2012 Karl Stenerud. All rights reserved.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall remain in place
+// in this source code.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+
+
+
+/* Checks the thread registry: adding, renaming and removing threads, a
+ * publish deferred while a reader holds the snapshot, and threads starting,
+ * renaming and exiting concurrently with lock-free lookups.
+ */
+
+
+#include "CLKSThreadRegistry.h"
+#include "CLKSTestCheck.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define WRITER_COUNT 4
+#define READER_COUNT 3
+#define THREADS_PER_WRITER 40
+#define WRITER_ROUNDS 2000
+
+static volatile bool g_writersFinished;
+
+
+// ============================================================================
+#pragma mark - Helpers -
+// ============================================================================
+
+static CLKSThread threadAt(int writer, int index)
+{
+    return (CLKSThread)(((writer + 1) << 16) | index) * 8;
+}
+
+/** Name a thread after its own ID, so readers can tell if a name belongs to another thread. */
+static void nameThread(char* name, size_t length, CLKSThread thread, int round)
+{
+    snprintf(name, length, "%lx-%d", (unsigned long)thread, round);
+}
+
+static bool isNameOfThread(const char* name, CLKSThread thread)
+{
+    return name != NULL && strtoul(name, NULL, 16) == (unsigned long)thread;
+}
+
+static bool hasThread(const CLKSThreadRegistrySnapshot* snapshot, CLKSThread thread)
+{
+    int threadCount;
+    const CLKSThread* threads = clkstreg_getThreads(snapshot, &threadCount);
+    for(int i = 0; i < threadCount; i++)
+    {
+        if(threads[i] == thread)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+
+// ============================================================================
+#pragma mark - Tests -
+// ============================================================================
+
+static void testSetAndRemove(void)
+{
+    clkstreg_reset();
+    const CLKSThreadRegistrySnapshot* snapshot = clkstreg_acquireSnapshot();
+    uint64_t epoch = clkstreg_getEpoch(snapshot);
+    clkstreg_releaseSnapshot(snapshot);
+
+    CLKSTEST_CHECK(clkstreg_setThread(100, "main", "com.apple.main-thread"));
+    CLKSTEST_CHECK(clkstreg_setThread(200, "worker", NULL));
+    CLKSTEST_CHECK(clkstreg_setThread(300, "", ""));
+    CLKSTEST_CHECK(clkstreg_setThread(200, "renamed", "queue"));
+    snapshot = clkstreg_acquireSnapshot();
+    int threadCount;
+    clkstreg_getThreads(snapshot, &threadCount);
+    CLKSTEST_CHECK(threadCount == 3);
+    CLKSTEST_CHECK(clkstreg_getEpoch(snapshot) > epoch);
+    CLKSTEST_CHECK(strcmp(clkstreg_getThreadName(snapshot, 100), "main") == 0);
+    CLKSTEST_CHECK(strcmp(clkstreg_getQueueName(snapshot, 100), "com.apple.main-thread") == 0);
+    CLKSTEST_CHECK(strcmp(clkstreg_getThreadName(snapshot, 200), "renamed") == 0);
+    CLKSTEST_CHECK(strcmp(clkstreg_getQueueName(snapshot, 200), "queue") == 0);
+    CLKSTEST_CHECK(clkstreg_getThreadName(snapshot, 300) == NULL);
+    CLKSTEST_CHECK(clkstreg_getQueueName(snapshot, 300) == NULL);
+    CLKSTEST_CHECK(clkstreg_getThreadName(snapshot, 400) == NULL);
+    clkstreg_releaseSnapshot(snapshot);
+
+    clkstreg_removeThread(100);
+    clkstreg_removeThread(400);
+    snapshot = clkstreg_acquireSnapshot();
+    clkstreg_getThreads(snapshot, &threadCount);
+    CLKSTEST_CHECK(threadCount == 2);
+    CLKSTEST_CHECK(!hasThread(snapshot, 100));
+    CLKSTEST_CHECK(clkstreg_getThreadName(snapshot, 100) == NULL);
+    CLKSTEST_CHECK(strcmp(clkstreg_getThreadName(snapshot, 200), "renamed") == 0);
+    clkstreg_releaseSnapshot(snapshot);
+}
+
+static void testFullRegistry(void)
+{
+    static CLKSThread threads[CLKSTREG_MAX_THREADS + 10];
+    for(int i = 0; i < CLKSTREG_MAX_THREADS + 10; i++)
+    {
+        threads[i] = (CLKSThread)(i + 1) * 16;
+    }
+    clkstreg_replaceAllThreads(threads, NULL, NULL, CLKSTREG_MAX_THREADS + 10);
+    const CLKSThreadRegistrySnapshot* snapshot = clkstreg_acquireSnapshot();
+    int threadCount;
+    clkstreg_getThreads(snapshot, &threadCount);
+    CLKSTEST_CHECK(threadCount == CLKSTREG_MAX_THREADS);
+    CLKSTEST_CHECK(hasThread(snapshot, threads[CLKSTREG_MAX_THREADS - 1]));
+    clkstreg_releaseSnapshot(snapshot);
+
+    CLKSTEST_CHECK(!clkstreg_setThread(threads[CLKSTREG_MAX_THREADS], "extra", NULL));
+    // Updating a registered thread still works when full.
+    CLKSTEST_CHECK(clkstreg_setThread(threads[0], "first", NULL));
+    clkstreg_reset();
+}
+
+static void testDeferredPublish(void)
+{
+    clkstreg_reset();
+    clkstreg_setThread(100, "before", NULL);
+    const CLKSThreadRegistrySnapshot* held = clkstreg_acquireSnapshot();
+    uint64_t heldEpoch = clkstreg_getEpoch(held);
+
+    // The first change goes into the other snapshot. The second would need
+    // the held one, so it waits.
+    clkstreg_setThread(200, "second", NULL);
+    clkstreg_setThread(300, "third", NULL);
+    clkstreg_setThread(100, "after", NULL);
+    CLKSTEST_CHECK(strcmp(clkstreg_getThreadName(held, 100), "before") == 0);
+    CLKSTEST_CHECK(!hasThread(held, 300));
+    CLKSTEST_CHECK(clkstreg_getEpoch(held) == heldEpoch);
+
+    const CLKSThreadRegistrySnapshot* other = clkstreg_acquireSnapshot();
+    CLKSTEST_CHECK(other != held);
+    CLKSTEST_CHECK(hasThread(other, 200));
+    clkstreg_releaseSnapshot(other);
+
+    // Letting go publishes everything that was held back.
+    clkstreg_releaseSnapshot(held);
+    const CLKSThreadRegistrySnapshot* latest = clkstreg_acquireSnapshot();
+    CLKSTEST_CHECK(clkstreg_getEpoch(latest) > heldEpoch + 1);
+    CLKSTEST_CHECK(hasThread(latest, 300));
+    CLKSTEST_CHECK(strcmp(clkstreg_getThreadName(latest, 100), "after") == 0);
+    clkstreg_releaseSnapshot(latest);
+}
+
+static void* writerThread(void* userData)
+{
+    const int writer = (int)(intptr_t)userData;
+    char name[CLKSTREG_MAX_NAME_LENGTH];
+    for(int round = 0; round < WRITER_ROUNDS; round++)
+    {
+        // Start, rename and exit threads, leaving a different half running each round.
+        for(int i = 0; i < THREADS_PER_WRITER; i++)
+        {
+            CLKSThread thread = threadAt(writer, i);
+            if((i + round) % 2 == 0)
+            {
+                nameThread(name, sizeof(name), thread, round);
+                clkstreg_setThread(thread, name, name);
+            }
+            else
+            {
+                clkstreg_removeThread(thread);
+            }
+        }
+    }
+    return NULL;
+}
+
+typedef struct
+{
+    int snapshotCount;
+    int failureCount;
+} ReaderResult;
+
+static void* readerThread(void* userData)
+{
+    ReaderResult* result = userData;
+    uint64_t lastEpoch = 0;
+    static __thread CLKSThread threadsCopy[CLKSTREG_MAX_THREADS];
+    while(!g_writersFinished)
+    {
+        const CLKSThreadRegistrySnapshot* snapshot = clkstreg_acquireSnapshot();
+        uint64_t epoch = clkstreg_getEpoch(snapshot);
+        if(epoch < lastEpoch)
+        {
+            result->failureCount++;
+        }
+        lastEpoch = epoch;
+
+        int threadCount;
+        const CLKSThread* threads = clkstreg_getThreads(snapshot, &threadCount);
+        memcpy(threadsCopy, threads, sizeof(*threads) * (size_t)threadCount);
+        for(int i = 0; i < threadCount; i++)
+        {
+            if(!isNameOfThread(clkstreg_getThreadName(snapshot, threads[i]), threads[i]) ||
+               !isNameOfThread(clkstreg_getQueueName(snapshot, threads[i]), threads[i]))
+            {
+                result->failureCount++;
+            }
+        }
+        sched_yield();
+
+        // Nothing changes while the snapshot is held.
+        int threadCountAfter;
+        threads = clkstreg_getThreads(snapshot, &threadCountAfter);
+        if(threadCountAfter != threadCount ||
+           memcmp(threadsCopy, threads, sizeof(*threads) * (size_t)threadCount) != 0 ||
+           clkstreg_getEpoch(snapshot) != epoch)
+        {
+            result->failureCount++;
+        }
+        clkstreg_releaseSnapshot(snapshot);
+        result->snapshotCount++;
+    }
+    return NULL;
+}
+
+static void testConcurrentStartAndExit(void)
+{
+    clkstreg_reset();
+    g_writersFinished = false;
+    pthread_t writers[WRITER_COUNT];
+    pthread_t readers[READER_COUNT];
+    ReaderResult results[READER_COUNT];
+    memset(results, 0, sizeof(results));
+    for(int i = 0; i < READER_COUNT; i++)
+    {
+        pthread_create(&readers[i], NULL, readerThread, &results[i]);
+    }
+    for(int i = 0; i < WRITER_COUNT; i++)
+    {
+        pthread_create(&writers[i], NULL, writerThread, (void*)(intptr_t)i);
+    }
+    for(int i = 0; i < WRITER_COUNT; i++)
+    {
+        pthread_join(writers[i], NULL);
+    }
+    g_writersFinished = true;
+    int failureCount = 0;
+    int snapshotCount = 0;
+    for(int i = 0; i < READER_COUNT; i++)
+    {
+        pthread_join(readers[i], NULL);
+        failureCount += results[i].failureCount;
+        snapshotCount += results[i].snapshotCount;
+    }
+    CLKSTEST_CHECK(failureCount == 0);
+    CLKSTEST_CHECK(snapshotCount > 0);
+
+    // Any publish a reader held back has gone out, so the last round is visible.
+    const CLKSThreadRegistrySnapshot* snapshot = clkstreg_acquireSnapshot();
+    int threadCount;
+    clkstreg_getThreads(snapshot, &threadCount);
+    CLKSTEST_CHECK(threadCount == WRITER_COUNT * THREADS_PER_WRITER / 2);
+    int missingCount = 0;
+    char name[CLKSTREG_MAX_NAME_LENGTH];
+    for(int writer = 0; writer < WRITER_COUNT; writer++)
+    {
+        for(int i = 0; i < THREADS_PER_WRITER; i++)
+        {
+            CLKSThread thread = threadAt(writer, i);
+            const char* actualName = clkstreg_getThreadName(snapshot, thread);
+            if((i + WRITER_ROUNDS - 1) % 2 == 0)
+            {
+                nameThread(name, sizeof(name), thread, WRITER_ROUNDS - 1);
+                missingCount += actualName == NULL || strcmp(actualName, name) != 0;
+            }
+            else
+            {
+                missingCount += actualName != NULL;
+            }
+        }
+    }
+    CLKSTEST_CHECK(missingCount == 0);
+    clkstreg_releaseSnapshot(snapshot);
+}
+
+
+int main(void)
+{
+    testSetAndRemove();
+    testFullRegistry();
+    testDeferredPublish();
+    testConcurrentStartAndExit();
+    return CLKSTEST_RESULT();
+}
@@ -0,0 +1,175 @@
+//
+//  CLKSThrowTrace_Tests.cpp
+//
+//  Copyright (c) 2012 Karl Stenerud. All rights reserved.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall remain in place
+// in this source code.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+
+
+/* Throws from many threads at once and checks that each thread gets back
+ * the trace of its own throw, and that sampling and slot reuse behave.
+ */
+
+
+#include "CLKSThrowTrace.h"
+#include "CLKSTestCheck.h"
+
+#include <atomic>
+#include <dlfcn.h>
+#include <string.h>
+#include <thread>
+#include <vector>
+
+typedef void (*CxaThrowFunc)(void*, void*, void (*)(void*));
+
+// Stand in for the C++ exception monitor's __cxa_throw hook.
+extern "C" void __cxa_throw(void* exception, void* type, void (*destructor)(void*))
+{
+    static CxaThrowFunc originalThrow;
+    clkstt_recordThrow(1);
+    if(originalThrow == NULL)
+    {
+        originalThrow = (CxaThrowFunc)dlsym(RTLD_NEXT, "__cxa_throw");
+    }
+    originalThrow(exception, type, destructor);
+    __builtin_unreachable();
+}
+
+// Not static, so that dladdr() can find them (see LDFLAGS).
+__attribute__((noinline)) void thrower(int value)
+{
+    throw value;
+}
+
+__attribute__((noinline)) void callThrower(int value)
+{
+    thrower(value);
+    asm volatile("");
+}
+
+static bool isInFunction(uintptr_t returnAddress, void* function)
+{
+    Dl_info info;
+    return dladdr((void*)(returnAddress - 1), &info) != 0 && info.dli_saddr == function;
+}
+
+static bool isTraceOfThrower(void)
+{
+    uintptr_t addresses[CLKSTT_MAX_DEPTH];
+    int count = clkstt_copyLastThrowTrace(addresses, CLKSTT_MAX_DEPTH);
+    return count >= 2 && isInFunction(addresses[0], (void*)thrower) && isInFunction(addresses[1], (void*)callThrower);
+}
+
+static int countTracedThrows(int throwCount)
+{
+    int tracedCount = 0;
+    for(int i = 0; i < throwCount; i++)
+    {
+        try
+        {
+            callThrower(i);
+        }
+        catch(int)
+        {
+            uintptr_t addresses[CLKSTT_MAX_DEPTH];
+            tracedCount += clkstt_copyLastThrowTrace(addresses, CLKSTT_MAX_DEPTH) > 0;
+        }
+    }
+    return tracedCount;
+}
+
+static void testConcurrentThrows(void)
+{
+    std::atomic<int> badTraceCount{0};
+    std::vector<std::thread> threads;
+    for(int t = 0; t < 8; t++)
+    {
+        threads.emplace_back([&badTraceCount, t] {
+            for(int i = 0; i < 5000; i++)
+            {
+                try
+                {
+                    callThrower(t * 100000 + i);
+                }
+                catch(int)
+                {
+                    badTraceCount += !isTraceOfThrower();
+                }
+            }
+        });
+    }
+    for(auto& thread : threads)
+    {
+        thread.join();
+    }
+    CLKSTEST_CHECK(badTraceCount == 0);
+}
+
+static void testNoTraceBeforeThrow(void)
+{
+    std::atomic<int> count{-1};
+    std::thread([&count] {
+        uintptr_t addresses[CLKSTT_MAX_DEPTH];
+        count = clkstt_copyLastThrowTrace(addresses, CLKSTT_MAX_DEPTH);
+    }).join();
+    CLKSTEST_CHECK(count == 0);
+}
+
+static void testSampling(void)
+{
+    clkstt_setSampling(2, 0);
+    CLKSTEST_CHECK(countTracedThrows(10) == 5);
+
+    clkstt_setSampling(1, 5);
+    int tracedCount = countTracedThrows(10);
+    CLKSTEST_CHECK(tracedCount >= 1 && tracedCount <= 5);
+
+    clkstt_setSampling(1, 0);
+    CLKSTEST_CHECK(countTracedThrows(10) == 10);
+}
+
+static void testSlotsReusedAfterThreadExit(void)
+{
+    // More threads than slots, one after another.
+    for(int i = 0; i < CLKSTT_MAX_THREADS * 2; i++)
+    {
+        std::thread([] { countTracedThrows(2); }).join();
+    }
+    std::atomic<int> tracedCount{0};
+    std::vector<std::thread> threads;
+    for(int i = 0; i < CLKSTT_MAX_THREADS - 4; i++)
+    {
+        threads.emplace_back([&tracedCount] { tracedCount += countTracedThrows(1); });
+    }
+    for(auto& thread : threads)
+    {
+        thread.join();
+    }
+    CLKSTEST_CHECK(tracedCount == CLKSTT_MAX_THREADS - 4);
+}
+
+int main(void)
+{
+    testConcurrentThrows();
+    testNoTraceBeforeThrow();
+    testSampling();
+    testSlotsReusedAfterThreadExit();
+    return CLKSTEST_RESULT();
+}